@@ -5,6 +5,10 @@
 #include <NIDAQmx.h>
 
 
+// Lines of the DO task; see CreateClockTasks()
+#define NUM_CLOCK_DO_LINES 3
+
+
 static OScDev_RichError *CreateClockTasks(OScDev_Device *device, struct ClockConfig *config, OScDev_Acquisition *acq);
 static OScDev_RichError *ConfigureClockTiming(OScDev_Device *device, struct ClockConfig *config, OScDev_Acquisition *acq);
 static OScDev_RichError *ConfigureClockTriggers(OScDev_Device *device, struct ClockConfig *config);
@@ -65,14 +69,14 @@ OScDev_RichError *SetUpClock(OScDev_Device *device, struct ClockConfig *config,
 
 	if (mustCommit)
 	{
-		err = CreateDAQmxError(DAQmxTaskControl(config->doTask, DAQmx_Val_Task_Commit));
+		err = CreateDAQmxError(GetDAQ()->TaskControl(config->doTask, DAQmx_Val_Task_Commit));
 		if (err)
 		{
 			err = OScDev_Error_Wrap(err, "Failed to commit clock do task");
 			goto error;
 		}
 
-		err = CreateDAQmxError(DAQmxTaskControl(config->lineCtrTask, DAQmx_Val_Task_Commit));
+		err = CreateDAQmxError(GetDAQ()->TaskControl(config->lineCtrTask, DAQmx_Val_Task_Commit));
 		if (err)
 		{
 			err = OScDev_Error_Wrap(err, "Failed to commit clock lineCtr task");
@@ -97,7 +101,7 @@ OScDev_RichError *ShutdownClock(OScDev_Device *device, struct ClockConfig *confi
 
 	if (config->doTask)
 	{
-		err1 = CreateDAQmxError(DAQmxClearTask(config->doTask));
+		err1 = CreateDAQmxError(GetDAQ()->ClearTask(config->doTask));
 		if (err1) 
 			err1 = OScDev_Error_Wrap(err1, "Failed to clear clock do task");
 		config->doTask = 0;
@@ -105,7 +109,7 @@ OScDev_RichError *ShutdownClock(OScDev_Device *device, struct ClockConfig *confi
 
 	if (config->lineCtrTask)
 	{
-		err2 = CreateDAQmxError(DAQmxClearTask(config->lineCtrTask));
+		err2 = CreateDAQmxError(GetDAQ()->ClearTask(config->lineCtrTask));
 		if (err2)
 			err2 = OScDev_Error_Wrap(err2, "Failed to clear clock lineCtr task");
 		config->lineCtrTask = 0;
@@ -126,7 +130,7 @@ OScDev_RichError *StartClock(OScDev_Device *device, struct ClockConfig *config)
 {
 	OScDev_RichError* err;
 
-	err = CreateDAQmxError(DAQmxStartTask(config->doTask));
+	err = CreateDAQmxError(GetDAQ()->StartTask(config->doTask));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to start clock do task");
@@ -134,7 +138,7 @@ OScDev_RichError *StartClock(OScDev_Device *device, struct ClockConfig *config)
 		return err;
 	}
 
-	err = CreateDAQmxError(DAQmxStartTask(config->lineCtrTask));
+	err = CreateDAQmxError(GetDAQ()->StartTask(config->lineCtrTask));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to start clock lineCtr task");
@@ -146,11 +150,27 @@ OScDev_RichError *StartClock(OScDev_Device *device, struct ClockConfig *config)
 }
 
 
+// Wait until the finite clock generation of a frame is complete
+// Only the line counter is waited for: the DO task is retriggerable, so it
+// never reports done, but its samples end with the last line.
+OScDev_RichError *WaitForClockDone(OScDev_Device *device, struct ClockConfig *config, double timeoutSec)
+{
+	OScDev_RichError *err;
+	err = CreateDAQmxError(GetDAQ()->WaitUntilTaskDone(config->lineCtrTask, timeoutSec));
+	if (err)
+	{
+		err = OScDev_Error_Wrap(err, "Failed to wait for clock lineCtr task to finish");
+		return err;
+	}
+	return OScDev_RichError_OK;
+}
+
+
 OScDev_RichError *StopClock(OScDev_Device *device, struct ClockConfig *config)
 {
 	OScDev_RichError *err;
 
-	err = CreateDAQmxError(DAQmxStopTask(config->doTask));
+	err = CreateDAQmxError(GetDAQ()->StopTask(config->doTask));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to stop clock do task");
@@ -158,7 +178,7 @@ OScDev_RichError *StopClock(OScDev_Device *device, struct ClockConfig *config)
 		return err;
 	}
 
-	err = CreateDAQmxError(DAQmxStopTask(config->lineCtrTask));
+	err = CreateDAQmxError(GetDAQ()->StopTask(config->lineCtrTask));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to stop clock lineCtr task");
@@ -170,10 +190,39 @@ OScDev_RichError *StopClock(OScDev_Device *device, struct ClockConfig *config)
 }
 
 
+// Stop the clock immediately, in the middle of a frame if necessary
+OScDev_RichError *AbortClock(OScDev_Device *device, struct ClockConfig *config)
+{
+	OScDev_RichError *err;
+
+	err = CreateDAQmxError(GetDAQ()->TaskControl(config->doTask, DAQmx_Val_Task_Abort));
+	if (err)
+	{
+		err = OScDev_Error_Wrap(err, "Failed to abort clock do task");
+		ShutdownClock(device, config);
+		return err;
+	}
+
+	err = CreateDAQmxError(GetDAQ()->TaskControl(config->lineCtrTask, DAQmx_Val_Task_Abort));
+	if (err)
+	{
+		err = OScDev_Error_Wrap(err, "Failed to abort clock lineCtr task");
+		ShutdownClock(device, config);
+		return err;
+	}
+
+	// Aborting discards the generation in progress; write the pattern afresh
+	// before the next start
+	config->mustRewriteOutput = true;
+
+	return OScDev_RichError_OK;
+}
+
+
 static OScDev_RichError *CreateClockTasks(OScDev_Device *device, struct ClockConfig *config, OScDev_Acquisition *acq)
 {
 	OScDev_RichError* err;
-	err = CreateDAQmxError(DAQmxCreateTask("ClockDO", &config->doTask));
+	err = CreateDAQmxError(GetDAQ()->CreateTask("ClockDO", &config->doTask));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to create clock do task");
@@ -189,7 +238,7 @@ static OScDev_RichError *CreateClockTasks(OScDev_Device *device, struct ClockCon
 	strncpy(doTerminals, GetData(device)->deviceName, sizeof(doTerminals) - 1);
 	strncat(doTerminals, "/port0/line5:7",
 		sizeof(doTerminals) - strlen(doTerminals) - 1);
-	err = CreateDAQmxError(DAQmxCreateDOChan(config->doTask, doTerminals, "ClockDO",
+	err = CreateDAQmxError(GetDAQ()->CreateDOChan(config->doTask, doTerminals, "ClockDO",
 		DAQmx_Val_ChanPerLine));
 	if (err)
 	{
@@ -197,14 +246,14 @@ static OScDev_RichError *CreateClockTasks(OScDev_Device *device, struct ClockCon
 		return err;
 	}
 
-	err = CreateDAQmxError(DAQmxGetReadNumChans(config->doTask, &GetData(device)->numDOChannels));
+	err = CreateDAQmxError(GetDAQ()->GetReadNumChans(config->doTask, &GetData(device)->numDOChannels));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to get number of channels from clock do task");
 		return err;
 	}
 
-	err = CreateDAQmxError(DAQmxCreateTask("ClockCtr", &config->lineCtrTask));
+	err = CreateDAQmxError(GetDAQ()->CreateTask("ClockCtr", &config->lineCtrTask));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to create clock lineCtr task");
@@ -215,7 +264,7 @@ static OScDev_RichError *CreateClockTasks(OScDev_Device *device, struct ClockCon
 	uint32_t xOffset, yOffset, width, height;
 	OScDev_Acquisition_GetROI(acq, &xOffset, &yOffset, &width, &height);
 
-	uint32_t elementsPerLine = GetData(device)->lineDelay + width + X_RETRACE_LEN;
+	uint32_t elementsPerLine = GetElementsPerLine(device, width);
 	double effectiveScanPortion = (double)width / elementsPerLine;
 	double lineFreqHz = pixelRateHz / elementsPerLine;
 	double scanPhase = 1.0 / pixelRateHz * GetData(device)->lineDelay;
@@ -224,7 +273,7 @@ static OScDev_RichError *CreateClockTasks(OScDev_Device *device, struct ClockCon
 	strncpy(ctrTerminals, GetData(device)->deviceName, sizeof(ctrTerminals) - 1);
 	strncat(ctrTerminals, "/ctr0",
 		sizeof(ctrTerminals) - strlen(ctrTerminals) - 1);
-	err = CreateDAQmxError(DAQmxCreateCOPulseChanFreq(config->lineCtrTask, ctrTerminals, "ClockLineCTR",
+	err = CreateDAQmxError(GetDAQ()->CreateCOPulseChanFreq(config->lineCtrTask, ctrTerminals, "ClockLineCTR",
 		DAQmx_Val_Hz, DAQmx_Val_Low, scanPhase, lineFreqHz, effectiveScanPortion));
 	if (err)
 	{
@@ -244,24 +293,50 @@ static OScDev_RichError *ConfigureClockTiming(OScDev_Device *device, struct Cloc
 	uint32_t xOffset, yOffset, width, height;
 	OScDev_Acquisition_GetROI(acq, &xOffset, &yOffset, &width, &height);
 
-	uint32_t elementsPerLine = GetData(device)->lineDelay + width + X_RETRACE_LEN;
-	uint32_t yLen = height + Y_RETRACE_LEN;
-	int32 elementsPerFramePerChan = elementsPerLine * height;
+	uint32_t elementsPerLine = GetElementsPerLine(device, width);
+	uint32_t scanLines = GetScanLinesPerFrame(device, height);
+	uint32_t yLen = scanLines + Y_RETRACE_LEN;
+	int32 elementsPerFramePerChan = elementsPerLine * scanLines;
 	int32 totalElementsPerFramePerChan = elementsPerLine * yLen;
 
-	err = CreateDAQmxError(DAQmxCfgSampClkTiming(config->doTask, "", pixelRateHz,
-		DAQmx_Val_Rising, DAQmx_Val_FiniteSamps, elementsPerFramePerChan));
+	// When streaming, the DO pattern covers the whole frame period (including
+	// the Y retrace) and is regenerated for every frame, in step with the
+	// scanner waveform
+	bool streaming = GetData(device)->streamSequence;
+	uint32_t numFrames = GetData(device)->streamFrames;
+	int32 sampleMode = DAQmx_Val_FiniteSamps;
+	uInt64 doSamplesPerChan = streaming ? totalElementsPerFramePerChan : elementsPerFramePerChan;
+	uInt64 lineCtrPulses = scanLines;
+	if (streaming && numFrames == 0)
+	{
+		sampleMode = DAQmx_Val_ContSamps;
+	}
+	else if (streaming)
+	{
+		doSamplesPerChan *= numFrames;
+		lineCtrPulses = (uInt64)yLen * numFrames;
+	}
+	err = CreateDAQmxError(GetDAQ()->CfgSampClkTiming(config->doTask, "", pixelRateHz,
+		DAQmx_Val_Rising, sampleMode, doSamplesPerChan));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to configure timing for clock do task");
 		return err;
 	}
 
+	err = CreateDAQmxError(GetDAQ()->CfgOutputBuffer(config->doTask,
+		streaming ? totalElementsPerFramePerChan : elementsPerFramePerChan));
+	if (err)
+	{
+		err = OScDev_Error_Wrap(err, "Failed to configure output buffer for clock do task");
+		return err;
+	}
+
 	double effectiveScanPortion = (double)width / elementsPerLine;
 	double lineFreqHz = pixelRateHz / elementsPerLine;
 	double scanPhase = 1.0 / pixelRateHz * GetData(device)->lineDelay;
 
-	err = CreateDAQmxError(DAQmxSetChanAttribute(config->lineCtrTask, "",
+	err = CreateDAQmxError(GetDAQ()->SetChanAttributeF64(config->lineCtrTask, "",
 		DAQmx_CO_Pulse_Freq, lineFreqHz));
 	if (err)
 	{
@@ -269,7 +344,7 @@ static OScDev_RichError *ConfigureClockTiming(OScDev_Device *device, struct Cloc
 		return err;
 	}
 
-	err = CreateDAQmxError(DAQmxSetChanAttribute(config->lineCtrTask, "",
+	err = CreateDAQmxError(GetDAQ()->SetChanAttributeF64(config->lineCtrTask, "",
 		DAQmx_CO_Pulse_Freq_InitialDelay, scanPhase));
 	if (err)
 	{
@@ -278,7 +353,7 @@ static OScDev_RichError *ConfigureClockTiming(OScDev_Device *device, struct Cloc
 
 	}
 
-	err = CreateDAQmxError(DAQmxSetChanAttribute(config->lineCtrTask, "",
+	err = CreateDAQmxError(GetDAQ()->SetChanAttributeF64(config->lineCtrTask, "",
 		DAQmx_CO_Pulse_DutyCyc, effectiveScanPortion));
 	if (err)
 	{
@@ -286,8 +361,10 @@ static OScDev_RichError *ConfigureClockTiming(OScDev_Device *device, struct Cloc
 		return err;
 	}
 
-	err = CreateDAQmxError(DAQmxCfgImplicitTiming(config->lineCtrTask, DAQmx_Val_FiniteSamps,
-		height));
+	// When streaming, the line counter also runs during the Y retrace, and
+	// the detector discards the lines acquired then
+	err = CreateDAQmxError(GetDAQ()->CfgImplicitTiming(config->lineCtrTask,
+		sampleMode, lineCtrPulses));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to configure timing for clock lineCtr");
@@ -307,7 +384,7 @@ static OScDev_RichError *ConfigureClockTriggers(OScDev_Device *device, struct Cl
 	strncat(triggerSource, "/ao/StartTrigger",
 		sizeof(triggerSource) - strlen(triggerSource) - 1);
 
-	err = CreateDAQmxError(DAQmxCfgDigEdgeStartTrig(config->doTask,
+	err = CreateDAQmxError(GetDAQ()->CfgDigEdgeStartTrig(config->doTask,
 		triggerSource, DAQmx_Val_Rising));
 	if (err)
 	{
@@ -315,14 +392,17 @@ static OScDev_RichError *ConfigureClockTriggers(OScDev_Device *device, struct Cl
 		return err;
 	}
 
-	err = CreateDAQmxError(DAQmxSetStartTrigRetriggerable(config->doTask, 1));
+	// When streaming, the task runs (possibly continuously) for the whole
+	// sequence, started once
+	err = CreateDAQmxError(GetDAQ()->SetStartTrigRetriggerable(config->doTask,
+		GetData(device)->streamSequence ? 0 : 1));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to set retriggerable clock do task");
 		return err;
 	}
 
-	err = CreateDAQmxError(DAQmxCfgDigEdgeStartTrig(config->lineCtrTask,
+	err = CreateDAQmxError(GetDAQ()->CfgDigEdgeStartTrig(config->lineCtrTask,
 		triggerSource, DAQmx_Val_Rising));
 	if (err)
 	{
@@ -334,18 +414,33 @@ static OScDev_RichError *ConfigureClockTriggers(OScDev_Device *device, struct Cl
 }
 
 
-static OScDev_RichError *WriteClockOutput(OScDev_Device *device, struct ClockConfig *config, OScDev_Acquisition *acq)
+// Allocate and generate the DO patterns for one frame with the given scan
+// geometry and the current settings: line clock, FLIM line clock, and FLIM
+// frame clock (lines P0.5-7), *elementsPerChan samples each, grouped by
+// channel. *peakBytes is set to the largest total of buffers allocated at
+// once. The caller must free *lineClockPatterns.
+// Also used by the waveform benchmark (see WaveformBenchmark.c).
+OScDev_RichError *GenerateClockOutput(OScDev_Device *device,
+	uint32_t width, uint32_t height,
+	uInt8 **lineClockPatterns, int32 *elementsPerChan, size_t *peakBytes)
 {
-	OScDev_RichError *err;
-	uint32_t xOffset, yOffset, width, height;
-	OScDev_Acquisition_GetROI(acq, &xOffset, &yOffset, &width, &height);
-
-	uint32_t elementsPerLine = GetData(device)->lineDelay + width + X_RETRACE_LEN;
-	uint32_t yLen = height + Y_RETRACE_LEN;
-	int32 elementsPerFramePerChan = elementsPerLine * height;  // without y retrace portion
+	OScDev_RichError *err = OScDev_RichError_OK;
+	uint32_t elementsPerLine = GetElementsPerLine(device, width);
+	uint32_t scanLines = GetScanLinesPerFrame(device, height);
+	uint32_t yLen = scanLines + Y_RETRACE_LEN;
+	int32 elementsPerFramePerChan = elementsPerLine * scanLines;  // without y retrace portion
 	int32 totalElementsPerFramePerChan = elementsPerLine * yLen;   // including y retrace portion
 
 	// Q: Why do we use elementsPerFramePerChan, not totalElementsPerFramePerChan?
+	// (When the DO task is retriggered for every frame, it need not cover
+	// the Y retrace. When streaming, it must, so that it stays in step with
+	// the scanner; the Y retrace portion is all low.)
+	int32 doElementsPerChan = GetData(device)->streamSequence ?
+		totalElementsPerFramePerChan : elementsPerFramePerChan;
+
+	// The line clock patterns are the same for forward and reverse lines of
+	// a bidirectional scan; only the retrace (turnaround) length differs
+	uint32_t xRetraceLen = GetXRetraceLen(GetData(device)->bidirectionalScan);
 
 	// digital line clock pattern for triggering acquisition line by line
 	uInt8 *lineClockPattern = (uInt8*)malloc(elementsPerFramePerChan);
@@ -354,51 +449,82 @@ static OScDev_RichError *WriteClockOutput(OScDev_Device *device, struct ClockCon
 	// digital frame clock pattern for FLIM
 	uInt8 *frameClockFLIM = (uInt8*)malloc(elementsPerFramePerChan);
 	// combination of lineClock, lineClockFLIM, and frameClock
-	uInt8 *lineClockPatterns = (uInt8*)malloc(
-		elementsPerFramePerChan * GetData(device)->numDOChannels);
+	uInt8 *patterns = (uInt8*)calloc(doElementsPerChan * NUM_CLOCK_DO_LINES, 1);
+	if (!lineClockPattern || !lineClockFLIM || !frameClockFLIM || !patterns)
+	{
+		err = OScDev_Error_Create("Failed to allocate clock waveforms");
+		goto cleanup;
+	}
 
 	// TODO: why use elementsPerLine instead of elementsPerFramePerChan?
-	err = GenerateLineClock(width, height,
-		GetData(device)->lineDelay,	lineClockPattern);
-	if (err)
-		return OScDev_Error_Create("Waveform Out Of Range");
-	err = GenerateFLIMLineClock(width, height,
-		GetData(device)->lineDelay, lineClockFLIM);
+	err = GenerateLineClock(width, scanLines,
+		GetData(device)->lineDelay, xRetraceLen, lineClockPattern);
+	if (!err)
+		err = GenerateFLIMLineClock(width, scanLines,
+			GetData(device)->lineDelay, xRetraceLen, lineClockFLIM);
+	if (!err)
+		err = GenerateFLIMFrameClock(width, scanLines,
+			GetData(device)->lineDelay, xRetraceLen, frameClockFLIM);
 	if (err)
-		return OScDev_Error_Create("Waveform Out Of Range");
-	err = GenerateFLIMFrameClock(width, height,
-		GetData(device)->lineDelay, frameClockFLIM);
-	if (err)
-		return OScDev_Error_Create("Waveform Out Of Range");
+	{
+		err = OScDev_Error_Wrap(err, "Waveform Out Of Range");
+		goto cleanup;
+	}
 
 	// combine line, inverted line, and frame clocks
 	// TODO: make it more generic
 	for (int i = 0; i < elementsPerFramePerChan; i++)
 	{
-		lineClockPatterns[i] = lineClockPattern[i];
-		lineClockPatterns[i + elementsPerFramePerChan] = lineClockFLIM[i];
-		lineClockPatterns[i + 2 * elementsPerFramePerChan] = frameClockFLIM[i];
+		patterns[i] = lineClockPattern[i];
+		patterns[i + doElementsPerChan] = lineClockFLIM[i];
+		patterns[i + 2 * doElementsPerChan] = frameClockFLIM[i];
 	}
 
+	*lineClockPatterns = patterns;
+	patterns = NULL;
+	*elementsPerChan = doElementsPerChan;
+	*peakBytes = 3 * (size_t)elementsPerFramePerChan +
+		(size_t)doElementsPerChan * NUM_CLOCK_DO_LINES;
+
+cleanup:
+	free(lineClockPattern);
+	free(lineClockFLIM);
+	free(frameClockFLIM);
+	free(patterns);
+	return err;
+}
+
+
+static OScDev_RichError *WriteClockOutput(OScDev_Device *device, struct ClockConfig *config, OScDev_Acquisition *acq)
+{
+	OScDev_RichError *err;
+	uint32_t xOffset, yOffset, width, height;
+	OScDev_Acquisition_GetROI(acq, &xOffset, &yOffset, &width, &height);
+
+	uInt8 *lineClockPatterns;
+	int32 doElementsPerChan;
+	size_t bytes;
+	err = GenerateClockOutput(device, width, height,
+		&lineClockPatterns, &doElementsPerChan, &bytes);
+	if (err)
+		return err;
+
 	int32 numWritten = 0;
-	err = CreateDAQmxError(DAQmxWriteDigitalLines(config->doTask,
-		elementsPerFramePerChan, FALSE, 10.0,
+	err = CreateDAQmxError(GetDAQ()->WriteDigitalLines(config->doTask,
+		doElementsPerChan, FALSE, 10.0,
 		DAQmx_Val_GroupByChannel, lineClockPatterns, &numWritten, NULL));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to write clock do waveforms");
 		goto cleanup;
 	}
-	if (numWritten != elementsPerFramePerChan)
+	if (numWritten != doElementsPerChan)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to write complete clock waveform");
 		goto cleanup;
 	}
 
 cleanup:
-	free(lineClockPattern);
-	free(lineClockFLIM);
-	free(frameClockFLIM);
 	free(lineClockPatterns);
 	return err;
 }
\ No newline at end of file
@@ -0,0 +1,800 @@
+#include "Conversion.h"
+
+#include <stdbool.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CONVERSION_HAVE_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC allows intrinsics for any instruction set in any function; GCC and
+// Clang require the target to be enabled per function.
+#if defined(CONVERSION_HAVE_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+
+// Pixels per channel handled by one iteration of the vector kernels (one
+// 128-bit store of uint16_t per channel)
+#define PIXELS_PER_BLOCK 8
+
+
+static inline uint16_t ScaleSample(double sample, double scale, double offset)
+{
+	double dpixel = sample * scale + offset;
+	if (dpixel < 0.0)
+		dpixel = 0.0;
+	if (dpixel > 65535.0)
+		dpixel = 65535.0;
+	return (uint16_t)dpixel;
+}
+
+
+void ConvertSamplesF64_Scalar(const double *src, size_t numPixels,
+	uint32_t numChannels, double scale, double offset, uint16_t *const *dest)
+{
+	for (size_t p = 0; p < numPixels; ++p)
+	{
+		const double *scan = src + p * numChannels;
+		for (uint32_t ch = 0; ch < numChannels; ++ch)
+			dest[ch][p] = ScaleSample(scan[ch], scale, offset);
+	}
+}
+
+
+// Convert the pixels [start, numPixels) that did not fill a whole block
+static void ConvertTail(const double *src, size_t start, size_t numPixels,
+	uint32_t numChannels, double scale, double offset, uint16_t *const *dest)
+{
+	for (size_t p = start; p < numPixels; ++p)
+	{
+		const double *scan = src + p * numChannels;
+		for (uint32_t ch = 0; ch < numChannels; ++ch)
+			dest[ch][p] = ScaleSample(scan[ch], scale, offset);
+	}
+}
+
+
+#ifdef CONVERSION_HAVE_X86
+
+/*
+ * SSE2 kernels
+ *
+ * Two samples are scaled per __m128d. Four of these make up one block of 8
+ * pixels of a single channel, which is packed to uint16_t and stored at once.
+ */
+
+TARGET_SSE2
+static inline __m128i ScaleToEpi32_SSE2(__m128d v, __m128d scale, __m128d offset)
+{
+	v = _mm_add_pd(_mm_mul_pd(v, scale), offset);
+	v = _mm_min_pd(_mm_max_pd(v, _mm_setzero_pd()), _mm_set1_pd(65535.0));
+	return _mm_cvttpd_epi32(v); // Result in low 64 bits
+}
+
+
+// Pack 8 int32 values, known to be in [0, 65535], to uint16_t. SSE2 only has
+// signed saturation, so shift the range to int16_t and back.
+TARGET_SSE2
+static inline __m128i PackToU16_SSE2(__m128i lo, __m128i hi)
+{
+	const __m128i bias32 = _mm_set1_epi32(32768);
+	const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+	__m128i packed = _mm_packs_epi32(_mm_sub_epi32(lo, bias32),
+		_mm_sub_epi32(hi, bias32));
+	return _mm_xor_si128(packed, bias16);
+}
+
+
+// v[0..3] hold 8 consecutive pixels of one channel, 2 per vector
+TARGET_SSE2
+static inline void StoreBlock_SSE2(const __m128d v[4], __m128d scale, __m128d offset,
+	uint16_t *dest)
+{
+	__m128i lo = _mm_unpacklo_epi64(ScaleToEpi32_SSE2(v[0], scale, offset),
+		ScaleToEpi32_SSE2(v[1], scale, offset));
+	__m128i hi = _mm_unpacklo_epi64(ScaleToEpi32_SSE2(v[2], scale, offset),
+		ScaleToEpi32_SSE2(v[3], scale, offset));
+	_mm_storeu_si128((__m128i *)dest, PackToU16_SSE2(lo, hi));
+}
+
+
+// Kernel for an even number of channels; called with a constant argument so
+// that the channel loop is unrolled. For each pair of pixels and each pair of
+// channels, two loads followed by unpacklo/unpackhi yield the two channels
+// with their two pixels each.
+TARGET_SSE2
+static inline void ConvertEvenChannels_SSE2(const double *src, size_t numPixels,
+	const uint32_t numChannels, double scale, double offset, uint16_t *const *dest)
+{
+	__m128d vscale = _mm_set1_pd(scale);
+	__m128d voffset = _mm_set1_pd(offset);
+	size_t numBlocks = numPixels / PIXELS_PER_BLOCK;
+
+	for (size_t b = 0; b < numBlocks; ++b)
+	{
+		size_t p = b * PIXELS_PER_BLOCK;
+		const double *block = src + p * numChannels;
+		for (uint32_t ch = 0; ch < numChannels; ch += 2)
+		{
+			__m128d even[4], odd[4];
+			for (int k = 0; k < 4; ++k)
+			{
+				__m128d a = _mm_loadu_pd(block + (2 * k) * numChannels + ch);
+				__m128d c = _mm_loadu_pd(block + (2 * k + 1) * numChannels + ch);
+				even[k] = _mm_unpacklo_pd(a, c);
+				odd[k] = _mm_unpackhi_pd(a, c);
+			}
+			StoreBlock_SSE2(even, vscale, voffset, dest[ch] + p);
+			StoreBlock_SSE2(odd, vscale, voffset, dest[ch + 1] + p);
+		}
+	}
+
+	ConvertTail(src, numBlocks * PIXELS_PER_BLOCK, numPixels, numChannels,
+		scale, offset, dest);
+}
+
+
+TARGET_SSE2
+static void ConvertSamplesF64_SSE2_1(const double *src, size_t numPixels,
+	uint32_t numChannels, double scale, double offset, uint16_t *const *dest)
+{
+	__m128d vscale = _mm_set1_pd(scale);
+	__m128d voffset = _mm_set1_pd(offset);
+	size_t numBlocks = numPixels / PIXELS_PER_BLOCK;
+
+	for (size_t b = 0; b < numBlocks; ++b)
+	{
+		size_t p = b * PIXELS_PER_BLOCK;
+		__m128d v[4];
+		for (int k = 0; k < 4; ++k)
+			v[k] = _mm_loadu_pd(src + p + 2 * k);
+		StoreBlock_SSE2(v, vscale, voffset, dest[0] + p);
+	}
+
+	ConvertTail(src, numBlocks * PIXELS_PER_BLOCK, numPixels, 1,
+		scale, offset, dest);
+}
+
+
+TARGET_SSE2
+static void ConvertSamplesF64_SSE2_2(const double *src, size_t numPixels,
+	uint32_t numChannels, double scale, double offset, uint16_t *const *dest)
+{
+	ConvertEvenChannels_SSE2(src, numPixels, 2, scale, offset, dest);
+}
+
+
+TARGET_SSE2
+static void ConvertSamplesF64_SSE2_4(const double *src, size_t numPixels,
+	uint32_t numChannels, double scale, double offset, uint16_t *const *dest)
+{
+	ConvertEvenChannels_SSE2(src, numPixels, 4, scale, offset, dest);
+}
+
+
+TARGET_SSE2
+static void ConvertSamplesF64_SSE2_8(const double *src, size_t numPixels,
+	uint32_t numChannels, double scale, double offset, uint16_t *const *dest)
+{
+	ConvertEvenChannels_SSE2(src, numPixels, 8, scale, offset, dest);
+}
+
+
+// Any number of channels: gather each channel's samples for a pair of
+// pixels with loadl/loadh
+TARGET_SSE2
+static void ConvertSamplesF64_SSE2_Generic(const double *src, size_t numPixels,
+	uint32_t numChannels, double scale, double offset, uint16_t *const *dest)
+{
+	__m128d vscale = _mm_set1_pd(scale);
+	__m128d voffset = _mm_set1_pd(offset);
+	size_t numBlocks = numPixels / PIXELS_PER_BLOCK;
+
+	for (size_t b = 0; b < numBlocks; ++b)
+	{
+		size_t p = b * PIXELS_PER_BLOCK;
+		const double *block = src + p * numChannels;
+		for (uint32_t ch = 0; ch < numChannels; ++ch)
+		{
+			__m128d v[4];
+			for (int k = 0; k < 4; ++k)
+			{
+				v[k] = _mm_loadh_pd(
+					_mm_load_sd(block + (2 * k) * numChannels + ch),
+					block + (2 * k + 1) * numChannels + ch);
+			}
+			StoreBlock_SSE2(v, vscale, voffset, dest[ch] + p);
+		}
+	}
+
+	ConvertTail(src, numBlocks * PIXELS_PER_BLOCK, numPixels, numChannels,
+		scale, offset, dest);
+}
+
+
+/*
+ * AVX2 kernels
+ *
+ * Four samples are scaled per __m256d; two of these make up one block of 8
+ * pixels of a single channel. Interleaved channels are separated with
+ * in-register transposes.
+ */
+
+TARGET_AVX2
+static inline __m128i ScaleToEpi32_AVX2(__m256d v, __m256d scale, __m256d offset)
+{
+	v = _mm256_add_pd(_mm256_mul_pd(v, scale), offset);
+	v = _mm256_min_pd(_mm256_max_pd(v, _mm256_setzero_pd()), _mm256_set1_pd(65535.0));
+	return _mm256_cvttpd_epi32(v);
+}
+
+
+// lo and hi hold 8 consecutive pixels of one channel
+TARGET_AVX2
+static inline void StoreBlock_AVX2(__m256d lo, __m256d hi, __m256d scale, __m256d offset,
+	uint16_t *dest)
+{
+	__m128i packed = _mm_packus_epi32(ScaleToEpi32_AVX2(lo, scale, offset),
+		ScaleToEpi32_AVX2(hi, scale, offset));
+	_mm_storeu_si128((__m128i *)dest, packed);
+}
+
+
+// Transpose 4 scans of 4 channels (starting at src, consecutive scans stride
+// doubles apart) into 4 channels of 4 pixels each
+TARGET_AVX2
+static inline void Transpose4x4_AVX2(const double *src, size_t stride,
+	__m256d *c0, __m256d *c1, __m256d *c2, __m256d *c3)
+{
+	__m256d r0 = _mm256_loadu_pd(src);
+	__m256d r1 = _mm256_loadu_pd(src + stride);
+	__m256d r2 = _mm256_loadu_pd(src + 2 * stride);
+	__m256d r3 = _mm256_loadu_pd(src + 3 * stride);
+	__m256d t0 = _mm256_unpacklo_pd(r0, r1);
+	__m256d t1 = _mm256_unpackhi_pd(r0, r1);
+	__m256d t2 = _mm256_unpacklo_pd(r2, r3);
+	__m256d t3 = _mm256_unpackhi_pd(r2, r3);
+	*c0 = _mm256_permute2f128_pd(t0, t2, 0x20);
+	*c1 = _mm256_permute2f128_pd(t1, t3, 0x20);
+	*c2 = _mm256_permute2f128_pd(t0, t2, 0x31);
+	*c3 = _mm256_permute2f128_pd(t1, t3, 0x31);
+}
+
+
+// Convert one block of 8 pixels of 4 channels, read from scans stride
+// doubles apart, into dest[0..3]
+TARGET_AVX2
+static inline void ConvertBlock4_AVX2(const double *src, size_t stride,
+	__m256d scale, __m256d offset, uint16_t *const *dest, size_t p)
+{
+	__m256d lo0, lo1, lo2, lo3, hi0, hi1, hi2, hi3;
+	Transpose4x4_AVX2(src, stride, &lo0, &lo1, &lo2, &lo3);
+	Transpose4x4_AVX2(src + 4 * stride, stride, &hi0, &hi1, &hi2, &hi3);
+	StoreBlock_AVX2(lo0, hi0, scale, offset, dest[0] + p);
+	StoreBlock_AVX2(lo1, hi1, scale, offset, dest[1] + p);
+	StoreBlock_AVX2(lo2, hi2, scale, offset, dest[2] + p);
+	StoreBlock_AVX2(lo3, hi3, scale, offset, dest[3] + p);
+}
+
+
+TARGET_AVX2
+static void ConvertSamplesF64_AVX2_1(const double *src, size_t numPixels,
+	uint32_t numChannels, double scale, double offset, uint16_t *const *dest)
+{
+	__m256d vscale = _mm256_set1_pd(scale);
+	__m256d voffset = _mm256_set1_pd(offset);
+	size_t numBlocks = numPixels / PIXELS_PER_BLOCK;
+
+	for (size_t b = 0; b < numBlocks; ++b)
+	{
+		size_t p = b * PIXELS_PER_BLOCK;
+		StoreBlock_AVX2(_mm256_loadu_pd(src + p), _mm256_loadu_pd(src + p + 4),
+			vscale, voffset, dest[0] + p);
+	}
+
+	ConvertTail(src, numBlocks * PIXELS_PER_BLOCK, numPixels, 1,
+		scale, offset, dest);
+}
+
+
+TARGET_AVX2
+static void ConvertSamplesF64_AVX2_2(const double *src, size_t numPixels,
+	uint32_t numChannels, double scale, double offset, uint16_t *const *dest)
+{
+	__m256d vscale = _mm256_set1_pd(scale);
+	__m256d voffset = _mm256_set1_pd(offset);
+	size_t numBlocks = numPixels / PIXELS_PER_BLOCK;
+
+	for (size_t b = 0; b < numBlocks; ++b)
+	{
+		size_t p = b * PIXELS_PER_BLOCK;
+		const double *block = src + p * 2;
+		// x0 = [c0p0 c1p0 c0p1 c1p1], x1 = [c0p2 c1p2 c0p3 c1p3], ...
+		__m256d x0 = _mm256_loadu_pd(block);
+		__m256d x1 = _mm256_loadu_pd(block + 4);
+		__m256d x2 = _mm256_loadu_pd(block + 8);
+		__m256d x3 = _mm256_loadu_pd(block + 12);
+		// unpack gives pixels in order [0 2 1 3]; permute restores the order
+		__m256d ch0lo = _mm256_permute4x64_pd(_mm256_unpacklo_pd(x0, x1), 0xD8);
+		__m256d ch1lo = _mm256_permute4x64_pd(_mm256_unpackhi_pd(x0, x1), 0xD8);
+		__m256d ch0hi = _mm256_permute4x64_pd(_mm256_unpacklo_pd(x2, x3), 0xD8);
+		__m256d ch1hi = _mm256_permute4x64_pd(_mm256_unpackhi_pd(x2, x3), 0xD8);
+		StoreBlock_AVX2(ch0lo, ch0hi, vscale, voffset, dest[0] + p);
+		StoreBlock_AVX2(ch1lo, ch1hi, vscale, voffset, dest[1] + p);
+	}
+
+	ConvertTail(src, numBlocks * PIXELS_PER_BLOCK, numPixels, 2,
+		scale, offset, dest);
+}
+
+
+TARGET_AVX2
+static void ConvertSamplesF64_AVX2_4(const double *src, size_t numPixels,
+	uint32_t numChannels, double scale, double offset, uint16_t *const *dest)
+{
+	__m256d vscale = _mm256_set1_pd(scale);
+	__m256d voffset = _mm256_set1_pd(offset);
+	size_t numBlocks = numPixels / PIXELS_PER_BLOCK;
+
+	for (size_t b = 0; b < numBlocks; ++b)
+	{
+		size_t p = b * PIXELS_PER_BLOCK;
+		ConvertBlock4_AVX2(src + p * 4, 4, vscale, voffset, dest, p);
+	}
+
+	ConvertTail(src, numBlocks * PIXELS_PER_BLOCK, numPixels, 4,
+		scale, offset, dest);
+}
+
+
+TARGET_AVX2
+static void ConvertSamplesF64_AVX2_8(const double *src, size_t numPixels,
+	uint32_t numChannels, double scale, double offset, uint16_t *const *dest)
+{
+	__m256d vscale = _mm256_set1_pd(scale);
+	__m256d voffset = _mm256_set1_pd(offset);
+	size_t numBlocks = numPixels / PIXELS_PER_BLOCK;
+
+	for (size_t b = 0; b < numBlocks; ++b)
+	{
+		size_t p = b * PIXELS_PER_BLOCK;
+		// Channels 0-3 and 4-7 are transposed separately
+		ConvertBlock4_AVX2(src + p * 8, 8, vscale, voffset, dest, p);
+		ConvertBlock4_AVX2(src + p * 8 + 4, 8, vscale, voffset, dest + 4, p);
+	}
+
+	ConvertTail(src, numBlocks * PIXELS_PER_BLOCK, numPixels, 8,
+		scale, offset, dest);
+}
+
+
+enum InstructionSet
+{
+	InstructionSet_Scalar,
+	InstructionSet_SSE2,
+	InstructionSet_AVX2,
+};
+
+
+static enum InstructionSet DetectInstructionSet(void)
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool hasSSE2 = (info[3] & (1 << 26)) != 0;
+	bool hasOSXSAVE = (info[2] & (1 << 27)) != 0;
+	bool hasAVX = (info[2] & (1 << 28)) != 0;
+
+	bool hasAVX2 = false;
+	if (maxLeaf >= 7 && hasOSXSAVE && hasAVX)
+	{
+		// The OS must also save the YMM registers on context switch
+		bool osSavesYMM = (_xgetbv(0) & 0x6) == 0x6;
+		__cpuidex(info, 7, 0);
+		hasAVX2 = osSavesYMM && (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	bool hasSSE2 = __builtin_cpu_supports("sse2");
+	bool hasAVX2 = __builtin_cpu_supports("avx2");
+#endif
+
+	if (hasAVX2)
+		return InstructionSet_AVX2;
+	if (hasSSE2)
+		return InstructionSet_SSE2;
+	return InstructionSet_Scalar;
+}
+
+
+static int GetInstructionSet(void)
+{
+	// Detection is cheap and idempotent, so a race on first use is harmless
+	static int instructionSet = -1;
+	if (instructionSet < 0)
+		instructionSet = DetectInstructionSet();
+	return instructionSet;
+}
+
+#endif // CONVERSION_HAVE_X86
+
+
+ConvertSamplesF64Func SelectConversionKernelF64(uint32_t numChannels, const char **name)
+{
+	const char *dummy;
+	if (!name)
+		name = &dummy;
+
+#ifdef CONVERSION_HAVE_X86
+	int instructionSet = GetInstructionSet();
+
+	if (instructionSet >= InstructionSet_AVX2)
+	{
+		switch (numChannels)
+		{
+		case 1: *name = "AVX2 (1 channel)"; return ConvertSamplesF64_AVX2_1;
+		case 2: *name = "AVX2 (2 channels)"; return ConvertSamplesF64_AVX2_2;
+		case 4: *name = "AVX2 (4 channels)"; return ConvertSamplesF64_AVX2_4;
+		case 8: *name = "AVX2 (8 channels)"; return ConvertSamplesF64_AVX2_8;
+		}
+	}
+
+	if (instructionSet >= InstructionSet_SSE2)
+	{
+		switch (numChannels)
+		{
+		case 1: *name = "SSE2 (1 channel)"; return ConvertSamplesF64_SSE2_1;
+		case 2: *name = "SSE2 (2 channels)"; return ConvertSamplesF64_SSE2_2;
+		case 4: *name = "SSE2 (4 channels)"; return ConvertSamplesF64_SSE2_4;
+		case 8: *name = "SSE2 (8 channels)"; return ConvertSamplesF64_SSE2_8;
+		default: *name = "SSE2 (any channels)"; return ConvertSamplesF64_SSE2_Generic;
+		}
+	}
+#endif
+
+	*name = "Scalar";
+	return ConvertSamplesF64_Scalar;
+}
+
+
+// Lookups are inherently scalar (gathers of 16-bit values do not pay off),
+// but fixing the channel count lets the compiler unroll the channel loop.
+static inline void ConvertSamplesI16_N(const int16_t *src, size_t numPixels,
+	const uint32_t numChannels, const uint16_t *const *tables, uint16_t *const *dest)
+{
+	for (size_t p = 0; p < numPixels; ++p)
+	{
+		const int16_t *scan = src + p * numChannels;
+		for (uint32_t ch = 0; ch < numChannels; ++ch)
+			dest[ch][p] = tables[ch][(uint16_t)scan[ch]];
+	}
+}
+
+
+static void ConvertSamplesI16_1(const int16_t *src, size_t numPixels,
+	uint32_t numChannels, const uint16_t *const *tables, uint16_t *const *dest)
+{
+	ConvertSamplesI16_N(src, numPixels, 1, tables, dest);
+}
+
+
+static void ConvertSamplesI16_2(const int16_t *src, size_t numPixels,
+	uint32_t numChannels, const uint16_t *const *tables, uint16_t *const *dest)
+{
+	ConvertSamplesI16_N(src, numPixels, 2, tables, dest);
+}
+
+
+static void ConvertSamplesI16_4(const int16_t *src, size_t numPixels,
+	uint32_t numChannels, const uint16_t *const *tables, uint16_t *const *dest)
+{
+	ConvertSamplesI16_N(src, numPixels, 4, tables, dest);
+}
+
+
+static void ConvertSamplesI16_8(const int16_t *src, size_t numPixels,
+	uint32_t numChannels, const uint16_t *const *tables, uint16_t *const *dest)
+{
+	ConvertSamplesI16_N(src, numPixels, 8, tables, dest);
+}
+
+
+static void ConvertSamplesI16_Generic(const int16_t *src, size_t numPixels,
+	uint32_t numChannels, const uint16_t *const *tables, uint16_t *const *dest)
+{
+	ConvertSamplesI16_N(src, numPixels, numChannels, tables, dest);
+}
+
+
+ConvertSamplesI16Func SelectConversionKernelI16(uint32_t numChannels, const char **name)
+{
+	const char *dummy;
+	if (!name)
+		name = &dummy;
+
+	switch (numChannels)
+	{
+	case 1: *name = "Table (1 channel)"; return ConvertSamplesI16_1;
+	case 2: *name = "Table (2 channels)"; return ConvertSamplesI16_2;
+	case 4: *name = "Table (4 channels)"; return ConvertSamplesI16_4;
+	case 8: *name = "Table (8 channels)"; return ConvertSamplesI16_8;
+	default: *name = "Table (any channels)"; return ConvertSamplesI16_Generic;
+	}
+}
+
+
+void BuildConversionTableI16(const double *coeffs, uint32_t numCoeffs,
+	double scale, double offset, uint16_t *table)
+{
+	for (int32_t code = INT16_MIN; code <= INT16_MAX; ++code)
+	{
+		// Horner's method
+		double volts = 0.0;
+		for (uint32_t i = numCoeffs; i > 0; --i)
+			volts = volts * code + coeffs[i - 1];
+
+		table[(uint16_t)code] = ScaleSample(volts, scale, offset);
+	}
+}
+
+
+/*
+ * Binning of oversampled data
+ */
+
+static void BinSamplesF64_Scalar(const double *src, size_t numPixels,
+	uint32_t numChannels, uint32_t factor, double *dest)
+{
+	for (size_t p = 0; p < numPixels; ++p)
+	{
+		const double *scans = src + p * factor * numChannels;
+		double *out = dest + p * numChannels;
+		for (uint32_t ch = 0; ch < numChannels; ++ch)
+		{
+			double sum = 0.0;
+			for (uint32_t k = 0; k < factor; ++k)
+				sum += scans[k * numChannels + ch];
+			out[ch] = sum;
+		}
+	}
+}
+
+
+#ifdef CONVERSION_HAVE_X86
+
+// Pairs of channels are summed in one __m128d. With a single channel, the
+// consecutive samples of each pixel are summed pairwise instead.
+TARGET_SSE2
+static void BinSamplesF64_SSE2(const double *src, size_t numPixels,
+	uint32_t numChannels, uint32_t factor, double *dest)
+{
+	const size_t scansStride = (size_t)factor * numChannels;
+
+	if (numChannels == 1)
+	{
+		for (size_t p = 0; p < numPixels; ++p)
+		{
+			const double *samples = src + p * scansStride;
+			__m128d acc = _mm_setzero_pd();
+			uint32_t k = 0;
+			for (; k + 1 < factor; k += 2)
+				acc = _mm_add_pd(acc, _mm_loadu_pd(samples + k));
+			double sum = _mm_cvtsd_f64(_mm_add_sd(acc, _mm_unpackhi_pd(acc, acc)));
+			if (k < factor)
+				sum += samples[k];
+			dest[p] = sum;
+		}
+		return;
+	}
+
+	for (size_t p = 0; p < numPixels; ++p)
+	{
+		const double *scans = src + p * scansStride;
+		double *out = dest + p * numChannels;
+		uint32_t ch = 0;
+		for (; ch + 1 < numChannels; ch += 2)
+		{
+			__m128d acc = _mm_setzero_pd();
+			for (uint32_t k = 0; k < factor; ++k)
+				acc = _mm_add_pd(acc, _mm_loadu_pd(scans + k * numChannels + ch));
+			_mm_storeu_pd(out + ch, acc);
+		}
+		if (ch < numChannels)
+		{
+			double sum = 0.0;
+			for (uint32_t k = 0; k < factor; ++k)
+				sum += scans[k * numChannels + ch];
+			out[ch] = sum;
+		}
+	}
+}
+
+#endif // CONVERSION_HAVE_X86
+
+
+void BinSamplesF64(const double *src, size_t numPixels, uint32_t numChannels,
+	uint32_t factor, double *dest)
+{
+#ifdef CONVERSION_HAVE_X86
+	if (GetInstructionSet() >= InstructionSet_SSE2)
+	{
+		BinSamplesF64_SSE2(src, numPixels, numChannels, factor, dest);
+		return;
+	}
+#endif
+	BinSamplesF64_Scalar(src, numPixels, numChannels, factor, dest);
+}
+
+
+static inline int16_t RoundedMean(int32_t sum, uint32_t factor)
+{
+	int32_t half = (int32_t)(factor / 2);
+	if (sum >= 0)
+		return (int16_t)((sum + half) / (int32_t)factor);
+	return (int16_t)-((-sum + half) / (int32_t)factor);
+}
+
+
+// Accumulate in int32 (no overflow for factor <= 65536). Fixing the channel
+// count lets the compiler vectorize the accumulation across channels.
+static inline void BinSamplesI16_N(const int16_t *src, size_t numPixels,
+	const uint32_t numChannels, uint32_t factor, int16_t *dest)
+{
+	for (size_t p = 0; p < numPixels; ++p)
+	{
+		const int16_t *scans = src + p * factor * numChannels;
+		int32_t sums[BIN_MAX_CHANNELS] = { 0 };
+		for (uint32_t k = 0; k < factor; ++k)
+		{
+			for (uint32_t ch = 0; ch < numChannels; ++ch)
+				sums[ch] += scans[k * numChannels + ch];
+		}
+		for (uint32_t ch = 0; ch < numChannels; ++ch)
+			dest[p * numChannels + ch] = RoundedMean(sums[ch], factor);
+	}
+}
+
+
+void BinSamplesI16(const int16_t *src, size_t numPixels, uint32_t numChannels,
+	uint32_t factor, int16_t *dest)
+{
+	switch (numChannels)
+	{
+	case 1: BinSamplesI16_N(src, numPixels, 1, factor, dest); return;
+	case 2: BinSamplesI16_N(src, numPixels, 2, factor, dest); return;
+	case 4: BinSamplesI16_N(src, numPixels, 4, factor, dest); return;
+	case 8: BinSamplesI16_N(src, numPixels, 8, factor, dest); return;
+	}
+	BinSamplesI16_N(src, numPixels, numChannels, factor, dest);
+}
+
+
+
+
+/*
+ * Frame averaging
+ */
+
+static void AccumulateU16_Scalar(const uint16_t *src, size_t numPixels, uint32_t *acc)
+{
+	for (size_t i = 0; i < numPixels; ++i)
+		acc[i] += src[i];
+}
+
+
+static void AccumulateExpF32_Scalar(const uint16_t *src, size_t numPixels,
+	float weight, float *acc)
+{
+	for (size_t i = 0; i < numPixels; ++i)
+		acc[i] += weight * ((float)src[i] - acc[i]);
+}
+
+
+#ifdef CONVERSION_HAVE_X86
+
+// Widen 8 pixels at a time to 32 bits by interleaving with zero
+TARGET_SSE2
+static void AccumulateU16_SSE2(const uint16_t *src, size_t numPixels, uint32_t *acc)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + PIXELS_PER_BLOCK <= numPixels; i += PIXELS_PER_BLOCK)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i lo = _mm_add_epi32(_mm_loadu_si128((const __m128i *)(acc + i)),
+			_mm_unpacklo_epi16(v, zero));
+		__m128i hi = _mm_add_epi32(_mm_loadu_si128((const __m128i *)(acc + i + 4)),
+			_mm_unpackhi_epi16(v, zero));
+		_mm_storeu_si128((__m128i *)(acc + i), lo);
+		_mm_storeu_si128((__m128i *)(acc + i + 4), hi);
+	}
+	AccumulateU16_Scalar(src + i, numPixels - i, acc + i);
+}
+
+
+TARGET_SSE2
+static void AccumulateExpF32_SSE2(const uint16_t *src, size_t numPixels,
+	float weight, float *acc)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 w = _mm_set1_ps(weight);
+	size_t i = 0;
+	for (; i + PIXELS_PER_BLOCK <= numPixels; i += PIXELS_PER_BLOCK)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128 xlo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+		__m128 xhi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero));
+		__m128 alo = _mm_loadu_ps(acc + i);
+		__m128 ahi = _mm_loadu_ps(acc + i + 4);
+		alo = _mm_add_ps(alo, _mm_mul_ps(w, _mm_sub_ps(xlo, alo)));
+		ahi = _mm_add_ps(ahi, _mm_mul_ps(w, _mm_sub_ps(xhi, ahi)));
+		_mm_storeu_ps(acc + i, alo);
+		_mm_storeu_ps(acc + i + 4, ahi);
+	}
+	AccumulateExpF32_Scalar(src + i, numPixels - i, weight, acc + i);
+}
+
+#endif // CONVERSION_HAVE_X86
+
+
+void AccumulateU16(const uint16_t *src, size_t numPixels, uint32_t *acc)
+{
+#ifdef CONVERSION_HAVE_X86
+	if (GetInstructionSet() >= InstructionSet_SSE2)
+	{
+		AccumulateU16_SSE2(src, numPixels, acc);
+		return;
+	}
+#endif
+	AccumulateU16_Scalar(src, numPixels, acc);
+}
+
+
+void AccumulateExpF32(const uint16_t *src, size_t numPixels, float weight, float *acc)
+{
+#ifdef CONVERSION_HAVE_X86
+	if (GetInstructionSet() >= InstructionSet_SSE2)
+	{
+		AccumulateExpF32_SSE2(src, numPixels, weight, acc);
+		return;
+	}
+#endif
+	AccumulateExpF32_Scalar(src, numPixels, weight, acc);
+}
+
+
+// Done once per averaged frame, so not worth vectorizing
+void StoreAccumulatorU32(const uint32_t *acc, size_t numPixels, uint32_t divisor, uint16_t *dest)
+{
+	uint32_t half = divisor / 2;
+	for (size_t i = 0; i < numPixels; ++i)
+	{
+		uint64_t v = ((uint64_t)acc[i] + half) / divisor;
+		dest[i] = v > 65535 ? 65535 : (uint16_t)v;
+	}
+}
+
+
+void StoreAccumulatorF32(const float *acc, size_t numPixels, uint16_t *dest)
+{
+	for (size_t i = 0; i < numPixels; ++i)
+	{
+		float v = acc[i] + 0.5f;
+		if (v < 0.0f)
+			v = 0.0f;
+		if (v > 65535.0f)
+			v = 65535.0f;
+		dest[i] = (uint16_t)v;
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Conversion of raw detector samples (channels interleaved, i.e. DAQmx
+// GroupByScanNumber order) into per-channel 16-bit pixel values.
+//
+// Each sample is scaled as pixel = sample * scale + offset, clamped to
+// [0, 65535], and truncated, while being deinterleaved into dest[ch].
+// dest[ch] must point to the position of the first pixel to be written for
+// the ch-th channel.
+typedef void (*ConvertSamplesF64Func)(const double *src, size_t numPixels,
+	uint32_t numChannels, double scale, double offset, uint16_t *const *dest);
+
+
+// Return the fastest conversion kernel for the given number of channels
+// that is supported by the CPU we are running on. If name is not NULL, it
+// is set to a static string describing the selected kernel.
+ConvertSamplesF64Func SelectConversionKernelF64(uint32_t numChannels, const char **name);
+
+// Portable reference implementation, usable for any number of channels
+void ConvertSamplesF64_Scalar(const double *src, size_t numPixels,
+	uint32_t numChannels, double scale, double offset, uint16_t *const *dest);
+
+
+// Oversampling: combine each run of factor consecutive scans (channels
+// interleaved) into a single scan, written to dest (numPixels scans). src
+// holds numPixels * factor scans.
+// numChannels must not exceed BIN_MAX_CHANNELS.
+#define BIN_MAX_CHANNELS 16
+
+// Sum the samples; the caller divides by the factor as part of the scaling
+void BinSamplesF64(const double *src, size_t numPixels, uint32_t numChannels,
+	uint32_t factor, double *dest);
+
+// Average the ADC codes, rounding to nearest, so that the result can be
+// looked up in the conversion tables (this assumes that the device scaling
+// is linear over the range of codes being averaged, which holds to well
+// within one code in practice)
+void BinSamplesI16(const int16_t *src, size_t numPixels, uint32_t numChannels,
+	uint32_t factor, int16_t *dest);
+
+
+// Frame averaging: accumulation of whole frames of pixel values, one channel
+// at a time, and conversion of the accumulators back to pixel values
+
+// acc[i] += src[i]
+void AccumulateU16(const uint16_t *src, size_t numPixels, uint32_t *acc);
+
+// Exponential running average: acc[i] += weight * (src[i] - acc[i])
+void AccumulateExpF32(const uint16_t *src, size_t numPixels, float weight, float *acc);
+
+// dest[i] = acc[i] / divisor, rounded to nearest and clamped to 65535 (so
+// that a divisor of 1 gives a saturating sum)
+void StoreAccumulatorU32(const uint32_t *acc, size_t numPixels, uint32_t divisor, uint16_t *dest);
+
+// dest[i] = acc[i], rounded to nearest and clamped to [0, 65535]
+void StoreAccumulatorF32(const float *acc, size_t numPixels, uint16_t *dest);
+
+
+// Number of entries in a per-channel table mapping raw 16-bit ADC codes to
+// pixel values
+#define CONVERSION_TABLE_SIZE 65536
+
+// Conversion of raw 16-bit ADC codes (channels interleaved) into per-channel
+// pixel values, by looking up each code in tables[ch] (indexed by the code
+// reinterpreted as unsigned).
+typedef void (*ConvertSamplesI16Func)(const int16_t *src, size_t numPixels,
+	uint32_t numChannels, const uint16_t *const *tables, uint16_t *const *dest);
+
+ConvertSamplesI16Func SelectConversionKernelI16(uint32_t numChannels, const char **name);
+
+// Fill in a table of CONVERSION_TABLE_SIZE entries. Each code is first
+// converted to volts with the polynomial coeffs[0] + coeffs[1] * code + ...
+// (as given by the device scaling coefficients), then scaled, clamped, and
+// truncated in the same way as ConvertSamplesF64Func.
+void BuildConversionTableI16(const double *coeffs, uint32_t numCoeffs,
+	double scale, double offset, uint16_t *table);
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <NIDAQmx.h>
+
+
+// The DAQ operations used by this module, as a table of functions with the
+// same parameters and status codes (negative for errors, positive for
+// warnings) as the NI-DAQmx functions of the same names. All calls go
+// through the backend returned by GetDAQ(), so that the acquisition engine
+// can run against a simulated DAQ as well as NI-DAQmx.
+struct DAQBackend
+{
+	const char *name;
+
+	// Called once, before any other function; may be NULL
+	void (*Initialize)(void);
+
+	// System and device
+	int32 (*GetSysDevNames)(char *data, uInt32 bufferSize);
+	int32 (*ResetDevice)(const char deviceName[]);
+	int32 (*GetDevProductCategory)(const char device[], int32 *data);
+	int32 (*GetDevAIPhysicalChans)(const char device[], char *data, uInt32 bufferSize);
+	int32 (*GetDevAIMaxSingleChanRate)(const char device[], float64 *data);
+	int32 (*GetDevAIMaxMultiChanRate)(const char device[], float64 *data);
+	int32 (*GetDevAOVoltageRngs)(const char device[], float64 *data, uInt32 arraySizeInElements);
+
+	// Task lifecycle
+	int32 (*CreateTask)(const char taskName[], TaskHandle *taskHandle);
+	int32 (*ClearTask)(TaskHandle taskHandle);
+	int32 (*StartTask)(TaskHandle taskHandle);
+	int32 (*StopTask)(TaskHandle taskHandle);
+	int32 (*TaskControl)(TaskHandle taskHandle, int32 action);
+	int32 (*WaitUntilTaskDone)(TaskHandle taskHandle, float64 timeToWait);
+	int32 (*GetTaskNumDevices)(TaskHandle taskHandle, uInt32 *data);
+	int32 (*GetNthTaskDevice)(TaskHandle taskHandle, uInt32 index, char buffer[], int32 bufferSize);
+
+	// Channels
+	int32 (*CreateAIVoltageChan)(TaskHandle taskHandle, const char physicalChannel[],
+		const char nameToAssignToChannel[], int32 terminalConfig,
+		float64 minVal, float64 maxVal, int32 units, const char customScaleName[]);
+	int32 (*CreateAOVoltageChan)(TaskHandle taskHandle, const char physicalChannel[],
+		const char nameToAssignToChannel[], float64 minVal, float64 maxVal,
+		int32 units, const char customScaleName[]);
+	int32 (*CreateDOChan)(TaskHandle taskHandle, const char lines[],
+		const char nameToAssignToLines[], int32 lineGrouping);
+	int32 (*CreateCOPulseChanFreq)(TaskHandle taskHandle, const char counter[],
+		const char nameToAssignToChannel[], int32 units, int32 idleState,
+		float64 initialDelay, float64 freq, float64 dutyCycle);
+	// DAQmxSetChanAttribute(), for float64 attributes only
+	int32 (*SetChanAttributeF64)(TaskHandle taskHandle, const char channel[],
+		int32 attribute, float64 value);
+	int32 (*GetAIDevScalingCoeff)(TaskHandle taskHandle, const char channel[],
+		float64 *data, uInt32 arraySizeInElements);
+
+	// Timing, triggering, and buffers
+	int32 (*CfgSampClkTiming)(TaskHandle taskHandle, const char source[], float64 rate,
+		int32 activeEdge, int32 sampleMode, uInt64 sampsPerChan);
+	int32 (*CfgImplicitTiming)(TaskHandle taskHandle, int32 sampleMode, uInt64 sampsPerChan);
+	int32 (*CfgDigEdgeStartTrig)(TaskHandle taskHandle, const char triggerSource[], int32 triggerEdge);
+	int32 (*SetStartTrigRetriggerable)(TaskHandle taskHandle, bool32 data);
+	int32 (*CfgInputBuffer)(TaskHandle taskHandle, uInt32 numSampsPerChan);
+	int32 (*CfgOutputBuffer)(TaskHandle taskHandle, uInt32 numSampsPerChan);
+
+	// Writing
+	int32 (*WriteAnalogF64)(TaskHandle taskHandle, int32 numSampsPerChan, bool32 autoStart,
+		float64 timeout, bool32 dataLayout, const float64 writeArray[],
+		int32 *sampsPerChanWritten, bool32 *reserved);
+	int32 (*WriteDigitalLines)(TaskHandle taskHandle, int32 numSampsPerChan, bool32 autoStart,
+		float64 timeout, bool32 dataLayout, const uInt8 writeArray[],
+		int32 *sampsPerChanWritten, bool32 *reserved);
+
+	// Reading
+	int32 (*RegisterEveryNSamplesEvent)(TaskHandle task, int32 everyNsamplesEventType,
+		uInt32 nSamples, uInt32 options, DAQmxEveryNSamplesEventCallbackPtr callbackFunction,
+		void *callbackData);
+	int32 (*SetReadReadAllAvailSamp)(TaskHandle taskHandle, bool32 data);
+	int32 (*GetReadNumChans)(TaskHandle taskHandle, uInt32 *data);
+	int32 (*GetReadAvailSampPerChan)(TaskHandle taskHandle, uInt32 *data);
+	int32 (*GetReadCurrReadPos)(TaskHandle taskHandle, uInt64 *data);
+	int32 (*GetReadTotalSampPerChanAcquired)(TaskHandle taskHandle, uInt64 *data);
+	int32 (*ReadAnalogF64)(TaskHandle taskHandle, int32 numSampsPerChan, float64 timeout,
+		bool32 fillMode, float64 readArray[], uInt32 arraySizeInSamps,
+		int32 *sampsPerChanRead, bool32 *reserved);
+	int32 (*ReadBinaryI16)(TaskHandle taskHandle, int32 numSampsPerChan, float64 timeout,
+		bool32 fillMode, int16 readArray[], uInt32 arraySizeInSamps,
+		int32 *sampsPerChanRead, bool32 *reserved);
+
+	// Description of the last error or warning on the calling thread
+	int32 (*GetExtendedErrorInfo)(char errorString[], uInt32 bufferSize);
+};
+
+
+// Calls NI-DAQmx; not available when built with OSCNIDAQ_NO_DAQMX
+// See DAQmxBackend.c
+extern const struct DAQBackend DAQmxBackend;
+
+// Software model of a DAQ card, needing no hardware or driver
+// See SimulatedDAQ.c
+extern const struct DAQBackend SimulatedDAQBackend;
+
+
+// Forwards to the given backend, recording each call in the trace (see
+// Trace.h); not available when built with OSCNIDAQ_NO_TRACE
+// See TracingDAQ.c
+const struct DAQBackend *GetTracingDAQ(const struct DAQBackend *backend);
+
+
+// The backend in use, chosen on first call: the simulated DAQ if the
+// environment variable OSCNIDAQ_SIMULATE is set (to anything but "0") or
+// the module was built with OSCNIDAQ_NO_DAQMX, otherwise NI-DAQmx. While
+// tracing, its calls go through GetTracingDAQ().
+// See OScNIDAQ.c
+const struct DAQBackend *GetDAQ(void);
@@ -0,0 +1,311 @@
+#ifndef OSCNIDAQ_NO_DAQMX
+
+#include "DAQBackend.h"
+
+#include <NIDAQmx.h>
+
+
+// Thin wrappers, because the DAQmx functions may use a calling convention
+// other than that of the function pointers in the backend
+
+
+static int32 GetSysDevNames_DAQmx(char *data, uInt32 bufferSize)
+{
+	return DAQmxGetSysDevNames(data, bufferSize);
+}
+
+
+static int32 ResetDevice_DAQmx(const char deviceName[])
+{
+	return DAQmxResetDevice(deviceName);
+}
+
+
+static int32 GetDevProductCategory_DAQmx(const char device[], int32 *data)
+{
+	return DAQmxGetDevProductCategory(device, data);
+}
+
+
+static int32 GetDevAIPhysicalChans_DAQmx(const char device[], char *data, uInt32 bufferSize)
+{
+	return DAQmxGetDevAIPhysicalChans(device, data, bufferSize);
+}
+
+
+static int32 GetDevAIMaxSingleChanRate_DAQmx(const char device[], float64 *data)
+{
+	return DAQmxGetDevAIMaxSingleChanRate(device, data);
+}
+
+
+static int32 GetDevAIMaxMultiChanRate_DAQmx(const char device[], float64 *data)
+{
+	return DAQmxGetDevAIMaxMultiChanRate(device, data);
+}
+
+
+static int32 GetDevAOVoltageRngs_DAQmx(const char device[], float64 *data, uInt32 arraySizeInElements)
+{
+	return DAQmxGetDevAOVoltageRngs(device, data, arraySizeInElements);
+}
+
+
+static int32 CreateTask_DAQmx(const char taskName[], TaskHandle *taskHandle)
+{
+	return DAQmxCreateTask(taskName, taskHandle);
+}
+
+
+static int32 ClearTask_DAQmx(TaskHandle taskHandle)
+{
+	return DAQmxClearTask(taskHandle);
+}
+
+
+static int32 StartTask_DAQmx(TaskHandle taskHandle)
+{
+	return DAQmxStartTask(taskHandle);
+}
+
+
+static int32 StopTask_DAQmx(TaskHandle taskHandle)
+{
+	return DAQmxStopTask(taskHandle);
+}
+
+
+static int32 TaskControl_DAQmx(TaskHandle taskHandle, int32 action)
+{
+	return DAQmxTaskControl(taskHandle, action);
+}
+
+
+static int32 WaitUntilTaskDone_DAQmx(TaskHandle taskHandle, float64 timeToWait)
+{
+	return DAQmxWaitUntilTaskDone(taskHandle, timeToWait);
+}
+
+
+static int32 GetTaskNumDevices_DAQmx(TaskHandle taskHandle, uInt32 *data)
+{
+	return DAQmxGetTaskNumDevices(taskHandle, data);
+}
+
+
+static int32 GetNthTaskDevice_DAQmx(TaskHandle taskHandle, uInt32 index, char buffer[], int32 bufferSize)
+{
+	return DAQmxGetNthTaskDevice(taskHandle, index, buffer, bufferSize);
+}
+
+
+static int32 CreateAIVoltageChan_DAQmx(TaskHandle taskHandle, const char physicalChannel[],
+	const char nameToAssignToChannel[], int32 terminalConfig,
+	float64 minVal, float64 maxVal, int32 units, const char customScaleName[])
+{
+	return DAQmxCreateAIVoltageChan(taskHandle, physicalChannel, nameToAssignToChannel,
+		terminalConfig, minVal, maxVal, units, customScaleName);
+}
+
+
+static int32 CreateAOVoltageChan_DAQmx(TaskHandle taskHandle, const char physicalChannel[],
+	const char nameToAssignToChannel[], float64 minVal, float64 maxVal,
+	int32 units, const char customScaleName[])
+{
+	return DAQmxCreateAOVoltageChan(taskHandle, physicalChannel, nameToAssignToChannel,
+		minVal, maxVal, units, customScaleName);
+}
+
+
+static int32 CreateDOChan_DAQmx(TaskHandle taskHandle, const char lines[],
+	const char nameToAssignToLines[], int32 lineGrouping)
+{
+	return DAQmxCreateDOChan(taskHandle, lines, nameToAssignToLines, lineGrouping);
+}
+
+
+static int32 CreateCOPulseChanFreq_DAQmx(TaskHandle taskHandle, const char counter[],
+	const char nameToAssignToChannel[], int32 units, int32 idleState,
+	float64 initialDelay, float64 freq, float64 dutyCycle)
+{
+	return DAQmxCreateCOPulseChanFreq(taskHandle, counter, nameToAssignToChannel, units,
+		idleState, initialDelay, freq, dutyCycle);
+}
+
+
+static int32 SetChanAttributeF64_DAQmx(TaskHandle taskHandle, const char channel[],
+	int32 attribute, float64 value)
+{
+	return DAQmxSetChanAttribute(taskHandle, channel, attribute, value);
+}
+
+
+static int32 GetAIDevScalingCoeff_DAQmx(TaskHandle taskHandle, const char channel[],
+	float64 *data, uInt32 arraySizeInElements)
+{
+	return DAQmxGetAIDevScalingCoeff(taskHandle, channel, data, arraySizeInElements);
+}
+
+
+static int32 CfgSampClkTiming_DAQmx(TaskHandle taskHandle, const char source[], float64 rate,
+	int32 activeEdge, int32 sampleMode, uInt64 sampsPerChan)
+{
+	return DAQmxCfgSampClkTiming(taskHandle, source, rate, activeEdge, sampleMode,
+		sampsPerChan);
+}
+
+
+static int32 CfgImplicitTiming_DAQmx(TaskHandle taskHandle, int32 sampleMode, uInt64 sampsPerChan)
+{
+	return DAQmxCfgImplicitTiming(taskHandle, sampleMode, sampsPerChan);
+}
+
+
+static int32 CfgDigEdgeStartTrig_DAQmx(TaskHandle taskHandle, const char triggerSource[], int32 triggerEdge)
+{
+	return DAQmxCfgDigEdgeStartTrig(taskHandle, triggerSource, triggerEdge);
+}
+
+
+static int32 SetStartTrigRetriggerable_DAQmx(TaskHandle taskHandle, bool32 data)
+{
+	return DAQmxSetStartTrigRetriggerable(taskHandle, data);
+}
+
+
+static int32 CfgInputBuffer_DAQmx(TaskHandle taskHandle, uInt32 numSampsPerChan)
+{
+	return DAQmxCfgInputBuffer(taskHandle, numSampsPerChan);
+}
+
+
+static int32 CfgOutputBuffer_DAQmx(TaskHandle taskHandle, uInt32 numSampsPerChan)
+{
+	return DAQmxCfgOutputBuffer(taskHandle, numSampsPerChan);
+}
+
+
+static int32 WriteAnalogF64_DAQmx(TaskHandle taskHandle, int32 numSampsPerChan, bool32 autoStart,
+	float64 timeout, bool32 dataLayout, const float64 writeArray[],
+	int32 *sampsPerChanWritten, bool32 *reserved)
+{
+	return DAQmxWriteAnalogF64(taskHandle, numSampsPerChan, autoStart, timeout,
+		dataLayout, writeArray, sampsPerChanWritten, reserved);
+}
+
+
+static int32 WriteDigitalLines_DAQmx(TaskHandle taskHandle, int32 numSampsPerChan, bool32 autoStart,
+	float64 timeout, bool32 dataLayout, const uInt8 writeArray[],
+	int32 *sampsPerChanWritten, bool32 *reserved)
+{
+	return DAQmxWriteDigitalLines(taskHandle, numSampsPerChan, autoStart, timeout,
+		dataLayout, writeArray, sampsPerChanWritten, reserved);
+}
+
+
+static int32 RegisterEveryNSamplesEvent_DAQmx(TaskHandle task, int32 everyNsamplesEventType,
+	uInt32 nSamples, uInt32 options, DAQmxEveryNSamplesEventCallbackPtr callbackFunction,
+	void *callbackData)
+{
+	return DAQmxRegisterEveryNSamplesEvent(task, everyNsamplesEventType, nSamples,
+		options, callbackFunction, callbackData);
+}
+
+
+static int32 SetReadReadAllAvailSamp_DAQmx(TaskHandle taskHandle, bool32 data)
+{
+	return DAQmxSetReadReadAllAvailSamp(taskHandle, data);
+}
+
+
+static int32 GetReadNumChans_DAQmx(TaskHandle taskHandle, uInt32 *data)
+{
+	return DAQmxGetReadNumChans(taskHandle, data);
+}
+
+
+static int32 GetReadAvailSampPerChan_DAQmx(TaskHandle taskHandle, uInt32 *data)
+{
+	return DAQmxGetReadAvailSampPerChan(taskHandle, data);
+}
+
+
+static int32 GetReadCurrReadPos_DAQmx(TaskHandle taskHandle, uInt64 *data)
+{
+	return DAQmxGetReadCurrReadPos(taskHandle, data);
+}
+
+
+static int32 GetReadTotalSampPerChanAcquired_DAQmx(TaskHandle taskHandle, uInt64 *data)
+{
+	return DAQmxGetReadTotalSampPerChanAcquired(taskHandle, data);
+}
+
+
+static int32 ReadAnalogF64_DAQmx(TaskHandle taskHandle, int32 numSampsPerChan, float64 timeout,
+	bool32 fillMode, float64 readArray[], uInt32 arraySizeInSamps,
+	int32 *sampsPerChanRead, bool32 *reserved)
+{
+	return DAQmxReadAnalogF64(taskHandle, numSampsPerChan, timeout, fillMode, readArray,
+		arraySizeInSamps, sampsPerChanRead, reserved);
+}
+
+
+static int32 ReadBinaryI16_DAQmx(TaskHandle taskHandle, int32 numSampsPerChan, float64 timeout,
+	bool32 fillMode, int16 readArray[], uInt32 arraySizeInSamps,
+	int32 *sampsPerChanRead, bool32 *reserved)
+{
+	return DAQmxReadBinaryI16(taskHandle, numSampsPerChan, timeout, fillMode, readArray,
+		arraySizeInSamps, sampsPerChanRead, reserved);
+}
+
+
+static int32 GetExtendedErrorInfo_DAQmx(char errorString[], uInt32 bufferSize)
+{
+	return DAQmxGetExtendedErrorInfo(errorString, bufferSize);
+}
+
+
+const struct DAQBackend DAQmxBackend = {
+	.name = "NI-DAQmx",
+	.GetSysDevNames = GetSysDevNames_DAQmx,
+	.ResetDevice = ResetDevice_DAQmx,
+	.GetDevProductCategory = GetDevProductCategory_DAQmx,
+	.GetDevAIPhysicalChans = GetDevAIPhysicalChans_DAQmx,
+	.GetDevAIMaxSingleChanRate = GetDevAIMaxSingleChanRate_DAQmx,
+	.GetDevAIMaxMultiChanRate = GetDevAIMaxMultiChanRate_DAQmx,
+	.GetDevAOVoltageRngs = GetDevAOVoltageRngs_DAQmx,
+	.CreateTask = CreateTask_DAQmx,
+	.ClearTask = ClearTask_DAQmx,
+	.StartTask = StartTask_DAQmx,
+	.StopTask = StopTask_DAQmx,
+	.TaskControl = TaskControl_DAQmx,
+	.WaitUntilTaskDone = WaitUntilTaskDone_DAQmx,
+	.GetTaskNumDevices = GetTaskNumDevices_DAQmx,
+	.GetNthTaskDevice = GetNthTaskDevice_DAQmx,
+	.CreateAIVoltageChan = CreateAIVoltageChan_DAQmx,
+	.CreateAOVoltageChan = CreateAOVoltageChan_DAQmx,
+	.CreateDOChan = CreateDOChan_DAQmx,
+	.CreateCOPulseChanFreq = CreateCOPulseChanFreq_DAQmx,
+	.SetChanAttributeF64 = SetChanAttributeF64_DAQmx,
+	.GetAIDevScalingCoeff = GetAIDevScalingCoeff_DAQmx,
+	.CfgSampClkTiming = CfgSampClkTiming_DAQmx,
+	.CfgImplicitTiming = CfgImplicitTiming_DAQmx,
+	.CfgDigEdgeStartTrig = CfgDigEdgeStartTrig_DAQmx,
+	.SetStartTrigRetriggerable = SetStartTrigRetriggerable_DAQmx,
+	.CfgInputBuffer = CfgInputBuffer_DAQmx,
+	.CfgOutputBuffer = CfgOutputBuffer_DAQmx,
+	.WriteAnalogF64 = WriteAnalogF64_DAQmx,
+	.WriteDigitalLines = WriteDigitalLines_DAQmx,
+	.RegisterEveryNSamplesEvent = RegisterEveryNSamplesEvent_DAQmx,
+	.SetReadReadAllAvailSamp = SetReadReadAllAvailSamp_DAQmx,
+	.GetReadNumChans = GetReadNumChans_DAQmx,
+	.GetReadAvailSampPerChan = GetReadAvailSampPerChan_DAQmx,
+	.GetReadCurrReadPos = GetReadCurrReadPos_DAQmx,
+	.GetReadTotalSampPerChanAcquired = GetReadTotalSampPerChanAcquired_DAQmx,
+	.ReadAnalogF64 = ReadAnalogF64_DAQmx,
+	.ReadBinaryI16 = ReadBinaryI16_DAQmx,
+	.GetExtendedErrorInfo = GetExtendedErrorInfo_DAQmx,
+};
+
+#endif // OSCNIDAQ_NO_DAQMX
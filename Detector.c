@@ -1,10 +1,12 @@
 #include "OScNIDAQDevicePrivate.h"
+#include "Waveform.h"
 
 #include <OpenScanDeviceLib.h>
 #include <NIDAQmx.h>
 
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 
 
 static OScDev_RichError *CreateDetectorTask(OScDev_Device *device, struct DetectorConfig *config);
@@ -13,7 +15,10 @@ static OScDev_RichError *ConfigureDetectorTrigger(OScDev_Device *device, struct
 static OScDev_RichError *ConfigureDetectorCallback(OScDev_Device *device, struct DetectorConfig *config, OScDev_Acquisition *acq);
 static int32 CVICALLBACK DetectorDataCallback(TaskHandle taskHandle,
 	int32 everyNsamplesEventType, uInt32 nSamples, void* callbackData);
-static int32 HandleRawData(OScDev_Device *device);
+static double GetLinePeriodMs(OScDev_Device *device, OScDev_Acquisition *acq);
+static uint32_t ChooseLinesPerCallback(OScDev_Device *device, OScDev_Acquisition *acq);
+static OScDev_RichError *StartProcessingThread(OScDev_Device *device);
+static void StopProcessingThread(OScDev_Device *device);
 
 
 // Initialize, configure, and arm the detector, whatever its current state
@@ -63,7 +68,7 @@ OScDev_RichError *SetUpDetector(OScDev_Device *device, struct DetectorConfig *co
 
 	if (mustCommit)
 	{
-		err = CreateDAQmxError(DAQmxTaskControl(config->aiTask, DAQmx_Val_Task_Commit));
+		err = CreateDAQmxError(GetDAQ()->TaskControl(config->aiTask, DAQmx_Val_Task_Commit));
 		if (err)
 		{
 			err = OScDev_Error_Wrap(err, "Failed to commit task for detector");
@@ -71,6 +76,13 @@ OScDev_RichError *SetUpDetector(OScDev_Device *device, struct DetectorConfig *co
 		}
 	}
 
+	if (!GetData(device)->processing.thread)
+	{
+		err = StartProcessingThread(device);
+		if (err)
+			goto error;
+	}
+
 	return OScDev_RichError_OK;
 
 error:
@@ -88,7 +100,7 @@ OScDev_RichError *ShutdownDetector(OScDev_Device *device, struct DetectorConfig
 	OScDev_RichError *err;
 	if (config->aiTask)
 	{
-		err = CreateDAQmxError(DAQmxClearTask(config->aiTask));
+		err = CreateDAQmxError(GetDAQ()->ClearTask(config->aiTask));
 		if (err)
 		{
 			err = OScDev_Error_Wrap(err, "Failed to clear detector task");
@@ -96,6 +108,10 @@ OScDev_RichError *ShutdownDetector(OScDev_Device *device, struct DetectorConfig
 		}
 		config->aiTask = 0;
 	}
+
+	// No more callbacks can occur, so we can stop the consumer
+	StopProcessingThread(device);
+
 	return OScDev_RichError_OK;
 }
 
@@ -103,7 +119,8 @@ OScDev_RichError *ShutdownDetector(OScDev_Device *device, struct DetectorConfig
 OScDev_RichError *StartDetector(OScDev_Device *device, struct DetectorConfig *config)
 {
 	OScDev_RichError *err;
-	err = CreateDAQmxError(DAQmxStartTask(config->aiTask));
+	Atomic_Store(&GetData(device)->processing.failed, 0);
+	err = CreateDAQmxError(GetDAQ()->StartTask(config->aiTask));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to start detector task");
@@ -114,6 +131,58 @@ OScDev_RichError *StartDetector(OScDev_Device *device, struct DetectorConfig *co
 }
 
 
+// True if detector data has failed to be read or processed since the
+// detector was started; the acquisition should then be stopped
+bool HasDetectorFailed(OScDev_Device *device)
+{
+	return Atomic_Load(&GetData(device)->processing.failed) != 0;
+}
+
+
+// Called on the callback or processing thread; wakes the acquisition thread
+// if it is waiting for frames
+static void SetDetectorFailed(OScDev_Device *device)
+{
+	Atomic_Store(&GetData(device)->processing.failed, 1);
+	Mutex_Lock(&GetData(device)->frameCompletion.mutex);
+	Mutex_Unlock(&GetData(device)->frameCompletion.mutex);
+	CondVar_Broadcast(&GetData(device)->frameCompletion.condition);
+}
+
+
+// Once the task has been stopped, do the teardown left by a failed callback
+static OScDev_RichError *ShutdownDetectorIfFailed(OScDev_Device *device, struct DetectorConfig *config)
+{
+	if (!HasDetectorFailed(device))
+		return OScDev_RichError_OK;
+
+	OScDev_RichError *err = ShutdownDetector(device, config); // Force re-setup next time
+	if (err)
+		OScDev_Error_Destroy(err);
+	return OScDev_Error_Create("Detector failed to read or process data");
+}
+
+
+// Let the processing thread finish with the data already read, so that it
+// does not overlap with the next acquisition. (The raw data is consumed only
+// after it has been fully processed.)
+static void WaitForRawDataDrained(OScDev_Device *device, uint32_t timeoutMs)
+{
+	uint64_t deadline = Time_GetMs() + timeoutMs;
+	while (GetData(device)->processing.thread &&
+		RingBuffer_GetSize(&GetData(device)->rawData) > 0)
+	{
+		uint64_t now = Time_GetMs();
+		if (now >= deadline)
+		{
+			OScDev_Log_Warning(device, "Timed out waiting for detector data to be processed");
+			break;
+		}
+		Event_Wait(&GetData(device)->processing.drainedEvent, (uint32_t)(deadline - now));
+	}
+}
+
+
 OScDev_RichError *StopDetector(OScDev_Device *device, struct DetectorConfig *config)
 {
 	OScDev_RichError *err;
@@ -121,13 +190,63 @@ OScDev_RichError *StopDetector(OScDev_Device *device, struct DetectorConfig *con
 	if (!config->aiTask)
 		return OScDev_RichError_OK;
 
-	err = CreateDAQmxError(DAQmxStopTask(config->aiTask));
+	err = CreateDAQmxError(GetDAQ()->StopTask(config->aiTask));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to stop detector task");
 		ShutdownDetector(device, config); // Force re-setup next time
 		return err;
 	}
+
+	err = ShutdownDetectorIfFailed(device, config);
+	if (err)
+		return err;
+
+	WaitForRawDataDrained(device, 1000);
+
+	char msg[OScDev_MAX_STR_LEN + 1];
+	uInt32 inputPeak = GetData(device)->processing.inputBufferHighWaterMark;
+	uInt32 inputSize = GetData(device)->processing.inputBufferSize;
+	snprintf(msg, OScDev_MAX_STR_LEN,
+		"Detector input buffer peak fill: %u of %u samples per channel (%.1f%%)",
+		inputPeak, inputSize, inputSize ? 100.0 * inputPeak / inputSize : 0.0);
+	OScDev_Log_Debug(device, msg);
+
+	snprintf(msg, OScDev_MAX_STR_LEN,
+		"Detector queue high-water marks: %zd of %zd chunks, %zd of %zd pixels",
+		GetData(device)->processing.chunkQueueHighWaterMark,
+		GetData(device)->processing.chunks.capacity,
+		GetData(device)->processing.rawDataHighWaterMark,
+		GetData(device)->rawData.capacity);
+	OScDev_Log_Debug(device, msg);
+
+	return OScDev_RichError_OK;
+}
+
+
+// Stop the detector immediately, in the middle of a line if necessary
+// The partial frame is discarded when the next acquisition starts.
+OScDev_RichError *AbortDetector(OScDev_Device *device, struct DetectorConfig *config)
+{
+	OScDev_RichError *err;
+	if (!config->aiTask)
+		return OScDev_RichError_OK;
+
+	err = CreateDAQmxError(GetDAQ()->TaskControl(config->aiTask, DAQmx_Val_Task_Abort));
+	if (err)
+	{
+		err = OScDev_Error_Wrap(err, "Failed to abort detector task");
+		ShutdownDetector(device, config); // Force re-setup next time
+		return err;
+	}
+
+	err = ShutdownDetectorIfFailed(device, config);
+	if (err)
+		return err;
+
+	// The data left is at most one callback's
+	WaitForRawDataDrained(device, 1000);
+
 	return OScDev_RichError_OK;
 }
 
@@ -139,7 +258,7 @@ static int32 GetAIVoltageRange(OScDev_Device *device, double *minVolts, double *
 
 	// TODO How does this relate to the setting "Input Voltage Range"?
 	// BUG: This should be AIVoltageRngs, but keeping existing behavior for now
-	int32 nierr = DAQmxGetDevAOVoltageRngs(GetData(device)->deviceName, ranges,
+	int32 nierr = GetDAQ()->GetDevAOVoltageRngs(GetData(device)->deviceName, ranges,
 		sizeof(ranges) / sizeof(float64));
 	if (nierr)
 	{
@@ -175,7 +294,7 @@ static int32 GetAIVoltageRange(OScDev_Device *device, double *minVolts, double *
 static OScDev_RichError *CreateDetectorTask(OScDev_Device *device, struct DetectorConfig *config)
 {
 	OScDev_RichError *err = OScDev_RichError_OK;
-	err = CreateDAQmxError(DAQmxCreateTask("Detector", &config->aiTask));
+	err = CreateDAQmxError(GetDAQ()->CreateTask("Detector", &config->aiTask));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to create detector task");
@@ -191,7 +310,7 @@ static OScDev_RichError *CreateDetectorTask(OScDev_Device *device, struct Detect
 	if (err)
 		goto error;
 
-	err = CreateDAQmxError(DAQmxCreateAIVoltageChan(config->aiTask,
+	err = CreateDAQmxError(GetDAQ()->CreateAIVoltageChan(config->aiTask,
 		aiPhysChans, "",
 		DAQmx_Val_Cfg_Default,
 		minVolts, maxVolts,
@@ -218,10 +337,33 @@ static OScDev_RichError *ConfigureDetectorTiming(OScDev_Device *device, struct D
 	uint32_t xOffset, yOffset, width, height;
 	OScDev_Acquisition_GetROI(acq, &xOffset, &yOffset, &width, &height);
 
-	err = CreateDAQmxError(DAQmxCfgSampClkTiming(config->aiTask,
-		"", pixelRateHz,
+	// With oversampling, acquire several samples per pixel, to be binned
+	uint32_t oversampling = GetData(device)->oversamplingFactor;
+	double sampleRateHz = pixelRateHz * oversampling;
+
+	float64 maxRateHz;
+	int32 nierr = GetNumberOfEnabledChannels(device) > 1 ?
+		GetDAQ()->GetDevAIMaxMultiChanRate(GetData(device)->deviceName, &maxRateHz) :
+		GetDAQ()->GetDevAIMaxSingleChanRate(GetData(device)->deviceName, &maxRateHz);
+	err = CreateDAQmxError(nierr);
+	if (err)
+	{
+		err = OScDev_Error_Wrap(err, "Failed to get maximum sample rate for detector");
+		return err;
+	}
+	if (sampleRateHz > maxRateHz)
+	{
+		char msg[OScDev_MAX_STR_LEN + 1];
+		snprintf(msg, OScDev_MAX_STR_LEN,
+			"Detector sample rate (%.0f Hz = %u x pixel rate) exceeds device maximum (%.0f Hz)",
+			sampleRateHz, oversampling, maxRateHz);
+		return OScDev_Error_Create(msg);
+	}
+
+	err = CreateDAQmxError(GetDAQ()->CfgSampClkTiming(config->aiTask,
+		"", sampleRateHz,
 		DAQmx_Val_Rising, DAQmx_Val_FiniteSamps,
-		width));
+		(uInt64)width * oversampling));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to configure timing for detector");
@@ -248,7 +390,7 @@ static OScDev_RichError *ConfigureDetectorTrigger(OScDev_Device *device, struct
 	strncat(triggerSource, "/PFI12",
 		sizeof(triggerSource) - strlen(triggerSource) - 1);
 
-	err = CreateDAQmxError(DAQmxCfgDigEdgeStartTrig(config->aiTask,
+	err = CreateDAQmxError(GetDAQ()->CfgDigEdgeStartTrig(config->aiTask,
 		triggerSource, DAQmx_Val_Rising));
 	if (err)
 	{
@@ -256,7 +398,7 @@ static OScDev_RichError *ConfigureDetectorTrigger(OScDev_Device *device, struct
 		return err;
 	}
 
-	err = CreateDAQmxError(DAQmxSetStartTrigRetriggerable(config->aiTask, 1));
+	err = CreateDAQmxError(GetDAQ()->SetStartTrigRetriggerable(config->aiTask, 1));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to set detector task retriggerable");
@@ -266,10 +408,122 @@ static OScDev_RichError *ConfigureDetectorTrigger(OScDev_Device *device, struct
 }
 
 
+// Scaling from volts to pixel values: pixel = volts * scale + offset
+static void GetPixelScaling(OScDev_Device *device, double *scale, double *offset)
+{
+	// TODO We need a positive offset so as not to clip the background
+	// noise
+	double offsetVolts = 1.0; // Temporary
+
+	// pixel = 65535 * (volts + offsetVolts) / inputVoltageRange
+	*scale = 65535.0 / GetData(device)->inputVoltageRange;
+	*offset = *scale * offsetVolts;
+}
+
+
+static void FreeConversionTables(OScDev_Device *device)
+{
+	for (int ch = 0; ch < MAX_PHYSICAL_CHANS; ++ch)
+	{
+		free(GetData(device)->conversionTables[ch]);
+		GetData(device)->conversionTables[ch] = NULL;
+	}
+}
+
+
+// Precompute the pixel value for every possible ADC code of the ch-th
+// enabled channel, given its scaling coefficients (volts as a polynomial in
+// the code)
+static OScDev_RichError *BuildConversionTable(OScDev_Device *device, int ch,
+	const float64 *coeffs, uint32_t numCoeffs)
+{
+	double scale, offset;
+	GetPixelScaling(device, &scale, &offset);
+
+	uint16_t *table = realloc(GetData(device)->conversionTables[ch],
+		sizeof(uint16_t) * CONVERSION_TABLE_SIZE);
+	if (!table)
+		return OScDev_Error_Create("Failed to allocate conversion table for detector");
+	GetData(device)->conversionTables[ch] = table;
+	BuildConversionTableI16(coeffs, numCoeffs, scale, offset, table);
+	return OScDev_RichError_OK;
+}
+
+
+// Build the conversion table of each enabled channel, using the device
+// scaling coefficients for that channel
+static OScDev_RichError *BuildConversionTables(OScDev_Device *device, struct DetectorConfig *config)
+{
+	OScDev_RichError *err;
+
+	int ch = 0; // Index among enabled channels
+	for (int i = 0; i < MAX_PHYSICAL_CHANS; ++i)
+	{
+		if (!GetData(device)->channelEnabled[i])
+			continue;
+
+		// The virtual channel name is the physical channel name, because we
+		// did not assign a name when creating the channels
+		char chan[64];
+		GetAIPhysChan(device, i, chan, sizeof(chan));
+
+		float64 coeffs[4] = { 0.0 };
+		err = CreateDAQmxError(GetDAQ()->GetAIDevScalingCoeff(config->aiTask,
+			chan, coeffs, sizeof(coeffs) / sizeof(float64)));
+		if (err)
+		{
+			err = OScDev_Error_Wrap(err, "Failed to get scaling coefficients for detector");
+			return err;
+		}
+
+		err = BuildConversionTable(device, ch, coeffs, sizeof(coeffs) / sizeof(float64));
+		if (err)
+			return err;
+		++ch;
+	}
+
+	// Free the tables for unused channels
+	for (; ch < MAX_PHYSICAL_CHANS; ++ch)
+	{
+		free(GetData(device)->conversionTables[ch]);
+		GetData(device)->conversionTables[ch] = NULL;
+	}
+
+	return OScDev_RichError_OK;
+}
+
+
+// Build conversion tables for the enabled channels without a DAQmx task,
+// assuming the 16-bit codes span the input voltage range linearly
+// Used by the detector benchmark (see DetectorBenchmark.c).
+OScDev_RichError *BuildNominalConversionTables(OScDev_Device *device)
+{
+	OScDev_RichError *err;
+	float64 coeffs[2] = { 0.0, GetData(device)->inputVoltageRange / 32768.0 };
+
+	int numChannels = GetNumberOfEnabledChannels(device);
+	for (int ch = 0; ch < MAX_PHYSICAL_CHANS; ++ch)
+	{
+		if (ch < numChannels)
+		{
+			err = BuildConversionTable(device, ch, coeffs, 2);
+			if (err)
+				return err;
+		}
+		else
+		{
+			free(GetData(device)->conversionTables[ch]);
+			GetData(device)->conversionTables[ch] = NULL;
+		}
+	}
+	return OScDev_RichError_OK;
+}
+
+
 static OScDev_RichError *UnconfigureDetectorCallback(OScDev_Device *device, struct DetectorConfig *config)
 {
 	OScDev_RichError *err;
-	err = CreateDAQmxError(DAQmxRegisterEveryNSamplesEvent(config->aiTask,
+	err = CreateDAQmxError(GetDAQ()->RegisterEveryNSamplesEvent(config->aiTask,
 		DAQmx_Val_Acquired_Into_Buffer,
 		0, 0, NULL, NULL));
 	if (err)
@@ -281,6 +535,169 @@ static OScDev_RichError *UnconfigureDetectorCallback(OScDev_Device *device, stru
 }
 
 
+// Allocate the buffers used to process detector data for frames of width x
+// height pixels, read from a DAQmx input buffer of bufferSize samples per
+// channel, using the current settings, and select the conversion kernel.
+// Also used by the detector benchmark (see DetectorBenchmark.c).
+OScDev_RichError *AllocateProcessingBuffers(OScDev_Device *device,
+	uint32_t width, uint32_t height, size_t bufferSize)
+{
+	// The buffers are shared with the processing thread; it is restarted by
+	// SetUpDetector().
+	StopProcessingThread(device);
+
+	uint32_t oversampling = GetData(device)->oversamplingFactor;
+	uint32_t pixelsPerLine = width;
+	size_t pixelsPerFrame = (size_t)pixelsPerLine * height;
+	uint32_t numChannels = GetNumberOfEnabledChannels(device);
+
+	// Allocate the ring buffer into which we read data. Set it to be large
+	// enough to read all available data from the input buffer in one go.
+	// Its elements are pixels (oversampling scans of one sample for each
+	// channel).
+	// Because processing is asynchronous, leave room for the processing
+	// thread to fall behind by another full input buffer.
+	bool binary = GetData(device)->readBinarySamples;
+	GetData(device)->rawDataIsBinary = binary;
+	GetData(device)->rawDataOversampling = oversampling;
+	GetData(device)->rawDataBidirectional = GetData(device)->bidirectionalScan;
+	size_t scanSize = (binary ? sizeof(int16) : sizeof(float64)) * numChannels;
+	if (!RingBuffer_Allocate(&GetData(device)->rawData,
+		2 * bufferSize / oversampling, scanSize * oversampling))
+		return OScDev_Error_Create("Failed to allocate raw sample buffer for detector");
+	size_t bytes = GetData(device)->rawData.capacity * GetData(device)->rawData.elementSize;
+
+	free(GetData(device)->binnedSamples);
+	GetData(device)->binnedSamples = NULL;
+	if (oversampling > 1)
+	{
+		GetData(device)->binnedSamples = malloc(BIN_BLOCK_PIXELS * scanSize);
+		if (!GetData(device)->binnedSamples)
+			return OScDev_Error_Create("Failed to allocate binning buffer for detector");
+		bytes += BIN_BLOCK_PIXELS * scanSize;
+	}
+
+	// Each callback queues at most one chunk per segment of the ring buffer,
+	// and (except at the end of the storage) each chunk is at least as large
+	// as the callback interval.
+	size_t maxChunks = 2 * (GetData(device)->rawData.capacity / pixelsPerLine + 1);
+	if (!RingBuffer_Allocate(&GetData(device)->processing.chunks, maxChunks,
+		sizeof(struct RawDataChunk)))
+		return OScDev_Error_Create("Failed to allocate chunk queue for detector");
+	bytes += GetData(device)->processing.chunks.capacity * sizeof(struct RawDataChunk);
+	GetData(device)->processing.chunkQueueHighWaterMark = 0;
+	GetData(device)->processing.rawDataHighWaterMark = 0;
+	GetData(device)->processing.inputBufferHighWaterMark = 0;
+	GetData(device)->processing.inputBufferSize = (uInt32)bufferSize;
+
+	// Allocate the frame buffer sets for the enabled channels, and free the
+	// buffers for unused sets and channels
+	uint32_t numSets = GetData(device)->numFrameSets;
+	for (uint32_t set = 0; set < MAX_FRAME_SETS; ++set)
+	{
+		for (uint32_t ch = 0; ch < MAX_PHYSICAL_CHANS; ++ch)
+		{
+			if (set < numSets && ch < numChannels)
+			{
+				uint16_t *buffer = realloc(GetData(device)->frameBuffers[set][ch],
+					sizeof(uint16_t) * pixelsPerFrame);
+				if (!buffer)
+					return OScDev_Error_Create("Failed to allocate frame buffers for detector");
+				GetData(device)->frameBuffers[set][ch] = buffer;
+				bytes += sizeof(uint16_t) * pixelsPerFrame;
+			}
+			else
+			{
+				free(GetData(device)->frameBuffers[set][ch]);
+				GetData(device)->frameBuffers[set][ch] = NULL;
+			}
+		}
+	}
+
+	// All sets start out free
+	if (!RingBuffer_Allocate(&GetData(device)->framePool.free, numSets, sizeof(uint32_t)) ||
+		!RingBuffer_Allocate(&GetData(device)->framePool.filled, numSets, sizeof(uint32_t)))
+		return OScDev_Error_Create("Failed to allocate frame pool for detector");
+	for (uint32_t set = 0; set < numSets; ++set)
+		RingBuffer_Push(&GetData(device)->framePool.free, &set);
+	GetData(device)->framePool.numSets = numSets;
+	GetData(device)->framePool.current = NO_FRAME_SET;
+	GetData(device)->framePool.dropping = false;
+
+	// Allocate the frame averaging accumulators for the enabled channels
+	enum FrameAveragingMode averagingMode = GetData(device)->averagingMode;
+	size_t accumulatorSize = 0;
+	if (averagingMode == FrameAveraging_Exponential)
+		accumulatorSize = sizeof(float) * pixelsPerFrame;
+	else if (averagingMode != FrameAveraging_Off)
+		accumulatorSize = sizeof(uint32_t) * pixelsPerFrame;
+	for (uint32_t ch = 0; ch < MAX_PHYSICAL_CHANS; ++ch)
+	{
+		if (ch < numChannels && accumulatorSize > 0)
+		{
+			void *acc = realloc(GetData(device)->averaging.accumulators[ch], accumulatorSize);
+			if (!acc)
+				return OScDev_Error_Create("Failed to allocate frame averaging buffers for detector");
+			GetData(device)->averaging.accumulators[ch] = acc;
+			bytes += accumulatorSize;
+		}
+		else
+		{
+			free(GetData(device)->averaging.accumulators[ch]);
+			GetData(device)->averaging.accumulators[ch] = NULL;
+		}
+	}
+	GetData(device)->averaging.mode = averagingMode;
+	GetData(device)->averaging.frames = GetData(device)->framesToAverage;
+	ResetFrameAveraging(device);
+
+	// Allocate the line averaging accumulators (one line per channel)
+	uint32_t linesToAverage = GetData(device)->linesToAverage;
+	for (uint32_t ch = 0; ch < MAX_PHYSICAL_CHANS; ++ch)
+	{
+		if (ch < numChannels && linesToAverage > 1)
+		{
+			uint32_t *acc = realloc(GetData(device)->lineAveraging.accumulators[ch],
+				sizeof(uint32_t) * pixelsPerLine);
+			if (!acc)
+				return OScDev_Error_Create("Failed to allocate line averaging buffers for detector");
+			GetData(device)->lineAveraging.accumulators[ch] = acc;
+			bytes += sizeof(uint32_t) * pixelsPerLine;
+		}
+		else
+		{
+			free(GetData(device)->lineAveraging.accumulators[ch]);
+			GetData(device)->lineAveraging.accumulators[ch] = NULL;
+		}
+	}
+	GetData(device)->lineAveraging.lines = linesToAverage;
+	GetData(device)->lineAveraging.repeat = 0;
+	GetData(device)->lineAveraging.pixelsInScan = 0;
+
+	// The conversion tables for binary samples depend on the DAQmx task, so
+	// are built separately
+	if (binary)
+	{
+		GetData(device)->convertBinarySamples = SelectConversionKernelI16(
+			numChannels, &GetData(device)->convertSamplesName);
+	}
+	else
+	{
+		FreeConversionTables(device);
+		GetData(device)->convertSamples = SelectConversionKernelF64(
+			numChannels, &GetData(device)->convertSamplesName);
+	}
+	GetData(device)->processing.bufferBytes = bytes;
+
+	char msg[OScDev_MAX_STR_LEN + 1];
+	snprintf(msg, sizeof(msg) - 1, "Using %s sample conversion (%zu bytes of buffers)",
+		GetData(device)->convertSamplesName, bytes);
+	OScDev_Log_Debug(device, msg);
+
+	return OScDev_RichError_OK;
+}
+
+
 static OScDev_RichError *ConfigureDetectorCallback(OScDev_Device *device, struct DetectorConfig *config, OScDev_Acquisition *acq)
 {
 	uint32_t xOffset, yOffset, width, height;
@@ -293,68 +710,71 @@ static OScDev_RichError *ConfigureDetectorCallback(OScDev_Device *device, struct
 	err = UnconfigureDetectorCallback(device, config);
 	if (err)
 		return err;
-		
-
-	// TODO: It probably makes sense to scale the buffer based on the time
-	// duration of data it holds (e.g. 500 ms), rather than the number of
-	// lines. We could still provide a user-settable scaling factor.
 
+	uint32_t oversampling = GetData(device)->oversamplingFactor;
 	uint32_t pixelsPerLine = width;
-	uint32_t pixelsPerFrame = pixelsPerLine * height;
-	uint32_t samplesPerChanPerLine = pixelsPerLine;
+	uint32_t samplesPerChanPerLine = pixelsPerLine * oversampling;
 	uint32_t numChannels = GetNumberOfEnabledChannels(device);
-	size_t bufferSize = GetData(device)->numLinesToBuffer *
-		samplesPerChanPerLine *
-		numChannels;
+
+	uint32_t linesPerCallback = ChooseLinesPerCallback(device, acq);
+	uint32_t samplesPerChanPerCallback = linesPerCallback * samplesPerChanPerLine;
+
+	// Size the input buffer to hold the requested duration of data. It must
+	// also hold at least two callbacks' worth of data and (to keep DAQmx
+	// happy) be a whole multiple of the callback interval.
+	double linePeriodMs = GetLinePeriodMs(device, acq);
+	uint32_t numLinesToBuffer = (uint32_t)ceil(
+		GetData(device)->acqBufferDurationMs / linePeriodMs);
+	if (numLinesToBuffer < 2 * linesPerCallback)
+		numLinesToBuffer = 2 * linesPerCallback;
+	numLinesToBuffer = (numLinesToBuffer + linesPerCallback - 1) /
+		linesPerCallback * linesPerCallback;
+	size_t bufferSize = (size_t)numLinesToBuffer * samplesPerChanPerLine; // Per channel
 
 	char msg[1024];
-	snprintf(msg, sizeof(msg) - 1, "Using DAQmx input buffer of size %zd", bufferSize);
+	snprintf(msg, sizeof(msg) - 1,
+		"Using DAQmx input buffer of %zd samples per channel x %u channels (%u lines; %.1f ms)",
+		bufferSize, numChannels, numLinesToBuffer, numLinesToBuffer * linePeriodMs);
 	OScDev_Log_Debug(device, msg);
 
-	err = CreateDAQmxError(DAQmxCfgInputBuffer(config->aiTask, (uInt32)bufferSize));
+	err = CreateDAQmxError(GetDAQ()->CfgInputBuffer(config->aiTask, (uInt32)bufferSize));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to configure input buffer for detector");
 		return err;
 	}
 
-	// Allocate buffer into which we read data. Set it to be large enough
-	// to read all available data from the input buffer in one go.
-	GetData(device)->rawDataCapacity = bufferSize;
-	GetData(device)->rawDataSize = 0;
-	GetData(device)->rawDataBuffer = realloc(GetData(device)->rawDataBuffer,
-		sizeof(float64) * GetData(device)->rawDataCapacity);
-
-	// Allocate frame buffers for the enabled channels
-	for (uint32_t ch = 0; ch < numChannels; ++ch)
-	{
-		GetData(device)->frameBuffers[ch] = realloc(
-			GetData(device)->frameBuffers[ch],
-			sizeof(uint16_t) * pixelsPerFrame);
-	}
-	// Free the frame buffers for unused channels
-	for (uint32_t ch = numChannels; ch < MAX_PHYSICAL_CHANS; ++ch)
+	GetData(device)->frameTiming.sampleRateHz =
+		OScDev_Acquisition_GetPixelRate(acq) * oversampling;
+	err = AllocateProcessingBuffers(device, width, height, bufferSize);
+	if (err)
+		return err;
+	if (GetData(device)->rawDataIsBinary)
 	{
-		free(GetData(device)->frameBuffers[ch]);
-		GetData(device)->frameBuffers[ch] = NULL;
+		err = BuildConversionTables(device, config);
+		if (err)
+			return err;
 	}
 
 	// Set DAQmxRead*() with DAQmx_Val_Auto to immediately return all
 	// available samples instead of waiting for the requested number of
 	// samples to become available.
-	err = CreateDAQmxError(DAQmxSetReadReadAllAvailSamp(config->aiTask, TRUE));
+	err = CreateDAQmxError(GetDAQ()->SetReadReadAllAvailSamp(config->aiTask, TRUE));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to set the Read All Available Samples property for the detector task");
 		return err;
 	}
 
-	// TODO: It probably makes sense to scale the callback frequency so that
-	// it is called at roughly 10 Hz. For now it is called once per line.
+	snprintf(msg, sizeof(msg) - 1,
+		"Detector callback every %u lines (%u samples per channel; %.2f ms)",
+		linesPerCallback, samplesPerChanPerCallback,
+		linesPerCallback * linePeriodMs);
+	OScDev_Log_Debug(device, msg);
 
-	err = CreateDAQmxError(DAQmxRegisterEveryNSamplesEvent(config->aiTask,
+	err = CreateDAQmxError(GetDAQ()->RegisterEveryNSamplesEvent(config->aiTask,
 		DAQmx_Val_Acquired_Into_Buffer,
-		samplesPerChanPerLine,
+		samplesPerChanPerCallback,
 		0, DetectorDataCallback, device));
 	if (err)
 	{
@@ -367,7 +787,69 @@ static OScDev_RichError *ConfigureDetectorCallback(OScDev_Device *device, struct
 }
 
 
-static int32 DetectorDataCallback(TaskHandle taskHandle,
+// Read up to count scans into dest, which has room for capacity pixels
+static int32 ReadRawSamples(OScDev_Device *device, TaskHandle taskHandle,
+	uInt32 count, void *dest, size_t capacity, int32 *scansRead)
+{
+	uint32_t numChannels = GetNumberOfEnabledChannels(device);
+	uInt32 arraySize = (uInt32)(capacity *
+		GetData(device)->rawDataOversampling * numChannels);
+
+	if (GetData(device)->rawDataIsBinary)
+	{
+		// Raw ADC codes: a quarter of the memory traffic of float64, and
+		// users get access to the uncalibrated values
+		return GetDAQ()->ReadBinaryI16(taskHandle, count, 0.0,
+			DAQmx_Val_GroupByScanNumber, (int16 *)dest, arraySize,
+			scansRead, NULL);
+	}
+	return GetDAQ()->ReadAnalogF64(taskHandle, count, 0.0,
+		DAQmx_Val_GroupByScanNumber, (float64 *)dest, arraySize,
+		scansRead, NULL);
+}
+
+
+// Each line (including line delay and retrace) is clocked at the pixel rate;
+// the detector is retriggered for every line
+static double GetLinePeriodMs(OScDev_Device *device, OScDev_Acquisition *acq)
+{
+	uint32_t xOffset, yOffset, width, height;
+	OScDev_Acquisition_GetROI(acq, &xOffset, &yOffset, &width, &height);
+
+	double pixelRateHz = OScDev_Acquisition_GetPixelRate(acq);
+	uint32_t elementsPerLine = GetElementsPerLine(device, width);
+	return 1e3 * elementsPerLine / pixelRateHz;
+}
+
+
+// Choose the number of lines acquired between callbacks, so that callbacks
+// occur at roughly the requested interval. It is always a divisor of the
+// number of lines scanned per frame, so that the end of each frame coincides
+// with a callback.
+static uint32_t ChooseLinesPerCallback(OScDev_Device *device, OScDev_Acquisition *acq)
+{
+	uint32_t xOffset, yOffset, width, height;
+	OScDev_Acquisition_GetROI(acq, &xOffset, &yOffset, &width, &height);
+	uint32_t scanLines = GetScanLinesPerFrame(device, height);
+
+	uint32_t intervalMs = GetData(device)->callbackIntervalMs;
+	if (intervalMs == 0)
+		return 1;
+
+	uint32_t target = (uint32_t)(intervalMs / GetLinePeriodMs(device, acq) + 0.5);
+	if (target < 1)
+		target = 1;
+	if (target > scanLines)
+		target = scanLines;
+
+	uint32_t lines = target;
+	while (scanLines % lines != 0)
+		--lines;
+	return lines;
+}
+
+
+static int32 ReadDetectorData(TaskHandle taskHandle,
 	int32 everyNsamplesEventType, uInt32 nSamples, void* callbackData)
 {
 	OScDev_Error errCode;
@@ -377,143 +859,741 @@ static int32 DetectorDataCallback(TaskHandle taskHandle,
 		return OScDev_OK;
 	if (everyNsamplesEventType != DAQmx_Val_Acquired_Into_Buffer)
 		return OScDev_OK;
+	if (HasDetectorFailed(device))
+		return OScDev_OK;
 
-	char msg[1024];
-	snprintf(msg, sizeof(msg) - 1, "Detector callback (%d samples)", nSamples);
-	OScDev_Log_Debug(device, msg);
-
-	uint32_t numChannels = GetNumberOfEnabledChannels(device);
-
-	OScDev_RichError *err;
+	// Keep this callback short: only drain DAQmx into the ring buffer and
+	// queue the data for the processing thread (no logging unless error).
 
-	// TODO We should use DAQmxReadBinaryU16, so that users have access to raw
-	// ADC values. This is often critical for correct interpretation or
-	// processing of the data.
-
-	// Read all available samples without waiting (because we have set the
-	// Read All Available Samples property on the task)
-	int32 samplesPerChanRead;
-	errCode = DAQmxReadAnalogF64(taskHandle,
-		DAQmx_Val_Auto,
-		0.0,
-		DAQmx_Val_GroupByScanNumber,
-		GetData(device)->rawDataBuffer + GetData(device)->rawDataSize,
-		(uInt32)(GetData(device)->rawDataCapacity - GetData(device)->rawDataSize),
-		&samplesPerChanRead,
-		NULL);
-	if (errCode == DAQmxErrorTimeoutExceeded)
-	{
-		OScDev_Log_Error(device, "Error: DAQ read data timeout");
-		return OScDev_OK;
-	}
+	OScDev_RichError *err = OScDev_RichError_OK;
 
+	uInt32 available;
+	errCode = GetDAQ()->GetReadAvailSampPerChan(taskHandle, &available);
 	if (errCode)
 	{
 		err = CreateDAQmxError(errCode);
-		err = OScDev_Error_Wrap(err, "Failed to read detector samples");
+		err = OScDev_Error_Wrap(err, "Failed to get available detector samples");
 		goto error;
 	}
-	
-	if (samplesPerChanRead == 0)
+
+	if (available == 0)
 	{
 		OScDev_Log_Error(device, "Error: DAQ failed to read any sample");
 		return OScDev_OK;
 	}
 
-	GetData(device)->rawDataSize += samplesPerChanRead * numChannels;
+	if (available > GetData(device)->processing.inputBufferHighWaterMark)
+		GetData(device)->processing.inputBufferHighWaterMark = available;
+
+	// Read all available samples without waiting. The free space in the ring
+	// buffer may wrap around its end, in which case we read in two parts,
+	// queued as separate chunks.
+	// With oversampling, read only whole pixels; any remaining scans are
+	// read by the next callback.
+	struct RingBuffer *ring = &GetData(device)->rawData;
+	struct RingBuffer *chunks = &GetData(device)->processing.chunks;
+	uint32_t oversampling = GetData(device)->rawDataOversampling;
+	int64_t totalScansRead = 0;
+	while (available >= oversampling)
+	{
+		void *dest;
+		size_t writable = RingBuffer_GetWritable(ring, &dest);
+		if (writable == 0)
+		{
+			OScDev_Log_Error(device, "Error: Raw detector sample buffer is full");
+			errCode = -1;
+			goto error;
+		}
+
+		uInt32 pixels = available / oversampling;
+		if (pixels > writable)
+			pixels = (uInt32)writable;
+
+		// The read position and acquired count let the processing thread
+		// timestamp frames in samples and detect lost data
+		uInt64 readPos, acquired;
+		errCode = GetDAQ()->GetReadCurrReadPos(taskHandle, &readPos);
+		if (!errCode)
+			errCode = GetDAQ()->GetReadTotalSampPerChanAcquired(taskHandle, &acquired);
+		if (errCode)
+		{
+			err = CreateDAQmxError(errCode);
+			err = OScDev_Error_Wrap(err, "Failed to get detector read position");
+			goto error;
+		}
+
+		int32 scansRead;
+		errCode = ReadRawSamples(device, taskHandle, pixels * oversampling,
+			dest, writable, &scansRead);
+		int64_t readTime = Time_GetTicks();
+		if (errCode == DAQmxErrorTimeoutExceeded)
+		{
+			OScDev_Log_Error(device, "Error: DAQ read data timeout");
+			return OScDev_OK;
+		}
+		if (errCode)
+		{
+			err = CreateDAQmxError(errCode);
+			err = OScDev_Error_Wrap(err, "Failed to read detector samples");
+			goto error;
+		}
+		if (scansRead == 0)
+			break;
+		if (scansRead % oversampling != 0)
+		{
+			OScDev_Log_Error(device, "Error: DAQ read a partial oversampled pixel");
+			errCode = -1;
+			goto error;
+		}
+
+		struct RawDataChunk chunk;
+		chunk.firstPixel = ring->writeCursor;
+		chunk.numPixels = scansRead / oversampling;
+		chunk.readTime = readTime;
+		chunk.firstSample = readPos;
+		chunk.samplesAcquired = acquired;
+		RingBuffer_Produce(ring, chunk.numPixels);
+		if (!RingBuffer_Push(chunks, &chunk))
+		{
+			OScDev_Log_Error(device, "Error: Detector chunk queue is full");
+			errCode = -1;
+			goto error;
+		}
+		available -= scansRead;
+		totalScansRead += scansRead;
+	}
+
+	size_t queuedChunks = RingBuffer_GetSize(chunks);
+	size_t queuedPixels = RingBuffer_GetSize(ring);
+	if (queuedChunks > GetData(device)->processing.chunkQueueHighWaterMark)
+		GetData(device)->processing.chunkQueueHighWaterMark = queuedChunks;
+	if (queuedPixels > GetData(device)->processing.rawDataHighWaterMark)
+		GetData(device)->processing.rawDataHighWaterMark = queuedPixels;
+
+	int64_t now = Time_GetTicks();
+	Counter_Add(&GetData(device)->counters.callbacks, 1);
+	Counter_Add(&GetData(device)->counters.samplesRead, totalScansRead);
+	if (Counter_Load(&GetData(device)->counters.firstCallbackTime) == 0)
+		Counter_Store(&GetData(device)->counters.firstCallbackTime, now);
+	Counter_Store(&GetData(device)->counters.lastCallbackTime, now);
+	Counter_Max(&GetData(device)->counters.rawDataPeakPixels, queuedPixels);
+
+	Event_Set(&GetData(device)->processing.wakeEvent);
 
-	errCode = HandleRawData(device);
-	if (errCode)
-		goto error;
-		
 	return OScDev_OK;
 
 error:
-	if (GetData(device)->detectorConfig.aiTask)
-		ShutdownDetector(device, &GetData(device)->detectorConfig);
+	if (err)
+	{
+		char msg[OScDev_MAX_STR_LEN + 1];
+		OScDev_Error_FormatRecursive(err, msg, sizeof(msg));
+		OScDev_Log_Error(device, msg);
+		OScDev_Error_Destroy(err);
+	}
+
+	// Stopping the task and the processing thread is left to the
+	// acquisition thread, which may be doing so already
+	SetDetectorFailed(device);
 	return errCode;
 }
 
 
-// Process data in rawDataBuffer and place the result into frameBuffers
-static int32 HandleRawData(OScDev_Device *device)
+static int32 DetectorDataCallback(TaskHandle taskHandle,
+	int32 everyNsamplesEventType, uInt32 nSamples, void* callbackData)
 {
-	// Some amount of data (rawDataSize samples) is in the rawDataBuffer.
-	// Since we have C channels and are binning every B samples per channel,
-	// we can only process a multiple of (C * B) samples at a time. We
-	// shift any remaining samples to the front of rawDataBuffer so that they
-	// can be handled when more data is available.
+	TRACE_THREAD_NAME("DAQmx Callback");
+	TRACE_BEGIN("DetectorDataCallback");
+	int32 ret = ReadDetectorData(taskHandle, everyNsamplesEventType, nSamples, callbackData);
+	TRACE_END("DetectorDataCallback");
+	return ret;
+}
+
 
-	size_t availableSamples = GetData(device)->rawDataSize;
+// Convert numPixels pixels (each of rawDataOversampling scans) at src and
+// write them to the frame buffer set being filled, starting at pixelIndex
+static void ConvertRawSamples(OScDev_Device *device, const void *src, size_t numPixels,
+	size_t pixelIndex)
+{
 	uint32_t numChannels = GetNumberOfEnabledChannels(device);
-	size_t leftoverSamples = availableSamples % numChannels;
-	size_t samplesToProcess = availableSamples - leftoverSamples;
-	size_t pixelsToProducePerChan = samplesToProcess / numChannels;
+	uint32_t oversampling = GetData(device)->rawDataOversampling;
 
-	double inputVoltageRange = GetData(device)->inputVoltageRange;
+	uint32_t set = GetData(device)->framePool.current;
+	uint16_t *dest[MAX_PHYSICAL_CHANS];
+	for (uint32_t ch = 0; ch < numChannels; ++ch)
+		dest[ch] = GetData(device)->frameBuffers[set][ch] + pixelIndex;
 
-	float64 *rawDataBuffer = GetData(device)->rawDataBuffer;
+	if (GetData(device)->rawDataIsBinary)
+	{
+		const int16_t *samples = (const int16_t *)src;
+		const uint16_t *const *tables =
+			(const uint16_t *const *)GetData(device)->conversionTables;
+		if (oversampling == 1)
+		{
+			GetData(device)->convertBinarySamples(samples,
+				numPixels, numChannels, tables, dest);
+		}
+		else
+		{
+			// Bin in blocks that stay in cache between the two passes
+			int16_t *binned = GetData(device)->binnedSamples;
+			for (size_t p = 0; p < numPixels; p += BIN_BLOCK_PIXELS)
+			{
+				size_t n = numPixels - p < BIN_BLOCK_PIXELS ? numPixels - p : BIN_BLOCK_PIXELS;
+				BinSamplesI16(samples + p * oversampling * numChannels, n,
+					numChannels, oversampling, binned);
+				GetData(device)->convertBinarySamples(binned, n, numChannels,
+					tables, dest);
+				for (uint32_t ch = 0; ch < numChannels; ++ch)
+					dest[ch] += n;
+			}
+		}
+	}
+	else
+	{
+		double scale, offset;
+		GetPixelScaling(device, &scale, &offset);
+		const double *samples = (const double *)src;
+		if (oversampling == 1)
+		{
+			GetData(device)->convertSamples(samples,
+				numPixels, numChannels, scale, offset, dest);
+		}
+		else
+		{
+			// Binning sums the samples, so fold the averaging into the scale
+			double *binned = GetData(device)->binnedSamples;
+			for (size_t p = 0; p < numPixels; p += BIN_BLOCK_PIXELS)
+			{
+				size_t n = numPixels - p < BIN_BLOCK_PIXELS ? numPixels - p : BIN_BLOCK_PIXELS;
+				BinSamplesF64(samples + p * oversampling * numChannels, n,
+					numChannels, oversampling, binned);
+				GetData(device)->convertSamples(binned, n, numChannels,
+					scale / oversampling, offset, dest);
+				for (uint32_t ch = 0; ch < numChannels; ++ch)
+					dest[ch] += n;
+			}
+		}
+	}
+}
 
-	// Given 2 channels and 2 samples per pixel per channel, rawDataBuffer
-	// contains data in the following order:
-	// | ch0_samp0 ch1_samp0 ch0_samp1 ch1_samp1 | ch0_samp0 ...
-	// We need to transfer this into per-channel frame buffers.
 
-	// Process raw data and fill in frame buffers
-	for (size_t p = 0; p < pixelsToProducePerChan; ++p)
+// Flip the given line of the frame buffers being filled
+static void ReverseLine(OScDev_Device *device, size_t line)
+{
+	uint32_t numChannels = GetNumberOfEnabledChannels(device);
+	uint32_t pixelsPerLine = GetData(device)->configuredRasterWidth;
+	uint32_t set = GetData(device)->framePool.current;
+
+	for (uint32_t ch = 0; ch < numChannels; ++ch)
 	{
-		size_t rawPixelStart = p * numChannels;
-		size_t pixelIndex = GetData(device)->framePixelsFilled++;
+		uint16_t *lo = GetData(device)->frameBuffers[set][ch] + line * pixelsPerLine;
+		uint16_t *hi = lo + pixelsPerLine - 1;
+		while (lo < hi)
+		{
+			uint16_t tmp = *lo;
+			*lo++ = *hi;
+			*hi-- = tmp;
+		}
+	}
+}
+
+
+// In a bidirectional scan, odd lines arrive in reverse order. Flip each of
+// them in the frame buffers once it has been completed by the pixels
+// [prevFilled, filled), while it is still in cache.
+static void ReverseOddLines(OScDev_Device *device, size_t prevFilled, size_t filled)
+{
+	uint32_t pixelsPerLine = GetData(device)->configuredRasterWidth;
+
+	for (size_t line = prevFilled / pixelsPerLine;
+		(line + 1) * pixelsPerLine <= filled; ++line)
+	{
+		if (line % 2 == 1)
+			ReverseLine(device, line);
+	}
+}
 
-		for (size_t ch = 0; ch < numChannels; ++ch)
+
+// With line averaging, convert the pixels at src that belong to the scan of
+// the current line being acquired. Each completed scan is added to the line
+// accumulators, and after the last scan of the line its mean is stored in the
+// frame buffers, so that only whole, averaged lines are counted as filled.
+// The scans are converted in place of the line (which is overwritten by each
+// scan), so no more memory is needed than for a single line.
+// Returns the number of pixels consumed, which is at most the remainder of
+// the scan.
+static size_t ReduceLineScans(OScDev_Device *device, const void *src, size_t numPixels)
+{
+	uint32_t pixelsPerLine = GetData(device)->configuredRasterWidth;
+	uint32_t lines = GetData(device)->lineAveraging.lines;
+	size_t lineStart = GetData(device)->framePixelsFilled;
+	bool dropping = GetData(device)->framePool.dropping;
+
+	size_t scanned = GetData(device)->lineAveraging.pixelsInScan;
+	size_t n = pixelsPerLine - scanned;
+	if (n > numPixels)
+		n = numPixels;
+	if (!dropping)
+		ConvertRawSamples(device, src, n, lineStart + scanned);
+	scanned += n;
+	if (scanned < pixelsPerLine)
+	{
+		GetData(device)->lineAveraging.pixelsInScan = scanned;
+		return n;
+	}
+	GetData(device)->lineAveraging.pixelsInScan = 0;
+
+	uint32_t repeat = GetData(device)->lineAveraging.repeat;
+	if (!dropping)
+	{
+		// In a bidirectional scan, the direction alternates with every scan
+		size_t line = lineStart / pixelsPerLine;
+		if (GetData(device)->rawDataBidirectional && (line * lines + repeat) % 2 == 1)
+			ReverseLine(device, line);
+
+		uint32_t numChannels = GetNumberOfEnabledChannels(device);
+		uint32_t set = GetData(device)->framePool.current;
+		for (uint32_t ch = 0; ch < numChannels; ++ch)
 		{
-			size_t rawChannelStart = rawPixelStart + ch;
+			uint16_t *scan = GetData(device)->frameBuffers[set][ch] + lineStart;
+			uint32_t *acc = GetData(device)->lineAveraging.accumulators[ch];
+			if (repeat == 0)
+				memset(acc, 0, sizeof(uint32_t) * pixelsPerLine);
+			AccumulateU16(scan, pixelsPerLine, acc);
+			if (repeat == lines - 1)
+				StoreAccumulatorU32(acc, pixelsPerLine, lines, scan);
+		}
+	}
 
-			double volts = rawDataBuffer[rawChannelStart];
+	if (++repeat < lines)
+	{
+		GetData(device)->lineAveraging.repeat = repeat;
+		return n;
+	}
+	GetData(device)->lineAveraging.repeat = 0;
+	GetData(device)->framePixelsFilled += pixelsPerLine;
+	return n;
+}
 
-			// TODO We need a positive offset so as not to clip the background
-			// noise
-			double offsetVolts = 1.0; // Temporary
 
-			double dpixel = 65535.0 * (volts + offsetVolts) / inputVoltageRange;
-			if (dpixel < 0) {
-				dpixel = 0.0;
-			}
-			if (dpixel > 65535.0) {
-				dpixel = 65535.0;
-			}
-			uint16_t pixel = (uint16_t)dpixel;
+// Give up on any partially filled frame (e.g. after a timeout) before
+// starting a new one
+// Must not be called while the processing thread may be handling data.
+void DiscardPartialFrame(OScDev_Device *device)
+{
+	if (GetData(device)->framePool.current != NO_FRAME_SET)
+	{
+		ReleaseFrameSet(device, GetData(device)->framePool.current);
+		GetData(device)->framePool.current = NO_FRAME_SET;
+	}
+	GetData(device)->framePool.dropping = false;
+	GetData(device)->framePixelsFilled = 0;
+	GetData(device)->lineAveraging.repeat = 0;
+	GetData(device)->lineAveraging.pixelsInScan = 0;
+	GetData(device)->averaging.groupFrames = 0;
+	GetData(device)->averaging.pixelsAccumulated = 0;
+}
+
+
+// Start frame averaging afresh, at the start of an acquisition
+// Must not be called while the processing thread may be handling data.
+void ResetFrameAveraging(OScDev_Device *device)
+{
+	GetData(device)->averaging.groupFrames = 0;
+	GetData(device)->averaging.pixelsAccumulated = 0;
+	GetData(device)->averaging.initialized = false;
+}
+
+
+// Number of frames scanned for every frame delivered
+uint32_t GetScansPerFrame(OScDev_Device *device)
+{
+	switch (GetData(device)->averagingMode)
+	{
+	case FrameAveraging_Mean:
+	case FrameAveraging_Sum:
+		return GetData(device)->framesToAverage;
+	default:
+		return 1;
+	}
+}
+
+
+// Add the pixels of the current frame that have been converted since the
+// last call to the averaging accumulators, while they are still in cache
+static void AccumulateFrameData(OScDev_Device *device)
+{
+	enum FrameAveragingMode mode = GetData(device)->averaging.mode;
+	if (mode == FrameAveraging_Off)
+		return;
+
+	// Odd lines of a bidirectional scan are only final once reversed
+	size_t start = GetData(device)->averaging.pixelsAccumulated;
+	size_t end = GetData(device)->framePixelsFilled;
+	if (GetData(device)->rawDataBidirectional)
+	{
+		uint32_t pixelsPerLine = GetData(device)->configuredRasterWidth;
+		end = end / pixelsPerLine * pixelsPerLine;
+	}
+	if (end <= start)
+		return;
+
+	uint32_t numChannels = GetNumberOfEnabledChannels(device);
+	uint32_t set = GetData(device)->framePool.current;
+	for (uint32_t ch = 0; ch < numChannels; ++ch)
+	{
+		const uint16_t *src = GetData(device)->frameBuffers[set][ch] + start;
+		void *acc = GetData(device)->averaging.accumulators[ch];
+		if (mode == FrameAveraging_Exponential)
+		{
+			// The first frame seeds the average
+			float weight = GetData(device)->averaging.initialized ?
+				1.0f / GetData(device)->averaging.frames : 1.0f;
+			AccumulateExpF32(src, end - start, weight, (float *)acc + start);
+		}
+		else
+		{
+			AccumulateU16(src, end - start, (uint32_t *)acc + start);
+		}
+	}
+	GetData(device)->averaging.pixelsAccumulated = end;
+}
+
 
-			GetData(device)->frameBuffers[ch][pixelIndex] = pixel;
+// Replace the contents of a completed frame set with the averaged frame
+static void StoreAveragedFrame(OScDev_Device *device, uint32_t set)
+{
+	uint32_t numChannels = GetNumberOfEnabledChannels(device);
+	size_t pixelsPerFrame = (size_t)GetData(device)->configuredRasterWidth *
+		GetData(device)->configuredRasterHeight;
+	for (uint32_t ch = 0; ch < numChannels; ++ch)
+	{
+		const void *acc = GetData(device)->averaging.accumulators[ch];
+		uint16_t *dest = GetData(device)->frameBuffers[set][ch];
+		switch (GetData(device)->averaging.mode)
+		{
+		case FrameAveraging_Mean:
+			StoreAccumulatorU32(acc, pixelsPerFrame, GetData(device)->averaging.frames, dest);
+			break;
+		case FrameAveraging_Sum:
+			StoreAccumulatorU32(acc, pixelsPerFrame, 1, dest);
+			break;
+		case FrameAveraging_Exponential:
+			StoreAccumulatorF32(acc, pixelsPerFrame, dest);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+
+// Called on the processing thread before the first pixel of a frame is
+// converted; that pixel is at chunkOffset in chunk
+static void BeginFrame(OScDev_Device *device, const struct RawDataChunk *chunk,
+	size_t chunkOffset)
+{
+	GetData(device)->averaging.pixelsAccumulated = 0;
+
+	// The frames of a group being averaged share one set (or are all
+	// dropped together), and the timing of the first
+	if (GetData(device)->averaging.groupFrames > 0)
+		return;
+
+	GetData(device)->frameTiming.current.startSample = chunk->firstSample +
+		chunkOffset * GetData(device)->rawDataOversampling;
+	GetData(device)->frameTiming.current.firstReadTime = chunk->readTime;
+
+	uint32_t set = AcquireFreeFrameSet(device);
+	GetData(device)->framePool.current = set;
+	GetData(device)->framePool.dropping = set == NO_FRAME_SET;
+
+	enum FrameAveragingMode mode = GetData(device)->averaging.mode;
+	if (set != NO_FRAME_SET &&
+		(mode == FrameAveraging_Mean || mode == FrameAveraging_Sum))
+	{
+		size_t pixelsPerFrame = (size_t)GetData(device)->configuredRasterWidth *
+			GetData(device)->configuredRasterHeight;
+		uint32_t numChannels = GetNumberOfEnabledChannels(device);
+		for (uint32_t ch = 0; ch < numChannels; ++ch)
+			memset(GetData(device)->averaging.accumulators[ch], 0,
+				sizeof(uint32_t) * pixelsPerFrame);
+	}
+}
+
+
+// Called on the processing thread when the current frame has been completed
+static void FinishFrame(OScDev_Device *device, const struct RawDataChunk *chunk)
+{
+	GetData(device)->framePixelsFilled = 0;
+
+	// When streaming, skip the lines acquired during the Y retrace
+	if (GetData(device)->stream.active)
+	{
+		GetData(device)->stream.retracePixelsToSkip =
+			(size_t)GetData(device)->configuredRasterWidth * Y_RETRACE_LEN;
+	}
+
+	enum FrameAveragingMode mode = GetData(device)->averaging.mode;
+	if (mode == FrameAveraging_Mean || mode == FrameAveraging_Sum)
+	{
+		if (++GetData(device)->averaging.groupFrames < GetData(device)->averaging.frames)
+			return;
+		GetData(device)->averaging.groupFrames = 0;
+	}
+
+	// Dropped frames also consume a sequence number, so that the gap is
+	// visible at delivery
+	struct FrameInfo *info = &GetData(device)->frameTiming.current;
+	info->sequenceNumber = GetData(device)->frameTiming.nextSequenceNumber++;
+	info->lastReadTime = chunk->readTime;
+
+	if (GetData(device)->framePool.dropping)
+	{
+		GetData(device)->framePool.dropping = false;
+		RecordDroppedFrame(device);
+		TRACE_INSTANT("Frame Dropped", info->sequenceNumber);
+	}
+	else
+	{
+		uint32_t set = GetData(device)->framePool.current;
+		GetData(device)->framePool.current = NO_FRAME_SET;
+		if (mode != FrameAveraging_Off)
+		{
+			StoreAveragedFrame(device, set);
+			GetData(device)->averaging.initialized = true;
 		}
+		QueueFilledFrameSet(device, set, info);
+		TRACE_INSTANT("Frame Finished", info->sequenceNumber);
 	}
+	info->sampleGap = false;
+	info->inputOverrun = false;
 
-	// Shift the leftover raw samples to the front of the buffer for future
-	// consumption
-	memmove(rawDataBuffer, rawDataBuffer + samplesToProcess,
-		sizeof(float64) * leftoverSamples);
-	GetData(device)->rawDataSize = leftoverSamples;
+	if (GetData(device)->stream.active &&
+		++GetData(device)->stream.framesCompleted >= GetData(device)->stream.framesToDeliver)
+		Atomic_Store(&GetData(device)->stream.finished, 1);
+}
+
+
+// Check that the chunk follows on from the previous one without lost
+// samples (each run of the task starts again from sample 0), and that the
+// DAQmx input buffer had not filled up; if not, flag the frame being filled
+// (or the next one, if the problem is at a frame boundary)
+static void CheckChunkContinuity(OScDev_Device *device, const struct RawDataChunk *chunk)
+{
+	struct FrameInfo *info = &GetData(device)->frameTiming.current;
+	char msg[OScDev_MAX_STR_LEN + 1];
+
+	uInt64 expected = GetData(device)->frameTiming.nextSample;
+	if (chunk->firstSample != 0 && chunk->firstSample != expected)
+	{
+		snprintf(msg, OScDev_MAX_STR_LEN,
+			"Error: Detector samples lost (expected sample %llu, got %llu)",
+			(unsigned long long)expected, (unsigned long long)chunk->firstSample);
+		OScDev_Log_Error(device, msg);
+		info->sampleGap = true;
+		GetData(device)->frameTiming.sampleGaps++;
+	}
+
+	if (chunk->samplesAcquired - chunk->firstSample >=
+		GetData(device)->processing.inputBufferSize)
+	{
+		OScDev_Log_Error(device, "Error: Detector input buffer overrun");
+		info->inputOverrun = true;
+		GetData(device)->frameTiming.inputOverruns++;
+	}
+
+	GetData(device)->frameTiming.nextSample = chunk->firstSample +
+		(uInt64)chunk->numPixels * GetData(device)->rawDataOversampling;
+}
+
+
+// Process one chunk of data in the raw data ring buffer and place the
+// result into the frame buffer set being filled
+// Called on the processing thread, or by the detector benchmark or raw data
+// replay while the thread is stopped
+int32 HandleRawData(OScDev_Device *device, const struct RawDataChunk *chunk)
+{
+	// The ring buffer holds whole pixels (rawDataOversampling scans of one
+	// sample per channel), so that every pixel read can be processed.
+	// Chunks never span the end of the ring buffer storage, so each is
+	// contiguous.
+
+	// Given 2 channels and 2 samples per pixel per channel, the raw data
+	// is in the following order:
+	// | ch0_samp0 ch1_samp0 ch0_samp1 ch1_samp1 | ch0_samp0 ...
+	// We need to transfer this into per-channel frame buffers.
+
+	struct RingBuffer *ring = &GetData(device)->rawData;
+
+	const void *src;
+	size_t readable = RingBuffer_GetReadable(ring, &src);
+	if (readable < chunk->numPixels)
+	{
+		OScDev_Log_Error(device, "Error: Detector chunk exceeds available raw data");
+		return -1;
+	}
+
+	CheckChunkContinuity(device, chunk);
 
 	// TODO Cleaner to get raster size from the OScDev_Acquisition (a future
 	// OpenScanLib should allow getting the current device from the
 	// acquisition, so that we can pass the acquisition as callback data)
 	uint32_t pixelsPerLine = GetData(device)->configuredRasterWidth;
 	uint32_t linesPerFrame = GetData(device)->configuredRasterHeight;
-
 	size_t pixelsPerFrame = pixelsPerLine * linesPerFrame;
-	char msg[OScDev_MAX_STR_LEN + 1];
-	snprintf(msg, OScDev_MAX_STR_LEN, "Read %zd pixels", GetData(device)->framePixelsFilled);
-	OScDev_Log_Debug(device, msg);
 
-	if (GetData(device)->framePixelsFilled == pixelsPerFrame)
+	// Process raw data and fill in frame buffers
+
+	// A chunk may end one frame and begin the next; when streaming, it may
+	// also contain Y retrace lines to discard, or data beyond the last frame
+	const char *pixels = src;
+	size_t remaining = chunk->numPixels;
+	while (remaining > 0)
 	{
-		// TODO This method of communication is unreliable without a mutex
-		// TODO But we should use a condition variable in any case
-		GetData(device)->oneFrameScanDone = true;
+		size_t n;
+		if (GetData(device)->stream.active &&
+			Atomic_Load(&GetData(device)->stream.finished))
+		{
+			n = remaining;
+		}
+		else if (GetData(device)->stream.retracePixelsToSkip > 0)
+		{
+			n = GetData(device)->stream.retracePixelsToSkip;
+			if (n > remaining)
+				n = remaining;
+			GetData(device)->stream.retracePixelsToSkip -= n;
+		}
+		else
+		{
+			size_t prevPixelsFilled = GetData(device)->framePixelsFilled;
+			if (prevPixelsFilled == 0 && GetData(device)->lineAveraging.repeat == 0 &&
+				GetData(device)->lineAveraging.pixelsInScan == 0)
+				BeginFrame(device, chunk, chunk->numPixels - remaining);
+			if (GetData(device)->lineAveraging.lines > 1)
+			{
+				n = ReduceLineScans(device, pixels, remaining);
+				if (!GetData(device)->framePool.dropping)
+					AccumulateFrameData(device);
+			}
+			else
+			{
+				n = pixelsPerFrame - prevPixelsFilled;
+				if (n > remaining)
+					n = remaining;
+				if (!GetData(device)->framePool.dropping)
+				{
+					ConvertRawSamples(device, pixels, n, prevPixelsFilled);
+					GetData(device)->framePixelsFilled += n;
+					if (GetData(device)->rawDataBidirectional)
+						ReverseOddLines(device, prevPixelsFilled, GetData(device)->framePixelsFilled);
+					AccumulateFrameData(device);
+				}
+				else
+				{
+					GetData(device)->framePixelsFilled += n;
+				}
+			}
 
-		// TODO This reset should occur at start of frame
-		GetData(device)->framePixelsFilled = 0;
+			if (GetData(device)->framePixelsFilled == pixelsPerFrame)
+				FinishFrame(device, chunk);
+		}
+		pixels += n * ring->elementSize;
+		remaining -= n;
 	}
 
+	RingBuffer_Consume(ring, chunk->numPixels);
+
+	// Processing time per chunk is in the performance counters (and traced);
+	// formatting a message here would cost more than converting a short chunk
 	return OScDev_OK;
-}
\ No newline at end of file
+}
+
+
+// Drop all queued chunks and the raw data read so far
+// Called on the processing thread
+static void DiscardQueuedRawData(OScDev_Device *device)
+{
+	struct RawDataChunk chunk;
+	while (RingBuffer_Pop(&GetData(device)->processing.chunks, &chunk))
+		continue;
+
+	const void *src;
+	size_t readable;
+	while ((readable = RingBuffer_GetReadable(&GetData(device)->rawData, &src)) > 0)
+		RingBuffer_Consume(&GetData(device)->rawData, readable);
+}
+
+
+static void DetectorProcessingLoop(void *param)
+{
+	OScDev_Device *device = (OScDev_Device *)param;
+	struct RingBuffer *chunks = &GetData(device)->processing.chunks;
+
+	for (;;)
+	{
+		Event_Wait(&GetData(device)->processing.wakeEvent, WAIT_FOREVER);
+		TRACE_THREAD_NAME("Detector Processing");
+
+		// Drain the queue even if asked to stop, so that no data that was
+		// read is lost
+		bool stopRequested = Atomic_Load(&GetData(device)->processing.stopRequested) != 0;
+
+		struct RawDataChunk chunk;
+		while (RingBuffer_Pop(chunks, &chunk))
+		{
+			// Nothing more is processed until the detector is restarted
+			if (HasDetectorFailed(device))
+			{
+				DiscardQueuedRawData(device);
+				break;
+			}
+
+			CaptureRawDataChunk(device, &chunk);
+
+			int64_t start = Time_GetTicks();
+			TRACE_BEGIN("HandleRawData");
+			if (HandleRawData(device, &chunk))
+			{
+				// The chunks still queued can no longer be matched to the
+				// raw data, so fail the acquisition rather than fill frames
+				// with misaligned pixels
+				SetDetectorFailed(device);
+				DiscardQueuedRawData(device);
+			}
+			TRACE_END("HandleRawData");
+			int64_t ticks = Time_GetTicks() - start;
+			Counter_Add(&GetData(device)->counters.processingTicks, ticks);
+			Counter_Max(&GetData(device)->counters.peakProcessingTicks, ticks);
+		}
+		Event_Set(&GetData(device)->processing.drainedEvent);
+
+		if (stopRequested)
+			break;
+	}
+}
+
+
+static OScDev_RichError *StartProcessingThread(OScDev_Device *device)
+{
+	Atomic_Store(&GetData(device)->processing.stopRequested, 0);
+
+	GetData(device)->processing.thread =
+		Thread_Start(DetectorProcessingLoop, device);
+	if (!GetData(device)->processing.thread)
+		return OScDev_Error_Create("Failed to start detector processing thread");
+	return OScDev_RichError_OK;
+}
+
+
+// Must not be called on the processing thread
+static void StopProcessingThread(OScDev_Device *device)
+{
+	if (!GetData(device)->processing.thread)
+		return;
+
+	Atomic_Store(&GetData(device)->processing.stopRequested, 1);
+	Event_Set(&GetData(device)->processing.wakeEvent);
+	Thread_Join(GetData(device)->processing.thread);
+	GetData(device)->processing.thread = NULL;
+}
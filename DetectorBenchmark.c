@@ -0,0 +1,302 @@
+#include "OScNIDAQDevicePrivate.h"
+
+#include <OpenScanDeviceLib.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Throughput benchmark of the detector processing path, run on synthetic
+// data without the DAQ. Each case copies interleaved samples into the raw
+// data ring buffer (as DetectorDataCallback() does when reading from DAQmx)
+// and processes them with HandleRawData(), for one channel count, frame
+// width, and number of lines per callback. The remaining detector settings
+// (sample format, oversampling, frame and line averaging, bidirectional
+// scan, frame buffer sets) are used as currently set.
+//
+// Only HandleRawData() (with the copy into the ring buffer) is measured:
+// DetectorDataCallback(), the chunk queue, and the processing thread are
+// not exercised, so the latency leaves out the handoff between threads and
+// the wakeup of the processing thread. The performance counters of an
+// acquisition (as printed by OScNIDAQAcquire) cover those.
+//
+// Each case is written as one line of JSON (see RunDetectorBenchmark()):
+//   samplesPerSecond: raw samples (all channels) processed per second
+//   nsPerPixel: time per raw pixel (all channels), including the copy
+//   allocBytes: buffers allocated for the case; no allocation takes place
+//     while processing
+//   maxChunkLatencyUs: longest time from starting to copy a chunk to
+//     finishing its processing in HandleRawData() (see above)
+
+
+#define BENCHMARK_FRAME_HEIGHT 256
+
+// Each case processes at least this many pixels and frames (after one
+// untimed frame to fault in the buffers)
+#define BENCHMARK_MIN_PIXELS (4 << 20)
+#define BENCHMARK_MIN_FRAMES 4
+
+static const uint32_t benchmarkWidths[] = { 256, 512, 1024, 2048 };
+
+// Scan lines per chunk; 0 for a whole frame
+static const uint32_t benchmarkChunkLines[] = { 1, 4, 16, 64, 0 };
+
+
+struct BenchmarkResult
+{
+	uint64_t pixels; // Raw pixels processed while timed
+	int64_t ticks;
+	int64_t maxChunkTicks;
+	size_t allocBytes;
+};
+
+
+// Fill one scan line of raw pixels (elements of the raw data ring buffer)
+// with a pattern spanning most of the input voltage range
+static void FillSyntheticLine(OScDev_Device *device, void *line, uint32_t width)
+{
+	uint32_t numChannels = GetNumberOfEnabledChannels(device);
+	size_t numSamples = (size_t)width * GetData(device)->rawDataOversampling * numChannels;
+	double range = GetData(device)->inputVoltageRange;
+
+	for (size_t i = 0; i < numSamples; ++i)
+	{
+		double volts = 0.45 * range * sin(0.05 * i);
+		if (GetData(device)->rawDataIsBinary)
+			((int16_t *)line)[i] = (int16_t)(volts / range * 32768.0);
+		else
+			((double *)line)[i] = volts;
+	}
+}
+
+
+// Copy numPixels raw pixels, starting at pixel index first of a sequence of
+// repeats of line (of width pixels)
+static void CopySyntheticPixels(char *dest, const char *line, size_t elementSize,
+	uint32_t width, uint64_t first, size_t numPixels)
+{
+	while (numPixels > 0)
+	{
+		size_t offset = (size_t)(first % width);
+		size_t n = width - offset;
+		if (n > numPixels)
+			n = numPixels;
+		memcpy(dest, line + offset * elementSize, n * elementSize);
+		dest += n * elementSize;
+		first += n;
+		numPixels -= n;
+	}
+}
+
+
+// Read numPixels synthetic pixels into the raw data ring buffer and
+// process them, in two chunks if the free space wraps around the end of the
+// storage; *nextPixel is the index of the first pixel of the stream
+static OScDev_RichError *ProcessSyntheticChunk(OScDev_Device *device,
+	const void *line, uint32_t width, size_t numPixels, uint64_t *nextPixel,
+	int64_t *ticks)
+{
+	struct RingBuffer *ring = &GetData(device)->rawData;
+	uint32_t oversampling = GetData(device)->rawDataOversampling;
+
+	int64_t start = Time_GetTicks();
+	while (numPixels > 0)
+	{
+		void *dest;
+		size_t n = RingBuffer_GetWritable(ring, &dest);
+		if (n == 0)
+			return OScDev_Error_Create("Raw detector sample buffer is full");
+		if (n > numPixels)
+			n = numPixels;
+		CopySyntheticPixels(dest, line, ring->elementSize, width, *nextPixel, n);
+
+		struct RawDataChunk chunk;
+		chunk.firstPixel = ring->writeCursor;
+		chunk.numPixels = (uint32_t)n;
+		chunk.readTime = Time_GetTicks();
+		chunk.firstSample = *nextPixel * oversampling;
+		chunk.samplesAcquired = chunk.firstSample + n * oversampling;
+		RingBuffer_Produce(ring, n);
+
+		if (HandleRawData(device, &chunk))
+			return OScDev_Error_Create("Failed to process detector data");
+		ReleaseFilledFrameSets(device);
+
+		*nextPixel += n;
+		numPixels -= n;
+	}
+	*ticks = Time_GetTicks() - start;
+	return OScDev_RichError_OK;
+}
+
+
+static OScDev_RichError *RunBenchmarkCase(OScDev_Device *device, uint32_t numChannels,
+	uint32_t width, uint32_t chunkLines, struct BenchmarkResult *result)
+{
+	OScDev_RichError *err;
+	void *line = NULL;
+
+	for (uint32_t ch = 0; ch < MAX_PHYSICAL_CHANS; ++ch)
+		GetData(device)->channelEnabled[ch] = ch < numChannels;
+	GetData(device)->configuredRasterWidth = width;
+	GetData(device)->configuredRasterHeight = BENCHMARK_FRAME_HEIGHT;
+
+	size_t chunkPixels = (size_t)chunkLines * width;
+
+	// As for an acquisition, the input buffer holds two callbacks' worth
+	err = AllocateProcessingBuffers(device, width, BENCHMARK_FRAME_HEIGHT,
+		2 * chunkPixels * GetData(device)->oversamplingFactor);
+	if (err)
+		goto cleanup;
+	result->allocBytes = GetData(device)->processing.bufferBytes;
+	if (GetData(device)->rawDataIsBinary)
+	{
+		err = BuildNominalConversionTables(device);
+		if (err)
+			goto cleanup;
+		result->allocBytes += numChannels * sizeof(uint16_t) * CONVERSION_TABLE_SIZE;
+	}
+
+	ResetFramePool(device, true);
+	DiscardPartialFrame(device);
+	GetData(device)->stream.active = false;
+	GetData(device)->stream.retracePixelsToSkip = 0;
+
+	line = malloc(width * GetData(device)->rawData.elementSize);
+	if (!line)
+	{
+		err = OScDev_Error_Create("Failed to allocate benchmark data");
+		goto cleanup;
+	}
+	FillSyntheticLine(device, line, width);
+
+	// Line averaging scans each line of the frame several times
+	uint64_t framePixels = (uint64_t)width * BENCHMARK_FRAME_HEIGHT *
+		GetData(device)->lineAveraging.lines;
+	uint64_t frames = (BENCHMARK_MIN_PIXELS + framePixels - 1) / framePixels;
+	if (frames < BENCHMARK_MIN_FRAMES)
+		frames = BENCHMARK_MIN_FRAMES;
+
+	uint64_t nextPixel = 0;
+	uint64_t endPixel = framePixels * (frames + 1);
+	result->pixels = 0;
+	result->ticks = 0;
+	result->maxChunkTicks = 0;
+	while (nextPixel < endPixel)
+	{
+		bool timed = nextPixel >= framePixels;
+		size_t n = chunkPixels;
+		if (n > endPixel - nextPixel)
+			n = (size_t)(endPixel - nextPixel);
+
+		int64_t ticks = 0;
+		err = ProcessSyntheticChunk(device, line, width, n, &nextPixel, &ticks);
+		if (err)
+			goto cleanup;
+
+		if (timed)
+		{
+			result->pixels += n;
+			result->ticks += ticks;
+			if (ticks > result->maxChunkTicks)
+				result->maxChunkTicks = ticks;
+		}
+	}
+
+cleanup:
+	free(line);
+	return err;
+}
+
+
+static void WriteBenchmarkResult(OScDev_Device *device, FILE *output, uint32_t numChannels,
+	uint32_t width, uint32_t chunkLines, const struct BenchmarkResult *result)
+{
+	double seconds = 1e-3 * Time_TicksToMs(result->ticks);
+	double samples = (double)result->pixels * numChannels *
+		GetData(device)->rawDataOversampling;
+
+	char msg[OScDev_MAX_STR_LEN + 1];
+	snprintf(msg, OScDev_MAX_STR_LEN,
+		"{\"benchmark\": \"detector\", \"measured\": \"HandleRawData\", "
+		"\"kernel\": \"%s\", \"format\": \"%s\", \"oversampling\": %u, \"channels\": %u, "
+		"\"width\": %u, \"height\": %u, \"chunkLines\": %u, "
+		"\"pixels\": %llu, \"seconds\": %.6f, \"samplesPerSecond\": %.4g, "
+		"\"nsPerPixel\": %.3f, \"allocBytes\": %zu, \"maxChunkLatencyUs\": %.1f}",
+		GetData(device)->convertSamplesName,
+		GetData(device)->rawDataIsBinary ? "i16" : "f64",
+		GetData(device)->rawDataOversampling, numChannels,
+		width, BENCHMARK_FRAME_HEIGHT, chunkLines,
+		(unsigned long long)result->pixels, seconds,
+		seconds > 0.0 ? samples / seconds : 0.0,
+		result->pixels > 0 ? 1e9 * seconds / result->pixels : 0.0,
+		result->allocBytes, 1e3 * Time_TicksToMs(result->maxChunkTicks));
+	if (output)
+	{
+		fprintf(output, "%s\n", msg);
+		fflush(output);
+	}
+	else
+		OScDev_Log_Info(device, msg);
+}
+
+
+// Run every case of the benchmark, writing the results to output, or
+// logging them (at Info level) if output is NULL. This takes several
+// seconds, during which the device cannot be armed.
+OScDev_RichError *RunDetectorBenchmark(OScDev_Device *device, FILE *output)
+{
+	OScDev_RichError *err = OScDev_RichError_OK;
+
+	struct Mutex *mutex = &GetData(device)->acquisition.mutex;
+	Mutex_Lock(mutex);
+	if (GetData(device)->acquisition.running)
+	{
+		Mutex_Unlock(mutex);
+		return OScDev_Error_Create("Cannot run the detector benchmark while acquiring");
+	}
+
+	bool channelEnabled[MAX_PHYSICAL_CHANS];
+	memcpy(channelEnabled, GetData(device)->channelEnabled, sizeof(channelEnabled));
+	uint32_t width = GetData(device)->configuredRasterWidth;
+	uint32_t height = GetData(device)->configuredRasterHeight;
+
+	OScDev_Log_Info(device, "Running detector benchmark");
+	for (uint32_t numChannels = 1; numChannels <= MAX_PHYSICAL_CHANS; ++numChannels)
+	{
+		for (size_t w = 0; w < sizeof(benchmarkWidths) / sizeof(benchmarkWidths[0]); ++w)
+		{
+			for (size_t c = 0; c < sizeof(benchmarkChunkLines) / sizeof(benchmarkChunkLines[0]); ++c)
+			{
+				uint32_t chunkLines = benchmarkChunkLines[c];
+				if (chunkLines == 0)
+					chunkLines = BENCHMARK_FRAME_HEIGHT * GetData(device)->linesToAverage;
+
+				struct BenchmarkResult result;
+				err = RunBenchmarkCase(device, numChannels, benchmarkWidths[w],
+					chunkLines, &result);
+				if (err)
+					goto cleanup;
+				WriteBenchmarkResult(device, output, numChannels,
+					benchmarkWidths[w], chunkLines, &result);
+			}
+		}
+	}
+	OScDev_Log_Info(device, "Detector benchmark finished");
+
+cleanup:
+	memcpy(GetData(device)->channelEnabled, channelEnabled, sizeof(channelEnabled));
+	GetData(device)->configuredRasterWidth = width;
+	GetData(device)->configuredRasterHeight = height;
+
+	// The buffers no longer match the detector configuration
+	ResetFramePool(device, true);
+	GetData(device)->detectorConfig.mustReconfigureCallback = true;
+
+	Mutex_Unlock(mutex);
+	if (err)
+		err = OScDev_Error_Wrap(err, "Detector benchmark failed");
+	return err;
+}
@@ -0,0 +1,449 @@
+#include "OScNIDAQDevicePrivate.h"
+
+#include <OpenScanDeviceLib.h>
+
+#include <stdio.h>
+
+
+// Frame buffer sets circulate between the detector processing thread, which
+// fills them, and the delivery thread, which passes them to OpenScanLib:
+//
+//   free --(processing: fill)--> filled --(delivery: callbacks)--> free
+//
+// The filled queue is the bounded queue of frames awaiting delivery. When
+// it holds every set but the one being delivered, the delivery policy
+// decides whether the processing thread waits, overwrites the oldest queued
+// frame, or drops the new frame.
+//
+// All hand-offs that may need to wake the other side happen under
+// frameCompletion.mutex, so wakeups cannot be missed; frameCompletion.condition
+// is broadcast on every change.
+
+
+// While streaming under the block policy, the processing thread stops
+// waiting for a free set (and drops the frame) once the raw data buffers
+// are this full, as the DAQ cannot be held back; checked at this interval
+static const double BLOCK_MAX_RAW_DATA_FILL = 0.5;
+static const uint32_t BLOCK_POLL_INTERVAL_MS = 10;
+
+
+static void RecordFrameLatency(OScDev_Device *device, int64_t lastSampleReadTime)
+{
+	double ms = Time_TicksToMs(Time_GetTicks() - lastSampleReadTime);
+
+	GetData(device)->frameCompletion.latencyCount++;
+	GetData(device)->frameCompletion.latencyTotalMs += ms;
+	if (ms > GetData(device)->frameCompletion.latencyMaxMs)
+		GetData(device)->frameCompletion.latencyMaxMs = ms;
+}
+
+
+// Return all frame buffer sets to the free queue (and optionally clear the
+// statistics) before starting an acquisition
+// Must not be called while the processing or delivery thread may be running.
+void ResetFramePool(OScDev_Device *device, bool resetStatistics)
+{
+	uint32_t set;
+	while (RingBuffer_Pop(&GetData(device)->framePool.filled, &set))
+		RingBuffer_Push(&GetData(device)->framePool.free, &set);
+	if (GetData(device)->framePool.current != NO_FRAME_SET)
+	{
+		RingBuffer_Push(&GetData(device)->framePool.free,
+			&GetData(device)->framePool.current);
+		GetData(device)->framePool.current = NO_FRAME_SET;
+	}
+	GetData(device)->framePool.dropping = false;
+	GetData(device)->framePixelsFilled = 0;
+
+	if (resetStatistics)
+	{
+		GetData(device)->frameCompletion.framesFinished = 0;
+		GetData(device)->frameCompletion.latencyCount = 0;
+		GetData(device)->frameCompletion.latencyTotalMs = 0.0;
+		GetData(device)->frameCompletion.latencyMaxMs = 0.0;
+		Atomic_Store(&GetData(device)->delivery.framesDelivered, 0);
+		Atomic_Store(&GetData(device)->delivery.framesDropped, 0);
+		GetData(device)->delivery.queueHighWaterMark = 0;
+		GetData(device)->delivery.nextSequenceNumber = 0;
+		GetData(device)->frameTiming.nextSequenceNumber = 0;
+		GetData(device)->frameTiming.sampleGaps = 0;
+		GetData(device)->frameTiming.inputOverruns = 0;
+		GetData(device)->frameTiming.current.sampleGap = false;
+		GetData(device)->frameTiming.current.inputOverrun = false;
+	}
+}
+
+
+// In the acquisition's count and the performance counters
+static void CountDroppedFrame(OScDev_Device *device)
+{
+	Atomic_Increment(&GetData(device)->delivery.framesDropped);
+	Counter_Add(&GetData(device)->counters.framesDropped, 1);
+}
+
+
+// True if the raw data waiting to be processed leaves too little room to keep
+// blocking (see BLOCK_MAX_RAW_DATA_FILL)
+static bool IsRawDataBacklogged(OScDev_Device *device)
+{
+	const struct RingBuffer *rawData = &GetData(device)->rawData;
+	const struct RingBuffer *chunks = &GetData(device)->processing.chunks;
+	return RingBuffer_GetSize(rawData) >= BLOCK_MAX_RAW_DATA_FILL * rawData->capacity ||
+		RingBuffer_GetSize(chunks) >= BLOCK_MAX_RAW_DATA_FILL * chunks->capacity;
+}
+
+
+// Get a set to fill with a new frame, applying the delivery policy if none
+// is free; returns NO_FRAME_SET if the frame should be dropped
+// Called on the processing thread
+uint32_t AcquireFreeFrameSet(OScDev_Device *device)
+{
+	struct Mutex *mutex = &GetData(device)->frameCompletion.mutex;
+	struct CondVar *cv = &GetData(device)->frameCompletion.condition;
+
+	uint32_t set;
+	if (RingBuffer_Pop(&GetData(device)->framePool.free, &set))
+		return set;
+
+	bool acquired = false;
+	Mutex_Lock(mutex);
+	switch (GetData(device)->deliveryPolicy)
+	{
+	case FrameDeliveryPolicy_Block:
+		// Wait (in slices, as the conditions for giving up are not all
+		// signaled) until the delivery thread releases a set. Frame by
+		// frame, the next frame is not scanned until a set is free, so this
+		// rarely waits; when streaming, the wait is bounded by the room left
+		// for the data still arriving.
+		while (!(acquired = RingBuffer_Pop(&GetData(device)->framePool.free, &set)))
+		{
+			if (!GetData(device)->delivery.thread ||
+				GetData(device)->delivery.stopRequested ||
+				Atomic_Load(&GetData(device)->delivery.consumerStopped) ||
+				Atomic_Load(&GetData(device)->processing.stopRequested) ||
+				(GetData(device)->stream.active &&
+					(Atomic_Load(&GetData(device)->stream.finished) ||
+						IsRawDataBacklogged(device))))
+				break;
+			CondVar_Wait(cv, mutex,
+				GetData(device)->stream.active ? BLOCK_POLL_INTERVAL_MS : 100);
+		}
+		break;
+
+	case FrameDeliveryPolicy_DropOldest:
+		// The set being delivered (if any) is not in the queue, so with at
+		// least two sets there is normally a queued one to take back
+		if ((acquired = RingBuffer_Pop(&GetData(device)->framePool.filled, &set)))
+			CountDroppedFrame(device);
+		break;
+
+	case FrameDeliveryPolicy_DropNewest:
+	default:
+		break;
+	}
+	Mutex_Unlock(mutex);
+
+	return acquired ? set : NO_FRAME_SET;
+}
+
+
+// Queue a filled set for delivery
+// Called on the processing thread
+void QueueFilledFrameSet(OScDev_Device *device, uint32_t set, const struct FrameInfo *info)
+{
+	GetData(device)->framePool.info[set] = *info;
+
+	Mutex_Lock(&GetData(device)->frameCompletion.mutex);
+	RingBuffer_Push(&GetData(device)->framePool.filled, &set);
+	size_t queued = RingBuffer_GetSize(&GetData(device)->framePool.filled);
+	if (queued > GetData(device)->delivery.queueHighWaterMark)
+		GetData(device)->delivery.queueHighWaterMark = queued;
+	GetData(device)->frameCompletion.framesFinished++;
+	Mutex_Unlock(&GetData(device)->frameCompletion.mutex);
+	CondVar_Broadcast(&GetData(device)->frameCompletion.condition);
+}
+
+
+// Account for a frame that was acquired without a set to fill
+// Called on the processing thread
+void RecordDroppedFrame(OScDev_Device *device)
+{
+	CountDroppedFrame(device);
+
+	Mutex_Lock(&GetData(device)->frameCompletion.mutex);
+	GetData(device)->frameCompletion.framesFinished++;
+	Mutex_Unlock(&GetData(device)->frameCompletion.mutex);
+	CondVar_Broadcast(&GetData(device)->frameCompletion.condition);
+}
+
+
+// Hand a set back for filling
+// Called on the delivery thread, or when the processing thread is idle
+void ReleaseFrameSet(OScDev_Device *device, uint32_t set)
+{
+	Mutex_Lock(&GetData(device)->frameCompletion.mutex);
+	RingBuffer_Push(&GetData(device)->framePool.free, &set);
+	Mutex_Unlock(&GetData(device)->frameCompletion.mutex);
+	CondVar_Broadcast(&GetData(device)->frameCompletion.condition);
+}
+
+
+// Hand back every filled set, undelivered; stands in for the delivery thread
+// when data is processed without an acquisition (benchmark and replay)
+void ReleaseFilledFrameSets(OScDev_Device *device)
+{
+	for (;;)
+	{
+		uint32_t set;
+		Mutex_Lock(&GetData(device)->frameCompletion.mutex);
+		bool popped = RingBuffer_Pop(&GetData(device)->framePool.filled, &set);
+		Mutex_Unlock(&GetData(device)->frameCompletion.mutex);
+		if (!popped)
+			break;
+		ReleaseFrameSet(device, set);
+	}
+}
+
+
+// Block until at least one set is free; return false on timeout
+bool WaitForFreeFrameSet(OScDev_Device *device, uint32_t timeoutMs)
+{
+	struct Mutex *mutex = &GetData(device)->frameCompletion.mutex;
+	struct CondVar *cv = &GetData(device)->frameCompletion.condition;
+
+	uint64_t deadline = Time_GetMs() + timeoutMs;
+	bool available;
+	Mutex_Lock(mutex);
+	while (!(available = RingBuffer_GetSize(&GetData(device)->framePool.free) > 0))
+	{
+		uint64_t now = Time_GetMs();
+		if (now >= deadline)
+			break;
+		CondVar_Wait(cv, mutex, (uint32_t)(deadline - now));
+	}
+	Mutex_Unlock(mutex);
+	return available;
+}
+
+
+uint32_t GetFramesFinished(OScDev_Device *device)
+{
+	Mutex_Lock(&GetData(device)->frameCompletion.mutex);
+	uint32_t count = GetData(device)->frameCompletion.framesFinished;
+	Mutex_Unlock(&GetData(device)->frameCompletion.mutex);
+	return count;
+}
+
+
+// Block until the processing thread has finished (completed or dropped)
+// count frames since the start of the acquisition; return false on timeout
+// or if the detector fails
+bool WaitForFramesFinished(OScDev_Device *device, uint32_t count, uint32_t timeoutMs)
+{
+	struct Mutex *mutex = &GetData(device)->frameCompletion.mutex;
+	struct CondVar *cv = &GetData(device)->frameCompletion.condition;
+
+	uint64_t deadline = Time_GetMs() + timeoutMs;
+	bool done;
+	Mutex_Lock(mutex);
+	while (!(done = GetData(device)->frameCompletion.framesFinished >= count))
+	{
+		uint64_t now = Time_GetMs();
+		if (now >= deadline || HasDetectorFailed(device))
+			break;
+		CondVar_Wait(cv, mutex, (uint32_t)(deadline - now));
+	}
+	Mutex_Unlock(mutex);
+	return done;
+}
+
+
+// Block until a filled set is queued, and take ownership of it; return false
+// once the queue is empty and the delivery thread has been asked to stop
+static bool WaitForFilledFrameSet(OScDev_Device *device, uint32_t *set)
+{
+	struct Mutex *mutex = &GetData(device)->frameCompletion.mutex;
+	struct CondVar *cv = &GetData(device)->frameCompletion.condition;
+
+	bool got;
+	Mutex_Lock(mutex);
+	while (!(got = RingBuffer_Pop(&GetData(device)->framePool.filled, set)))
+	{
+		if (GetData(device)->delivery.stopRequested)
+			break;
+		CondVar_Wait(cv, mutex, WAIT_FOREVER);
+	}
+	if (got)
+		RecordFrameLatency(device, GetData(device)->framePool.info[*set].lastReadTime);
+	Mutex_Unlock(mutex);
+	return got;
+}
+
+
+// Report the timing of a frame about to be delivered, and any frames missing
+// before it (dropped by the processing thread or overwritten in the queue)
+static void LogFrameInfo(OScDev_Device *device, const struct FrameInfo *info)
+{
+	char msg[OScDev_MAX_STR_LEN + 1];
+
+	uint32_t expected = GetData(device)->delivery.nextSequenceNumber;
+	if (info->sequenceNumber != expected)
+	{
+		snprintf(msg, OScDev_MAX_STR_LEN,
+			"Frames %u to %u were dropped before delivery",
+			expected, info->sequenceNumber - 1);
+		OScDev_Log_Warning(device, msg);
+	}
+	GetData(device)->delivery.nextSequenceNumber = info->sequenceNumber + 1;
+
+	snprintf(msg, OScDev_MAX_STR_LEN,
+		"Frame %u: starts at detector sample %llu (%.3f ms); read over %.3f ms%s%s",
+		info->sequenceNumber, (unsigned long long)info->startSample,
+		1e3 * info->startSample / GetData(device)->frameTiming.sampleRateHz,
+		Time_TicksToMs(info->lastReadTime - info->firstReadTime),
+		info->sampleGap ? "; samples lost" : "",
+		info->inputOverrun ? "; input buffer overrun" : "");
+	if (info->sampleGap || info->inputOverrun)
+		OScDev_Log_Warning(device, msg);
+	else
+		OScDev_Log_Debug(device, msg);
+}
+
+
+static void FrameDeliveryLoop(void *param)
+{
+	OScDev_Device *device = (OScDev_Device *)param;
+	OScDev_Acquisition *acq = GetData(device)->delivery.acquisition;
+	TRACE_THREAD_NAME("Frame Delivery");
+
+	uint32_t set;
+	while (WaitForFilledFrameSet(device, &set))
+	{
+		// Once the consumer has declined further frames, just recycle
+		if (Atomic_Load(&GetData(device)->delivery.consumerStopped))
+		{
+			ReleaseFrameSet(device, set);
+			CountDroppedFrame(device);
+			continue;
+		}
+
+		LogFrameInfo(device, &GetData(device)->framePool.info[set]);
+
+		TRACE_BEGIN("Deliver Frame");
+		bool shouldContinue = true;
+		int nChans = GetNumberOfEnabledChannels(device);
+		for (int ch = 0; ch < nChans; ++ch)
+		{
+			if (!OScDev_Acquisition_CallFrameCallback(acq, ch,
+				GetData(device)->frameBuffers[set][ch]))
+				shouldContinue = false;
+		}
+		ReleaseFrameSet(device, set);
+		Atomic_Increment(&GetData(device)->delivery.framesDelivered);
+		TRACE_END("Deliver Frame");
+
+		int64_t now = Time_GetTicks();
+		Counter_Add(&GetData(device)->counters.framesDelivered, 1);
+		if (Counter_Load(&GetData(device)->counters.firstDeliveryTime) == 0)
+			Counter_Store(&GetData(device)->counters.firstDeliveryTime, now);
+		Counter_Store(&GetData(device)->counters.lastDeliveryTime, now);
+
+		if (!shouldContinue)
+		{
+			GetData(device)->delivery.consumerStopTime = Time_GetTicks();
+			Atomic_Store(&GetData(device)->delivery.consumerStopped, 1);
+		}
+	}
+}
+
+
+OScDev_RichError *StartFrameDelivery(OScDev_Device *device, OScDev_Acquisition *acq)
+{
+	GetData(device)->delivery.acquisition = acq;
+	GetData(device)->delivery.stopRequested = false;
+	GetData(device)->delivery.consumerStopTime = 0;
+	Atomic_Store(&GetData(device)->delivery.consumerStopped, 0);
+
+	struct Thread *thread = Thread_Start(FrameDeliveryLoop, device);
+	if (!thread)
+		return OScDev_Error_Create("Failed to start frame delivery thread");
+
+	Mutex_Lock(&GetData(device)->frameCompletion.mutex);
+	GetData(device)->delivery.thread = thread;
+	Mutex_Unlock(&GetData(device)->frameCompletion.mutex);
+	return OScDev_RichError_OK;
+}
+
+
+// Deliver all queued frames, then stop the delivery thread
+// Must be called after the processing thread has finished the last frame.
+void StopFrameDelivery(OScDev_Device *device)
+{
+	struct Thread *thread = GetData(device)->delivery.thread;
+	if (!thread)
+		return;
+
+	Mutex_Lock(&GetData(device)->frameCompletion.mutex);
+	GetData(device)->delivery.stopRequested = true;
+	Mutex_Unlock(&GetData(device)->frameCompletion.mutex);
+	CondVar_Broadcast(&GetData(device)->frameCompletion.condition);
+
+	Thread_Join(thread);
+
+	Mutex_Lock(&GetData(device)->frameCompletion.mutex);
+	GetData(device)->delivery.thread = NULL;
+	Mutex_Unlock(&GetData(device)->frameCompletion.mutex);
+}
+
+
+// True once a frame callback has returned false, asking us to stop
+bool IsFrameConsumerStopped(OScDev_Device *device)
+{
+	return Atomic_Load(&GetData(device)->delivery.consumerStopped) != 0;
+}
+
+
+// Time (Time_GetTicks()) at which a frame callback returned false,
+// or 0
+int64_t GetFrameConsumerStopTime(OScDev_Device *device)
+{
+	if (!IsFrameConsumerStopped(device))
+		return 0;
+	return GetData(device)->delivery.consumerStopTime;
+}
+
+
+void LogFrameDeliveryStatistics(OScDev_Device *device)
+{
+	char msg[OScDev_MAX_STR_LEN + 1];
+	int32_t dropped = Atomic_Load(&GetData(device)->delivery.framesDropped);
+	snprintf(msg, OScDev_MAX_STR_LEN,
+		"Delivered %d frames, dropped %d; peak delivery queue %zd of %u frame buffer sets",
+		Atomic_Load(&GetData(device)->delivery.framesDelivered),
+		dropped, GetData(device)->delivery.queueHighWaterMark,
+		GetData(device)->framePool.numSets);
+	if (dropped > 0)
+		OScDev_Log_Warning(device, msg);
+	else
+		OScDev_Log_Debug(device, msg);
+
+	uint32_t gaps = GetData(device)->frameTiming.sampleGaps;
+	uint32_t overruns = GetData(device)->frameTiming.inputOverruns;
+	if (gaps > 0 || overruns > 0)
+	{
+		snprintf(msg, OScDev_MAX_STR_LEN,
+			"Detector lost samples %u times; input buffer overran %u times",
+			gaps, overruns);
+		OScDev_Log_Warning(device, msg);
+	}
+
+	uint32_t count = GetData(device)->frameCompletion.latencyCount;
+	if (count == 0)
+		return;
+
+	snprintf(msg, OScDev_MAX_STR_LEN,
+		"Frame latency from last sample read to start of delivery: mean %.3f ms, max %.3f ms (%u frames)",
+		GetData(device)->frameCompletion.latencyTotalMs / count,
+		GetData(device)->frameCompletion.latencyMaxMs, count);
+	OScDev_Log_Debug(device, msg);
+}
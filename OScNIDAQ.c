@@ -2,13 +2,46 @@
 #include "OScNIDAQ.h"
 #include "Waveform.h"
 
-#include <Windows.h>
 
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 
+// How often the acquisition thread checks for a stop request while waiting
+// for a scan; this bounds the time taken to stop
+static const uint32_t STOP_POLL_INTERVAL_MS = 10;
+
+
+const struct DAQBackend *GetDAQ(void)
+{
+	// Chosen during device enumeration, before any other thread exists
+	static const struct DAQBackend *backend = NULL;
+	if (!backend)
+	{
+#ifdef OSCNIDAQ_NO_DAQMX
+		backend = &SimulatedDAQBackend;
+#else
+		const char *simulate = getenv("OSCNIDAQ_SIMULATE");
+		bool useSimulation = simulate && simulate[0] && strcmp(simulate, "0") != 0;
+		backend = useSimulation ? &SimulatedDAQBackend : &DAQmxBackend;
+#endif
+		if (backend->Initialize)
+			backend->Initialize();
+
+		char msg[OScDev_MAX_STR_LEN + 1];
+		snprintf(msg, sizeof(msg), "Using %s backend", backend->name);
+		OScDev_Log_Debug(NULL, msg);
+	}
+#ifndef OSCNIDAQ_NO_TRACE
+	if (traceEnabled)
+		return GetTracingDAQ(backend);
+#endif
+	return backend;
+}
+
+
 // Must be called immediately after failed DAQmx function
 void LogNiError(OScDev_Device *device, int32 nierr, const char *when)
 {
@@ -18,7 +51,7 @@ void LogNiError(OScDev_Device *device, int32 nierr, const char *when)
 	strncat(buf, "; extended error info follows", sizeof(buf) - strlen(buf) - 1);
 	OScDev_Log_Error(device, buf);
 
-	DAQmxGetExtendedErrorInfo(buf, sizeof(buf));
+	GetDAQ()->GetExtendedErrorInfo(buf, sizeof(buf));
 	OScDev_Log_Error(device, buf);
 }
 
@@ -39,7 +72,7 @@ OScDev_RichError *CreateDAQmxError(int32 nierr)
 {
 
 	char buf[1024];
-	DAQmxGetExtendedErrorInfo(buf, sizeof(buf));
+	GetDAQ()->GetExtendedErrorInfo(buf, sizeof(buf));
 
 	if (nierr > 0)
 		OScDev_Log_Warning(NULL, buf);
@@ -55,15 +88,27 @@ OScDev_RichError *CreateDAQmxError(int32 nierr)
 static void InitializePrivateData(struct OScNIDAQPrivateData *data)
 {
 	data->lineDelay = 50;
-	data->numLinesToBuffer = 8;
+	data->acqBufferDurationMs = 500;
+	data->oversamplingFactor = 1;
+	data->numFrameSets = 3;
+	data->framesToAverage = 4;
+	data->linesToAverage = 1;
 	data->inputVoltageRange = 10.0;
 	data->minVolts_ = -10.0;
 	data->maxVolts_ = 10.0;
 
 	data->channelEnabled[0] = true;
 	
-	InitializeCriticalSection(&(data->acquisition.mutex));
-	InitializeConditionVariable(&(data->acquisition.acquisitionFinishCondition));
+	Mutex_Init(&(data->acquisition.mutex));
+	CondVar_Init(&(data->acquisition.acquisitionFinishCondition));
+
+	Mutex_Init(&(data->frameCompletion.mutex));
+	CondVar_Init(&(data->frameCompletion.condition));
+
+	Event_Init(&(data->processing.wakeEvent));
+	Event_Init(&(data->processing.drainedEvent));
+
+	Mutex_Init(&(data->rawDataCapture.mutex));
 }
 
 
@@ -73,7 +118,7 @@ OScDev_RichError *EnumerateInstances(OScDev_PtrArray **devices, OScDev_DeviceImp
 
 	// get a comma-delimited list of all of the devices installed in the system
 	char deviceNames[4096];
-	err = CreateDAQmxError(DAQmxGetSysDevNames(deviceNames, sizeof(deviceNames)));
+	err = CreateDAQmxError(GetDAQ()->GetSysDevNames(deviceNames, sizeof(deviceNames)));
 	if (err)
 		return err;
 
@@ -120,7 +165,7 @@ OScDev_Error GetVoltageRangeForDevice(OScDev_Device* device, double* minVolts, d
 		ranges[2 * i + 1] = 0.0;
 	}
 
-	int32 nierr = DAQmxGetDevAOVoltageRngs(GetData(device)->deviceName, ranges,
+	int32 nierr = GetDAQ()->GetDevAOVoltageRngs(GetData(device)->deviceName, ranges,
 		sizeof(ranges) / sizeof(float64));
 	if (nierr != 0)
 	{
@@ -149,7 +194,7 @@ OScDev_Error GetVoltageRangeForDevice(OScDev_Device* device, double* minVolts, d
 OScDev_RichError *EnumerateAIPhysChans(OScDev_Device *device)
 {
 	char *buf = malloc(1024);
-	int32 nierr = DAQmxGetDevAIPhysicalChans(GetData(device)->deviceName, buf, 1024);
+	int32 nierr = GetDAQ()->GetDevAIPhysicalChans(GetData(device)->deviceName, buf, 1024);
 	if (nierr < 0)
 		return CreateDAQmxError(nierr);
 	if (strlen(buf) == 0)
@@ -206,6 +251,23 @@ int GetNumberOfAIPhysChans(OScDev_Device *device)
 }
 
 
+// Number of samples (at the pixel rate) in each line of the scan, including
+// the line delay (undershoot) and the retrace or turnaround
+uint32_t GetElementsPerLine(OScDev_Device *device, uint32_t width)
+{
+	return GetData(device)->lineDelay + width +
+		GetXRetraceLen(GetData(device)->bidirectionalScan);
+}
+
+
+// Number of lines scanned for each frame, excluding the Y retrace; with line
+// averaging, each line of the frame is scanned several times
+uint32_t GetScanLinesPerFrame(OScDev_Device *device, uint32_t height)
+{
+	return height * GetData(device)->linesToAverage;
+}
+
+
 // Return the index-th physical channel, or empty string if no such channel
 void GetAIPhysChan(OScDev_Device *device, int index, char *buf, size_t bufsiz)
 {
@@ -238,7 +300,7 @@ void GetAIPhysChan(OScDev_Device *device, int index, char *buf, size_t bufsiz)
 
 // convert comma comma - delimited device list to a 2D string array
 // each row contains the name of one device
-static OScDev_RichError *ParseDeviceNameList(char *names,
+OScDev_RichError *ParseDeviceNameList(char *names,
 	char (*deviceNames)[OScDev_MAX_STR_LEN + 1], size_t *deviceCount)
 {
 	const char s[3] = ", ";
@@ -306,7 +368,7 @@ OScDev_RichError *CloseDAQ(OScDev_Device *device)
 }
 
 
-static OScDev_RichError *GetTerminalNameWithDevPrefix(TaskHandle taskHandle, const char terminalName[], char triggerName[])
+OScDev_RichError *GetTerminalNameWithDevPrefix(TaskHandle taskHandle, const char terminalName[], char triggerName[])
 {
 	int32	error = 0;
 	char	device[256];
@@ -314,14 +376,14 @@ static OScDev_RichError *GetTerminalNameWithDevPrefix(TaskHandle taskHandle, con
 	uInt32	numDevices, i = 1;
 	OScDev_RichError *err;
 
-	err = CreateDAQmxError(DAQmxGetTaskNumDevices(taskHandle, &numDevices));
+	err = CreateDAQmxError(GetDAQ()->GetTaskNumDevices(taskHandle, &numDevices));
 	if (err)
 		return err;
 	while (i <= numDevices) {
-		err = CreateDAQmxError(DAQmxGetNthTaskDevice(taskHandle, i++, device, 256));
+		err = CreateDAQmxError(GetDAQ()->GetNthTaskDevice(taskHandle, i++, device, 256));
 		if (err)
 			return err;
-		err = CreateDAQmxError(DAQmxGetDevProductCategory(device, &productCategory));
+		err = CreateDAQmxError(GetDAQ()->GetDevProductCategory(device, &productCategory));
 		if (err)
 			return err;
 		if (productCategory != DAQmx_Val_CSeriesModule && productCategory != DAQmx_Val_SCXIModule) {
@@ -341,23 +403,24 @@ static OScDev_RichError *GetTerminalNameWithDevPrefix(TaskHandle taskHandle, con
 static OScDev_RichError *StartScan(OScDev_Device *device)
 {
 	OScDev_RichError *err;
+	TRACE_BEGIN("StartScan");
 	if (!GetData(device)->scannerOnly) {
 		err = StartDetector(device, &GetData(device)->detectorConfig);
 		if (err)
-			return err;
+			goto cleanup;
 	}		
 	else
 		OScDev_Log_Debug(device, "DAQ not used as detector");
 
 	err = StartClock(device, &GetData(device)->clockConfig);
 	if (err)
-		return err;
+		goto cleanup;
 
 	err = StartScanner(device, &GetData(device)->scannerConfig);
-	if (err)
-		return err;
 
-	return OScDev_RichError_OK;
+cleanup:
+	TRACE_END("StartScan");
+	return err;
 }
 
 
@@ -373,28 +436,92 @@ static OScDev_RichError *WaitScanToFinish(OScDev_Device *device, OScDev_Acquisit
 	// but the waveform generation is not done yet -- thus nierr 200010:
 	// "Finite acquisition or generation has been stopped before the requested number
 	// of samples were acquired or generated."
-	// So need to wait some miliseconds till waveform generation is done before stop the task.
-	uint32_t xLen = GetData(device)->lineDelay + width + X_RETRACE_LEN;
-	uint32_t yLen = height + Y_RETRACE_LEN;
-	uint32_t yRetraceTime = (uint32_t)(1e3 * xLen * Y_RETRACE_LEN / pixelRateHz);
-	uint32_t estFrameTime = (uint32_t)(1e3 * xLen * yLen / pixelRateHz);
-	// TODO: casting
-	uint32_t waitScanToFinish = GetData(device)->scannerOnly ? estFrameTime : yRetraceTime;  // wait longer if no real acquisition;
+	// So wait until the hardware reports that the generation is done. By the
+	// time we get here this is normally already the case, so the wait
+	// returns immediately; the timeout only guards against a stalled task.
+	uint32_t xLen = GetElementsPerLine(device, width);
+	uint32_t yLen = GetScanLinesPerFrame(device, height) + Y_RETRACE_LEN;
+	double estFrameTimeSec = xLen * yLen / pixelRateHz;
+	double timeoutSec = 2.0 * estFrameTimeSec + 1.0;
+
+	int64_t start = Time_GetTicks();
+
+	OScDev_RichError *err;
+	err = WaitForScannerDone(device, &GetData(device)->scannerConfig, timeoutSec);
+	if (err)
+		return err;
+	err = WaitForClockDone(device, &GetData(device)->clockConfig, timeoutSec);
+	if (err)
+		return err;
+
 	char msg[OScDev_MAX_STR_LEN + 1];
-	snprintf(msg, OScDev_MAX_STR_LEN, "Wait %d ms for scan to finish...", waitScanToFinish);
+	snprintf(msg, OScDev_MAX_STR_LEN, "Waited %.2f ms for scan to finish",
+		Time_TicksToMs(Time_GetTicks() - start));
 	OScDev_Log_Debug(device, msg);
-	Sleep(waitScanToFinish);
 
 	return OScDev_RichError_OK;
 }
 
 
+// Dead time statistics; see deadTime in OScNIDAQPrivateData
+static void ResetDeadTime(OScDev_Device *device)
+{
+	GetData(device)->deadTime.lastScanEndTime = 0;
+	GetData(device)->deadTime.count = 0;
+	GetData(device)->deadTime.totalMs = 0.0;
+	GetData(device)->deadTime.maxMs = 0.0;
+}
+
+
+static void RecordScanStart(OScDev_Device *device)
+{
+	if (GetData(device)->deadTime.lastScanEndTime == 0)
+		return;
+
+	int64_t ticks = Time_GetTicks() - GetData(device)->deadTime.lastScanEndTime;
+	double ms = Time_TicksToMs(ticks);
+
+	GetData(device)->deadTime.count++;
+	GetData(device)->deadTime.totalMs += ms;
+	if (ms > GetData(device)->deadTime.maxMs)
+		GetData(device)->deadTime.maxMs = ms;
+	Counter_Add(&GetData(device)->counters.deadTimeCount, 1);
+	Counter_Add(&GetData(device)->counters.deadTimeTicks, ticks);
+
+	char msg[OScDev_MAX_STR_LEN + 1];
+	snprintf(msg, OScDev_MAX_STR_LEN, "Dead time since previous frame: %.2f ms", ms);
+	OScDev_Log_Debug(device, msg);
+}
+
+
+static void RecordScanEnd(OScDev_Device *device)
+{
+	GetData(device)->deadTime.lastScanEndTime = Time_GetTicks();
+}
+
+
+static void LogDeadTimeStatistics(OScDev_Device *device)
+{
+	uint32_t count = GetData(device)->deadTime.count;
+	if (count == 0)
+		return;
+
+	char msg[OScDev_MAX_STR_LEN + 1];
+	snprintf(msg, OScDev_MAX_STR_LEN,
+		"Dead time between frames: mean %.2f ms, max %.2f ms (%u intervals)",
+		GetData(device)->deadTime.totalMs / count,
+		GetData(device)->deadTime.maxMs, count);
+	OScDev_Log_Debug(device, msg);
+}
+
+
 
 // stop running tasks
 // need to stop detector first, then clock and scanner
 static OScDev_RichError *StopScan(OScDev_Device *device, OScDev_Acquisition *acq)
 {
 	OScDev_RichError *err, *lastErr = OScDev_RichError_OK;
+	TRACE_BEGIN("StopScan");
 
 	// Stopping a task may return an error if it failed, so make sure to stop
 	// all tasks even if we get errors.
@@ -405,16 +532,16 @@ static OScDev_RichError *StopScan(OScDev_Device *device, OScDev_Acquisition *acq
 			lastErr = err;
 	}
 
-	// When scanRate is low, it takes longer to finish generating scan waveform.
-	// Since acquisition only takes a portion of the total scan time,
-	// it may occur that waveform task is stopped right after acquisition is done
-	// but the waveform generation is not done yet -- thus nierr 200010:
-	// "Finite acquisition or generation has been stopped before the requested number
-	// of samples were acquired or generated."
-	// So need to wait some miliseconds till waveform generation is done before stop the task.
-	err = WaitScanToFinish(device, acq);
-	if (err)
-		return err;
+	// Finite generation must be complete before the tasks are stopped (see
+	// WaitScanToFinish()). When the tasks run for the whole sequence,
+	// StreamFrames() waits if appropriate. If the wait fails (the tasks have
+	// stalled), they must still be stopped.
+	if (!GetData(device)->streamSequence)
+	{
+		err = WaitScanToFinish(device, acq);
+		if (err)
+			lastErr = err;
+	}
 
 	err = StopClock(device, &GetData(device)->clockConfig);
 	if (err)
@@ -424,75 +551,177 @@ static OScDev_RichError *StopScan(OScDev_Device *device, OScDev_Acquisition *acq
 	if (err)
 		lastErr = err;
 
+	TRACE_END("StopScan");
 	return lastErr;
 }
 
 
+// The user asked to stop, or a frame callback returned false
+static bool ShouldStopAcquisition(OScDev_Device *device)
+{
+	bool stopRequested;
+	Mutex_Lock(&(GetData(device)->acquisition.mutex));
+	stopRequested = GetData(device)->acquisition.stopRequested;
+	Mutex_Unlock(&(GetData(device)->acquisition.mutex));
+	return stopRequested || IsFrameConsumerStopped(device);
+}
+
+
+// Time (Time_GetTicks()) at which we were first asked to stop, by
+// the user or by a frame callback; 0 if not asked
+static int64_t GetStopRequestTime(OScDev_Device *device)
+{
+	int64_t requestTime;
+	Mutex_Lock(&(GetData(device)->acquisition.mutex));
+	requestTime = GetData(device)->acquisition.stopRequestTime;
+	Mutex_Unlock(&(GetData(device)->acquisition.mutex));
+
+	int64_t consumerStopTime = GetFrameConsumerStopTime(device);
+	if (consumerStopTime != 0 && (requestTime == 0 || consumerStopTime < requestTime))
+		requestTime = consumerStopTime;
+	return requestTime;
+}
+
+
+// Cut the current scan short: abort all tasks without waiting for the frame
+// to be completed, and return the galvos to their resting position
+static OScDev_RichError *AbortScan(OScDev_Device *device)
+{
+	OScDev_RichError *err, *lastErr = OScDev_RichError_OK;
+
+	// Stop the galvos first; as in StopScan(), stop all tasks even if we get
+	// errors
+	err = AbortScanner(device, &GetData(device)->scannerConfig);
+	if (err)
+		lastErr = err;
+
+	err = AbortClock(device, &GetData(device)->clockConfig);
+	if (err)
+		lastErr = err;
+
+	if (!GetData(device)->scannerOnly) {
+		err = AbortDetector(device, &GetData(device)->detectorConfig);
+		if (err)
+			lastErr = err;
+	}
+
+	err = ParkScanner(device, &GetData(device)->scannerConfig);
+	if (err)
+		lastErr = err;
+
+	int64_t requestTime = GetStopRequestTime(device);
+	if (requestTime != 0)
+	{
+		char msg[OScDev_MAX_STR_LEN + 1];
+		snprintf(msg, OScDev_MAX_STR_LEN,
+			"Aborted scan and parked galvos %.1f ms after stop request",
+			Time_TicksToMs(Time_GetTicks() - requestTime));
+		OScDev_Log_Debug(device, msg);
+	}
+
+	return lastErr;
+}
+
+
+// Wait for the finite waveform of the current frame to be generated,
+// checking for a stop request so that a slow frame can be cut short; in
+// which case the scan is aborted and *aborted set to true. Returns as soon
+// as the hardware is done, so that no dead time is added between frames.
+static OScDev_RichError *WaitScanOrAbort(OScDev_Device *device, uint32_t timeoutMs, bool *aborted)
+{
+	*aborted = false;
+	uint64_t startTime = Time_GetMs();
+	for (;;)
+	{
+		OScDev_RichError *err;
+		bool done;
+		err = WaitForScannerDoneWithin(device, &GetData(device)->scannerConfig,
+			STOP_POLL_INTERVAL_MS / 1e3, &done);
+		if (err)
+			return err;
+		if (done)
+			return OScDev_RichError_OK;
+
+		if (ShouldStopAcquisition(device))
+		{
+			*aborted = true;
+			return AbortScan(device);
+		}
+
+		if (Time_GetMs() - startTime > timeoutMs)
+			return OScDev_Error_Create("Timed out waiting for scan to finish");
+	}
+}
+
+
 // DAQ version; acquire from multiple channels
+// The frame is delivered asynchronously by the frame delivery thread.
 static OScDev_RichError *ReadImage(OScDev_Device *device, OScDev_Acquisition *acq)
 {
 	double pixelRateHz = OScDev_Acquisition_GetPixelRate(acq);
 	uint32_t xOffset, yOffset, width, height;
 	OScDev_Acquisition_GetROI(acq, &xOffset, &yOffset, &width, &height);
 
-	uint32_t elementsPerLine = GetData(device)->lineDelay + width + X_RETRACE_LEN;
-	uint32_t scanLines = height;
+	uint32_t elementsPerLine = GetElementsPerLine(device, width);
+	uint32_t scanLines = GetScanLinesPerFrame(device, height);
 	int32 elementsPerFramePerChan = elementsPerLine * scanLines;
 	size_t nPixels = width * height;
 
-	GetData(device)->oneFrameScanDone = false;
-	GetData(device)->framePixelsFilled = 0;
+	DiscardPartialFrame(device);
+	GetData(device)->stream.active = false;
 
-	uint32_t yLen = height + Y_RETRACE_LEN;
+	uint32_t yLen = GetScanLinesPerFrame(device, height) + Y_RETRACE_LEN;
 	uint32_t estFrameTimeMs = (uint32_t)(1e3 * elementsPerLine * yLen / pixelRateHz);
-	uint32_t totalWaitTimeMs = 0;
-
-	OScDev_RichError *err;
-	err = StartScan(device);
-	if (err)
-		return err;
 
-	// Wait for scan to complete
-	err = CreateDAQmxError(DAQmxWaitUntilTaskDone(GetData(device)->scannerConfig.aoTask,
-		2 * estFrameTimeMs * 1e-3));
-	if (err) {
-		err = OScDev_Error_Wrap(err, "Failed to wait for scanner task to finish");
-		return err;
-	}
+	bool scannerOnly = GetData(device)->scannerOnly;
 
-	// Wait for data
-	if (!GetData(device)->scannerOnly)
+	// Under the block policy, apply backpressure by not scanning until there
+	// is a frame buffer set to fill
+	if (!scannerOnly && GetData(device)->deliveryPolicy == FrameDeliveryPolicy_Block)
 	{
-		while (!GetData(device)->oneFrameScanDone) {
-			Sleep(1);
-			totalWaitTimeMs += 1;
-			if (totalWaitTimeMs > 2 * estFrameTimeMs)
-			{
-				OScDev_Log_Error(device, "Error: Acquisition timeout!");
-				break;
-			}
+		while (!WaitForFreeFrameSet(device, 100))
+		{
+			if (ShouldStopAcquisition(device))
+				return OScDev_RichError_OK;
 		}
-		char msg[OScDev_MAX_STR_LEN + 1];
-		snprintf(msg, OScDev_MAX_STR_LEN, "Total wait time is %d ", totalWaitTimeMs);
-		OScDev_Log_Debug(device, msg);
 	}
 
-	err = StopScan(device, acq);
-	if (err)
-		return err;
+	uint32_t framesFinished = GetFramesFinished(device);
 
-	if (!GetData(device)->scannerOnly)
+	// When averaging frames, scan repeatedly; the processing thread finishes
+	// the frame with the last scan
+	uint32_t numScans = GetScansPerFrame(device);
+	for (uint32_t scan = 0; scan < numScans; ++scan)
 	{
-		int nChans = GetNumberOfEnabledChannels(device);
-		for (int ch = 0; ch < nChans; ++ch)
+		if (scan > 0 && ShouldStopAcquisition(device))
+			break;
+
+		OScDev_RichError *err;
+		err = StartScan(device);
+		if (err)
+			return err;
+		RecordScanStart(device);
+
+		// Wait for scan to complete, unless asked to stop
+		bool aborted;
+		err = WaitScanOrAbort(device, 2 * estFrameTimeMs, &aborted);
+		if (err)
+			return err;
+		if (aborted)
+			break;
+		RecordScanEnd(device);
+
+		// Wait for data
+		if (!scannerOnly && scan == numScans - 1)
 		{
-			bool shouldContinue = OScDev_Acquisition_CallFrameCallback(acq,
-				ch, GetData(device)->frameBuffers[ch]);
-			if (!shouldContinue)
-			{
-				// TODO Stop acquisition
-			}
+			if (!WaitForFramesFinished(device, framesFinished + 1, 2 * estFrameTimeMs) &&
+				!HasDetectorFailed(device)) // Reported by StopScan()
+				OScDev_Log_Error(device, "Error: Acquisition timeout!");
 		}
+
+		err = StopScan(device, acq);
+		if (err)
+			return err;
 	}
 
 	return OScDev_RichError_OK;
@@ -512,65 +741,242 @@ static OScDev_RichError *AcquireFrame(OScDev_Device *device, OScDev_Acquisition
 }
 
 
-static DWORD WINAPI AcquisitionLoop(void *param)
+// Acquire a whole sequence with a single start and stop of the tasks, which
+// either generate the configured number of frames or run continuously (see
+// streamSequence). The detector processing thread splits the stream into
+// frames and queues them for the frame delivery thread, so there is no dead
+// time between frames.
+static OScDev_RichError *StreamFrames(OScDev_Device *device, OScDev_Acquisition *acq,
+	uint32_t totalFrames)
+{
+	double pixelRateHz = OScDev_Acquisition_GetPixelRate(acq);
+	uint32_t xOffset, yOffset, width, height;
+	OScDev_Acquisition_GetROI(acq, &xOffset, &yOffset, &width, &height);
+
+	uint32_t elementsPerLine = GetElementsPerLine(device, width);
+	uint32_t yLen = GetScanLinesPerFrame(device, height) + Y_RETRACE_LEN;
+	uint32_t estFrameTimeMs = (uint32_t)(1e3 * elementsPerLine * yLen / pixelRateHz);
+
+	bool scannerOnly = GetData(device)->scannerOnly;
+	DiscardPartialFrame(device);
+	GetData(device)->stream.retracePixelsToSkip = 0;
+	GetData(device)->stream.framesToDeliver = totalFrames;
+	GetData(device)->stream.framesCompleted = 0;
+	Atomic_Store(&GetData(device)->stream.finished, 0);
+	GetData(device)->stream.active = !scannerOnly;
+
+	OScDev_RichError *err;
+	err = StartScan(device);
+	if (err)
+		return err;
+
+	uint64_t startTime = Time_GetMs();
+	uint64_t lastProgressTime = startTime;
+	uint32_t framesFinished = GetFramesFinished(device);
+	uint32_t firstFrame = framesFinished;
+	bool acquiredAll = false;
+	bool stopped = false;
+	for (;;)
+	{
+		if (ShouldStopAcquisition(device))
+		{
+			stopped = true;
+			break;
+		}
+
+		if (scannerOnly)
+		{
+			if (Time_GetMs() - startTime >=
+				(uint64_t)totalFrames * GetScansPerFrame(device) * estFrameTimeMs)
+			{
+				acquiredAll = true;
+				break;
+			}
+			Time_SleepMs(STOP_POLL_INTERVAL_MS);
+			continue;
+		}
+
+		if (Atomic_Load(&GetData(device)->stream.finished))
+		{
+			acquiredAll = true;
+			break;
+		}
+
+		// AbortScan() shuts down the failed detector and reports the error
+		if (HasDetectorFailed(device))
+		{
+			stopped = true;
+			break;
+		}
+
+		// Wait in short slices so that stop requests are noticed
+		if (WaitForFramesFinished(device, framesFinished + 1, STOP_POLL_INTERVAL_MS))
+		{
+			framesFinished = GetFramesFinished(device);
+			lastProgressTime = Time_GetMs();
+		}
+		else if (Time_GetMs() - lastProgressTime >
+			2 * (uint64_t)estFrameTimeMs * GetScansPerFrame(device) + 1000)
+		{
+			OScDev_Log_Error(device, "Error: Acquisition timeout!");
+			break;
+		}
+	}
+
+	// Discard anything acquired after this point
+	Atomic_Store(&GetData(device)->stream.finished, 1);
+
+	// Let finite tasks complete the final Y retrace before stopping them;
+	// if stopped early, they are just cut short
+	if (acquiredAll && GetData(device)->streamFrames > 0)
+	{
+		err = WaitScanToFinish(device, acq);
+		if (err)
+		{
+			char msg[OScDev_MAX_STR_LEN + 1];
+			OScDev_Error_FormatRecursive(err, msg, sizeof(msg));
+			OScDev_Log_Error(device, msg);
+			OScDev_Error_Destroy(err);
+		}
+	}
+
+	// When asked to stop, do not wait for the frame in progress
+	if (stopped)
+		err = AbortScan(device);
+	else
+		err = StopScan(device, acq);
+
+	char msg[OScDev_MAX_STR_LEN + 1];
+	snprintf(msg, OScDev_MAX_STR_LEN, "Streamed %u frames in %llu ms",
+		GetFramesFinished(device) - firstFrame,
+		(unsigned long long)(Time_GetMs() - startTime));
+	OScDev_Log_Debug(device, msg);
+
+	return err;
+}
+
+
+static void AcquisitionLoop(void *param)
 {
 	OScDev_Device *device = (OScDev_Device *)param;
 	OScDev_Acquisition *acq = GetData(device)->acquisition.acquisition;
 
 	uint32_t totalFrames = OScDev_Acquisition_GetNumberOfFrames(acq);
 
-	for (uint32_t frame = 0; frame < totalFrames; ++frame)
+	TRACE_THREAD_NAME("Acquisition");
+	TRACE_BEGIN("AcquisitionLoop");
+	ResetFramePool(device, true);
+	ResetFrameAveraging(device);
+	ResetDeadTime(device);
+
+	OScDev_RichError *err;
+	if (!GetData(device)->scannerOnly)
 	{
-		bool stopRequested;
-		EnterCriticalSection(&(GetData(device)->acquisition.mutex));
-		stopRequested = GetData(device)->acquisition.stopRequested;
-		LeaveCriticalSection(&(GetData(device)->acquisition.mutex));
-		if (stopRequested)
-			break;
+		// Failing to capture does not stop the acquisition
+		err = StartRawDataCapture(device);
+		if (err)
+		{
+			char msg[OScDev_MAX_STR_LEN + 1];
+			OScDev_Error_FormatRecursive(err, msg, sizeof(msg));
+			OScDev_Log_Error(device, msg);
+			OScDev_Error_Destroy(err);
+		}
+	}
 
+	err = StartFrameDelivery(device, acq);
+	if (err)
+	{
+		err = OScDev_Error_Wrap(err, "Error during sequence acquisition");
 		char msg[OScDev_MAX_STR_LEN + 1];
-		snprintf(msg, OScDev_MAX_STR_LEN, "Sequence acquiring frame # %d", frame);
-		OScDev_Log_Debug(device, msg);
-
-		OScDev_RichError *err;
-		err = AcquireFrame(device, acq);
+		OScDev_Error_FormatRecursive(err, msg, sizeof(msg));
+		OScDev_Log_Error(device, msg);
+	}
+	else if (GetData(device)->streamSequence)
+	{
+		err = StreamFrames(device, acq, totalFrames);
 		if (err)
 		{
 			err = OScDev_Error_Wrap(err, "Error during sequence acquisition");
 			char msg[OScDev_MAX_STR_LEN + 1];
 			OScDev_Error_FormatRecursive(err, msg, sizeof(msg));
 			OScDev_Log_Error(device, msg);
-			break;
 		}
 	}
+	else
+	{
+		for (uint32_t frame = 0; frame < totalFrames; ++frame)
+		{
+			if (ShouldStopAcquisition(device))
+				break;
 
-	EnterCriticalSection(&(GetData(device)->acquisition.mutex));
-	GetData(device)->acquisition.running = false;
-	LeaveCriticalSection(&(GetData(device)->acquisition.mutex));
-	CONDITION_VARIABLE *cv = &(GetData(device)->acquisition.acquisitionFinishCondition);
-	WakeAllConditionVariable(cv);
+			char msg[OScDev_MAX_STR_LEN + 1];
+			snprintf(msg, OScDev_MAX_STR_LEN, "Sequence acquiring frame # %d", frame);
+			OScDev_Log_Debug(device, msg);
+
+			TRACE_BEGIN("AcquireFrame");
+			err = AcquireFrame(device, acq);
+			TRACE_END("AcquireFrame");
+			if (err)
+			{
+				err = OScDev_Error_Wrap(err, "Error during sequence acquisition");
+				char msg[OScDev_MAX_STR_LEN + 1];
+				OScDev_Error_FormatRecursive(err, msg, sizeof(msg));
+				OScDev_Log_Error(device, msg);
+				break;
+			}
+		}
+	}
+
+	// Deliver the frames still queued before reporting the acquisition as
+	// finished
+	StopFrameDelivery(device);
+	StopRawDataCapture(device);
+	TRACE_END("AcquisitionLoop");
 
-	return 0;
+	if (!GetData(device)->scannerOnly)
+		LogFrameDeliveryStatistics(device);
+	LogDeadTimeStatistics(device);
+
+	Mutex_Lock(&(GetData(device)->acquisition.mutex));
+	GetData(device)->acquisition.running = false;
+	Mutex_Unlock(&(GetData(device)->acquisition.mutex));
+	struct CondVar *cv = &(GetData(device)->acquisition.acquisitionFinishCondition);
+	CondVar_Broadcast(cv);
 }
 
 
 OScDev_RichError *RunAcquisitionLoop(OScDev_Device *device)
 {
-	DWORD id;
-	GetData(device)->acquisition.thread =
-		CreateThread(NULL, 0, AcquisitionLoop, device, 0, &id);
+	// The thread of the previous acquisition has finished, or is about to
+	if (GetData(device)->acquisition.thread)
+		Thread_Join(GetData(device)->acquisition.thread);
+
+	GetData(device)->acquisition.thread = Thread_Start(AcquisitionLoop, device);
+	if (!GetData(device)->acquisition.thread)
+	{
+		Mutex_Lock(&(GetData(device)->acquisition.mutex));
+		GetData(device)->acquisition.running = false;
+		Mutex_Unlock(&(GetData(device)->acquisition.mutex));
+		CondVar_Broadcast(&(GetData(device)->acquisition.acquisitionFinishCondition));
+		return OScDev_Error_Create("Failed to start acquisition thread");
+	}
 	return OScDev_RichError_OK;
 }
 
 
 OScDev_RichError *StopAcquisitionAndWait(OScDev_Device *device)
 {
-	CRITICAL_SECTION *mutex = &GetData(device)->acquisition.mutex;
-	CONDITION_VARIABLE *cv = &(GetData(device)->acquisition.acquisitionFinishCondition);
+	struct Mutex *mutex = &GetData(device)->acquisition.mutex;
+	struct CondVar *cv = &(GetData(device)->acquisition.acquisitionFinishCondition);
+
+	int64_t requestTime = Time_GetTicks();
 
-	EnterCriticalSection(mutex);
+	Mutex_Lock(mutex);
+	bool wasRunning = GetData(device)->acquisition.running;
 	if (GetData(device)->acquisition.started) {
 		GetData(device)->acquisition.stopRequested = true;
+		if (GetData(device)->acquisition.stopRequestTime == 0)
+			GetData(device)->acquisition.stopRequestTime = requestTime;
 	}
 	else { // Armed but not started
 		GetData(device)->acquisition.running = false;
@@ -578,9 +984,17 @@ OScDev_RichError *StopAcquisitionAndWait(OScDev_Device *device)
 
 	while (GetData(device)->acquisition.running)
 	{
-		SleepConditionVariableCS(cv, mutex, INFINITE);
+		CondVar_Wait(cv, mutex, WAIT_FOREVER);
+	}
+	Mutex_Unlock(mutex);
+
+	if (wasRunning)
+	{
+		char msg[OScDev_MAX_STR_LEN + 1];
+		snprintf(msg, OScDev_MAX_STR_LEN, "Acquisition stopped %.1f ms after stop request",
+			Time_TicksToMs(Time_GetTicks() - requestTime));
+		OScDev_Log_Debug(device, msg);
 	}
-	LeaveCriticalSection(mutex);
 
 	return OScDev_RichError_OK;
 }
@@ -588,24 +1002,24 @@ OScDev_RichError *StopAcquisitionAndWait(OScDev_Device *device)
 
 OScDev_RichError *IsAcquisitionRunning(OScDev_Device *device, bool *isRunning)
 {
-	EnterCriticalSection(&(GetData(device)->acquisition.mutex));
+	Mutex_Lock(&(GetData(device)->acquisition.mutex));
 	*isRunning = GetData(device)->acquisition.running;
-	LeaveCriticalSection(&(GetData(device)->acquisition.mutex));
+	Mutex_Unlock(&(GetData(device)->acquisition.mutex));
 	return OScDev_RichError_OK;
 }
 
 
 OScDev_RichError *WaitForAcquisitionToFinish(OScDev_Device *device)
 {
-	CRITICAL_SECTION *mutex = &GetData(device)->acquisition.mutex;
-	CONDITION_VARIABLE *cv = &(GetData(device)->acquisition.acquisitionFinishCondition);
+	struct Mutex *mutex = &GetData(device)->acquisition.mutex;
+	struct CondVar *cv = &(GetData(device)->acquisition.acquisitionFinishCondition);
 
-	EnterCriticalSection(mutex);
+	Mutex_Lock(mutex);
 	while (GetData(device)->acquisition.running)
 	{
-		SleepConditionVariableCS(cv, mutex, INFINITE);
+		CondVar_Wait(cv, mutex, WAIT_FOREVER);
 	}
-	LeaveCriticalSection(mutex);
+	Mutex_Unlock(mutex);
 
 	return OScDev_RichError_OK;
 }
@@ -622,6 +1036,7 @@ OScDev_RichError *ReconfigDAQ(OScDev_Device *device, OScDev_Acquisition *acq)
 		GetData(device)->clockConfig.mustReconfigureTiming = true;
 		GetData(device)->scannerConfig.mustReconfigureTiming = true;
 		GetData(device)->detectorConfig.mustReconfigureTiming = true;
+		GetData(device)->detectorConfig.mustReconfigureCallback = true; // Callback interval
 	}
 	if (resolution != GetData(device)->configuredResolution) {
 		GetData(device)->scannerConfig.mustReconfigureTiming = true;
@@ -645,19 +1060,50 @@ OScDev_RichError *ReconfigDAQ(OScDev_Device *device, OScDev_Acquisition *acq)
 		GetData(device)->detectorConfig.mustReconfigureCallback = true;
 	}
 
+	// A bounded sequence of several frames is generated in one go, with the
+	// one-frame waveforms regenerated for every frame (including each frame
+	// scanned for averaging)
+	uint32_t numFrames = OScDev_Acquisition_GetNumberOfFrames(acq);
+	bool bounded = numFrames != UNBOUNDED_FRAME_COUNT;
+	uint64_t numScans = (uint64_t)numFrames * GetScansPerFrame(device);
+	bool streamSequence = GetData(device)->continuousStreaming || (bounded && numScans > 1);
+	uint32_t streamFrames = 0;
+	if (streamSequence && bounded && numScans < UNBOUNDED_FRAME_COUNT)
+		streamFrames = (uint32_t)numScans;
+	if (streamSequence != GetData(device)->streamSequence ||
+		streamFrames != GetData(device)->streamFrames) {
+		GetData(device)->clockConfig.mustReconfigureTiming = true;
+		GetData(device)->clockConfig.mustReconfigureTriggers = true;
+		GetData(device)->clockConfig.mustRewriteOutput = true;
+		GetData(device)->scannerConfig.mustReconfigureTiming = true;
+		GetData(device)->scannerConfig.mustRewriteOutput = true;
+	}
+	GetData(device)->streamSequence = streamSequence;
+	GetData(device)->streamFrames = streamFrames;
+
 	// Note that additional setting of 'mustReconfigure' flags occurs in settings
 
 	OScDev_RichError *err;
 
+	// Check before touching any task, so that we fail cleanly
+	if (GetData(device)->bidirectionalScan && GetScanLinesPerFrame(device, height) % 2 != 0)
+		return OScDev_Error_Create("Bidirectional scan requires an even number of lines (times lines to average)");
+
+	TRACE_BEGIN("SetUpClock");
 	err = SetUpClock(device, &GetData(device)->clockConfig, acq);
+	TRACE_END("SetUpClock");
 	if (err)
 		return err;
+	TRACE_BEGIN("SetUpScanner");
 	err = SetUpScanner(device, &GetData(device)->scannerConfig, acq);
+	TRACE_END("SetUpScanner");
 	if (err)
 		return err;
 	if (!GetData(device)->scannerOnly)
 	{
+		TRACE_BEGIN("SetUpDetector");
 		err = SetUpDetector(device, &GetData(device)->detectorConfig, acq);
+		TRACE_END("SetUpDetector");
 		if (err)
 			return err;
 	}
@@ -7,7 +7,6 @@
 
 #include <string.h>
 
-#include <Windows.h>
 
 // Forward declaration
 static OScDev_DeviceImpl DeviceImpl;
@@ -20,7 +19,7 @@ static OScDev_Error NIDAQGetModelName(const char **name)
 }
 
 
-static OScDev_Error NIDAQEnumerateInstances(OScDev_PtrArray **devices)
+OScDev_Error NIDAQEnumerateInstances(OScDev_PtrArray **devices)
 {
 	OScDev_RichError* err = EnumerateInstances(devices, &DeviceImpl);
 	return OScDev_Error_ReturnAsCode(err);
@@ -44,7 +43,7 @@ static OScDev_Error NIDAQGetName(OScDev_Device *device, char *name)
 
 static OScDev_Error NIDAQOpen(OScDev_Device *device)
 {
-	int32 nierr = DAQmxResetDevice(GetData(device)->deviceName); // TODO wrong function
+	int32 nierr = GetDAQ()->ResetDevice(GetData(device)->deviceName); // TODO wrong function
 	if (nierr)
 	{
 		OScDev_RichError* err = CreateDAQmxError(nierr);
@@ -182,67 +181,73 @@ static OScDev_Error NIDAQArm(OScDev_Device *device, OScDev_Acquisition *acq)
 	}
 
 	OScDev_RichError *err;
-	CRITICAL_SECTION *mutex = &GetData(device)->acquisition.mutex;
-	EnterCriticalSection(mutex);
+	struct Mutex *mutex = &GetData(device)->acquisition.mutex;
+	Mutex_Lock(mutex);
 	{
 		if (GetData(device)->acquisition.running)
 		{
 			// TODO Error should be "already armed"
-			LeaveCriticalSection(mutex);
+			Mutex_Unlock(mutex);
 			return OScDev_Error_ReturnAsCode(OScDev_Error_Create("Device already armed"));
 		}
+		TRACE_BEGIN("NIDAQArm");
 
 		GetData(device)->acquisition.acquisition = acq;
 
 		GetData(device)->acquisition.stopRequested = false;
+		GetData(device)->acquisition.stopRequestTime = 0;
 		GetData(device)->acquisition.running = true;
 		GetData(device)->acquisition.armed = false;
 		GetData(device)->acquisition.started = false;
 	}
-	LeaveCriticalSection(mutex);
+	Mutex_Unlock(mutex);
 
+	TRACE_BEGIN("ReconfigDAQ");
 	err = ReconfigDAQ(device, acq);
+	TRACE_END("ReconfigDAQ");
 	if (err)
 		goto error;
 
-	EnterCriticalSection(&(GetData(device)->acquisition.mutex));
+	Mutex_Lock(&(GetData(device)->acquisition.mutex));
 	{
 		GetData(device)->acquisition.armed = true;
 	}
-	LeaveCriticalSection(&(GetData(device)->acquisition.mutex));
+	Mutex_Unlock(&(GetData(device)->acquisition.mutex));
 
+	TRACE_END("NIDAQArm");
 	return OScDev_OK;
 
 error:
-	EnterCriticalSection(mutex);
+	Mutex_Lock(mutex);
 	{
 		GetData(device)->acquisition.running = false;
 		GetData(device)->acquisition.acquisition = NULL;
 	}
-	LeaveCriticalSection(mutex);
+	Mutex_Unlock(mutex);
+	TRACE_END("NIDAQArm");
 	return OScDev_Error_ReturnAsCode(err);
 }
 
 
 static OScDev_Error NIDAQStart(OScDev_Device *device)
 {
-	EnterCriticalSection(&(GetData(device)->acquisition.mutex));
+	Mutex_Lock(&(GetData(device)->acquisition.mutex));
 	{
 		if (!GetData(device)->acquisition.running ||
 			!GetData(device)->acquisition.armed)
 		{
-			LeaveCriticalSection(&(GetData(device)->acquisition.mutex));
+			Mutex_Unlock(&(GetData(device)->acquisition.mutex));
 			return OScDev_Error_Not_Armed;
 		}
 		if (GetData(device)->acquisition.started)
 		{
-			LeaveCriticalSection(&(GetData(device)->acquisition.mutex));
+			Mutex_Unlock(&(GetData(device)->acquisition.mutex));
 			return OScDev_Error_Acquisition_Running;
 		}
 
 		GetData(device)->acquisition.started = true;
 	}
-	LeaveCriticalSection(&(GetData(device)->acquisition.mutex));
+	Mutex_Unlock(&(GetData(device)->acquisition.mutex));
 
 	return OScDev_Error_ReturnAsCode(RunAcquisitionLoop(device));
 }
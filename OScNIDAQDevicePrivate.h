@@ -1,13 +1,29 @@
 #pragma once
 
 #include "OpenScanDeviceLib.h"
+#include "Conversion.h"
+#include "DAQBackend.h"
+#include "Platform.h"
+#include "RingBuffer.h"
+#include "Trace.h"
 
 #include <NIDAQmx.h>
 
-#include <Windows.h>
+#include <stdio.h>
+
 
 #define MAX_PHYSICAL_CHANS 8
 
+// Maximum number of frame buffer sets in the frame pool
+#define MAX_FRAME_SETS 8
+#define NO_FRAME_SET UINT32_MAX
+
+// Number of frames taken to mean an unbounded (live) sequence
+#define UNBOUNDED_FRAME_COUNT UINT32_MAX
+
+// Pixels binned at a time when oversampling
+#define BIN_BLOCK_PIXELS 512
+
 
 // DAQmx tasks and flags to track invalidated configurations for clock
 // See Clock.c
@@ -28,6 +44,7 @@ struct ScannerConfig
 	TaskHandle aoTask;
 	bool mustReconfigureTiming;
 	bool mustRewriteOutput;
+	double parkVolts[2]; // X and Y at the start of the frame
 };
 
 
@@ -42,6 +59,90 @@ struct DetectorConfig
 };
 
 
+// A run of pixels in the raw data ring buffer, read by one detector callback
+// and queued for the processing thread
+// See Detector.c
+struct RawDataChunk
+{
+	uint64_t firstPixel; // Ring buffer cursor at start of chunk
+	uint32_t numPixels;
+	int64_t readTime; // Time_GetTicks() when read from DAQmx
+	uInt64 firstSample; // DAQmx read position (per channel) of the first scan
+	uInt64 samplesAcquired; // DAQmx total samples acquired (per channel) before the read
+};
+
+
+// Timing and integrity of a frame, carried with its frame buffer set.
+// Sample indices are per channel, counted by DAQmx from the start of the
+// detector task (i.e. from the start of the frame or sequence scanned).
+// See Detector.c
+struct FrameInfo
+{
+	uint32_t sequenceNumber; // Counts every frame finished, delivered or dropped
+	uInt64 startSample; // Of the first pixel of the frame
+	int64_t firstReadTime; // Time_GetTicks() when the first pixel was read
+	int64_t lastReadTime; // Ditto, last pixel
+	bool sampleGap; // Samples were lost during (or just before) the frame
+	bool inputOverrun; // The DAQmx input buffer was full when read
+};
+
+
+// What the processing thread does with a new frame when every frame buffer
+// set is still awaiting delivery
+// See FrameDelivery.c
+enum FrameDeliveryPolicy
+{
+	FrameDeliveryPolicy_Block, // Hold back processing (not the DAQ) for the consumer; see AcquireFreeFrameSet()
+	FrameDeliveryPolicy_DropOldest, // Overwrite the oldest undelivered frame
+	FrameDeliveryPolicy_DropNewest, // Discard the new frame
+
+	NumFrameDeliveryPolicies,
+};
+
+
+// Combination of consecutive frames into each delivered frame
+// See Detector.c
+enum FrameAveragingMode
+{
+	FrameAveraging_Off,
+	FrameAveraging_Mean, // Of each group of framesToAverage frames
+	FrameAveraging_Sum, // Of each group of framesToAverage frames; saturating
+	FrameAveraging_Exponential, // Running average with weight 1/framesToAverage
+
+	NumFrameAveragingModes,
+};
+
+
+// Quantities derived from the performance counters, each exposed as a
+// read-only setting
+// See PerformanceCounters.c
+enum PerformanceCounter
+{
+	PerfCounter_CallbacksPerSecond,
+	PerfCounter_SamplesPerCallback, // Per channel
+	PerfCounter_ProcessingUsPerCallback,
+	PerfCounter_PeakProcessingUs, // Of a single chunk
+	PerfCounter_RawDataPeakPercent, // Of the raw data ring buffer capacity
+	PerfCounter_FramesDelivered,
+	PerfCounter_FramesDropped,
+	PerfCounter_FramesPerSecond, // Delivered
+	PerfCounter_DeadTimeMsPerFrame,
+
+	NumPerformanceCounters,
+};
+
+
+// Pace at which captured raw detector data is replayed
+// See RawDataCapture.c
+enum ReplaySpeed
+{
+	ReplaySpeed_Recorded, // Each chunk at the time it was read, relative to the first
+	ReplaySpeed_Maximum, // Each chunk as soon as the previous one is processed
+
+	NumReplaySpeeds,
+};
+
+
 struct OScNIDAQPrivateData
 {
 	// The DAQmx name for the DAQ card
@@ -56,7 +157,6 @@ struct OScNIDAQPrivateData
 	uint32_t configuredXOffset, configuredYOffset;
 	uint32_t configuredRasterWidth, configuredRasterHeight;
 
-	bool oneFrameScanDone;
 	bool scannerOnly;
 
 	// counted as number of pixels. 
@@ -64,7 +164,28 @@ struct OScNIDAQPrivateData
 	// scan phase (uSec) = line delay / scan rate
 	uint32_t lineDelay; 
 
-	uint32_t numLinesToBuffer;
+	// Scan odd lines in reverse, with a short turnaround instead of a
+	// flyback between lines
+	bool bidirectionalScan;
+
+	// Run the tasks continuously for the whole sequence, rather than
+	// starting and stopping them for every frame
+	bool continuousStreaming;
+
+	// How the armed sequence is acquired, decided in ReconfigDAQ: whether
+	// the tasks run for the whole sequence rather than one frame at a time
+	// (always the case for a bounded sequence of several frames), and if so
+	// the number of frames they are configured to generate (0 to run
+	// continuously)
+	bool streamSequence;
+	uint32_t streamFrames;
+
+	// Duration of acquisition that the DAQmx input buffer can hold
+	uint32_t acqBufferDurationMs;
+	// Target interval between detector callbacks; 0 to call back every line.
+	// The actual interval is rounded to a whole number of lines dividing the
+	// frame height.
+	uint32_t callbackIntervalMs;
 	double inputVoltageRange;
 	uInt32 numDOChannels; // Number of DO lines under current clock configuration
 	double offsetXY[2];
@@ -80,28 +201,272 @@ struct OScNIDAQPrivateData
 	char *aiPhysChans; // ", "-delimited string; at least numAIPhysChans elements
 	bool channelEnabled[MAX_PHYSICAL_CHANS];
 
+	// Read raw 16-bit ADC codes (DAQmxReadBinaryI16) instead of volts
+	bool readBinarySamples;
+
+	// Number of detector samples (per channel) acquired and binned into
+	// each pixel; the AI sample clock runs at this multiple of the pixel rate
+	uint32_t oversamplingFactor;
+
+	// Frame averaging settings. With Mean or Sum, framesToAverage frames are
+	// scanned for every frame delivered; with Exponential, every frame
+	// scanned is delivered.
+	enum FrameAveragingMode averagingMode;
+	uint32_t framesToAverage;
+
+	// Line averaging: each line of the frame is scanned linesToAverage times
+	// in succession (at the same Y position) and the mean is delivered
+	uint32_t linesToAverage;
+
 	// Read, but unprocessed, raw samples; channels interleaved
-	// Leftover data from the previous read, if any, is at the start of the
-	// buffer and consists of rawDataSize samples.
-	float64 *rawDataBuffer;
-	size_t rawDataSize; // Current data size
-	size_t rawDataCapacity; // Buffer size
+	// Elements of the ring buffer are pixels, each consisting of
+	// rawDataOversampling scans (one sample for each enabled channel). The
+	// samples are int16 ADC codes if rawDataIsBinary, else float64 volts.
+	struct RingBuffer rawData;
+	bool rawDataIsBinary; // readBinarySamples at the time of configuration
+	uint32_t rawDataOversampling; // oversamplingFactor at the time of configuration
+	bool rawDataBidirectional; // bidirectionalScan at the time of configuration
+
+	// Scratch space for binned scans (BIN_BLOCK_PIXELS of them), used when
+	// rawDataOversampling > 1
+	void *binnedSamples;
+
+	// The DAQmx callback only reads into rawData and queues a RawDataChunk;
+	// conversion and frame bookkeeping happen on the processing thread.
+	// See Detector.c
+	struct
+	{
+		struct RingBuffer chunks; // Elements are struct RawDataChunk
+		struct Thread *thread;
+		struct Event wakeEvent; // Set when chunks are queued
+		struct Event drainedEvent; // Set when the queue has been emptied
+		volatile int32_t stopRequested;
+
+		// Set by the callback when it fails to read data, or by the
+		// processing thread when it fails to process it. No more data is
+		// read or processed until the detector is restarted; the
+		// acquisition thread notices and shuts the detector down (the
+		// other threads must not).
+		volatile int32_t failed;
+
+		// Maximum queue depths seen since the callback was configured, to
+		// help size the buffers
+		size_t chunkQueueHighWaterMark; // chunks
+		size_t rawDataHighWaterMark; // pixels
+
+		// Peak number of samples per channel waiting in the DAQmx input
+		// buffer at the time of a callback, and the buffer size; if the
+		// former reaches the latter, the input buffer has overrun
+		uInt32 inputBufferHighWaterMark;
+		uInt32 inputBufferSize;
+
+		// Total size of the raw data, chunk queue, frame, and averaging
+		// buffers, as last allocated
+		size_t bufferBytes;
+	} processing;
 
 	// Per-channel frame buffers that we fill in and pass to OpenScanLib
-	// Index is order among currently enabled channels.
-	// Buffers for unused channels may not be allocated.
-	uint16_t *frameBuffers[MAX_PHYSICAL_CHANS];
-	size_t framePixelsFilled;
+	// There are framePool.numSets sets, so that completed frames can be
+	// delivered while the next one is being filled.
+	// Index is [set][order among currently enabled channels].
+	// Buffers for unused sets or channels may not be allocated.
+	uint16_t *frameBuffers[MAX_FRAME_SETS][MAX_PHYSICAL_CHANS];
+	size_t framePixelsFilled; // In the set being filled
 
+	// Number of frame buffer sets to allocate (setting)
+	uint32_t numFrameSets;
+	enum FrameDeliveryPolicy deliveryPolicy;
+
+	// Ownership of the frame buffer sets. A set is either free, being filled
+	// by the processing thread, or filled and waiting for (or undergoing)
+	// delivery. Sets are handed between the processing thread and the
+	// delivering thread through two queues of set indices.
+	// See Detector.c
+	struct
+	{
+		uint32_t numSets; // numFrameSets at the time of configuration
+		struct RingBuffer free; // Processing thread pops; delivering thread pushes
+		struct RingBuffer filled; // Accessed under frameCompletion.mutex only
+		uint32_t current; // Set being filled, or NO_FRAME_SET
+		bool dropping; // No set was free at the start of the current frame
+		struct FrameInfo info[MAX_FRAME_SETS]; // Of each filled set
+	} framePool;
+
+	// Filled frame sets are passed to OpenScanLib on a dedicated thread, so
+	// that a slow consumer does not hold up acquisition
+	// See FrameDelivery.c
+	struct
+	{
+		struct Thread *thread;
+		OScDev_Acquisition *acquisition;
+		bool stopRequested; // Under frameCompletion.mutex; exit when queue is empty
+		volatile int32_t consumerStopped; // A frame callback returned false
+		int64_t consumerStopTime; // Time_GetTicks(); set before consumerStopped
+		uint32_t nextSequenceNumber; // Expected of the next frame delivered
+
+		// Counts since the start of the acquisition
+		volatile int32_t framesDelivered;
+		volatile int32_t framesDropped;
+		size_t queueHighWaterMark; // Under frameCompletion.mutex
+	} delivery;
+
+	// Accumulation of frames being averaged, done on the processing thread
+	// as each part of a frame is converted
+	// See Detector.c
+	struct
+	{
+		enum FrameAveragingMode mode; // averagingMode at the time of configuration
+		uint32_t frames; // framesToAverage at the time of configuration
+
+		// Per-channel accumulators of a frame's pixels, allocated for the
+		// enabled channels when mode is not Off; uint32_t for Mean and Sum,
+		// float for Exponential
+		void *accumulators[MAX_PHYSICAL_CHANS];
+
+		uint32_t groupFrames; // Frames of the current group already accumulated
+		size_t pixelsAccumulated; // Of the frame being converted
+		bool initialized; // Exponential average has been seeded with a frame
+	} averaging;
+
+	// Reduction of the repeated scans of each line into one line of the
+	// frame, done on the processing thread as the data arrives
+	// See Detector.c
+	struct
+	{
+		uint32_t lines; // linesToAverage at the time of configuration
+
+		// Per-channel sums of the scans of the current line, allocated for
+		// the enabled channels when lines > 1
+		uint32_t *accumulators[MAX_PHYSICAL_CHANS];
+
+		uint32_t repeat; // Index of the scan of the current line being filled
+		size_t pixelsInScan; // Pixels of that scan converted so far
+	} lineAveraging;
+
+	// Tracking of the DAQmx sample position, to timestamp each frame and
+	// detect lost samples, on the processing thread
+	// See Detector.c
+	struct
+	{
+		double sampleRateHz; // Of the detector, at the time of configuration
+		uInt64 nextSample; // Expected read position of the next chunk
+		uint32_t nextSequenceNumber;
+		struct FrameInfo current; // Of the frame being filled
+
+		// Counts since the start of the acquisition
+		uint32_t sampleGaps;
+		uint32_t inputOverruns;
+	} frameTiming;
+
+	// Kernel converting rawData into frameBuffers, selected for the
+	// current number of channels and CPU
+	ConvertSamplesF64Func convertSamples;
+	ConvertSamplesI16Func convertBinarySamples;
+	const char *convertSamplesName;
+
+	// Per-channel tables mapping ADC codes to pixel values, allocated for
+	// the enabled channels when rawDataIsBinary
+	uint16_t *conversionTables[MAX_PHYSICAL_CHANS];
+
+	// Signaled whenever a frame set changes hands, or a frame is finished
+	// See FrameDelivery.c
 	struct
 	{
-		CRITICAL_SECTION mutex;
-		HANDLE thread;
-		CONDITION_VARIABLE acquisitionFinishCondition;
+		struct Mutex mutex;
+		struct CondVar condition;
+
+		// Frames completed or dropped by the processing thread since the
+		// start of the acquisition
+		uint32_t framesFinished;
+
+		// Delay from reading the last sample of a frame from DAQmx to
+		// waking up to deliver the frame; reset at the start of each
+		// acquisition
+		uint32_t latencyCount;
+		double latencyTotalMs;
+		double latencyMaxMs;
+	} frameCompletion;
+
+	// State of a streaming acquisition, in which the processing thread
+	// splits the continuous stream into frames
+	// See OScNIDAQ.c and Detector.c
+	struct
+	{
+		bool active; // Set before the tasks are started
+		uint32_t framesToDeliver;
+		uint32_t framesCompleted; // Accessed by processing thread only
+		volatile int32_t finished; // All frames completed, or stop requested
+
+		// Pixels of the Y retrace lines remaining to be discarded
+		size_t retracePixelsToSkip;
+	} stream;
+
+	// Time during which the scanner is idle between consecutive frames of a
+	// frame-by-frame acquisition, from the end of one frame's waveform to
+	// the start of the next; reset at the start of each acquisition
+	// See OScNIDAQ.c
+	struct
+	{
+		int64_t lastScanEndTime; // Time_GetTicks(); 0 if none yet
+		uint32_t count;
+		double totalMs;
+		double maxMs;
+	} deadTime;
+
+	// Totals since the counters were last reset (by a setting), from which
+	// the performance counter settings are derived. Updated without locking
+	// where the data flows, with Counter_*() (relaxed atomics), so values
+	// read together may be momentarily inconsistent.
+	// See PerformanceCounters.c
+	struct
+	{
+		volatile int64_t callbacks; // Detector callbacks that read data
+		volatile int64_t firstCallbackTime; // Time_GetTicks(); 0 if none yet
+		volatile int64_t lastCallbackTime;
+		volatile int64_t samplesRead; // Per channel
+		volatile int64_t processingTicks; // Handling chunks on the processing thread
+		volatile int64_t peakProcessingTicks;
+		volatile int64_t rawDataPeakPixels; // Queued in rawData after a callback
+		volatile int64_t framesDelivered;
+		volatile int64_t framesDropped;
+		volatile int64_t firstDeliveryTime; // Time_GetTicks(); 0 if none yet
+		volatile int64_t lastDeliveryTime;
+		volatile int64_t deadTimeCount;
+		volatile int64_t deadTimeTicks;
+	} counters;
+
+	// Recording of the raw detector data of each acquisition, chunk by
+	// chunk, as handled by the processing thread; and replay of a
+	// recording through the same processing, without the DAQ
+	// See RawDataCapture.c
+	struct
+	{
+		char capturePath[OScDev_MAX_STR_LEN + 1]; // Setting; empty to not capture
+		char replayPath[OScDev_MAX_STR_LEN + 1]; // Setting
+		enum ReplaySpeed replaySpeed; // Setting
+
+		struct Mutex mutex; // Guards the following
+		FILE *file; // Open from the start to the end of a captured acquisition
+		bool headerWritten; // Deferred to the first chunk
+		int64_t startTime; // Time_GetTicks() when the capture was opened
+		uint64_t chunks;
+		uint64_t bytes;
+	} rawDataCapture;
+
+	// Chrome trace JSON file written by the Export Trace setting. The
+	// trace itself is shared by all devices; see Trace.h
+	char traceExportPath[OScDev_MAX_STR_LEN + 1];
+
+	struct
+	{
+		struct Mutex mutex;
+		struct Thread *thread;
+		struct CondVar acquisitionFinishCondition;
 		bool running;
 		bool armed; // Valid when running == true
 		bool started; // Valid when running == true
 		bool stopRequested; // Valid when running == true
+		int64_t stopRequestTime; // Time_GetTicks(); 0 if not requested
 		OScDev_Acquisition *acquisition;
 	} acquisition;
 };
@@ -119,20 +484,68 @@ int GetNumberOfEnabledChannels(OScDev_Device *device);
 void GetEnabledChannels(OScDev_Device *device, char *buf, size_t bufsiz);
 int GetNumberOfAIPhysChans(OScDev_Device *device);
 void GetAIPhysChan(OScDev_Device *device, int index, char *buf, size_t bufsiz);
+uint32_t GetElementsPerLine(OScDev_Device *device, uint32_t width);
+uint32_t GetScanLinesPerFrame(OScDev_Device *device, uint32_t height);
 OScDev_Error NIDAQMakeSettings(OScDev_Device *device, OScDev_PtrArray **settings);
 
 OScDev_RichError *SetUpClock(OScDev_Device *device, struct ClockConfig *config, OScDev_Acquisition *acq);
 OScDev_RichError *ShutdownClock(OScDev_Device *device, struct ClockConfig *config);
 OScDev_RichError *StartClock(OScDev_Device *device, struct ClockConfig *config);
 OScDev_RichError *StopClock(OScDev_Device *device, struct ClockConfig *config);
+OScDev_RichError *WaitForClockDone(OScDev_Device *device, struct ClockConfig *config, double timeoutSec);
+OScDev_RichError *AbortClock(OScDev_Device *device, struct ClockConfig *config);
+OScDev_RichError *GenerateClockOutput(OScDev_Device *device, uint32_t width, uint32_t height,
+	uInt8 **lineClockPatterns, int32 *elementsPerChan, size_t *peakBytes);
 OScDev_RichError *SetUpScanner(OScDev_Device *device, struct ScannerConfig *config, OScDev_Acquisition *acq);
 OScDev_RichError *ShutdownScanner(OScDev_Device *device, struct ScannerConfig *config);
 OScDev_RichError *StartScanner(OScDev_Device *device, struct ScannerConfig *config);
 OScDev_RichError *StopScanner(OScDev_Device *device, struct ScannerConfig *config);
+OScDev_RichError *WaitForScannerDone(OScDev_Device *device, struct ScannerConfig *config, double timeoutSec);
+OScDev_RichError *WaitForScannerDoneWithin(OScDev_Device *device, struct ScannerConfig *config,
+	double timeoutSec, bool *done);
+OScDev_RichError *AbortScanner(OScDev_Device *device, struct ScannerConfig *config);
+OScDev_RichError *ParkScanner(OScDev_Device *device, struct ScannerConfig *config);
+OScDev_RichError *GenerateScannerOutput(OScDev_Device *device, uint32_t resolution, double zoomFactor,
+	uint32_t xOffset, uint32_t yOffset, uint32_t width, uint32_t height,
+	double **xyWaveformFrame, int32 *elementsPerChan, size_t *peakBytes);
 OScDev_RichError *SetUpDetector(OScDev_Device *device, struct DetectorConfig *config, OScDev_Acquisition *acq);
 OScDev_RichError *ShutdownDetector(OScDev_Device *device, struct DetectorConfig *config);
 OScDev_RichError *StartDetector(OScDev_Device *device, struct DetectorConfig *config);
 OScDev_RichError *StopDetector(OScDev_Device *device, struct DetectorConfig *config);
+OScDev_RichError *AbortDetector(OScDev_Device *device, struct DetectorConfig *config);
+OScDev_RichError *AllocateProcessingBuffers(OScDev_Device *device, uint32_t width, uint32_t height, size_t bufferSize);
+OScDev_RichError *BuildNominalConversionTables(OScDev_Device *device);
+int32 HandleRawData(OScDev_Device *device, const struct RawDataChunk *chunk);
+void DiscardPartialFrame(OScDev_Device *device);
+bool HasDetectorFailed(OScDev_Device *device);
+void ResetFrameAveraging(OScDev_Device *device);
+uint32_t GetScansPerFrame(OScDev_Device *device);
+
+void ResetFramePool(OScDev_Device *device, bool resetStatistics);
+uint32_t AcquireFreeFrameSet(OScDev_Device *device);
+void QueueFilledFrameSet(OScDev_Device *device, uint32_t set, const struct FrameInfo *info);
+void RecordDroppedFrame(OScDev_Device *device);
+void ReleaseFrameSet(OScDev_Device *device, uint32_t set);
+void ReleaseFilledFrameSets(OScDev_Device *device);
+bool WaitForFreeFrameSet(OScDev_Device *device, uint32_t timeoutMs);
+uint32_t GetFramesFinished(OScDev_Device *device);
+bool WaitForFramesFinished(OScDev_Device *device, uint32_t count, uint32_t timeoutMs);
+OScDev_RichError *StartFrameDelivery(OScDev_Device *device, OScDev_Acquisition *acq);
+void StopFrameDelivery(OScDev_Device *device);
+bool IsFrameConsumerStopped(OScDev_Device *device);
+int64_t GetFrameConsumerStopTime(OScDev_Device *device);
+void LogFrameDeliveryStatistics(OScDev_Device *device);
+
+OScDev_RichError *RunDetectorBenchmark(OScDev_Device *device, FILE *output);
+OScDev_RichError *RunWaveformBenchmark(OScDev_Device *device, FILE *output);
+
+void ResetPerformanceCounters(OScDev_Device *device);
+double GetPerformanceCounter(OScDev_Device *device, enum PerformanceCounter counter);
+
+OScDev_RichError *StartRawDataCapture(OScDev_Device *device);
+void CaptureRawDataChunk(OScDev_Device *device, const struct RawDataChunk *chunk);
+void StopRawDataCapture(OScDev_Device *device);
+OScDev_RichError *ReplayRawData(OScDev_Device *device);
 
 
 // Must be called immediately after failed DAQmx function
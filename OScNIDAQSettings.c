@@ -26,6 +26,13 @@ OScDev_Error GetNumericConstraintTypeImpl_Range(OScDev_Setting *setting, OScDev_
 }
 
 
+OScDev_Error IsWritableImpl_False(OScDev_Setting *setting, bool *writable)
+{
+	*writable = false;
+	return OScDev_OK;
+}
+
+
 static OScDev_Error GetLineDelay(OScDev_Setting *setting, int32_t *value)
 {
 	*value = GetSettingDeviceData(setting)->lineDelay;
@@ -42,6 +49,7 @@ static OScDev_Error SetLineDelay(OScDev_Setting *setting, int32_t value)
 	GetSettingDeviceData(setting)->scannerConfig.mustReconfigureTiming = true;
 	GetSettingDeviceData(setting)->clockConfig.mustRewriteOutput = true;
 	GetSettingDeviceData(setting)->scannerConfig.mustRewriteOutput = true;
+	GetSettingDeviceData(setting)->detectorConfig.mustReconfigureCallback = true; // Callback interval
 
 	return OScDev_OK;
 }
@@ -63,16 +71,67 @@ OScDev_SettingImpl SettingImpl_LineDelay = {
 };
 
 
+static OScDev_Error GetBidirectionalScan(OScDev_Setting *setting, bool *value)
+{
+	*value = GetSettingDeviceData(setting)->bidirectionalScan;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetBidirectionalScan(OScDev_Setting *setting, bool value)
+{
+	GetSettingDeviceData(setting)->bidirectionalScan = value;
+
+	// Line length changes, as well as the waveforms
+	GetSettingDeviceData(setting)->clockConfig.mustReconfigureTiming = true;
+	GetSettingDeviceData(setting)->scannerConfig.mustReconfigureTiming = true;
+	GetSettingDeviceData(setting)->clockConfig.mustRewriteOutput = true;
+	GetSettingDeviceData(setting)->scannerConfig.mustRewriteOutput = true;
+	GetSettingDeviceData(setting)->detectorConfig.mustReconfigureCallback = true;
+
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_BidirectionalScan = {
+	.GetBool = GetBidirectionalScan,
+	.SetBool = SetBidirectionalScan,
+};
+
+
+static OScDev_Error GetContinuousStreaming(OScDev_Setting *setting, bool *value)
+{
+	*value = GetSettingDeviceData(setting)->continuousStreaming;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetContinuousStreaming(OScDev_Setting *setting, bool value)
+{
+	// The resulting change of task configuration (if any) is determined
+	// together with the number of frames when the next acquisition is armed
+	GetSettingDeviceData(setting)->continuousStreaming = value;
+
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_ContinuousStreaming = {
+	.GetBool = GetContinuousStreaming,
+	.SetBool = SetContinuousStreaming,
+};
+
+
 static OScDev_Error GetAcqBufferSize(OScDev_Setting *setting, int32_t *value)
 {
-	*value = GetSettingDeviceData(setting)->numLinesToBuffer;
+	*value = GetSettingDeviceData(setting)->acqBufferDurationMs;
 	return OScDev_OK;
 }
 
 // OnAcqBufferSize
 static OScDev_Error SetAcqBufferSize(OScDev_Setting *setting, int32_t value)
 {
-	GetSettingDeviceData(setting)->numLinesToBuffer = value;
+	GetSettingDeviceData(setting)->acqBufferDurationMs = value;
 
 	GetSettingDeviceData(setting)->detectorConfig.mustReconfigureCallback = true;
 
@@ -82,14 +141,13 @@ static OScDev_Error SetAcqBufferSize(OScDev_Setting *setting, int32_t value)
 static OScDev_Error GetAcqBufferSizeValues(OScDev_Setting *setting, OScDev_NumArray **values)
 {
 	static const uint32_t v[] = {
-		2,
-		4,
-		8,
-		16,
-		32,
-		64,
-		128,
-		256,
+		50,
+		100,
+		200,
+		500,
+		1000,
+		2000,
+		5000,
 		0 // End mark
 	};
 	*values = OScDev_NumArray_Create();
@@ -106,6 +164,311 @@ static OScDev_SettingImpl SettingImpl_AcqBufferSize = {
 	.GetInt32DiscreteValues = GetAcqBufferSizeValues,
 };
 
+static OScDev_Error GetCallbackInterval(OScDev_Setting *setting, int32_t *value)
+{
+	*value = GetSettingDeviceData(setting)->callbackIntervalMs;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetCallbackInterval(OScDev_Setting *setting, int32_t value)
+{
+	GetSettingDeviceData(setting)->callbackIntervalMs = value;
+
+	GetSettingDeviceData(setting)->detectorConfig.mustReconfigureCallback = true;
+
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetCallbackIntervalRange(OScDev_Setting *setting, int32_t *min, int32_t *max)
+{
+	*min = 0; // Every line
+	*max = 1000;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_CallbackInterval = {
+	.GetInt32 = GetCallbackInterval,
+	.SetInt32 = SetCallbackInterval,
+	.GetNumericConstraintType = GetNumericConstraintTypeImpl_Range,
+	.GetInt32Range = GetCallbackIntervalRange,
+};
+
+
+static OScDev_Error GetOversamplingFactor(OScDev_Setting *setting, int32_t *value)
+{
+	*value = GetSettingDeviceData(setting)->oversamplingFactor;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetOversamplingFactor(OScDev_Setting *setting, int32_t value)
+{
+	GetSettingDeviceData(setting)->oversamplingFactor = value;
+
+	GetSettingDeviceData(setting)->detectorConfig.mustReconfigureTiming = true;
+	GetSettingDeviceData(setting)->detectorConfig.mustReconfigureCallback = true;
+
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetOversamplingFactorRange(OScDev_Setting *setting, int32_t *min, int32_t *max)
+{
+	*min = 1;
+	*max = 64;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_OversamplingFactor = {
+	.GetInt32 = GetOversamplingFactor,
+	.SetInt32 = SetOversamplingFactor,
+	.GetNumericConstraintType = GetNumericConstraintTypeImpl_Range,
+	.GetInt32Range = GetOversamplingFactorRange,
+};
+
+
+static OScDev_Error GetFrameBufferSets(OScDev_Setting *setting, int32_t *value)
+{
+	*value = GetSettingDeviceData(setting)->numFrameSets;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetFrameBufferSets(OScDev_Setting *setting, int32_t value)
+{
+	GetSettingDeviceData(setting)->numFrameSets = value;
+
+	GetSettingDeviceData(setting)->detectorConfig.mustReconfigureCallback = true;
+
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetFrameBufferSetsRange(OScDev_Setting *setting, int32_t *min, int32_t *max)
+{
+	// At least one set must be free to fill while another is delivered
+	*min = 2;
+	*max = MAX_FRAME_SETS;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_FrameBufferSets = {
+	.GetInt32 = GetFrameBufferSets,
+	.SetInt32 = SetFrameBufferSets,
+	.GetNumericConstraintType = GetNumericConstraintTypeImpl_Range,
+	.GetInt32Range = GetFrameBufferSetsRange,
+};
+
+
+// Block holds back only the processing of detector data, not the DAQ: frame
+// by frame, the next frame is not scanned until a frame buffer set is free;
+// when streaming, the raw data buffers absorb a slow consumer until they are
+// half full, after which frames are dropped as with Drop Newest.
+static const char *const FrameDeliveryPolicyNames[NumFrameDeliveryPolicies] = {
+	"Block",
+	"Drop Oldest",
+	"Drop Newest",
+};
+
+
+static OScDev_Error GetFrameDeliveryPolicy(OScDev_Setting *setting, uint32_t *value)
+{
+	*value = GetSettingDeviceData(setting)->deliveryPolicy;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetFrameDeliveryPolicy(OScDev_Setting *setting, uint32_t value)
+{
+	// Takes effect immediately; read by the processing thread at the start
+	// of each frame
+	GetSettingDeviceData(setting)->deliveryPolicy = value;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetFrameDeliveryPolicyNumValues(OScDev_Setting *setting, uint32_t *count)
+{
+	*count = NumFrameDeliveryPolicies;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetFrameDeliveryPolicyNameForValue(OScDev_Setting *setting, uint32_t value, char *name)
+{
+	if (value >= NumFrameDeliveryPolicies)
+		return OScDev_Error_ReturnAsCode(OScDev_Error_Create("Unknown frame delivery policy"));
+	strncpy(name, FrameDeliveryPolicyNames[value], OScDev_MAX_STR_LEN);
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetFrameDeliveryPolicyValueForName(OScDev_Setting *setting, uint32_t *value, const char *name)
+{
+	for (uint32_t i = 0; i < NumFrameDeliveryPolicies; ++i)
+	{
+		if (strcmp(name, FrameDeliveryPolicyNames[i]) == 0)
+		{
+			*value = i;
+			return OScDev_OK;
+		}
+	}
+	return OScDev_Error_ReturnAsCode(OScDev_Error_Create("Unknown frame delivery policy"));
+}
+
+
+static OScDev_SettingImpl SettingImpl_FrameDeliveryPolicy = {
+	.GetEnum = GetFrameDeliveryPolicy,
+	.SetEnum = SetFrameDeliveryPolicy,
+	.GetEnumNumValues = GetFrameDeliveryPolicyNumValues,
+	.GetEnumNameForValue = GetFrameDeliveryPolicyNameForValue,
+	.GetEnumValueForName = GetFrameDeliveryPolicyValueForName,
+};
+
+
+static const char *const FrameAveragingModeNames[NumFrameAveragingModes] = {
+	"Off",
+	"Mean",
+	"Sum",
+	"Exponential",
+};
+
+
+static OScDev_Error GetFrameAveraging(OScDev_Setting *setting, uint32_t *value)
+{
+	*value = GetSettingDeviceData(setting)->averagingMode;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetFrameAveraging(OScDev_Setting *setting, uint32_t value)
+{
+	GetSettingDeviceData(setting)->averagingMode = value;
+
+	// Accumulators are allocated with the callback
+	GetSettingDeviceData(setting)->detectorConfig.mustReconfigureCallback = true;
+
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetFrameAveragingNumValues(OScDev_Setting *setting, uint32_t *count)
+{
+	*count = NumFrameAveragingModes;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetFrameAveragingNameForValue(OScDev_Setting *setting, uint32_t value, char *name)
+{
+	if (value >= NumFrameAveragingModes)
+		return OScDev_Error_ReturnAsCode(OScDev_Error_Create("Unknown frame averaging mode"));
+	strncpy(name, FrameAveragingModeNames[value], OScDev_MAX_STR_LEN);
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetFrameAveragingValueForName(OScDev_Setting *setting, uint32_t *value, const char *name)
+{
+	for (uint32_t i = 0; i < NumFrameAveragingModes; ++i)
+	{
+		if (strcmp(name, FrameAveragingModeNames[i]) == 0)
+		{
+			*value = i;
+			return OScDev_OK;
+		}
+	}
+	return OScDev_Error_ReturnAsCode(OScDev_Error_Create("Unknown frame averaging mode"));
+}
+
+
+static OScDev_SettingImpl SettingImpl_FrameAveraging = {
+	.GetEnum = GetFrameAveraging,
+	.SetEnum = SetFrameAveraging,
+	.GetEnumNumValues = GetFrameAveragingNumValues,
+	.GetEnumNameForValue = GetFrameAveragingNameForValue,
+	.GetEnumValueForName = GetFrameAveragingValueForName,
+};
+
+
+static OScDev_Error GetFramesToAverage(OScDev_Setting *setting, int32_t *value)
+{
+	*value = GetSettingDeviceData(setting)->framesToAverage;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetFramesToAverage(OScDev_Setting *setting, int32_t value)
+{
+	GetSettingDeviceData(setting)->framesToAverage = value;
+
+	GetSettingDeviceData(setting)->detectorConfig.mustReconfigureCallback = true;
+
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetFramesToAverageRange(OScDev_Setting *setting, int32_t *min, int32_t *max)
+{
+	// The sum of 1024 frames still fits in the uint32 accumulators with
+	// plenty of headroom
+	*min = 1;
+	*max = 1024;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_FramesToAverage = {
+	.GetInt32 = GetFramesToAverage,
+	.SetInt32 = SetFramesToAverage,
+	.GetNumericConstraintType = GetNumericConstraintTypeImpl_Range,
+	.GetInt32Range = GetFramesToAverageRange,
+};
+
+
+static OScDev_Error GetLinesToAverage(OScDev_Setting *setting, int32_t *value)
+{
+	*value = GetSettingDeviceData(setting)->linesToAverage;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetLinesToAverage(OScDev_Setting *setting, int32_t value)
+{
+	GetSettingDeviceData(setting)->linesToAverage = value;
+
+	// Number of lines per frame changes, as well as the waveforms
+	GetSettingDeviceData(setting)->clockConfig.mustReconfigureTiming = true;
+	GetSettingDeviceData(setting)->scannerConfig.mustReconfigureTiming = true;
+	GetSettingDeviceData(setting)->clockConfig.mustRewriteOutput = true;
+	GetSettingDeviceData(setting)->scannerConfig.mustRewriteOutput = true;
+	GetSettingDeviceData(setting)->detectorConfig.mustReconfigureCallback = true;
+
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetLinesToAverageRange(OScDev_Setting *setting, int32_t *min, int32_t *max)
+{
+	*min = 1;
+	*max = 64;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_LinesToAverage = {
+	.GetInt32 = GetLinesToAverage,
+	.SetInt32 = SetLinesToAverage,
+	.GetNumericConstraintType = GetNumericConstraintTypeImpl_Range,
+	.GetInt32Range = GetLinesToAverageRange,
+};
+
+
 static OScDev_Error GetInputVoltageRange(OScDev_Setting *setting, double *value)
 {
 	*value = GetSettingDeviceData(setting)->inputVoltageRange;
@@ -116,6 +479,10 @@ static OScDev_Error GetInputVoltageRange(OScDev_Setting *setting, double *value)
 static OScDev_Error SetInputVoltageRange(OScDev_Setting *setting, double value)
 {
 	GetSettingDeviceData(setting)->inputVoltageRange = value;
+
+	// Conversion tables for raw ADC values depend on the range
+	GetSettingDeviceData(setting)->detectorConfig.mustReconfigureCallback = true;
+
 	return OScDev_OK;
 }
 
@@ -145,6 +512,29 @@ static OScDev_SettingImpl SettingImpl_InputVoltageRange = {
 };
 
 
+static OScDev_Error GetReadRawADCValues(OScDev_Setting *setting, bool *value)
+{
+	*value = GetSettingDeviceData(setting)->readBinarySamples;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetReadRawADCValues(OScDev_Setting *setting, bool value)
+{
+	GetSettingDeviceData(setting)->readBinarySamples = value;
+
+	GetSettingDeviceData(setting)->detectorConfig.mustReconfigureCallback = true;
+
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_ReadRawADCValues = {
+	.GetBool = GetReadRawADCValues,
+	.SetBool = SetReadRawADCValues,
+};
+
+
 struct EnableChannelData {
 	OScDev_Device *device;
 	int hwChannel;
@@ -200,6 +590,311 @@ static OScDev_SettingImpl SettingImpl_ScannerOnly = {
 };
 
 
+// Always reads false; setting to true runs the benchmark before returning
+static OScDev_Error GetRunDetectorBenchmark(OScDev_Setting *setting, bool *value)
+{
+	*value = false;
+	return OScDev_OK;
+}
+
+static OScDev_Error SetRunDetectorBenchmark(OScDev_Setting *setting, bool value)
+{
+	if (!value)
+		return OScDev_OK;
+	OScDev_Device *device = (OScDev_Device *)OScDev_Setting_GetImplData(setting);
+	return OScDev_Error_ReturnAsCode(RunDetectorBenchmark(device, NULL));
+}
+
+static OScDev_SettingImpl SettingImpl_RunDetectorBenchmark = {
+	.GetBool = GetRunDetectorBenchmark,
+	.SetBool = SetRunDetectorBenchmark,
+};
+
+
+// Likewise
+static OScDev_Error GetRunWaveformBenchmark(OScDev_Setting *setting, bool *value)
+{
+	*value = false;
+	return OScDev_OK;
+}
+
+static OScDev_Error SetRunWaveformBenchmark(OScDev_Setting *setting, bool value)
+{
+	if (!value)
+		return OScDev_OK;
+	OScDev_Device *device = (OScDev_Device *)OScDev_Setting_GetImplData(setting);
+	return OScDev_Error_ReturnAsCode(RunWaveformBenchmark(device, NULL));
+}
+
+static OScDev_SettingImpl SettingImpl_RunWaveformBenchmark = {
+	.GetBool = GetRunWaveformBenchmark,
+	.SetBool = SetRunWaveformBenchmark,
+};
+
+
+static OScDev_Error GetRawDataCaptureFile(OScDev_Setting *setting, char *value)
+{
+	strncpy(value, GetSettingDeviceData(setting)->rawDataCapture.capturePath, OScDev_MAX_STR_LEN);
+	return OScDev_OK;
+}
+
+static OScDev_Error SetRawDataCaptureFile(OScDev_Setting *setting, const char *value)
+{
+	// Takes effect from the next acquisition
+	strncpy(GetSettingDeviceData(setting)->rawDataCapture.capturePath, value, OScDev_MAX_STR_LEN);
+	return OScDev_OK;
+}
+
+static OScDev_SettingImpl SettingImpl_RawDataCaptureFile = {
+	.GetString = GetRawDataCaptureFile,
+	.SetString = SetRawDataCaptureFile,
+};
+
+
+static OScDev_Error GetRawDataReplayFile(OScDev_Setting *setting, char *value)
+{
+	strncpy(value, GetSettingDeviceData(setting)->rawDataCapture.replayPath, OScDev_MAX_STR_LEN);
+	return OScDev_OK;
+}
+
+static OScDev_Error SetRawDataReplayFile(OScDev_Setting *setting, const char *value)
+{
+	strncpy(GetSettingDeviceData(setting)->rawDataCapture.replayPath, value, OScDev_MAX_STR_LEN);
+	return OScDev_OK;
+}
+
+static OScDev_SettingImpl SettingImpl_RawDataReplayFile = {
+	.GetString = GetRawDataReplayFile,
+	.SetString = SetRawDataReplayFile,
+};
+
+
+static const char *const ReplaySpeedNames[NumReplaySpeeds] = {
+	"Recorded",
+	"Maximum",
+};
+
+
+static OScDev_Error GetReplaySpeed(OScDev_Setting *setting, uint32_t *value)
+{
+	*value = GetSettingDeviceData(setting)->rawDataCapture.replaySpeed;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetReplaySpeed(OScDev_Setting *setting, uint32_t value)
+{
+	GetSettingDeviceData(setting)->rawDataCapture.replaySpeed = value;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetReplaySpeedNumValues(OScDev_Setting *setting, uint32_t *count)
+{
+	*count = NumReplaySpeeds;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetReplaySpeedNameForValue(OScDev_Setting *setting, uint32_t value, char *name)
+{
+	if (value >= NumReplaySpeeds)
+		return OScDev_Error_ReturnAsCode(OScDev_Error_Create("Unknown replay speed"));
+	strncpy(name, ReplaySpeedNames[value], OScDev_MAX_STR_LEN);
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetReplaySpeedValueForName(OScDev_Setting *setting, uint32_t *value, const char *name)
+{
+	for (uint32_t i = 0; i < NumReplaySpeeds; ++i)
+	{
+		if (strcmp(name, ReplaySpeedNames[i]) == 0)
+		{
+			*value = i;
+			return OScDev_OK;
+		}
+	}
+	return OScDev_Error_ReturnAsCode(OScDev_Error_Create("Unknown replay speed"));
+}
+
+
+static OScDev_SettingImpl SettingImpl_ReplaySpeed = {
+	.GetEnum = GetReplaySpeed,
+	.SetEnum = SetReplaySpeed,
+	.GetEnumNumValues = GetReplaySpeedNumValues,
+	.GetEnumNameForValue = GetReplaySpeedNameForValue,
+	.GetEnumValueForName = GetReplaySpeedValueForName,
+};
+
+
+// Always reads false; setting to true replays the replay file before returning
+static OScDev_Error GetReplayRawData(OScDev_Setting *setting, bool *value)
+{
+	*value = false;
+	return OScDev_OK;
+}
+
+static OScDev_Error SetReplayRawData(OScDev_Setting *setting, bool value)
+{
+	if (!value)
+		return OScDev_OK;
+	OScDev_Device *device = (OScDev_Device *)OScDev_Setting_GetImplData(setting);
+	return OScDev_Error_ReturnAsCode(ReplayRawData(device));
+}
+
+static OScDev_SettingImpl SettingImpl_ReplayRawData = {
+	.GetBool = GetReplayRawData,
+	.SetBool = SetReplayRawData,
+};
+
+
+// Tracing is process-wide, so this reads the same on every device
+static OScDev_Error GetTracing(OScDev_Setting *setting, bool *value)
+{
+	*value = Trace_IsStarted();
+	return OScDev_OK;
+}
+
+static OScDev_Error SetTracing(OScDev_Setting *setting, bool value)
+{
+	if (!value)
+	{
+		Trace_Stop();
+		return OScDev_OK;
+	}
+	if (!Trace_Start())
+		return OScDev_Error_ReturnAsCode(OScDev_Error_Create("Tracing is not available"));
+	return OScDev_OK;
+}
+
+static OScDev_SettingImpl SettingImpl_Tracing = {
+	.GetBool = GetTracing,
+	.SetBool = SetTracing,
+};
+
+
+static OScDev_Error GetTraceExportFile(OScDev_Setting *setting, char *value)
+{
+	strncpy(value, GetSettingDeviceData(setting)->traceExportPath, OScDev_MAX_STR_LEN);
+	return OScDev_OK;
+}
+
+static OScDev_Error SetTraceExportFile(OScDev_Setting *setting, const char *value)
+{
+	strncpy(GetSettingDeviceData(setting)->traceExportPath, value, OScDev_MAX_STR_LEN);
+	return OScDev_OK;
+}
+
+static OScDev_SettingImpl SettingImpl_TraceExportFile = {
+	.GetString = GetTraceExportFile,
+	.SetString = SetTraceExportFile,
+};
+
+
+// Always reads false; setting to true writes the trace to the trace export
+// file. Not allowed while acquiring, when the trace is still being written.
+static OScDev_Error GetExportTrace(OScDev_Setting *setting, bool *value)
+{
+	*value = false;
+	return OScDev_OK;
+}
+
+static OScDev_Error SetExportTrace(OScDev_Setting *setting, bool value)
+{
+	if (!value)
+		return OScDev_OK;
+	OScDev_Device *device = (OScDev_Device *)OScDev_Setting_GetImplData(setting);
+	OScDev_RichError *err = OScDev_RichError_OK;
+
+	struct Mutex *mutex = &GetData(device)->acquisition.mutex;
+	Mutex_Lock(mutex);
+	if (GetData(device)->acquisition.running)
+		err = OScDev_Error_Create("Cannot export the trace while acquiring");
+	else if (GetData(device)->traceExportPath[0] == '\0')
+		err = OScDev_Error_Create("No trace export file set");
+	else if (!Trace_WriteChromeJSON(GetData(device)->traceExportPath))
+		err = OScDev_Error_Create("Failed to write trace file");
+	Mutex_Unlock(mutex);
+
+	return OScDev_Error_ReturnAsCode(err);
+}
+
+static OScDev_SettingImpl SettingImpl_ExportTrace = {
+	.GetBool = GetExportTrace,
+	.SetBool = SetExportTrace,
+};
+
+
+static const char *const PerformanceCounterNames[NumPerformanceCounters] = {
+	"Callbacks Per Second",
+	"Samples Per Callback",
+	"Processing Time Per Callback (us)",
+	"Peak Processing Time (us)",
+	"Raw Data Buffer Peak Use (%)",
+	"Frames Delivered",
+	"Frames Dropped",
+	"Achieved Frame Rate (fps)",
+	"Dead Time Per Frame (ms)",
+};
+
+
+struct PerformanceCounterSettingData
+{
+	OScDev_Device *device;
+	enum PerformanceCounter counter;
+};
+
+
+static OScDev_Error GetPerformanceCounterValue(OScDev_Setting *setting, double *value)
+{
+	struct PerformanceCounterSettingData *data = OScDev_Setting_GetImplData(setting);
+	*value = GetPerformanceCounter(data->device, data->counter);
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetPerformanceCounterValue(OScDev_Setting *setting, double value)
+{
+	return OScDev_Error_ReturnAsCode(OScDev_Error_Create("Performance counters are read-only"));
+}
+
+
+static void ReleasePerformanceCounter(OScDev_Setting *setting)
+{
+	struct PerformanceCounterSettingData *data = OScDev_Setting_GetImplData(setting);
+	free(data);
+}
+
+
+static OScDev_SettingImpl SettingImpl_PerformanceCounter = {
+	.Release = ReleasePerformanceCounter,
+	.IsWritable = IsWritableImpl_False,
+	.GetFloat64 = GetPerformanceCounterValue,
+	.SetFloat64 = SetPerformanceCounterValue,
+};
+
+
+// Always reads false; setting to true zeroes the performance counters
+static OScDev_Error GetResetPerformanceCounters(OScDev_Setting *setting, bool *value)
+{
+	*value = false;
+	return OScDev_OK;
+}
+
+static OScDev_Error SetResetPerformanceCounters(OScDev_Setting *setting, bool value)
+{
+	if (value)
+		ResetPerformanceCounters((OScDev_Device *)OScDev_Setting_GetImplData(setting));
+	return OScDev_OK;
+}
+
+static OScDev_SettingImpl SettingImpl_ResetPerformanceCounters = {
+	.GetBool = GetResetPerformanceCounters,
+	.SetBool = SetResetPerformanceCounters,
+};
+
+
 struct OffsetSettingData
 {
 	OScDev_Device *device;
@@ -272,6 +967,20 @@ OScDev_Error NIDAQMakeSettings(OScDev_Device *device, OScDev_PtrArray **settings
 		goto error;
 	OScDev_PtrArray_Append(*settings, lineDelay);
 
+	OScDev_Setting *bidirectionalScan;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&bidirectionalScan, "Bidirectional Scan", OScDev_ValueType_Bool,
+		&SettingImpl_BidirectionalScan, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, bidirectionalScan);
+
+	OScDev_Setting *continuousStreaming;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&continuousStreaming, "Continuous Streaming", OScDev_ValueType_Bool,
+		&SettingImpl_ContinuousStreaming, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, continuousStreaming);
+
 	for (int i = 0; i < 2; ++i)
 	{
 		OScDev_Setting *offset;
@@ -286,12 +995,19 @@ OScDev_Error NIDAQMakeSettings(OScDev_Device *device, OScDev_PtrArray **settings
 		OScDev_PtrArray_Append(*settings, offset);
 	}
 
-	OScDev_Setting *numLinesToBuffer;
-	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&numLinesToBuffer, "Acq Buffer Size (lines)", OScDev_ValueType_Int32,
+	OScDev_Setting *acqBufferSize;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&acqBufferSize, "Acq Buffer Size (ms)", OScDev_ValueType_Int32,
 		&SettingImpl_AcqBufferSize, device));
 	if (err)
 		goto error;
-	OScDev_PtrArray_Append(*settings, numLinesToBuffer);
+	OScDev_PtrArray_Append(*settings, acqBufferSize);
+
+	OScDev_Setting *callbackInterval;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&callbackInterval, "Acq Callback Interval (ms)", OScDev_ValueType_Int32,
+		&SettingImpl_CallbackInterval, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, callbackInterval);
 
 	int nPhysChans = GetNumberOfAIPhysChans(device);
 	for (int i = 0; i < nPhysChans; ++i)
@@ -316,6 +1032,138 @@ OScDev_Error NIDAQMakeSettings(OScDev_Device *device, OScDev_PtrArray **settings
 		goto error;
 	OScDev_PtrArray_Append(*settings, inputVoltageRange);
 
+	OScDev_Setting *readRawADCValues;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&readRawADCValues, "Read Raw ADC Values", OScDev_ValueType_Bool,
+		&SettingImpl_ReadRawADCValues, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, readRawADCValues);
+
+	OScDev_Setting *oversamplingFactor;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&oversamplingFactor, "Oversampling Factor", OScDev_ValueType_Int32,
+		&SettingImpl_OversamplingFactor, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, oversamplingFactor);
+
+	OScDev_Setting *frameAveraging;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&frameAveraging, "Frame Averaging", OScDev_ValueType_Enum,
+		&SettingImpl_FrameAveraging, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, frameAveraging);
+
+	OScDev_Setting *framesToAverage;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&framesToAverage, "Frames To Average", OScDev_ValueType_Int32,
+		&SettingImpl_FramesToAverage, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, framesToAverage);
+
+	OScDev_Setting *linesToAverage;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&linesToAverage, "Lines To Average", OScDev_ValueType_Int32,
+		&SettingImpl_LinesToAverage, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, linesToAverage);
+
+	OScDev_Setting *frameBufferSets;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&frameBufferSets, "Frame Buffer Sets", OScDev_ValueType_Int32,
+		&SettingImpl_FrameBufferSets, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, frameBufferSets);
+
+	OScDev_Setting *frameDeliveryPolicy;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&frameDeliveryPolicy, "Frame Delivery Policy", OScDev_ValueType_Enum,
+		&SettingImpl_FrameDeliveryPolicy, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, frameDeliveryPolicy);
+
+	OScDev_Setting *runDetectorBenchmark;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&runDetectorBenchmark, "Run Detector Benchmark", OScDev_ValueType_Bool,
+		&SettingImpl_RunDetectorBenchmark, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, runDetectorBenchmark);
+
+	OScDev_Setting *runWaveformBenchmark;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&runWaveformBenchmark, "Run Waveform Benchmark", OScDev_ValueType_Bool,
+		&SettingImpl_RunWaveformBenchmark, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, runWaveformBenchmark);
+
+	OScDev_Setting *rawDataCaptureFile;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&rawDataCaptureFile, "Raw Data Capture File", OScDev_ValueType_String,
+		&SettingImpl_RawDataCaptureFile, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, rawDataCaptureFile);
+
+	OScDev_Setting *rawDataReplayFile;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&rawDataReplayFile, "Raw Data Replay File", OScDev_ValueType_String,
+		&SettingImpl_RawDataReplayFile, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, rawDataReplayFile);
+
+	OScDev_Setting *replaySpeed;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&replaySpeed, "Replay Speed", OScDev_ValueType_Enum,
+		&SettingImpl_ReplaySpeed, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, replaySpeed);
+
+	OScDev_Setting *replayRawData;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&replayRawData, "Replay Raw Data", OScDev_ValueType_Bool,
+		&SettingImpl_ReplayRawData, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, replayRawData);
+
+	for (int i = 0; i < NumPerformanceCounters; ++i)
+	{
+		OScDev_Setting *counter;
+		struct PerformanceCounterSettingData *data = malloc(sizeof(struct PerformanceCounterSettingData));
+		data->device = device;
+		data->counter = i;
+		err = OScDev_Error_AsRichError(OScDev_Setting_Create(&counter, PerformanceCounterNames[i],
+			OScDev_ValueType_Float64, &SettingImpl_PerformanceCounter, data));
+		if (err)
+			goto error;
+		OScDev_PtrArray_Append(*settings, counter);
+	}
+
+	OScDev_Setting *resetPerformanceCounters;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&resetPerformanceCounters, "Reset Performance Counters", OScDev_ValueType_Bool,
+		&SettingImpl_ResetPerformanceCounters, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, resetPerformanceCounters);
+
+	OScDev_Setting *tracing;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&tracing, "Tracing", OScDev_ValueType_Bool,
+		&SettingImpl_Tracing, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, tracing);
+
+	OScDev_Setting *traceExportFile;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&traceExportFile, "Trace Export File", OScDev_ValueType_String,
+		&SettingImpl_TraceExportFile, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, traceExportFile);
+
+	OScDev_Setting *exportTrace;
+	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&exportTrace, "Export Trace", OScDev_ValueType_Bool,
+		&SettingImpl_ExportTrace, device));
+	if (err)
+		goto error;
+	OScDev_PtrArray_Append(*settings, exportTrace);
+
 	OScDev_Setting *scannerOnly;
 	err = OScDev_Error_AsRichError(OScDev_Setting_Create(&scannerOnly, "ScannerOnly", OScDev_ValueType_Bool,
 		&SettingImpl_ScannerOnly, device));
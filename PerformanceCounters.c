@@ -0,0 +1,97 @@
+#include "OScNIDAQDevicePrivate.h"
+
+#include <OpenScanDeviceLib.h>
+
+
+// Performance counters, accumulated since the last reset across any number
+// of acquisitions, so that throughput can be watched while acquiring. The
+// totals are updated on the detector callback, processing, delivery, and
+// acquisition threads (see counters in OScNIDAQPrivateData); the derived
+// values are computed when read.
+
+
+// Zero every total. An update racing with the reset may survive it.
+void ResetPerformanceCounters(OScDev_Device *device)
+{
+	Counter_Store(&GetData(device)->counters.callbacks, 0);
+	Counter_Store(&GetData(device)->counters.firstCallbackTime, 0);
+	Counter_Store(&GetData(device)->counters.lastCallbackTime, 0);
+	Counter_Store(&GetData(device)->counters.samplesRead, 0);
+	Counter_Store(&GetData(device)->counters.processingTicks, 0);
+	Counter_Store(&GetData(device)->counters.peakProcessingTicks, 0);
+	Counter_Store(&GetData(device)->counters.rawDataPeakPixels, 0);
+	Counter_Store(&GetData(device)->counters.framesDelivered, 0);
+	Counter_Store(&GetData(device)->counters.framesDropped, 0);
+	Counter_Store(&GetData(device)->counters.firstDeliveryTime, 0);
+	Counter_Store(&GetData(device)->counters.lastDeliveryTime, 0);
+	Counter_Store(&GetData(device)->counters.deadTimeCount, 0);
+	Counter_Store(&GetData(device)->counters.deadTimeTicks, 0);
+}
+
+
+// Events per second over the intervals between count events from first to
+// last; 0 until there are two
+static double GetEventRate(int64_t count, int64_t firstTime, int64_t lastTime)
+{
+	if (count < 2 || firstTime == 0 || lastTime <= firstTime)
+		return 0.0;
+	return 1e3 * (count - 1) / Time_TicksToMs(lastTime - firstTime);
+}
+
+
+double GetPerformanceCounter(OScDev_Device *device, enum PerformanceCounter counter)
+{
+	int64_t callbacks = Counter_Load(&GetData(device)->counters.callbacks);
+	int64_t frames = Counter_Load(&GetData(device)->counters.framesDelivered);
+	int64_t deadTimes = Counter_Load(&GetData(device)->counters.deadTimeCount);
+	size_t capacity = GetData(device)->rawData.capacity;
+
+	switch (counter)
+	{
+	case PerfCounter_CallbacksPerSecond:
+		return GetEventRate(callbacks,
+			Counter_Load(&GetData(device)->counters.firstCallbackTime),
+			Counter_Load(&GetData(device)->counters.lastCallbackTime));
+
+	case PerfCounter_SamplesPerCallback:
+		if (callbacks == 0)
+			return 0.0;
+		return (double)Counter_Load(&GetData(device)->counters.samplesRead) / callbacks;
+
+	case PerfCounter_ProcessingUsPerCallback:
+		// Includes both chunks of a callback whose read wrapped around the
+		// end of the ring buffer
+		if (callbacks == 0)
+			return 0.0;
+		return 1e3 * Time_TicksToMs(Counter_Load(&GetData(device)->counters.processingTicks)) /
+			callbacks;
+
+	case PerfCounter_PeakProcessingUs:
+		return 1e3 * Time_TicksToMs(Counter_Load(&GetData(device)->counters.peakProcessingTicks));
+
+	case PerfCounter_RawDataPeakPercent:
+		if (capacity == 0)
+			return 0.0;
+		return 100.0 * Counter_Load(&GetData(device)->counters.rawDataPeakPixels) / capacity;
+
+	case PerfCounter_FramesDelivered:
+		return (double)frames;
+
+	case PerfCounter_FramesDropped:
+		return (double)Counter_Load(&GetData(device)->counters.framesDropped);
+
+	case PerfCounter_FramesPerSecond:
+		return GetEventRate(frames,
+			Counter_Load(&GetData(device)->counters.firstDeliveryTime),
+			Counter_Load(&GetData(device)->counters.lastDeliveryTime));
+
+	case PerfCounter_DeadTimeMsPerFrame:
+		if (deadTimes == 0)
+			return 0.0;
+		return Time_TicksToMs(Counter_Load(&GetData(device)->counters.deadTimeTicks)) /
+			deadTimes;
+
+	default:
+		return 0.0;
+	}
+}
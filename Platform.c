@@ -0,0 +1,351 @@
+#include "Platform.h"
+
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <time.h>
+#endif
+
+
+struct Thread
+{
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t thread;
+#endif
+	ThreadFunc func;
+	void *arg;
+};
+
+
+#ifdef _WIN32
+
+void Mutex_Init(struct Mutex *mutex)
+{
+	InitializeCriticalSection(&mutex->cs);
+}
+
+
+void Mutex_Destroy(struct Mutex *mutex)
+{
+	DeleteCriticalSection(&mutex->cs);
+}
+
+
+void Mutex_Lock(struct Mutex *mutex)
+{
+	EnterCriticalSection(&mutex->cs);
+}
+
+
+void Mutex_Unlock(struct Mutex *mutex)
+{
+	LeaveCriticalSection(&mutex->cs);
+}
+
+
+void CondVar_Init(struct CondVar *cv)
+{
+	InitializeConditionVariable(&cv->cv);
+}
+
+
+void CondVar_Destroy(struct CondVar *cv)
+{
+	// Nothing to free
+}
+
+
+bool CondVar_Wait(struct CondVar *cv, struct Mutex *mutex, uint32_t timeoutMs)
+{
+	return SleepConditionVariableCS(&cv->cv, &mutex->cs,
+		timeoutMs == WAIT_FOREVER ? INFINITE : timeoutMs) != 0;
+}
+
+
+void CondVar_Broadcast(struct CondVar *cv)
+{
+	WakeAllConditionVariable(&cv->cv);
+}
+
+
+bool Event_Init(struct Event *event)
+{
+	event->handle = CreateEvent(NULL, FALSE, FALSE, NULL);
+	return event->handle != NULL;
+}
+
+
+void Event_Destroy(struct Event *event)
+{
+	CloseHandle(event->handle);
+	event->handle = NULL;
+}
+
+
+void Event_Set(struct Event *event)
+{
+	SetEvent(event->handle);
+}
+
+
+bool Event_Wait(struct Event *event, uint32_t timeoutMs)
+{
+	return WaitForSingleObject(event->handle,
+		timeoutMs == WAIT_FOREVER ? INFINITE : timeoutMs) == WAIT_OBJECT_0;
+}
+
+
+static DWORD WINAPI ThreadEntry(void *param)
+{
+	struct Thread *thread = param;
+	thread->func(thread->arg);
+	return 0;
+}
+
+
+struct Thread *Thread_Start(ThreadFunc func, void *arg)
+{
+	struct Thread *thread = malloc(sizeof(struct Thread));
+	if (!thread)
+		return NULL;
+	thread->func = func;
+	thread->arg = arg;
+
+	DWORD id;
+	thread->handle = CreateThread(NULL, 0, ThreadEntry, thread, 0, &id);
+	if (!thread->handle)
+	{
+		free(thread);
+		return NULL;
+	}
+	return thread;
+}
+
+
+void Thread_Join(struct Thread *thread)
+{
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+	free(thread);
+}
+
+
+int64_t Time_GetTicks(void)
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+}
+
+
+int64_t Time_GetTicksPerSecond(void)
+{
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	return freq.QuadPart;
+}
+
+
+uint64_t Time_GetMs(void)
+{
+	return GetTickCount64();
+}
+
+
+void Time_SleepMs(uint32_t ms)
+{
+	Sleep(ms);
+}
+
+#else // pthreads
+
+// Absolute CLOCK_MONOTONIC time timeoutMs from now, for timed waits on
+// condition variables created with that clock
+static struct timespec GetDeadline(uint32_t timeoutMs)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeoutMs / 1000;
+	deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_sec += 1;
+		deadline.tv_nsec -= 1000000000;
+	}
+	return deadline;
+}
+
+
+static void InitMonotonicCond(pthread_cond_t *cond)
+{
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+
+void Mutex_Init(struct Mutex *mutex)
+{
+	pthread_mutex_init(&mutex->mutex, NULL);
+}
+
+
+void Mutex_Destroy(struct Mutex *mutex)
+{
+	pthread_mutex_destroy(&mutex->mutex);
+}
+
+
+void Mutex_Lock(struct Mutex *mutex)
+{
+	pthread_mutex_lock(&mutex->mutex);
+}
+
+
+void Mutex_Unlock(struct Mutex *mutex)
+{
+	pthread_mutex_unlock(&mutex->mutex);
+}
+
+
+void CondVar_Init(struct CondVar *cv)
+{
+	InitMonotonicCond(&cv->cond);
+}
+
+
+void CondVar_Destroy(struct CondVar *cv)
+{
+	pthread_cond_destroy(&cv->cond);
+}
+
+
+bool CondVar_Wait(struct CondVar *cv, struct Mutex *mutex, uint32_t timeoutMs)
+{
+	if (timeoutMs == WAIT_FOREVER)
+		return pthread_cond_wait(&cv->cond, &mutex->mutex) == 0;
+	struct timespec deadline = GetDeadline(timeoutMs);
+	return pthread_cond_timedwait(&cv->cond, &mutex->mutex, &deadline) != ETIMEDOUT;
+}
+
+
+void CondVar_Broadcast(struct CondVar *cv)
+{
+	pthread_cond_broadcast(&cv->cond);
+}
+
+
+bool Event_Init(struct Event *event)
+{
+	pthread_mutex_init(&event->mutex, NULL);
+	InitMonotonicCond(&event->cond);
+	event->signaled = false;
+	return true;
+}
+
+
+void Event_Destroy(struct Event *event)
+{
+	pthread_cond_destroy(&event->cond);
+	pthread_mutex_destroy(&event->mutex);
+}
+
+
+void Event_Set(struct Event *event)
+{
+	pthread_mutex_lock(&event->mutex);
+	event->signaled = true;
+	pthread_mutex_unlock(&event->mutex);
+	pthread_cond_signal(&event->cond);
+}
+
+
+bool Event_Wait(struct Event *event, uint32_t timeoutMs)
+{
+	struct timespec deadline;
+	if (timeoutMs != WAIT_FOREVER)
+		deadline = GetDeadline(timeoutMs);
+
+	pthread_mutex_lock(&event->mutex);
+	int ret = 0;
+	while (!event->signaled && ret != ETIMEDOUT)
+	{
+		if (timeoutMs == WAIT_FOREVER)
+			ret = pthread_cond_wait(&event->cond, &event->mutex);
+		else
+			ret = pthread_cond_timedwait(&event->cond, &event->mutex, &deadline);
+	}
+	bool signaled = event->signaled;
+	event->signaled = false; // Auto-reset
+	pthread_mutex_unlock(&event->mutex);
+	return signaled;
+}
+
+
+static void *ThreadEntry(void *param)
+{
+	struct Thread *thread = param;
+	thread->func(thread->arg);
+	return NULL;
+}
+
+
+struct Thread *Thread_Start(ThreadFunc func, void *arg)
+{
+	struct Thread *thread = malloc(sizeof(struct Thread));
+	if (!thread)
+		return NULL;
+	thread->func = func;
+	thread->arg = arg;
+
+	if (pthread_create(&thread->thread, NULL, ThreadEntry, thread) != 0)
+	{
+		free(thread);
+		return NULL;
+	}
+	return thread;
+}
+
+
+void Thread_Join(struct Thread *thread)
+{
+	pthread_join(thread->thread, NULL);
+	free(thread);
+}
+
+
+int64_t Time_GetTicks(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+int64_t Time_GetTicksPerSecond(void)
+{
+	return 1000000000;
+}
+
+
+uint64_t Time_GetMs(void)
+{
+	return (uint64_t)(Time_GetTicks() / 1000000);
+}
+
+
+void Time_SleepMs(uint32_t ms)
+{
+	struct timespec duration;
+	duration.tv_sec = ms / 1000;
+	duration.tv_nsec = (long)(ms % 1000) * 1000000;
+	while (nanosleep(&duration, &duration) != 0 && errno == EINTR)
+		;
+}
+
+#endif
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+
+
+// Threading and timing primitives used by the acquisition engine, with a
+// Win32 implementation and a pthreads implementation for other platforms.
+// All objects must be initialized before use and are not copyable.
+
+// Timeout meaning wait indefinitely
+#define WAIT_FOREVER UINT32_MAX
+
+
+struct Mutex
+{
+#ifdef _WIN32
+	CRITICAL_SECTION cs;
+#else
+	pthread_mutex_t mutex;
+#endif
+};
+
+void Mutex_Init(struct Mutex *mutex);
+void Mutex_Destroy(struct Mutex *mutex);
+void Mutex_Lock(struct Mutex *mutex);
+void Mutex_Unlock(struct Mutex *mutex);
+
+
+struct CondVar
+{
+#ifdef _WIN32
+	CONDITION_VARIABLE cv;
+#else
+	pthread_cond_t cond;
+#endif
+};
+
+void CondVar_Init(struct CondVar *cv);
+void CondVar_Destroy(struct CondVar *cv);
+
+// Atomically release the mutex (which must be locked) and wait until woken
+// or timeoutMs has elapsed; the mutex is locked again on return. Returns
+// false on timeout. Spurious wakeups are possible, so callers must recheck
+// their condition.
+bool CondVar_Wait(struct CondVar *cv, struct Mutex *mutex, uint32_t timeoutMs);
+void CondVar_Broadcast(struct CondVar *cv);
+
+
+// Auto-reset event: Event_Set() releases one waiter, or the next one to
+// wait if there is none
+struct Event
+{
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool signaled;
+#endif
+};
+
+bool Event_Init(struct Event *event);
+void Event_Destroy(struct Event *event);
+void Event_Set(struct Event *event);
+
+// Returns false on timeout
+bool Event_Wait(struct Event *event, uint32_t timeoutMs);
+
+
+typedef void (*ThreadFunc)(void *arg);
+
+// Opaque; NULL is never a valid thread
+struct Thread;
+
+// Start func(arg) on a new thread; returns NULL on failure
+struct Thread *Thread_Start(ThreadFunc func, void *arg);
+
+// Wait for the thread to exit and free the handle
+void Thread_Join(struct Thread *thread);
+
+
+// Storage class for variables with a separate instance per thread
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+
+// Sequentially consistent operations on 32-bit integers shared between
+// threads without locking
+static inline int32_t Atomic_Load(volatile int32_t *p)
+{
+#ifdef _WIN32
+	return InterlockedCompareExchange((volatile LONG *)p, 0, 0);
+#else
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+#endif
+}
+
+
+static inline void Atomic_Store(volatile int32_t *p, int32_t value)
+{
+#ifdef _WIN32
+	InterlockedExchange((volatile LONG *)p, value);
+#else
+	__atomic_store_n(p, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+
+// Returns the incremented value
+static inline int32_t Atomic_Increment(volatile int32_t *p)
+{
+#ifdef _WIN32
+	return InterlockedIncrement((volatile LONG *)p);
+#else
+	return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+
+// Acquire and release operations on 64-bit values (such as ring buffer
+// cursors) that one thread publishes to another without locking: a load
+// with acquire semantics sees everything written before the store with
+// release semantics of the value it reads
+static inline uint64_t Atomic_LoadAcquire64(const volatile uint64_t *p)
+{
+#if defined(_M_X64)
+	// Aligned 64-bit loads are atomic, and x64 does not reorder a load with
+	// later accesses; only the compiler must be kept from doing so
+	uint64_t value = *p;
+	_ReadWriteBarrier();
+	return value;
+#elif defined(_WIN32)
+	return (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)p, 0, 0);
+#else
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+
+static inline void Atomic_StoreRelease64(volatile uint64_t *p, uint64_t value)
+{
+#if defined(_M_X64)
+	_ReadWriteBarrier();
+	*p = value;
+#elif defined(_WIN32)
+	InterlockedExchange64((volatile LONG64 *)p, (LONG64)value);
+#else
+	__atomic_store_n(p, value, __ATOMIC_RELEASE);
+#endif
+}
+
+
+// Relaxed operations on 64-bit counters shared between threads without
+// locking: each operation is atomic, but imposes no ordering on other memory
+// accesses
+static inline int64_t Counter_Load(volatile int64_t *p)
+{
+#if defined(_WIN64)
+	return *p; // Aligned 64-bit loads are atomic
+#elif defined(_WIN32)
+	return InterlockedCompareExchange64((volatile LONG64 *)p, 0, 0);
+#else
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+#endif
+}
+
+
+static inline void Counter_Store(volatile int64_t *p, int64_t value)
+{
+#if defined(_WIN64)
+	*p = value;
+#elif defined(_WIN32)
+	InterlockedExchange64((volatile LONG64 *)p, value);
+#else
+	__atomic_store_n(p, value, __ATOMIC_RELAXED);
+#endif
+}
+
+
+static inline void Counter_Add(volatile int64_t *p, int64_t delta)
+{
+#ifdef _WIN32
+	InterlockedExchangeAdd64((volatile LONG64 *)p, delta);
+#else
+	__atomic_fetch_add(p, delta, __ATOMIC_RELAXED);
+#endif
+}
+
+
+// Raise the counter to value if it is lower
+static inline void Counter_Max(volatile int64_t *p, int64_t value)
+{
+	int64_t current = Counter_Load(p);
+	while (value > current)
+	{
+#ifdef _WIN32
+		int64_t previous = InterlockedCompareExchange64((volatile LONG64 *)p, value, current);
+		if (previous == current)
+			break;
+		current = previous;
+#else
+		if (__atomic_compare_exchange_n(p, &current, value, true,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+#endif
+	}
+}
+
+
+// High-resolution monotonic clock, in ticks of 1 / Time_GetTicksPerSecond()
+// seconds from an arbitrary origin (never 0 in practice, so that 0 can mean
+// "no time")
+int64_t Time_GetTicks(void);
+int64_t Time_GetTicksPerSecond(void);
+
+// Milliseconds between two tick counts
+static inline double Time_TicksToMs(int64_t ticks)
+{
+	return 1e3 * ticks / Time_GetTicksPerSecond();
+}
+
+// Monotonic clock in milliseconds, for coarse timeouts
+uint64_t Time_GetMs(void);
+
+void Time_SleepMs(uint32_t ms);
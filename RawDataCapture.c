@@ -0,0 +1,431 @@
+#include "OScNIDAQDevicePrivate.h"
+
+#include <OpenScanDeviceLib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Capture of the raw detector data of an acquisition to a file, and replay
+// of the file through the same processing (HandleRawData()) without the DAQ,
+// to reproduce and profile the processing of a real stream (e.g. one that
+// stalled) deterministically.
+//
+// Chunks are written by the processing thread just before it handles them,
+// so the file holds exactly the chunks (as read by DetectorDataCallback())
+// that the processing saw, with the time each was read from the DAQ.
+//
+// The file consists of a CaptureFileHeader, written when the first chunk
+// arrives, followed by each chunk as a CaptureChunkRecord and its raw pixels
+// (numPixels elements of the raw data ring buffer). Fields are in host
+// (little-endian) byte order; the structs have no padding.
+
+
+#define CAPTURE_MAGIC "OScNIRaw"
+#define CAPTURE_VERSION 1
+
+
+struct CaptureFileHeader
+{
+	char magic[8]; // CAPTURE_MAGIC, not nul-terminated
+	uint32_t version;
+	uint32_t headerBytes; // sizeof(struct CaptureFileHeader)
+	uint32_t numChannels; // Interleaved in each scan
+	uint32_t oversampling; // Scans per pixel
+	uint32_t width; // Of the frame, in pixels
+	uint32_t height; // Of the frame, in lines
+	uint32_t linesToAverage;
+	uint32_t inputBufferSize; // DAQmx input buffer, in samples per channel
+	uint32_t framesToDeliver; // When streaming; UNBOUNDED_FRAME_COUNT if live
+	uint8_t binary; // int16 ADC codes; else float64 volts
+	uint8_t bidirectional;
+	uint8_t streaming; // Y retrace lines are included between frames
+	uint8_t reserved;
+	uint64_t ringOffset; // Position of the first chunk in the ring buffer storage
+	double sampleRateHz;
+	double inputVoltageRange;
+};
+
+
+struct CaptureChunkRecord
+{
+	uint32_t numPixels;
+	uint32_t reserved;
+	int64_t readTimeNs; // Since the first chunk was read
+	uint64_t firstSample;
+	uint64_t samplesAcquired;
+};
+
+
+static void FillCaptureFileHeader(OScDev_Device *device, struct CaptureFileHeader *header,
+	uint64_t firstPixel)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, CAPTURE_MAGIC, sizeof(header->magic));
+	header->version = CAPTURE_VERSION;
+	header->headerBytes = sizeof(*header);
+	header->numChannels = GetNumberOfEnabledChannels(device);
+	header->oversampling = GetData(device)->rawDataOversampling;
+	header->width = GetData(device)->configuredRasterWidth;
+	header->height = GetData(device)->configuredRasterHeight;
+	header->linesToAverage = GetData(device)->lineAveraging.lines;
+	header->inputBufferSize = GetData(device)->processing.inputBufferSize;
+	header->framesToDeliver = GetData(device)->stream.framesToDeliver;
+	header->binary = GetData(device)->rawDataIsBinary;
+	header->bidirectional = GetData(device)->rawDataBidirectional;
+	header->streaming = GetData(device)->stream.active;
+	header->ringOffset = firstPixel & (GetData(device)->rawData.capacity - 1);
+	header->sampleRateHz = GetData(device)->frameTiming.sampleRateHz;
+	header->inputVoltageRange = GetData(device)->inputVoltageRange;
+}
+
+
+// Open the capture file, if one is set, for the acquisition about to start
+OScDev_RichError *StartRawDataCapture(OScDev_Device *device)
+{
+	if (GetData(device)->rawDataCapture.capturePath[0] == '\0')
+		return OScDev_RichError_OK;
+
+	FILE *file = fopen(GetData(device)->rawDataCapture.capturePath, "wb");
+	if (!file)
+		return OScDev_Error_Create("Cannot open raw data capture file");
+
+	Mutex_Lock(&GetData(device)->rawDataCapture.mutex);
+	GetData(device)->rawDataCapture.file = file;
+	GetData(device)->rawDataCapture.headerWritten = false;
+	GetData(device)->rawDataCapture.chunks = 0;
+	GetData(device)->rawDataCapture.bytes = 0;
+	Mutex_Unlock(&GetData(device)->rawDataCapture.mutex);
+	return OScDev_RichError_OK;
+}
+
+
+// Close the file; must hold the capture mutex
+static void CloseCaptureFile(OScDev_Device *device)
+{
+	if (fclose(GetData(device)->rawDataCapture.file) != 0)
+		OScDev_Log_Error(device, "Error: Failed to finish writing raw data capture file");
+	GetData(device)->rawDataCapture.file = NULL;
+}
+
+
+// Append a chunk (still in the raw data ring buffer) to the capture file;
+// on error, log it and stop capturing
+// Called on the processing thread, before handling the chunk
+void CaptureRawDataChunk(OScDev_Device *device, const struct RawDataChunk *chunk)
+{
+	struct RingBuffer *ring = &GetData(device)->rawData;
+
+	Mutex_Lock(&GetData(device)->rawDataCapture.mutex);
+	if (!GetData(device)->rawDataCapture.file)
+	{
+		Mutex_Unlock(&GetData(device)->rawDataCapture.mutex);
+		return;
+	}
+	FILE *file = GetData(device)->rawDataCapture.file;
+
+	bool ok = true;
+	if (!GetData(device)->rawDataCapture.headerWritten)
+	{
+		struct CaptureFileHeader header;
+		FillCaptureFileHeader(device, &header, chunk->firstPixel);
+		ok = fwrite(&header, sizeof(header), 1, file) == 1;
+		GetData(device)->rawDataCapture.headerWritten = true;
+		GetData(device)->rawDataCapture.startTime = chunk->readTime;
+	}
+
+	struct CaptureChunkRecord record;
+	memset(&record, 0, sizeof(record));
+	record.numPixels = chunk->numPixels;
+	record.readTimeNs = (int64_t)(1e6 *
+		Time_TicksToMs(chunk->readTime - GetData(device)->rawDataCapture.startTime));
+	record.firstSample = chunk->firstSample;
+	record.samplesAcquired = chunk->samplesAcquired;
+
+	// Chunks never span the end of the ring buffer storage
+	const char *pixels = ring->data +
+		(chunk->firstPixel & (ring->capacity - 1)) * ring->elementSize;
+	size_t bytes = chunk->numPixels * ring->elementSize;
+	ok = ok && fwrite(&record, sizeof(record), 1, file) == 1 &&
+		fwrite(pixels, 1, bytes, file) == bytes;
+
+	if (ok)
+	{
+		GetData(device)->rawDataCapture.chunks++;
+		GetData(device)->rawDataCapture.bytes += sizeof(record) + bytes;
+	}
+	else
+	{
+		OScDev_Log_Error(device, "Error: Failed to write raw data capture file; capture stopped");
+		CloseCaptureFile(device);
+	}
+	Mutex_Unlock(&GetData(device)->rawDataCapture.mutex);
+}
+
+
+// Close the capture file at the end of the acquisition. Chunks still being
+// processed are not captured.
+void StopRawDataCapture(OScDev_Device *device)
+{
+	Mutex_Lock(&GetData(device)->rawDataCapture.mutex);
+	if (GetData(device)->rawDataCapture.file)
+	{
+		CloseCaptureFile(device);
+
+		char msg[OScDev_MAX_STR_LEN + 1];
+		snprintf(msg, OScDev_MAX_STR_LEN,
+			"Captured %llu chunks (%llu bytes) of raw detector data",
+			(unsigned long long)GetData(device)->rawDataCapture.chunks,
+			(unsigned long long)GetData(device)->rawDataCapture.bytes);
+		OScDev_Log_Info(device, msg);
+	}
+	Mutex_Unlock(&GetData(device)->rawDataCapture.mutex);
+}
+
+
+static OScDev_RichError *ReadCaptureFileHeader(FILE *file, struct CaptureFileHeader *header)
+{
+	if (fread(header, sizeof(*header), 1, file) != 1 ||
+		memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) != 0)
+		return OScDev_Error_Create("Not a raw data capture file");
+	if (header->version != CAPTURE_VERSION || header->headerBytes != sizeof(*header))
+		return OScDev_Error_Create("Unsupported raw data capture file version");
+	if (header->numChannels < 1 || header->numChannels > MAX_PHYSICAL_CHANS ||
+		header->oversampling < 1 || header->width < 1 || header->height < 1 ||
+		header->linesToAverage < 1 || header->inputBufferSize < header->oversampling ||
+		header->sampleRateHz <= 0.0)
+		return OScDev_Error_Create("Invalid raw data capture file header");
+	return OScDev_RichError_OK;
+}
+
+
+struct ReplayStatistics
+{
+	uint64_t chunks;
+	uint64_t pixels;
+	int64_t recordedNs; // Read time of the last chunk
+	int64_t processingTicks;
+	int64_t maxChunkTicks;
+	int64_t maxLagTicks; // Behind the recorded read time
+};
+
+
+// Read one chunk into the raw data ring buffer and process it, in two parts
+// if the free space wraps around the end of the storage (which only happens
+// if the chunk was not so split when captured)
+static OScDev_RichError *ReplayChunk(OScDev_Device *device, FILE *file,
+	const struct CaptureChunkRecord *record, struct ReplayStatistics *stats)
+{
+	struct RingBuffer *ring = &GetData(device)->rawData;
+	uint32_t oversampling = GetData(device)->rawDataOversampling;
+
+	size_t done = 0;
+	while (done < record->numPixels)
+	{
+		void *dest;
+		size_t n = RingBuffer_GetWritable(ring, &dest);
+		if (n > record->numPixels - done)
+			n = record->numPixels - done;
+		if (fread(dest, ring->elementSize, n, file) != n)
+			return OScDev_Error_Create("Raw data capture file is truncated");
+
+		struct RawDataChunk chunk;
+		chunk.firstPixel = ring->writeCursor;
+		chunk.numPixels = (uint32_t)n;
+		chunk.readTime = Time_GetTicks();
+		chunk.firstSample = record->firstSample + done * oversampling;
+		chunk.samplesAcquired = record->samplesAcquired;
+		RingBuffer_Produce(ring, n);
+
+		int64_t start = Time_GetTicks();
+		if (HandleRawData(device, &chunk))
+			return OScDev_Error_Create("Failed to process detector data");
+		int64_t ticks = Time_GetTicks() - start;
+		ReleaseFilledFrameSets(device);
+
+		stats->processingTicks += ticks;
+		if (ticks > stats->maxChunkTicks)
+			stats->maxChunkTicks = ticks;
+		done += n;
+	}
+	stats->chunks++;
+	stats->pixels += record->numPixels;
+	stats->recordedNs = record->readTimeNs;
+	return OScDev_RichError_OK;
+}
+
+
+static OScDev_RichError *ReplayChunks(OScDev_Device *device, FILE *file,
+	struct ReplayStatistics *stats)
+{
+	bool recordedSpeed = GetData(device)->rawDataCapture.replaySpeed == ReplaySpeed_Recorded;
+	int64_t ticksPerSecond = Time_GetTicksPerSecond();
+	int64_t startTime = Time_GetTicks();
+
+	for (;;)
+	{
+		struct CaptureChunkRecord record;
+		size_t got = fread(&record, 1, sizeof(record), file);
+		if (got == 0 && feof(file))
+			return OScDev_RichError_OK;
+		if (got != sizeof(record))
+			return OScDev_Error_Create("Raw data capture file is truncated");
+		if (record.numPixels > GetData(device)->rawData.capacity)
+			return OScDev_Error_Create("Invalid chunk in raw data capture file");
+
+		if (recordedSpeed)
+		{
+			int64_t due = startTime + (int64_t)(record.readTimeNs * 1e-9 * ticksPerSecond);
+			int64_t now = Time_GetTicks();
+			if (due > now)
+				Time_SleepMs((uint32_t)Time_TicksToMs(due - now));
+			else if (now - due > stats->maxLagTicks)
+				stats->maxLagTicks = now - due;
+		}
+
+		OScDev_RichError *err = ReplayChunk(device, file, &record, stats);
+		if (err)
+			return err;
+	}
+}
+
+
+static void LogReplayStatistics(OScDev_Device *device, const struct CaptureFileHeader *header,
+	const struct ReplayStatistics *stats, int64_t wallTicks)
+{
+	double seconds = 1e-3 * Time_TicksToMs(stats->processingTicks);
+	double samples = (double)stats->pixels * header->numChannels * header->oversampling;
+
+	char msg[OScDev_MAX_STR_LEN + 1];
+	snprintf(msg, OScDev_MAX_STR_LEN,
+		"{\"replay\": \"raw data\", \"speed\": \"%s\", \"kernel\": \"%s\", "
+		"\"format\": \"%s\", \"oversampling\": %u, \"channels\": %u, "
+		"\"width\": %u, \"height\": %u, \"chunks\": %llu, \"pixels\": %llu, "
+		"\"recordedSeconds\": %.6f, \"wallSeconds\": %.6f, "
+		"\"processingSeconds\": %.6f, \"samplesPerSecond\": %.4g, "
+		"\"maxChunkProcessingUs\": %.1f, \"maxLagMs\": %.3f, "
+		"\"framesFinished\": %u, \"framesDropped\": %d}",
+		GetData(device)->rawDataCapture.replaySpeed == ReplaySpeed_Recorded ?
+		"recorded" : "maximum",
+		GetData(device)->convertSamplesName,
+		header->binary ? "i16" : "f64", header->oversampling, header->numChannels,
+		header->width, header->height,
+		(unsigned long long)stats->chunks, (unsigned long long)stats->pixels,
+		1e-9 * stats->recordedNs, 1e-3 * Time_TicksToMs(wallTicks),
+		seconds, seconds > 0.0 ? samples / seconds : 0.0,
+		1e3 * Time_TicksToMs(stats->maxChunkTicks), Time_TicksToMs(stats->maxLagTicks),
+		GetFramesFinished(device),
+		Atomic_Load(&GetData(device)->delivery.framesDropped));
+	OScDev_Log_Info(device, msg);
+}
+
+
+// Replay the replay file through the detector processing, as configured when
+// it was captured (except that ADC codes are scaled nominally, and frame
+// averaging and buffering are as currently set), and log the statistics.
+// The frames are discarded. The device cannot be armed meanwhile.
+OScDev_RichError *ReplayRawData(OScDev_Device *device)
+{
+	OScDev_RichError *err = OScDev_RichError_OK;
+
+	struct Mutex *mutex = &GetData(device)->acquisition.mutex;
+	Mutex_Lock(mutex);
+	if (GetData(device)->acquisition.running)
+	{
+		Mutex_Unlock(mutex);
+		return OScDev_Error_Create("Cannot replay raw data while acquiring");
+	}
+
+	bool channelEnabled[MAX_PHYSICAL_CHANS];
+	memcpy(channelEnabled, GetData(device)->channelEnabled, sizeof(channelEnabled));
+	uint32_t width = GetData(device)->configuredRasterWidth;
+	uint32_t height = GetData(device)->configuredRasterHeight;
+	bool readBinarySamples = GetData(device)->readBinarySamples;
+	uint32_t oversamplingFactor = GetData(device)->oversamplingFactor;
+	uint32_t linesToAverage = GetData(device)->linesToAverage;
+	bool bidirectionalScan = GetData(device)->bidirectionalScan;
+	double inputVoltageRange = GetData(device)->inputVoltageRange;
+
+	FILE *file = fopen(GetData(device)->rawDataCapture.replayPath, "rb");
+	if (!file)
+	{
+		err = OScDev_Error_Create("Cannot open raw data replay file");
+		goto cleanup;
+	}
+
+	struct CaptureFileHeader header;
+	err = ReadCaptureFileHeader(file, &header);
+	if (err)
+		goto cleanup;
+
+	for (uint32_t ch = 0; ch < MAX_PHYSICAL_CHANS; ++ch)
+		GetData(device)->channelEnabled[ch] = ch < header.numChannels;
+	GetData(device)->configuredRasterWidth = header.width;
+	GetData(device)->configuredRasterHeight = header.height;
+	GetData(device)->readBinarySamples = header.binary;
+	GetData(device)->oversamplingFactor = header.oversampling;
+	GetData(device)->linesToAverage = header.linesToAverage;
+	GetData(device)->bidirectionalScan = header.bidirectional;
+	GetData(device)->inputVoltageRange = header.inputVoltageRange;
+	GetData(device)->frameTiming.sampleRateHz = header.sampleRateHz;
+
+	err = AllocateProcessingBuffers(device, header.width, header.height,
+		header.inputBufferSize);
+	if (err)
+		goto cleanup;
+	if (header.binary)
+	{
+		err = BuildNominalConversionTables(device);
+		if (err)
+			goto cleanup;
+	}
+
+	ResetFramePool(device, true);
+	ResetFrameAveraging(device);
+	DiscardPartialFrame(device);
+	GetData(device)->stream.active = header.streaming;
+	GetData(device)->stream.framesToDeliver = header.framesToDeliver;
+	GetData(device)->stream.framesCompleted = 0;
+	GetData(device)->stream.retracePixelsToSkip = 0;
+	Atomic_Store(&GetData(device)->stream.finished, 0);
+
+	// Start at the same position in the ring buffer storage as the capture,
+	// so that chunks are split at its end as they were when read
+	struct RingBuffer *ring = &GetData(device)->rawData;
+	size_t ringOffset = (size_t)(header.ringOffset & (ring->capacity - 1));
+	RingBuffer_Produce(ring, ringOffset);
+	RingBuffer_Consume(ring, ringOffset);
+
+	OScDev_Log_Info(device, "Replaying raw detector data");
+	struct ReplayStatistics stats;
+	memset(&stats, 0, sizeof(stats));
+	int64_t start = Time_GetTicks();
+	err = ReplayChunks(device, file, &stats);
+	if (err)
+		goto cleanup;
+	LogReplayStatistics(device, &header, &stats, Time_GetTicks() - start);
+
+cleanup:
+	if (file)
+		fclose(file);
+
+	memcpy(GetData(device)->channelEnabled, channelEnabled, sizeof(channelEnabled));
+	GetData(device)->configuredRasterWidth = width;
+	GetData(device)->configuredRasterHeight = height;
+	GetData(device)->readBinarySamples = readBinarySamples;
+	GetData(device)->oversamplingFactor = oversamplingFactor;
+	GetData(device)->linesToAverage = linesToAverage;
+	GetData(device)->bidirectionalScan = bidirectionalScan;
+	GetData(device)->inputVoltageRange = inputVoltageRange;
+
+	// The buffers no longer match the detector configuration
+	ResetFramePool(device, true);
+	GetData(device)->stream.active = false;
+	GetData(device)->detectorConfig.mustReconfigureCallback = true;
+
+	Mutex_Unlock(mutex);
+	if (err)
+		err = OScDev_Error_Wrap(err, "Raw data replay failed");
+	return err;
+}
@@ -0,0 +1,113 @@
+#include "RingBuffer.h"
+#include "Platform.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+static size_t RoundUpToPowerOfTwo(size_t n)
+{
+	size_t ret = 1;
+	while (ret < n)
+		ret <<= 1;
+	return ret;
+}
+
+
+bool RingBuffer_Allocate(struct RingBuffer *ring, size_t minCapacity, size_t elementSize)
+{
+	size_t capacity = RoundUpToPowerOfTwo(minCapacity > 0 ? minCapacity : 1);
+	char *data = realloc(ring->data, capacity * elementSize);
+	if (!data)
+		return false;
+
+	ring->data = data;
+	ring->elementSize = elementSize;
+	ring->capacity = capacity;
+	RingBuffer_Reset(ring);
+	return true;
+}
+
+
+void RingBuffer_Free(struct RingBuffer *ring)
+{
+	free(ring->data);
+	ring->data = NULL;
+	ring->capacity = 0;
+	RingBuffer_Reset(ring);
+}
+
+
+void RingBuffer_Reset(struct RingBuffer *ring)
+{
+	ring->writeCursor = 0;
+	ring->readCursor = 0;
+}
+
+
+size_t RingBuffer_GetSize(const struct RingBuffer *ring)
+{
+	uint64_t readCursor = Atomic_LoadAcquire64(&ring->readCursor);
+	return (size_t)(Atomic_LoadAcquire64(&ring->writeCursor) - readCursor);
+}
+
+
+size_t RingBuffer_GetWritable(struct RingBuffer *ring, void **ptr)
+{
+	size_t mask = ring->capacity - 1;
+	uint64_t writeCursor = ring->writeCursor; // Only we modify it
+	size_t start = (size_t)writeCursor & mask;
+	size_t free = ring->capacity -
+		(size_t)(writeCursor - Atomic_LoadAcquire64(&ring->readCursor));
+	size_t untilEnd = ring->capacity - start;
+
+	*ptr = ring->data + start * ring->elementSize;
+	return free < untilEnd ? free : untilEnd;
+}
+
+
+void RingBuffer_Produce(struct RingBuffer *ring, size_t count)
+{
+	Atomic_StoreRelease64(&ring->writeCursor, ring->writeCursor + count);
+}
+
+
+bool RingBuffer_Push(struct RingBuffer *ring, const void *element)
+{
+	void *ptr;
+	if (RingBuffer_GetWritable(ring, &ptr) == 0)
+		return false;
+	memcpy(ptr, element, ring->elementSize);
+	RingBuffer_Produce(ring, 1);
+	return true;
+}
+
+
+size_t RingBuffer_GetReadable(struct RingBuffer *ring, const void **ptr)
+{
+	size_t mask = ring->capacity - 1;
+	uint64_t readCursor = ring->readCursor; // Only we modify it
+	size_t start = (size_t)readCursor & mask;
+	size_t size = (size_t)(Atomic_LoadAcquire64(&ring->writeCursor) - readCursor);
+	size_t untilEnd = ring->capacity - start;
+
+	*ptr = ring->data + start * ring->elementSize;
+	return size < untilEnd ? size : untilEnd;
+}
+
+
+void RingBuffer_Consume(struct RingBuffer *ring, size_t count)
+{
+	Atomic_StoreRelease64(&ring->readCursor, ring->readCursor + count);
+}
+
+
+bool RingBuffer_Pop(struct RingBuffer *ring, void *element)
+{
+	const void *ptr;
+	if (RingBuffer_GetReadable(ring, &ptr) == 0)
+		return false;
+	memcpy(element, ptr, ring->elementSize);
+	RingBuffer_Consume(ring, 1);
+	return true;
+}
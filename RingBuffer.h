@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Circular buffer of fixed-size elements (here, scans of interleaved
+// detector samples) with explicit read and write cursors.
+//
+// The capacity is a power of two, so that positions are obtained by masking
+// the cursors, which count elements written and read since the last reset
+// and never wrap in practice. Data is never moved; readers and writers access
+// the buffer in at most two contiguous segments (before and after the end of
+// the storage).
+//
+// One thread may produce while another consumes, without locking: each
+// cursor is only advanced by its owner, and is published with release
+// semantics after the corresponding data has been written or read.
+// Allocate, Free, and Reset require that no other thread is accessing the
+// buffer.
+struct RingBuffer
+{
+	char *data;
+	size_t elementSize; // bytes
+	size_t capacity; // elements; power of two
+	volatile uint64_t writeCursor; // Advanced by producer
+	volatile uint64_t readCursor; // Advanced by consumer
+};
+
+
+// Allocate (or reallocate) storage for at least minCapacity elements.
+// Any data in the buffer is discarded. Returns false on allocation failure.
+bool RingBuffer_Allocate(struct RingBuffer *ring, size_t minCapacity, size_t elementSize);
+void RingBuffer_Free(struct RingBuffer *ring);
+
+// Discard all data
+void RingBuffer_Reset(struct RingBuffer *ring);
+
+// Number of elements currently in the buffer
+size_t RingBuffer_GetSize(const struct RingBuffer *ring);
+
+// Get the contiguous free space at the write position; returns the number of
+// elements that can be written at *ptr before calling RingBuffer_Produce().
+// Producer only.
+size_t RingBuffer_GetWritable(struct RingBuffer *ring, void **ptr);
+void RingBuffer_Produce(struct RingBuffer *ring, size_t count);
+
+// Copy one element in; returns false if the buffer is full. Producer only.
+bool RingBuffer_Push(struct RingBuffer *ring, const void *element);
+
+// Get the contiguous data at the read position; returns the number of
+// elements available at *ptr before calling RingBuffer_Consume().
+// Consumer only.
+size_t RingBuffer_GetReadable(struct RingBuffer *ring, const void **ptr);
+void RingBuffer_Consume(struct RingBuffer *ring, size_t count);
+
+// Copy one element out; returns false if the buffer is empty. Consumer only.
+bool RingBuffer_Pop(struct RingBuffer *ring, void *element);
@@ -0,0 +1,103 @@
+// Console program that runs acquisitions through the device, as an OpenScan
+// host would (Arm, Start, frame callbacks, Wait), against StandaloneHost.c.
+// Prints one JSON line per acquisition to stdout, including the performance
+// counters; exits with a nonzero status on error or if any frames were lost.
+
+#include "StandaloneHost.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static void PrintUsage(const char *program)
+{
+	fprintf(stderr,
+		"Usage: %s [options] [\"Setting Name=Value\" ...]\n"
+		"  -n FRAMES      number of frames per acquisition (default 5)\n"
+		"  -r HZ          pixel rate (default 1.25e6)\n"
+		"  -s PIXELS      resolution (default 256)\n"
+		"  -a COUNT       number of acquisitions (default 1)\n"
+		"  -k FRAMES      stop the acquisition after this many frames\n"
+		"  -v             log debug messages\n",
+		program);
+}
+
+
+int main(int argc, char **argv)
+{
+	struct StandaloneAcquisitionParams params = {
+		.frames = 5,
+		.pixelRateHz = 1.25e6,
+		.resolution = 256,
+		.stopAfterFrames = 0,
+	};
+	unsigned acquisitions = 1;
+
+	int argi = 1;
+	for (; argi < argc && argv[argi][0] == '-'; ++argi)
+	{
+		const char *opt = argv[argi];
+		if (strcmp(opt, "-v") == 0)
+		{
+			Standalone_SetVerbose(true);
+			continue;
+		}
+		if (strlen(opt) != 2 || !strchr("nrsak", opt[1]) || argi + 1 >= argc)
+		{
+			PrintUsage(argv[0]);
+			return 2;
+		}
+		const char *arg = argv[++argi];
+		switch (opt[1])
+		{
+		case 'n': params.frames = (uint32_t)strtoul(arg, NULL, 10); break;
+		case 'r': params.pixelRateHz = strtod(arg, NULL); break;
+		case 's': params.resolution = (uint32_t)strtoul(arg, NULL, 10); break;
+		case 'a': acquisitions = (unsigned)strtoul(arg, NULL, 10); break;
+		case 'k': params.stopAfterFrames = (uint32_t)strtoul(arg, NULL, 10); break;
+		}
+	}
+
+	OScDev_Device *device = Standalone_OpenDevice();
+	if (!device)
+		return 1;
+
+	int status = 0;
+	for (; argi < argc; ++argi)
+	{
+		if (!Standalone_ApplySetting(device, argv[argi]))
+		{
+			status = 1;
+			goto cleanup;
+		}
+	}
+
+	uint32_t expectedFrames = params.frames;
+	if (params.stopAfterFrames > 0 && params.stopAfterFrames < expectedFrames)
+		expectedFrames = params.stopAfterFrames;
+
+	for (unsigned i = 0; i < acquisitions; ++i)
+	{
+		struct StandaloneAcquisitionResult result;
+		bool ok = Standalone_Acquire(device, &params, &result);
+
+		printf("{\"acquisition\": %u, \"ok\": %s, \"frames\": %u, \"framesDelivered\": %u, "
+			"\"meanPixel\": %.3f, \"armMs\": %.3f, \"runMs\": %.3f",
+			i, ok ? "true" : "false", (unsigned)params.frames, (unsigned)result.framesDelivered,
+			result.meanPixel, result.armMs, result.runMs);
+		Standalone_WriteCountersJSON(device, stdout);
+		printf("}\n");
+		fflush(stdout);
+
+		if (!ok || result.framesDelivered != expectedFrames)
+		{
+			status = 1;
+			break;
+		}
+	}
+
+cleanup:
+	Standalone_CloseDevice(device);
+	return status;
+}
@@ -0,0 +1,61 @@
+// Console program that runs a benchmark (see DetectorBenchmark.c and
+// WaveformBenchmark.c) on a device opened through StandaloneHost.c, writing
+// one JSON line per case to stdout, for tracking performance regressions.
+
+#include "OScNIDAQDevicePrivate.h"
+#include "StandaloneHost.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+static void PrintUsage(const char *program)
+{
+	fprintf(stderr,
+		"Usage: %s [-v] detector|waveform [\"Setting Name=Value\" ...]\n"
+		"  -v             log debug messages\n"
+		"The settings are applied before running the benchmark.\n",
+		program);
+}
+
+
+int main(int argc, char **argv)
+{
+	int argi = 1;
+	if (argi < argc && strcmp(argv[argi], "-v") == 0)
+	{
+		Standalone_SetVerbose(true);
+		++argi;
+	}
+	if (argi >= argc ||
+		(strcmp(argv[argi], "detector") != 0 && strcmp(argv[argi], "waveform") != 0))
+	{
+		PrintUsage(argv[0]);
+		return 2;
+	}
+	bool waveform = strcmp(argv[argi], "waveform") == 0;
+	++argi;
+
+	OScDev_Device *device = Standalone_OpenDevice();
+	if (!device)
+		return 1;
+
+	int status = 0;
+	for (; argi < argc; ++argi)
+	{
+		if (!Standalone_ApplySetting(device, argv[argi]))
+		{
+			status = 1;
+			goto cleanup;
+		}
+	}
+
+	OScDev_RichError *err = waveform ?
+		RunWaveformBenchmark(device, stdout) : RunDetectorBenchmark(device, stdout);
+	if (OScDev_Error_ReturnAsCode(err) != OScDev_OK)
+		status = 1;
+
+cleanup:
+	Standalone_CloseDevice(device);
+	return status;
+}
@@ -19,7 +19,7 @@ OScDev_RichError *SetUpScanner(OScDev_Device *device, struct ScannerConfig *conf
 
 	if (!config->aoTask)
 	{
-		err = CreateDAQmxError(DAQmxCreateTask("Scanner", &config->aoTask));
+		err = CreateDAQmxError(GetDAQ()->CreateTask("Scanner", &config->aoTask));
 		if (err)
 		{
 			err = OScDev_Error_Wrap(err, "Failed to create scanner task");
@@ -30,7 +30,7 @@ OScDev_RichError *SetUpScanner(OScDev_Device *device, struct ScannerConfig *conf
 		strncpy(aoTerminals, GetData(device)->deviceName, sizeof(aoTerminals) - 1);
 		strncat(aoTerminals, "/ao0:1", sizeof(aoTerminals) - strlen(aoTerminals) - 1);
 
-		err = CreateDAQmxError(DAQmxCreateAOVoltageChan(config->aoTask, aoTerminals,
+		err = CreateDAQmxError(GetDAQ()->CreateAOVoltageChan(config->aoTask, aoTerminals,
 			"Galvos", -10.0, 10.0, DAQmx_Val_Volts, NULL));
 		if (err)
 		{
@@ -63,7 +63,7 @@ OScDev_RichError *SetUpScanner(OScDev_Device *device, struct ScannerConfig *conf
 
 	if (mustCommit)
 	{
-		err = CreateDAQmxError(DAQmxTaskControl(config->aoTask, DAQmx_Val_Task_Commit));
+		err = CreateDAQmxError(GetDAQ()->TaskControl(config->aoTask, DAQmx_Val_Task_Commit));
 		if (err)
 		{
 			err = OScDev_Error_Wrap(err, "Failed to commit task for scanner");
@@ -86,7 +86,7 @@ OScDev_RichError *ShutdownScanner(OScDev_Device *device, struct ScannerConfig *c
 	OScDev_RichError *err;
 	if (config->aoTask)
 	{
-		err = CreateDAQmxError(DAQmxClearTask(config->aoTask));
+		err = CreateDAQmxError(GetDAQ()->ClearTask(config->aoTask));
 		if (err)
 		{
 			err = OScDev_Error_Wrap(err, "Failed to clear scanner task");
@@ -101,7 +101,7 @@ OScDev_RichError *ShutdownScanner(OScDev_Device *device, struct ScannerConfig *c
 OScDev_RichError *StartScanner(OScDev_Device *device, struct ScannerConfig *config)
 {
 	OScDev_RichError *err;
-	err = CreateDAQmxError(DAQmxStartTask(config->aoTask));
+	err = CreateDAQmxError(GetDAQ()->StartTask(config->aoTask));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to start scanner task");
@@ -112,10 +112,47 @@ OScDev_RichError *StartScanner(OScDev_Device *device, struct ScannerConfig *conf
 }
 
 
+// Wait until the finite waveform of a frame (including the Y retrace) has
+// been generated
+OScDev_RichError *WaitForScannerDone(OScDev_Device *device, struct ScannerConfig *config, double timeoutSec)
+{
+	OScDev_RichError *err;
+	err = CreateDAQmxError(GetDAQ()->WaitUntilTaskDone(config->aoTask, timeoutSec));
+	if (err)
+	{
+		err = OScDev_Error_Wrap(err, "Failed to wait for scanner task to finish");
+		return err;
+	}
+	return OScDev_RichError_OK;
+}
+
+
+// Wait up to timeoutSec for the finite waveform of a frame to be generated,
+// returning early when it is; *done is false (and no error returned) if it
+// is still being generated
+OScDev_RichError *WaitForScannerDoneWithin(OScDev_Device *device, struct ScannerConfig *config,
+	double timeoutSec, bool *done)
+{
+	int32 nierr = GetDAQ()->WaitUntilTaskDone(config->aoTask, timeoutSec);
+	*done = nierr != DAQmxErrorWaitUntilDoneDoesNotIndicateDone;
+	if (!*done)
+		return OScDev_RichError_OK;
+
+	OScDev_RichError *err;
+	err = CreateDAQmxError(nierr);
+	if (err)
+	{
+		err = OScDev_Error_Wrap(err, "Failed to wait for scanner task to finish");
+		return err;
+	}
+	return OScDev_RichError_OK;
+}
+
+
 OScDev_RichError *StopScanner(OScDev_Device *device, struct ScannerConfig *config)
 {
 	OScDev_RichError *err;
-	err = CreateDAQmxError(DAQmxStopTask(config->aoTask));
+	err = CreateDAQmxError(GetDAQ()->StopTask(config->aoTask));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to stop scanner task");
@@ -126,6 +163,68 @@ OScDev_RichError *StopScanner(OScDev_Device *device, struct ScannerConfig *confi
 }
 
 
+// Stop the scanner immediately, leaving the galvos wherever they are in the
+// frame; follow with ParkScanner()
+OScDev_RichError *AbortScanner(OScDev_Device *device, struct ScannerConfig *config)
+{
+	OScDev_RichError *err;
+	err = CreateDAQmxError(GetDAQ()->TaskControl(config->aoTask, DAQmx_Val_Task_Abort));
+	if (err)
+	{
+		err = OScDev_Error_Wrap(err, "Failed to abort scanner task");
+		ShutdownScanner(device, config); // Force re-setup next time
+		return err;
+	}
+
+	// Aborting discards the generation in progress; write the waveform
+	// afresh before the next start
+	config->mustRewriteOutput = true;
+
+	return OScDev_RichError_OK;
+}
+
+
+// Move the galvos to the start of the frame, where a completed scan leaves
+// them. The scanner task must not be running (an aborted task releases the
+// channels, so that we can write to them with a separate on-demand task).
+OScDev_RichError *ParkScanner(OScDev_Device *device, struct ScannerConfig *config)
+{
+	OScDev_RichError *err;
+	TaskHandle parkTask = 0;
+	err = CreateDAQmxError(GetDAQ()->CreateTask("ScannerPark", &parkTask));
+	if (err)
+	{
+		err = OScDev_Error_Wrap(err, "Failed to create scanner park task");
+		return err;
+	}
+
+	char aoTerminals[256];
+	strncpy(aoTerminals, GetData(device)->deviceName, sizeof(aoTerminals) - 1);
+	strncat(aoTerminals, "/ao0:1", sizeof(aoTerminals) - strlen(aoTerminals) - 1);
+
+	err = CreateDAQmxError(GetDAQ()->CreateAOVoltageChan(parkTask, aoTerminals,
+		"GalvosPark", -10.0, 10.0, DAQmx_Val_Volts, NULL));
+	if (err)
+	{
+		err = OScDev_Error_Wrap(err, "Failed to create ao channels for scanner park");
+		goto cleanup;
+	}
+
+	int32 numWritten = 0;
+	err = CreateDAQmxError(GetDAQ()->WriteAnalogF64(parkTask, 1, TRUE, 1.0,
+		DAQmx_Val_GroupByChannel, config->parkVolts, &numWritten, NULL));
+	if (err)
+	{
+		err = OScDev_Error_Wrap(err, "Failed to park galvos");
+		goto cleanup;
+	}
+
+cleanup:
+	GetDAQ()->ClearTask(parkTask);
+	return err;
+}
+
+
 static OScDev_RichError *ConfigureScannerTiming(OScDev_Device *device, struct ScannerConfig *config, OScDev_Acquisition *acq)
 {
 	OScDev_RichError *err;
@@ -133,49 +232,108 @@ static OScDev_RichError *ConfigureScannerTiming(OScDev_Device *device, struct Sc
 	uint32_t xOffset, yOffset, width, height;
 	OScDev_Acquisition_GetROI(acq, &xOffset, &yOffset, &width, &height);
 
-	uint32_t elementsPerLine = GetData(device)->lineDelay + width + X_RETRACE_LEN;
-	uint32_t yLen = height + Y_RETRACE_LEN;
-	int32 elementsPerFramePerChan = elementsPerLine * height;
+	uint32_t elementsPerLine = GetElementsPerLine(device, width);
+	uint32_t scanLines = GetScanLinesPerFrame(device, height);
+	uint32_t yLen = scanLines + Y_RETRACE_LEN;
 	int32 totalElementsPerFramePerChan = elementsPerLine * yLen;
 
-	err = CreateDAQmxError(DAQmxCfgSampClkTiming(config->aoTask, "", pixelRateHz,
-		DAQmx_Val_Rising, DAQmx_Val_FiniteSamps, totalElementsPerFramePerChan));
+	// When the task runs for the whole sequence, the one-frame waveform in
+	// the buffer is regenerated for every frame, either for the number of
+	// frames in the sequence or until the task is stopped
+	bool streaming = GetData(device)->streamSequence;
+	uint32_t numFrames = GetData(device)->streamFrames;
+	int32 sampleMode = DAQmx_Val_FiniteSamps;
+	uInt64 samplesPerChan = totalElementsPerFramePerChan;
+	if (streaming && numFrames == 0)
+		sampleMode = DAQmx_Val_ContSamps;
+	else if (streaming)
+		samplesPerChan *= numFrames;
+	err = CreateDAQmxError(GetDAQ()->CfgSampClkTiming(config->aoTask, "", pixelRateHz,
+		DAQmx_Val_Rising, sampleMode, samplesPerChan));
 	if (err)
 	{
 		err = OScDev_Error_Wrap(err, "Failed to configure timing for scanner");
 		return err;
 	}
 
+	// Keep the buffer to one frame, rather than the whole finite sequence
+	err = CreateDAQmxError(GetDAQ()->CfgOutputBuffer(config->aoTask,
+		totalElementsPerFramePerChan));
+	if (err)
+	{
+		err = OScDev_Error_Wrap(err, "Failed to configure output buffer for scanner");
+		return err;
+	}
+
 	return OScDev_RichError_OK;
 }
 
 
-static OScDev_RichError *WriteScannerOutput(OScDev_Device *device, struct ScannerConfig *config, OScDev_Acquisition *acq)
+// Allocate and generate the X and Y waveforms for one frame, including the
+// Y retrace, with the given scan geometry and the current settings. The
+// waveforms are *elementsPerChan samples each, grouped by channel.
+// *peakBytes is set to the size of the buffer, which the caller must free.
+// Also used by the waveform benchmark (see WaveformBenchmark.c).
+OScDev_RichError *GenerateScannerOutput(OScDev_Device *device,
+	uint32_t resolution, double zoomFactor,
+	uint32_t xOffset, uint32_t yOffset, uint32_t width, uint32_t height,
+	double **xyWaveformFrame, int32 *elementsPerChan, size_t *peakBytes)
 {
 	OScDev_RichError *err;
-	uint32_t resolution = OScDev_Acquisition_GetResolution(acq);
-	double zoomFactor = OScDev_Acquisition_GetZoomFactor(acq);
-	uint32_t xOffset, yOffset, width, height;
-	OScDev_Acquisition_GetROI(acq, &xOffset, &yOffset, &width, &height);
-
-	uint32_t elementsPerLine = GetData(device)->lineDelay + width + X_RETRACE_LEN;
-	uint32_t yLen = height + Y_RETRACE_LEN;
-	int32 elementsPerFramePerChan = elementsPerLine * height;  // without y retrace portion
+	uint32_t elementsPerLine = GetElementsPerLine(device, width);
+	uint32_t scanLines = GetScanLinesPerFrame(device, height);
+	uint32_t yLen = scanLines + Y_RETRACE_LEN;
 	int32 totalElementsPerFramePerChan = elementsPerLine * yLen;   // including y retrace portion
 
-	double *xyWaveformFrame = (double*)malloc(sizeof(double) * totalElementsPerFramePerChan * 2);
+	size_t bytes = sizeof(double) * totalElementsPerFramePerChan * 2;
+	double *waveform = (double*)malloc(bytes);
+	if (!waveform)
+		return OScDev_Error_Create("Failed to allocate scanner waveforms");
 
 	err = GenerateGalvoWaveformFrame(resolution, zoomFactor,
 		GetData(device)->lineDelay,
 		xOffset, yOffset, width, height,
+		GetData(device)->linesToAverage,
+		GetData(device)->bidirectionalScan,
 		GetData(device)->offsetXY[0],
 		GetData(device)->offsetXY[1],
-		xyWaveformFrame);
+		waveform);
+	if (err)
+	{
+		free(waveform);
+		return err;
+	}
+
+	*xyWaveformFrame = waveform;
+	*elementsPerChan = totalElementsPerFramePerChan;
+	*peakBytes = bytes;
+	return OScDev_RichError_OK;
+}
+
+
+static OScDev_RichError *WriteScannerOutput(OScDev_Device *device, struct ScannerConfig *config, OScDev_Acquisition *acq)
+{
+	OScDev_RichError *err;
+	uint32_t resolution = OScDev_Acquisition_GetResolution(acq);
+	double zoomFactor = OScDev_Acquisition_GetZoomFactor(acq);
+	uint32_t xOffset, yOffset, width, height;
+	OScDev_Acquisition_GetROI(acq, &xOffset, &yOffset, &width, &height);
+
+	double *xyWaveformFrame;
+	int32 totalElementsPerFramePerChan;
+	size_t bytes;
+	err = GenerateScannerOutput(device, resolution, zoomFactor,
+		xOffset, yOffset, width, height,
+		&xyWaveformFrame, &totalElementsPerFramePerChan, &bytes);
 	if (err)
 		return err;
 
+	// The first sample of each galvo's waveform is its resting position
+	config->parkVolts[0] = xyWaveformFrame[0];
+	config->parkVolts[1] = xyWaveformFrame[totalElementsPerFramePerChan];
+
 	int32 numWritten = 0;
-	err = CreateDAQmxError(DAQmxWriteAnalogF64(config->aoTask,
+	err = CreateDAQmxError(GetDAQ()->WriteAnalogF64(config->aoTask,
 		totalElementsPerFramePerChan, FALSE, 10.0,
 		DAQmx_Val_GroupByChannel, xyWaveformFrame, &numWritten, NULL));
 	if (err)
@@ -0,0 +1,1302 @@
+#include "DAQBackend.h"
+#include "Platform.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// A software model of one DAQ card, detailed enough to run the whole
+// acquisition engine (and measure its performance) without hardware.
+//
+// Timed tasks generate or acquire samples at their sample clock rate from
+// the time they are triggered, as computed from the monotonic clock whenever
+// they are queried; there is no per-sample work except for the data read.
+// Finite tasks finish after their samples (or pulses); retriggerable and
+// continuous tasks never do.
+//
+// Start triggers: "/<dev>/ao/StartTrigger" fires when a timed AO task is
+// started; "/<dev>/PFI12" (the default output terminal of ctr0) and
+// "/<dev>/Ctr0InternalOutput" fire on every rising edge of the running
+// counter output task. Any other source is taken to fire when the task
+// starts. A retriggerable finite AI task acquires its samples after every
+// trigger.
+//
+// Every N Samples callbacks are called on a timer thread, which polls the
+// running tasks every SIM_CALLBACK_POLL_MS.
+//
+// AI samples are a synthetic image: a smooth pattern over the trigger
+// (line) number and the sample position after the trigger, plus noise.
+// Output data is accepted but not otherwise used.
+
+#define SIM_DEVICE_NAME "SimDev1"
+#define SIM_AI_PHYSICAL_CHANS \
+	SIM_DEVICE_NAME "/ai0, " SIM_DEVICE_NAME "/ai1, " \
+	SIM_DEVICE_NAME "/ai2, " SIM_DEVICE_NAME "/ai3"
+#define SIM_AI_MAX_SINGLE_CHAN_RATE 2e6
+#define SIM_AI_MAX_MULTI_CHAN_RATE 1e6
+#define SIM_AO_MIN_VOLTS -10.0
+#define SIM_AO_MAX_VOLTS 10.0
+
+#define SIM_CALLBACK_POLL_MS 1
+
+// DAQmx status -200479: the operation is not permitted while the task is
+// running
+#define SIM_ERROR_TASK_RUNNING (-200479)
+
+
+enum SimTaskType
+{
+	SimTaskType_None, // No channels yet
+	SimTaskType_AI,
+	SimTaskType_AO,
+	SimTaskType_DO,
+	SimTaskType_CO,
+};
+
+
+enum SimTrigger
+{
+	SimTrigger_None,
+	SimTrigger_AOStart,
+	SimTrigger_Counter,
+};
+
+
+struct SimTask
+{
+	struct SimTask *next;
+	char name[64];
+	enum SimTaskType type;
+	uInt32 numChans;
+	float64 maxVolts; // AI; the range is assumed symmetric about 0
+
+	// Sample clock, or pulse train for a counter. Untimed tasks are on
+	// demand (done as soon as started).
+	bool timed;
+	float64 rate; // Samples or pulses per second
+	int32 sampleMode;
+	uInt64 sampsPerChan; // Per trigger, for finite tasks; pulses for counter
+	float64 initialDelay; // Counter; seconds
+	float64 dutyCycle; // Counter
+
+	enum SimTrigger trigger;
+	bool retriggerable;
+
+	uInt32 inputBufferSize; // 0 for the default
+	bool readAllAvailSamp;
+
+	uInt32 everyNSamples; // 0 if no callback registered
+	DAQmxEveryNSamplesEventCallbackPtr callback;
+	void *callbackData;
+	uInt64 nextCallbackSample;
+
+	bool running;
+	int64_t startTime; // Time_GetTicks()
+	int64_t triggerTime; // 0 if not yet triggered (AO start or no trigger)
+	uInt64 bankedSamples; // Acquired on counter edges of earlier counter runs
+	uInt64 readPos;
+};
+
+
+static struct
+{
+	struct Mutex mutex;
+	struct CondVar condition; // Task started, stopped, or cleared; callback returned
+	struct SimTask *tasks;
+	struct SimTask *counter; // Running counter output task, or NULL
+	struct SimTask *callbackTask; // Whose callback the timer thread is calling
+	struct Thread *timerThread;
+	double ticksPerSecond;
+	double sineTable[256];
+} sim;
+
+static THREAD_LOCAL char lastError[512];
+static THREAD_LOCAL bool onTimerThread;
+
+
+static int32 SetError(int32 code, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vsnprintf(lastError, sizeof(lastError), format, args);
+	va_end(args);
+	return code;
+}
+
+
+static int32 CopyString(char *dest, uInt32 bufferSize, const char *src)
+{
+	// As with DAQmx, a buffer size of 0 queries the size required
+	if (bufferSize == 0)
+		return (int32)strlen(src) + 1;
+	if (strlen(src) >= bufferSize)
+		return SetError(DAQmxErrorBufferTooSmallForString,
+			"Simulated DAQ: buffer too small for string");
+	strcpy(dest, src);
+	return 0;
+}
+
+
+static int32 CheckDevice(const char device[])
+{
+	if (!device || strcmp(device, SIM_DEVICE_NAME) != 0)
+		return SetError(DAQmxErrorInvalidDeviceID,
+			"Simulated DAQ: no such device: %s", device ? device : "(null)");
+	return 0;
+}
+
+
+// Number of physical channels in a list such as "Dev1/ai0, Dev1/ai2:3" or
+// "Dev1/port0/line5:7"; 0 if any of them is not on the simulated device
+static uInt32 CountPhysicalChannels(const char *list)
+{
+	static const char prefix[] = SIM_DEVICE_NAME "/";
+	uInt32 count = 0;
+	const char *p = list;
+	while (*p == ' ')
+		++p;
+	while (*p)
+	{
+		const char *end = strchr(p, ',');
+		if (!end)
+			end = p + strlen(p);
+		if (strncmp(p, prefix, sizeof(prefix) - 1) != 0)
+			return 0;
+
+		const char *colon = memchr(p, ':', end - p);
+		if (colon)
+		{
+			const char *q = colon;
+			while (q > p && isdigit((unsigned char)q[-1]))
+				--q;
+			long first = strtol(q, NULL, 10);
+			long last = strtol(colon + 1, NULL, 10);
+			count += (uInt32)labs(last - first) + 1;
+		}
+		else
+			++count;
+
+		p = *end ? end + 1 : end;
+		while (*p == ' ')
+			++p;
+	}
+	return count;
+}
+
+
+static double TicksToSeconds(int64_t ticks)
+{
+	return ticks / sim.ticksPerSecond;
+}
+
+
+// Samples clocked by the task's sample clock from time from to time to
+static uInt64 CountSamplesBetween(const struct SimTask *task, int64_t from, int64_t to)
+{
+	if (to <= from)
+		return 0;
+	return (uInt64)(TicksToSeconds(to - from) * task->rate);
+}
+
+
+// Rising edges output by the counter task after time since and up to time
+// now; the times of the first and last of them are returned in *first and
+// *last
+static uInt64 CountCounterEdges(const struct SimTask *counter, int64_t since,
+	int64_t now, int64_t *first, int64_t *last)
+{
+	if (!counter->triggerTime || counter->rate <= 0.0)
+		return 0;
+
+	double periodSec = 1.0 / counter->rate;
+	double firstSec = TicksToSeconds(counter->triggerTime) + counter->initialDelay;
+	double nowSec = TicksToSeconds(now);
+	if (nowSec < firstSec)
+		return 0;
+
+	uInt64 edges = (uInt64)((nowSec - firstSec) / periodSec) + 1;
+	if (counter->sampleMode == DAQmx_Val_FiniteSamps && edges > counter->sampsPerChan)
+		edges = counter->sampsPerChan;
+
+	// Edges before the observing task started are missed
+	uInt64 missed = 0;
+	double sinceSec = TicksToSeconds(since);
+	if (sinceSec > firstSec)
+	{
+		missed = (uInt64)ceil((sinceSec - firstSec) / periodSec);
+		if (missed > edges)
+			missed = edges;
+	}
+	if (missed == edges)
+		return 0;
+
+	*first = (int64_t)((firstSec + missed * periodSec) * sim.ticksPerSecond);
+	*last = (int64_t)((firstSec + (edges - 1) * periodSec) * sim.ticksPerSecond);
+	return edges - missed;
+}
+
+
+// Samples (per channel) acquired or generated by a running task by time now
+static uInt64 GetSamplesDone(const struct SimTask *task, int64_t now)
+{
+	if (!task->timed)
+		return 0;
+
+	bool finite = task->sampleMode == DAQmx_Val_FiniteSamps;
+	uInt64 samples;
+
+	if (task->trigger == SimTrigger_Counter)
+	{
+		samples = task->bankedSamples;
+		int64_t first = 0, last = 0;
+		uInt64 edges = sim.counter ?
+			CountCounterEdges(sim.counter, task->startTime, now, &first, &last) : 0;
+		if (edges > 0 && task->retriggerable && finite)
+		{
+			uInt64 sinceLast = CountSamplesBetween(task, last, now);
+			if (sinceLast > task->sampsPerChan)
+				sinceLast = task->sampsPerChan;
+			samples += (edges - 1) * task->sampsPerChan + sinceLast;
+		}
+		else if (edges > 0 && samples == 0)
+		{
+			// Not retriggerable: only the first edge counts
+			samples = CountSamplesBetween(task, first, now);
+		}
+		if (finite && !task->retriggerable && samples > task->sampsPerChan)
+			samples = task->sampsPerChan;
+		return samples;
+	}
+
+	if (!task->triggerTime)
+		return 0;
+	samples = CountSamplesBetween(task, task->triggerTime, now);
+	if (finite && samples > task->sampsPerChan)
+		samples = task->sampsPerChan;
+	return samples;
+}
+
+
+static bool IsDone(const struct SimTask *task, int64_t now)
+{
+	if (!task->running || !task->timed)
+		return true;
+	if (task->sampleMode != DAQmx_Val_FiniteSamps || task->retriggerable)
+		return false;
+
+	if (task->type == SimTaskType_CO)
+	{
+		// Done at the end of the last pulse period
+		if (!task->triggerTime)
+			return false;
+		double end = TicksToSeconds(task->triggerTime) + task->initialDelay +
+			task->sampsPerChan / task->rate;
+		return TicksToSeconds(now) >= end;
+	}
+
+	return GetSamplesDone(task, now) >= task->sampsPerChan;
+}
+
+
+// Default input buffer sizes, as DAQmx chooses them
+static uInt64 GetInputBufferSize(const struct SimTask *task)
+{
+	if (task->inputBufferSize > 0)
+		return task->inputBufferSize;
+	if (task->sampleMode == DAQmx_Val_FiniteSamps && !task->retriggerable)
+		return task->sampsPerChan;
+	if (task->rate <= 100.0)
+		return 1000;
+	if (task->rate <= 10000.0)
+		return 10000;
+	if (task->rate <= 1000000.0)
+		return 100000;
+	return 1000000;
+}
+
+
+static double SyntheticVolts(const struct SimTask *task, uInt32 chan, uInt64 sample)
+{
+	// Treat each triggered acquisition as a line of the image
+	uInt64 line = 0, pos = sample;
+	if (task->trigger == SimTrigger_Counter && task->retriggerable &&
+		task->sampsPerChan > 0)
+	{
+		line = sample / task->sampsPerChan;
+		pos = sample % task->sampsPerChan;
+	}
+
+	double pattern = sim.sineTable[(pos * 3 + chan * 40) & 255] *
+		sim.sineTable[(line * 5 + 64) & 255];
+
+	uint32_t h = (uint32_t)sample * 2654435761u ^ chan * 40503u;
+	h ^= h >> 15;
+	h *= 2246822519u;
+	h ^= h >> 13;
+	double noise = (h & 0xffff) / 65536.0 - 0.5;
+
+	// A positive signal, as from a PMT, within half of full scale
+	return task->maxVolts * (0.25 + 0.2 * pattern + 0.04 * noise);
+}
+
+
+static double GetVoltsPerCode(const struct SimTask *task)
+{
+	return task->maxVolts / 32768.0;
+}
+
+
+static struct SimTask *FindTask(TaskHandle handle)
+{
+	for (struct SimTask *task = sim.tasks; task; task = task->next)
+	{
+		if ((TaskHandle)task == handle)
+			return task;
+	}
+	return NULL;
+}
+
+
+// Lock the simulation and look up the task; if it does not exist, *err is
+// set and NULL returned, with the lock still held
+static struct SimTask *LockTask(TaskHandle handle, int32 *err)
+{
+	Mutex_Lock(&sim.mutex);
+	struct SimTask *task = FindTask(handle);
+	*err = task ? 0 : SetError(DAQmxErrorInvalidTask,
+		"Simulated DAQ: task handle is invalid or the task has been cleared");
+	return task;
+}
+
+
+static int32 Unlock(int32 ret)
+{
+	Mutex_Unlock(&sim.mutex);
+	return ret;
+}
+
+
+static int32 CheckNotRunning(const struct SimTask *task)
+{
+	if (task->running)
+		return SetError(SIM_ERROR_TASK_RUNNING,
+			"Simulated DAQ: operation not permitted while task %s is running", task->name);
+	return 0;
+}
+
+
+// Called with the lock held. DAQmx does not return from stopping or clearing
+// a task while its callback is running, except on the callback's own thread.
+static void WaitForCallbackToReturn(const struct SimTask *task)
+{
+	while (sim.callbackTask == task && !onTimerThread)
+		CondVar_Wait(&sim.condition, &sim.mutex, WAIT_FOREVER);
+}
+
+
+static int32 DoStartTask(struct SimTask *task)
+{
+	if (task->running)
+		return CheckNotRunning(task);
+	if (task->type == SimTaskType_None)
+		return SetError(DAQmxErrorInvalidTask,
+			"Simulated DAQ: task %s has no channels", task->name);
+
+	int64_t now = Time_GetTicks();
+	task->running = true;
+	task->startTime = now;
+	task->triggerTime = task->trigger == SimTrigger_None ? now : 0;
+	task->bankedSamples = 0;
+	task->readPos = 0;
+	task->nextCallbackSample = task->everyNSamples;
+
+	if (task->type == SimTaskType_CO)
+		sim.counter = task;
+
+	if (task->type == SimTaskType_AO && task->timed)
+	{
+		for (struct SimTask *t = sim.tasks; t; t = t->next)
+		{
+			if (t->running && t->trigger == SimTrigger_AOStart &&
+				(t->retriggerable || !t->triggerTime))
+				t->triggerTime = now;
+		}
+	}
+
+	CondVar_Broadcast(&sim.condition);
+	return 0;
+}
+
+
+static int32 DoStopTask(struct SimTask *task, bool warnIfNotDone)
+{
+	WaitForCallbackToReturn(task);
+	if (!task->running)
+		return 0;
+
+	int64_t now = Time_GetTicks();
+	int32 ret = 0;
+	bool finite = task->sampleMode == DAQmx_Val_FiniteSamps && !task->retriggerable;
+	if (warnIfNotDone && finite && !IsDone(task, now))
+		ret = SetError(DAQmxWarningStoppedBeforeDone,
+			"Simulated DAQ: finite task %s was stopped before all samples were generated or acquired",
+			task->name);
+
+	if (task == sim.counter)
+	{
+		// Tasks triggered by the counter keep the samples acquired so far,
+		// including the rest of any acquisition in progress
+		for (struct SimTask *t = sim.tasks; t; t = t->next)
+		{
+			if (!t->running || t->trigger != SimTrigger_Counter)
+				continue;
+			uInt64 samples = GetSamplesDone(t, now);
+			if (t->retriggerable && t->sampleMode == DAQmx_Val_FiniteSamps &&
+				t->sampsPerChan > 0)
+			{
+				samples = (samples + t->sampsPerChan - 1) /
+					t->sampsPerChan * t->sampsPerChan;
+			}
+			t->bankedSamples = samples;
+		}
+		sim.counter = NULL;
+	}
+
+	task->running = false;
+	CondVar_Broadcast(&sim.condition);
+	return ret;
+}
+
+
+static void TimerLoop(void *param)
+{
+	onTimerThread = true;
+
+	Mutex_Lock(&sim.mutex);
+	for (;;)
+	{
+		bool anyCallbacks = false;
+		struct SimTask *due = NULL;
+		int64_t now = Time_GetTicks();
+		for (struct SimTask *task = sim.tasks; task; task = task->next)
+		{
+			if (!task->running || !task->callback)
+				continue;
+			anyCallbacks = true;
+			uInt64 acquired = GetSamplesDone(task, now);
+			if (acquired < task->nextCallbackSample)
+				continue;
+			if (acquired == task->readPos)
+			{
+				// The previous callback has already read the samples
+				task->nextCallbackSample = (acquired / task->everyNSamples + 1) *
+					task->everyNSamples;
+				continue;
+			}
+			due = task;
+			break;
+		}
+
+		if (!due)
+		{
+			CondVar_Wait(&sim.condition, &sim.mutex,
+				anyCallbacks ? SIM_CALLBACK_POLL_MS : WAIT_FOREVER);
+			continue;
+		}
+
+		// Events falling due within one poll interval are delivered as a
+		// single callback, rather than as a burst in which all but the first
+		// find no samples left to read
+		DAQmxEveryNSamplesEventCallbackPtr callback = due->callback;
+		void *callbackData = due->callbackData;
+		uInt32 n = due->everyNSamples;
+		due->nextCallbackSample = (GetSamplesDone(due, now) / n + 1) * n;
+
+		// The callback may stop or clear its own task
+		sim.callbackTask = due;
+		Mutex_Unlock(&sim.mutex);
+
+		callback((TaskHandle)due, DAQmx_Val_Acquired_Into_Buffer, n, callbackData);
+
+		Mutex_Lock(&sim.mutex);
+		sim.callbackTask = NULL;
+		CondVar_Broadcast(&sim.condition);
+	}
+}
+
+
+static void Initialize_Sim(void)
+{
+	Mutex_Init(&sim.mutex);
+	CondVar_Init(&sim.condition);
+	sim.ticksPerSecond = (double)Time_GetTicksPerSecond();
+	for (int i = 0; i < 256; ++i)
+		sim.sineTable[i] = sin(2.0 * 3.14159265358979323846 * i / 256);
+	sim.timerThread = Thread_Start(TimerLoop, NULL);
+}
+
+
+/*
+ * System and device
+ */
+
+static int32 GetSysDevNames_Sim(char *data, uInt32 bufferSize)
+{
+	return CopyString(data, bufferSize, SIM_DEVICE_NAME);
+}
+
+
+static int32 ResetDevice_Sim(const char deviceName[])
+{
+	// Tasks are not affected; the module does not reset the device while it
+	// has any
+	return CheckDevice(deviceName);
+}
+
+
+static int32 GetDevProductCategory_Sim(const char device[], int32 *data)
+{
+	int32 err = CheckDevice(device);
+	if (err)
+		return err;
+	*data = DAQmx_Val_XSeriesDAQ;
+	return 0;
+}
+
+
+static int32 GetDevAIPhysicalChans_Sim(const char device[], char *data, uInt32 bufferSize)
+{
+	int32 err = CheckDevice(device);
+	if (err)
+		return err;
+	return CopyString(data, bufferSize, SIM_AI_PHYSICAL_CHANS);
+}
+
+
+static int32 GetDevAIMaxSingleChanRate_Sim(const char device[], float64 *data)
+{
+	int32 err = CheckDevice(device);
+	if (err)
+		return err;
+	*data = SIM_AI_MAX_SINGLE_CHAN_RATE;
+	return 0;
+}
+
+
+static int32 GetDevAIMaxMultiChanRate_Sim(const char device[], float64 *data)
+{
+	int32 err = CheckDevice(device);
+	if (err)
+		return err;
+	*data = SIM_AI_MAX_MULTI_CHAN_RATE;
+	return 0;
+}
+
+
+static int32 GetDevAOVoltageRngs_Sim(const char device[], float64 *data, uInt32 arraySizeInElements)
+{
+	int32 err = CheckDevice(device);
+	if (err)
+		return err;
+	if (arraySizeInElements == 0)
+		return 2;
+	if (arraySizeInElements < 2)
+		return SetError(DAQmxErrorBufferTooSmallForString,
+			"Simulated DAQ: array too small for voltage ranges");
+	data[0] = SIM_AO_MIN_VOLTS;
+	data[1] = SIM_AO_MAX_VOLTS;
+	return 0;
+}
+
+
+/*
+ * Task lifecycle
+ */
+
+static int32 CreateTask_Sim(const char taskName[], TaskHandle *taskHandle)
+{
+	struct SimTask *task = calloc(1, sizeof(struct SimTask));
+	if (!task)
+		return SetError(DAQmxErrorInvalidTask, "Simulated DAQ: out of memory");
+	if (taskName)
+		strncpy(task->name, taskName, sizeof(task->name) - 1);
+	task->sampleMode = DAQmx_Val_FiniteSamps;
+
+	Mutex_Lock(&sim.mutex);
+	task->next = sim.tasks;
+	sim.tasks = task;
+	Mutex_Unlock(&sim.mutex);
+
+	*taskHandle = (TaskHandle)task;
+	return 0;
+}
+
+
+static int32 ClearTask_Sim(TaskHandle taskHandle)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+
+	DoStopTask(task, false);
+	for (struct SimTask **p = &sim.tasks; *p; p = &(*p)->next)
+	{
+		if (*p == task)
+		{
+			*p = task->next;
+			break;
+		}
+	}
+	free(task);
+	return Unlock(0);
+}
+
+
+static int32 StartTask_Sim(TaskHandle taskHandle)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	return Unlock(DoStartTask(task));
+}
+
+
+static int32 StopTask_Sim(TaskHandle taskHandle)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	return Unlock(DoStopTask(task, true));
+}
+
+
+static int32 TaskControl_Sim(TaskHandle taskHandle, int32 action)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+
+	switch (action)
+	{
+	case DAQmx_Val_Task_Start:
+		return Unlock(DoStartTask(task));
+	case DAQmx_Val_Task_Stop:
+		return Unlock(DoStopTask(task, true));
+	case DAQmx_Val_Task_Abort:
+	case DAQmx_Val_Task_Unreserve:
+		return Unlock(DoStopTask(task, false));
+	default:
+		// Verify, commit, reserve: nothing to do
+		return Unlock(0);
+	}
+}
+
+
+static int32 IsTaskDone_Sim(TaskHandle taskHandle, bool32 *isTaskDone)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	*isTaskDone = IsDone(task, Time_GetTicks()) ? TRUE : FALSE;
+	return Unlock(0);
+}
+
+
+static int32 WaitUntilTaskDone_Sim(TaskHandle taskHandle, float64 timeToWait)
+{
+	uint64_t start = Time_GetMs();
+	for (;;)
+	{
+		bool32 done;
+		int32 err = IsTaskDone_Sim(taskHandle, &done);
+		if (err)
+			return err;
+		if (done)
+			return 0;
+		if (timeToWait >= 0.0 && Time_GetMs() - start >= timeToWait * 1e3)
+			return SetError(DAQmxErrorWaitUntilDoneDoesNotIndicateDone,
+				"Simulated DAQ: task was not done within the timeout");
+		Time_SleepMs(1);
+	}
+}
+
+
+static int32 GetTaskNumDevices_Sim(TaskHandle taskHandle, uInt32 *data)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	*data = task->type == SimTaskType_None ? 0 : 1;
+	return Unlock(0);
+}
+
+
+static int32 GetNthTaskDevice_Sim(TaskHandle taskHandle, uInt32 index, char buffer[], int32 bufferSize)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	if (index != 1 || task->type == SimTaskType_None)
+		return Unlock(SetError(DAQmxErrorInvalidAttributeValue,
+			"Simulated DAQ: task device index out of range"));
+	return Unlock(CopyString(buffer, (uInt32)bufferSize, SIM_DEVICE_NAME));
+}
+
+
+/*
+ * Channels
+ */
+
+// Called with the lock held
+static int32 AddChannels(struct SimTask *task, enum SimTaskType type, const char physicalChannel[])
+{
+	int32 err = CheckNotRunning(task);
+	if (err)
+		return err;
+	if (task->type != SimTaskType_None && task->type != type)
+		return SetError(DAQmxErrorInvalidAttributeValue,
+			"Simulated DAQ: task %s cannot mix channel types", task->name);
+
+	uInt32 count = physicalChannel ? CountPhysicalChannels(physicalChannel) : 0;
+	if (count == 0)
+		return SetError(DAQmxErrorInvalidAttributeValue,
+			"Simulated DAQ: invalid physical channel list: %s",
+			physicalChannel ? physicalChannel : "(null)");
+
+	task->type = type;
+	task->numChans += count;
+	return 0;
+}
+
+
+static int32 CreateAIVoltageChan_Sim(TaskHandle taskHandle, const char physicalChannel[],
+	const char nameToAssignToChannel[], int32 terminalConfig,
+	float64 minVal, float64 maxVal, int32 units, const char customScaleName[])
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	err = AddChannels(task, SimTaskType_AI, physicalChannel);
+	if (err)
+		return Unlock(err);
+	task->maxVolts = fmax(fabs(minVal), fabs(maxVal));
+	return Unlock(0);
+}
+
+
+static int32 CreateAOVoltageChan_Sim(TaskHandle taskHandle, const char physicalChannel[],
+	const char nameToAssignToChannel[], float64 minVal, float64 maxVal,
+	int32 units, const char customScaleName[])
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	if (minVal < SIM_AO_MIN_VOLTS || maxVal > SIM_AO_MAX_VOLTS)
+		return Unlock(SetError(DAQmxErrorInvalidAttributeValue,
+			"Simulated DAQ: AO range exceeds device range"));
+	return Unlock(AddChannels(task, SimTaskType_AO, physicalChannel));
+}
+
+
+static int32 CreateDOChan_Sim(TaskHandle taskHandle, const char lines[],
+	const char nameToAssignToLines[], int32 lineGrouping)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	return Unlock(AddChannels(task, SimTaskType_DO, lines));
+}
+
+
+static int32 CreateCOPulseChanFreq_Sim(TaskHandle taskHandle, const char counter[],
+	const char nameToAssignToChannel[], int32 units, int32 idleState,
+	float64 initialDelay, float64 freq, float64 dutyCycle)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	if (freq <= 0.0 || dutyCycle <= 0.0 || dutyCycle >= 1.0)
+		return Unlock(SetError(DAQmxErrorInvalidAttributeValue,
+			"Simulated DAQ: invalid pulse frequency or duty cycle"));
+	err = AddChannels(task, SimTaskType_CO, counter);
+	if (err)
+		return Unlock(err);
+
+	// Without implicit timing, a single pulse
+	task->timed = true;
+	task->rate = freq;
+	task->initialDelay = initialDelay;
+	task->dutyCycle = dutyCycle;
+	task->sampleMode = DAQmx_Val_FiniteSamps;
+	task->sampsPerChan = 1;
+	return Unlock(0);
+}
+
+
+static int32 SetChanAttributeF64_Sim(TaskHandle taskHandle, const char channel[],
+	int32 attribute, float64 value)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	err = CheckNotRunning(task);
+	if (err)
+		return Unlock(err);
+	if (task->type != SimTaskType_CO)
+		return Unlock(SetError(DAQmxErrorInvalidAttributeValue,
+			"Simulated DAQ: channel attribute not simulated for task %s", task->name));
+
+	switch (attribute)
+	{
+	case DAQmx_CO_Pulse_Freq:
+		task->rate = value;
+		break;
+	case DAQmx_CO_Pulse_Freq_InitialDelay:
+		task->initialDelay = value;
+		break;
+	case DAQmx_CO_Pulse_DutyCyc:
+		task->dutyCycle = value;
+		break;
+	default:
+		return Unlock(SetError(DAQmxErrorInvalidAttributeValue,
+			"Simulated DAQ: counter attribute 0x%x not simulated", (unsigned)attribute));
+	}
+	return Unlock(0);
+}
+
+
+static int32 GetAIDevScalingCoeff_Sim(TaskHandle taskHandle, const char channel[],
+	float64 *data, uInt32 arraySizeInElements)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	if (task->type != SimTaskType_AI)
+		return Unlock(SetError(DAQmxErrorInvalidAttributeValue,
+			"Simulated DAQ: task %s has no AI channels", task->name));
+	if (arraySizeInElements == 0)
+		return Unlock(2);
+
+	// A linear 16-bit ADC spanning the channel range
+	memset(data, 0, sizeof(float64) * arraySizeInElements);
+	if (arraySizeInElements > 1)
+		data[1] = GetVoltsPerCode(task);
+	return Unlock(0);
+}
+
+
+/*
+ * Timing, triggering, and buffers
+ */
+
+static int32 CfgSampClkTiming_Sim(TaskHandle taskHandle, const char source[], float64 rate,
+	int32 activeEdge, int32 sampleMode, uInt64 sampsPerChan)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	err = CheckNotRunning(task);
+	if (err)
+		return Unlock(err);
+	if (source && source[0])
+		return Unlock(SetError(DAQmxErrorInvalidAttributeValue,
+			"Simulated DAQ: only the onboard sample clock is simulated"));
+	if (rate <= 0.0 || (sampleMode == DAQmx_Val_FiniteSamps && sampsPerChan == 0))
+		return Unlock(SetError(DAQmxErrorInvalidAttributeValue,
+			"Simulated DAQ: invalid sample clock timing for task %s", task->name));
+
+	task->timed = true;
+	task->rate = rate;
+	task->sampleMode = sampleMode;
+	task->sampsPerChan = sampsPerChan;
+	return Unlock(0);
+}
+
+
+static int32 CfgImplicitTiming_Sim(TaskHandle taskHandle, int32 sampleMode, uInt64 sampsPerChan)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	err = CheckNotRunning(task);
+	if (err)
+		return Unlock(err);
+	if (task->type != SimTaskType_CO)
+		return Unlock(SetError(DAQmxErrorInvalidAttributeValue,
+			"Simulated DAQ: implicit timing is only simulated for counter output"));
+
+	task->sampleMode = sampleMode;
+	task->sampsPerChan = sampsPerChan;
+	return Unlock(0);
+}
+
+
+static int32 CfgDigEdgeStartTrig_Sim(TaskHandle taskHandle, const char triggerSource[], int32 triggerEdge)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	err = CheckNotRunning(task);
+	if (err)
+		return Unlock(err);
+
+	if (strstr(triggerSource, "/ao/StartTrigger"))
+		task->trigger = SimTrigger_AOStart;
+	else if (strstr(triggerSource, "/PFI12") || strstr(triggerSource, "/Ctr0InternalOutput"))
+		task->trigger = SimTrigger_Counter;
+	else
+		task->trigger = SimTrigger_None;
+	return Unlock(0);
+}
+
+
+static int32 SetStartTrigRetriggerable_Sim(TaskHandle taskHandle, bool32 data)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	err = CheckNotRunning(task);
+	if (err)
+		return Unlock(err);
+	task->retriggerable = data != FALSE;
+	return Unlock(0);
+}
+
+
+static int32 CfgInputBuffer_Sim(TaskHandle taskHandle, uInt32 numSampsPerChan)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	err = CheckNotRunning(task);
+	if (err)
+		return Unlock(err);
+	task->inputBufferSize = numSampsPerChan;
+	return Unlock(0);
+}
+
+
+static int32 CfgOutputBuffer_Sim(TaskHandle taskHandle, uInt32 numSampsPerChan)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	return Unlock(CheckNotRunning(task));
+}
+
+
+/*
+ * Writing
+ */
+
+static int32 WriteOutput(TaskHandle taskHandle, enum SimTaskType type,
+	int32 numSampsPerChan, bool32 autoStart, int32 *sampsPerChanWritten)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	if (task->type != type || numSampsPerChan < 0)
+		return Unlock(SetError(DAQmxErrorInvalidAttributeValue,
+			"Simulated DAQ: invalid write to task %s", task->name));
+
+	if (autoStart && !task->running)
+	{
+		err = DoStartTask(task);
+		if (err)
+			return Unlock(err);
+	}
+	if (sampsPerChanWritten)
+		*sampsPerChanWritten = numSampsPerChan;
+	return Unlock(0);
+}
+
+
+static int32 WriteAnalogF64_Sim(TaskHandle taskHandle, int32 numSampsPerChan, bool32 autoStart,
+	float64 timeout, bool32 dataLayout, const float64 writeArray[],
+	int32 *sampsPerChanWritten, bool32 *reserved)
+{
+	return WriteOutput(taskHandle, SimTaskType_AO, numSampsPerChan, autoStart,
+		sampsPerChanWritten);
+}
+
+
+static int32 WriteDigitalLines_Sim(TaskHandle taskHandle, int32 numSampsPerChan, bool32 autoStart,
+	float64 timeout, bool32 dataLayout, const uInt8 writeArray[],
+	int32 *sampsPerChanWritten, bool32 *reserved)
+{
+	return WriteOutput(taskHandle, SimTaskType_DO, numSampsPerChan, autoStart,
+		sampsPerChanWritten);
+}
+
+
+/*
+ * Reading
+ */
+
+static int32 RegisterEveryNSamplesEvent_Sim(TaskHandle task_, int32 everyNsamplesEventType,
+	uInt32 nSamples, uInt32 options, DAQmxEveryNSamplesEventCallbackPtr callbackFunction,
+	void *callbackData)
+{
+	int32 err;
+	struct SimTask *task = LockTask(task_, &err);
+	if (!task)
+		return Unlock(err);
+	err = CheckNotRunning(task);
+	if (err)
+		return Unlock(err);
+	if (everyNsamplesEventType != DAQmx_Val_Acquired_Into_Buffer ||
+		(callbackFunction && (task->type != SimTaskType_AI || nSamples == 0)))
+		return Unlock(SetError(DAQmxErrorInvalidAttributeValue,
+			"Simulated DAQ: only Every N Samples Acquired Into Buffer events on AI tasks are simulated"));
+
+	WaitForCallbackToReturn(task);
+	task->everyNSamples = callbackFunction ? nSamples : 0;
+	task->callback = callbackFunction;
+	task->callbackData = callbackData;
+	return Unlock(0);
+}
+
+
+static int32 SetReadReadAllAvailSamp_Sim(TaskHandle taskHandle, bool32 data)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	task->readAllAvailSamp = data != FALSE;
+	return Unlock(0);
+}
+
+
+static int32 GetReadNumChans_Sim(TaskHandle taskHandle, uInt32 *data)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	*data = task->numChans;
+	return Unlock(0);
+}
+
+
+// Called with the lock held
+static int32 CheckReadable(const struct SimTask *task)
+{
+	if (task->type != SimTaskType_AI)
+		return SetError(DAQmxErrorInvalidAttributeValue,
+			"Simulated DAQ: task %s has no AI channels", task->name);
+	if (!task->running)
+		return SetError(DAQmxErrorInvalidTask,
+			"Simulated DAQ: task %s is not running", task->name);
+	return 0;
+}
+
+
+static int32 GetReadAvailSampPerChan_Sim(TaskHandle taskHandle, uInt32 *data)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	err = CheckReadable(task);
+	if (err)
+		return Unlock(err);
+
+	uInt64 available = GetSamplesDone(task, Time_GetTicks()) - task->readPos;
+	uInt64 bufferSize = GetInputBufferSize(task);
+	*data = (uInt32)(available < bufferSize ? available : bufferSize);
+	return Unlock(0);
+}
+
+
+static int32 GetReadCurrReadPos_Sim(TaskHandle taskHandle, uInt64 *data)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	*data = task->readPos;
+	return Unlock(0);
+}
+
+
+static int32 GetReadTotalSampPerChanAcquired_Sim(TaskHandle taskHandle, uInt64 *data)
+{
+	int32 err;
+	struct SimTask *task = LockTask(taskHandle, &err);
+	if (!task)
+		return Unlock(err);
+	err = CheckReadable(task);
+	if (err)
+		return Unlock(err);
+	*data = GetSamplesDone(task, Time_GetTicks());
+	return Unlock(0);
+}
+
+
+// Read into either f64Array or i16Array, waiting up to timeout seconds (or
+// indefinitely if negative) for the samples requested
+static int32 ReadSamples(TaskHandle taskHandle, int32 numSampsPerChan, float64 timeout,
+	bool32 fillMode, float64 *f64Array, int16 *i16Array, uInt32 arraySizeInSamps,
+	int32 *sampsPerChanRead)
+{
+	if (sampsPerChanRead)
+		*sampsPerChanRead = 0;
+	uint64_t start = Time_GetMs();
+
+	int32 err;
+	struct SimTask *task;
+	uInt64 count;
+	for (;;)
+	{
+		task = LockTask(taskHandle, &err);
+		if (!task)
+			return Unlock(err);
+		err = CheckReadable(task);
+		if (err)
+			return Unlock(err);
+
+		uInt64 acquired = GetSamplesDone(task, Time_GetTicks());
+		uInt64 available = acquired - task->readPos;
+		if (available > GetInputBufferSize(task))
+			return Unlock(SetError(DAQmxErrorSamplesNoLongerAvailable,
+				"Simulated DAQ: samples were overwritten in the input buffer of task %s before being read",
+				task->name));
+
+		if (numSampsPerChan >= 0)
+			count = (uInt64)numSampsPerChan;
+		else if (task->readAllAvailSamp || task->sampleMode != DAQmx_Val_FiniteSamps ||
+			task->retriggerable)
+			count = available;
+		else
+			count = task->sampsPerChan - task->readPos;
+		if (count <= available)
+			break;
+
+		Mutex_Unlock(&sim.mutex);
+		if (timeout >= 0.0 && Time_GetMs() - start >= timeout * 1e3)
+			return SetError(DAQmxErrorSamplesNotYetAvailable,
+				"Simulated DAQ: samples requested have not yet been acquired");
+		Time_SleepMs(1);
+	}
+
+	uInt32 numChans = task->numChans;
+	if (count * numChans > arraySizeInSamps)
+		return Unlock(SetError(DAQmxErrorReadBufferTooSmall,
+			"Simulated DAQ: read array too small for samples requested"));
+
+	for (uInt64 i = 0; i < count; ++i)
+	{
+		uInt64 sample = task->readPos + i;
+		for (uInt32 ch = 0; ch < numChans; ++ch)
+		{
+			size_t index = fillMode == DAQmx_Val_GroupByScanNumber ?
+				i * numChans + ch : ch * count + i;
+			double volts = SyntheticVolts(task, ch, sample);
+			if (f64Array)
+				f64Array[index] = volts;
+			else
+				i16Array[index] = (int16)lrint(volts / GetVoltsPerCode(task));
+		}
+	}
+	task->readPos += count;
+
+	if (sampsPerChanRead)
+		*sampsPerChanRead = (int32)count;
+	return Unlock(0);
+}
+
+
+static int32 ReadAnalogF64_Sim(TaskHandle taskHandle, int32 numSampsPerChan, float64 timeout,
+	bool32 fillMode, float64 readArray[], uInt32 arraySizeInSamps,
+	int32 *sampsPerChanRead, bool32 *reserved)
+{
+	return ReadSamples(taskHandle, numSampsPerChan, timeout, fillMode,
+		readArray, NULL, arraySizeInSamps, sampsPerChanRead);
+}
+
+
+static int32 ReadBinaryI16_Sim(TaskHandle taskHandle, int32 numSampsPerChan, float64 timeout,
+	bool32 fillMode, int16 readArray[], uInt32 arraySizeInSamps,
+	int32 *sampsPerChanRead, bool32 *reserved)
+{
+	return ReadSamples(taskHandle, numSampsPerChan, timeout, fillMode,
+		NULL, readArray, arraySizeInSamps, sampsPerChanRead);
+}
+
+
+static int32 GetExtendedErrorInfo_Sim(char errorString[], uInt32 bufferSize)
+{
+	if (bufferSize == 0)
+		return (int32)strlen(lastError) + 1;
+	snprintf(errorString, bufferSize, "%s", lastError);
+	return 0;
+}
+
+
+const struct DAQBackend SimulatedDAQBackend = {
+	.name = "Simulated DAQ",
+	.Initialize = Initialize_Sim,
+	.GetSysDevNames = GetSysDevNames_Sim,
+	.ResetDevice = ResetDevice_Sim,
+	.GetDevProductCategory = GetDevProductCategory_Sim,
+	.GetDevAIPhysicalChans = GetDevAIPhysicalChans_Sim,
+	.GetDevAIMaxSingleChanRate = GetDevAIMaxSingleChanRate_Sim,
+	.GetDevAIMaxMultiChanRate = GetDevAIMaxMultiChanRate_Sim,
+	.GetDevAOVoltageRngs = GetDevAOVoltageRngs_Sim,
+	.CreateTask = CreateTask_Sim,
+	.ClearTask = ClearTask_Sim,
+	.StartTask = StartTask_Sim,
+	.StopTask = StopTask_Sim,
+	.TaskControl = TaskControl_Sim,
+	.WaitUntilTaskDone = WaitUntilTaskDone_Sim,
+	.GetTaskNumDevices = GetTaskNumDevices_Sim,
+	.GetNthTaskDevice = GetNthTaskDevice_Sim,
+	.CreateAIVoltageChan = CreateAIVoltageChan_Sim,
+	.CreateAOVoltageChan = CreateAOVoltageChan_Sim,
+	.CreateDOChan = CreateDOChan_Sim,
+	.CreateCOPulseChanFreq = CreateCOPulseChanFreq_Sim,
+	.SetChanAttributeF64 = SetChanAttributeF64_Sim,
+	.GetAIDevScalingCoeff = GetAIDevScalingCoeff_Sim,
+	.CfgSampClkTiming = CfgSampClkTiming_Sim,
+	.CfgImplicitTiming = CfgImplicitTiming_Sim,
+	.CfgDigEdgeStartTrig = CfgDigEdgeStartTrig_Sim,
+	.SetStartTrigRetriggerable = SetStartTrigRetriggerable_Sim,
+	.CfgInputBuffer = CfgInputBuffer_Sim,
+	.CfgOutputBuffer = CfgOutputBuffer_Sim,
+	.WriteAnalogF64 = WriteAnalogF64_Sim,
+	.WriteDigitalLines = WriteDigitalLines_Sim,
+	.RegisterEveryNSamplesEvent = RegisterEveryNSamplesEvent_Sim,
+	.SetReadReadAllAvailSamp = SetReadReadAllAvailSamp_Sim,
+	.GetReadNumChans = GetReadNumChans_Sim,
+	.GetReadAvailSampPerChan = GetReadAvailSampPerChan_Sim,
+	.GetReadCurrReadPos = GetReadCurrReadPos_Sim,
+	.GetReadTotalSampPerChanAcquired = GetReadTotalSampPerChanAcquired_Sim,
+	.ReadAnalogF64 = ReadAnalogF64_Sim,
+	.ReadBinaryI16 = ReadBinaryI16_Sim,
+	.GetExtendedErrorInfo = GetExtendedErrorInfo_Sim,
+};
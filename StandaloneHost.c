@@ -0,0 +1,607 @@
+#include "StandaloneHost.h"
+#include "OScNIDAQ.h"
+#include "Platform.h"
+
+#include <OpenScanDeviceLib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Returned in place of rich errors, which are logged when converted
+#define RICH_ERROR_CODE 10000
+
+
+struct OScDev_Device
+{
+	OScDev_DeviceImpl *impl;
+	void *implData;
+	OScDev_PtrArray *settings; // While open
+};
+
+
+struct OScDev_Acquisition
+{
+	struct StandaloneAcquisitionParams params;
+
+	// Updated on the frame delivery thread
+	uint32_t framesDelivered;
+	uint64_t pixelSum; // Of the first channel
+};
+
+
+struct OScDev_Setting
+{
+	char name[OScDev_MAX_STR_LEN + 1];
+	OScDev_ValueType valueType;
+	OScDev_SettingImpl *impl;
+	void *implData;
+};
+
+
+struct OScDev_PtrArray
+{
+	void **ptrs;
+	size_t size;
+	size_t capacity;
+};
+
+
+struct OScDev_NumArray
+{
+	double *values;
+	size_t size;
+	size_t capacity;
+};
+
+
+// Only created for the module's use; the host does not query ranges
+struct OScDev_NumRange
+{
+	bool isDiscrete;
+	double rangeMin, rangeMax;
+	OScDev_NumArray *values;
+};
+
+
+struct OScDev_RichError
+{
+	char message[OScDev_MAX_STR_LEN + 1];
+	OScDev_RichError *cause;
+};
+
+
+static bool verboseLogging;
+
+
+void Standalone_SetVerbose(bool verbose)
+{
+	verboseLogging = verbose;
+}
+
+
+static void Log(const char *level, const char *message)
+{
+	fprintf(stderr, "[%s] %s\n", level, message);
+}
+
+
+void OScDev_Log_Error(OScDev_Device *device, const char *message)
+{
+	Log("error", message);
+}
+
+
+void OScDev_Log_Warning(OScDev_Device *device, const char *message)
+{
+	Log("warning", message);
+}
+
+
+void OScDev_Log_Info(OScDev_Device *device, const char *message)
+{
+	Log("info", message);
+}
+
+
+void OScDev_Log_Debug(OScDev_Device *device, const char *message)
+{
+	if (verboseLogging)
+		Log("debug", message);
+}
+
+
+OScDev_RichError *OScDev_Error_Create(const char *message)
+{
+	OScDev_RichError *err = calloc(1, sizeof(OScDev_RichError));
+	if (err)
+		snprintf(err->message, sizeof(err->message), "%s", message);
+	return err;
+}
+
+
+OScDev_RichError *OScDev_Error_CreateWithCode(const char *domain, int32_t code, const char *message)
+{
+	char msg[OScDev_MAX_STR_LEN + 1];
+	snprintf(msg, sizeof(msg), "%s %d: %s", domain, (int)code, message);
+	return OScDev_Error_Create(msg);
+}
+
+
+OScDev_RichError *OScDev_Error_Wrap(OScDev_RichError *cause, const char *message)
+{
+	if (!cause)
+		return OScDev_RichError_OK;
+	OScDev_RichError *err = OScDev_Error_Create(message);
+	if (!err)
+		return cause;
+	err->cause = cause;
+	return err;
+}
+
+
+void OScDev_Error_Destroy(OScDev_RichError *err)
+{
+	while (err)
+	{
+		OScDev_RichError *cause = err->cause;
+		free(err);
+		err = cause;
+	}
+}
+
+
+void OScDev_Error_FormatRecursive(OScDev_RichError *err, char *buffer, size_t bufferSize)
+{
+	if (bufferSize == 0)
+		return;
+	buffer[0] = '\0';
+	size_t len = 0;
+	for (; err && len + 1 < bufferSize; err = err->cause)
+	{
+		int n = snprintf(buffer + len, bufferSize - len, "%s%s",
+			len > 0 ? ": " : "", err->message);
+		if (n < 0)
+			break;
+		len += n;
+	}
+}
+
+
+OScDev_Error OScDev_Error_ReturnAsCode(OScDev_RichError *err)
+{
+	if (!err)
+		return OScDev_OK;
+	char msg[4 * (OScDev_MAX_STR_LEN + 1)];
+	OScDev_Error_FormatRecursive(err, msg, sizeof(msg));
+	Log("error", msg);
+	OScDev_Error_Destroy(err);
+	return RICH_ERROR_CODE;
+}
+
+
+OScDev_RichError *OScDev_Error_AsRichError(OScDev_Error code)
+{
+	if (code == OScDev_OK)
+		return OScDev_RichError_OK;
+	char msg[64];
+	snprintf(msg, sizeof(msg), "Error code %d", (int)code);
+	return OScDev_Error_Create(msg);
+}
+
+
+void OScDev_Error_RegisterCodeDomain(const char *domain, OScDev_ErrorCodeFormat format)
+{
+}
+
+
+OScDev_PtrArray *OScDev_PtrArray_Create(void)
+{
+	return calloc(1, sizeof(OScDev_PtrArray));
+}
+
+
+void OScDev_PtrArray_Destroy(const OScDev_PtrArray *arr)
+{
+	if (!arr)
+		return;
+	free(arr->ptrs);
+	free((OScDev_PtrArray *)arr);
+}
+
+
+void OScDev_PtrArray_Append(OScDev_PtrArray *arr, void *obj)
+{
+	if (arr->size == arr->capacity)
+	{
+		size_t capacity = arr->capacity ? 2 * arr->capacity : 16;
+		void **ptrs = realloc(arr->ptrs, capacity * sizeof(void *));
+		if (!ptrs)
+			abort();
+		arr->ptrs = ptrs;
+		arr->capacity = capacity;
+	}
+	arr->ptrs[arr->size++] = obj;
+}
+
+
+size_t OScDev_PtrArray_Size(const OScDev_PtrArray *arr)
+{
+	return arr ? arr->size : 0;
+}
+
+
+void *OScDev_PtrArray_At(const OScDev_PtrArray *arr, size_t index)
+{
+	return arr->ptrs[index];
+}
+
+
+OScDev_NumArray *OScDev_NumArray_Create(void)
+{
+	return calloc(1, sizeof(OScDev_NumArray));
+}
+
+
+void OScDev_NumArray_Append(OScDev_NumArray *arr, double val)
+{
+	if (arr->size == arr->capacity)
+	{
+		size_t capacity = arr->capacity ? 2 * arr->capacity : 16;
+		double *values = realloc(arr->values, capacity * sizeof(double));
+		if (!values)
+			abort();
+		arr->values = values;
+		arr->capacity = capacity;
+	}
+	arr->values[arr->size++] = val;
+}
+
+
+OScDev_NumRange *OScDev_NumRange_CreateContinuous(double rMin, double rMax)
+{
+	OScDev_NumRange *range = calloc(1, sizeof(OScDev_NumRange));
+	if (range)
+	{
+		range->rangeMin = rMin;
+		range->rangeMax = rMax;
+	}
+	return range;
+}
+
+
+OScDev_NumRange *OScDev_NumRange_CreateDiscrete(void)
+{
+	OScDev_NumRange *range = calloc(1, sizeof(OScDev_NumRange));
+	if (range)
+	{
+		range->isDiscrete = true;
+		range->values = OScDev_NumArray_Create();
+	}
+	return range;
+}
+
+
+void OScDev_NumRange_AppendDiscrete(OScDev_NumRange *range, double val)
+{
+	OScDev_NumArray_Append(range->values, val);
+}
+
+
+OScDev_Error OScDev_Device_Create(OScDev_Device **device, OScDev_DeviceImpl *impl, void *data)
+{
+	*device = calloc(1, sizeof(OScDev_Device));
+	if (!*device)
+		return OScDev_Error_ReturnAsCode(OScDev_Error_Create("Failed to allocate device"));
+	(*device)->impl = impl;
+	(*device)->implData = data;
+	return OScDev_OK;
+}
+
+
+void *OScDev_Device_GetImplData(OScDev_Device *device)
+{
+	return device->implData;
+}
+
+
+OScDev_Error OScDev_Setting_Create(OScDev_Setting **setting, const char *name,
+	OScDev_ValueType valueType, OScDev_SettingImpl *impl, void *data)
+{
+	*setting = calloc(1, sizeof(OScDev_Setting));
+	if (!*setting)
+		return OScDev_Error_ReturnAsCode(OScDev_Error_Create("Failed to allocate setting"));
+	strncpy((*setting)->name, name, OScDev_MAX_STR_LEN);
+	(*setting)->valueType = valueType;
+	(*setting)->impl = impl;
+	(*setting)->implData = data;
+	return OScDev_OK;
+}
+
+
+void OScDev_Setting_Destroy(OScDev_Setting *setting)
+{
+	if (!setting)
+		return;
+	if (setting->impl->Release)
+		setting->impl->Release(setting);
+	free(setting);
+}
+
+
+void *OScDev_Setting_GetImplData(OScDev_Setting *setting)
+{
+	return setting->implData;
+}
+
+
+uint32_t OScDev_Acquisition_GetNumberOfFrames(OScDev_Acquisition *acq)
+{
+	return acq->params.frames;
+}
+
+
+double OScDev_Acquisition_GetPixelRate(OScDev_Acquisition *acq)
+{
+	return acq->params.pixelRateHz;
+}
+
+
+uint32_t OScDev_Acquisition_GetResolution(OScDev_Acquisition *acq)
+{
+	return acq->params.resolution;
+}
+
+
+double OScDev_Acquisition_GetZoomFactor(OScDev_Acquisition *acq)
+{
+	return 1.0;
+}
+
+
+void OScDev_Acquisition_GetROI(OScDev_Acquisition *acq, uint32_t *xOffset, uint32_t *yOffset,
+	uint32_t *width, uint32_t *height)
+{
+	*xOffset = 0;
+	*yOffset = 0;
+	*width = acq->params.resolution;
+	*height = acq->params.resolution;
+}
+
+
+OScDev_Error OScDev_Acquisition_IsClockRequested(OScDev_Acquisition *acq, bool *isRequested)
+{
+	*isRequested = true;
+	return OScDev_OK;
+}
+
+
+OScDev_Error OScDev_Acquisition_IsScannerRequested(OScDev_Acquisition *acq, bool *isRequested)
+{
+	*isRequested = true;
+	return OScDev_OK;
+}
+
+
+OScDev_Error OScDev_Acquisition_IsDetectorRequested(OScDev_Acquisition *acq, bool *isRequested)
+{
+	*isRequested = true;
+	return OScDev_OK;
+}
+
+
+OScDev_Error OScDev_Acquisition_GetClockStartTriggerSource(OScDev_Acquisition *acq,
+	OScDev_TriggerSource *src)
+{
+	*src = OScDev_TriggerSource_Software;
+	return OScDev_OK;
+}
+
+
+OScDev_Error OScDev_Acquisition_GetClockSource(OScDev_Acquisition *acq, OScDev_ClockSource *src)
+{
+	*src = OScDev_ClockSource_Internal;
+	return OScDev_OK;
+}
+
+
+bool OScDev_Acquisition_CallFrameCallback(OScDev_Acquisition *acq, uint32_t channel, void *pixels)
+{
+	if (channel == 0)
+	{
+		const uint16_t *frame = pixels;
+		size_t numPixels = (size_t)acq->params.resolution * acq->params.resolution;
+		for (size_t i = 0; i < numPixels; ++i)
+			acq->pixelSum += frame[i];
+		acq->framesDelivered++;
+	}
+	return acq->params.stopAfterFrames == 0 ||
+		acq->framesDelivered < acq->params.stopAfterFrames;
+}
+
+
+OScDev_Device *Standalone_OpenDevice(void)
+{
+	OScDev_PtrArray *devices = NULL;
+	if (NIDAQEnumerateInstances(&devices) != OScDev_OK)
+		return NULL;
+
+	OScDev_Device *device = NULL;
+	for (size_t i = 0; i < OScDev_PtrArray_Size(devices); ++i)
+	{
+		OScDev_Device *dev = OScDev_PtrArray_At(devices, i);
+		if (!device)
+		{
+			device = dev;
+			continue;
+		}
+		dev->impl->ReleaseInstance(dev);
+		free(dev);
+	}
+	OScDev_PtrArray_Destroy(devices);
+	if (!device)
+	{
+		Log("error", "No device found");
+		return NULL;
+	}
+
+	if (device->impl->Open(device) != OScDev_OK)
+		goto error;
+	if (device->impl->MakeSettings(device, &device->settings) != OScDev_OK)
+	{
+		device->impl->Close(device);
+		goto error;
+	}
+
+	char name[OScDev_MAX_STR_LEN + 1] = "";
+	device->impl->GetName(device, name);
+	char msg[sizeof("Opened device ") + OScDev_MAX_STR_LEN];
+	snprintf(msg, sizeof(msg), "Opened device %s", name);
+	OScDev_Log_Debug(device, msg);
+	return device;
+
+error:
+	device->impl->ReleaseInstance(device);
+	free(device);
+	return NULL;
+}
+
+
+void Standalone_CloseDevice(OScDev_Device *device)
+{
+	if (!device)
+		return;
+	device->impl->Close(device);
+	for (size_t i = 0; i < OScDev_PtrArray_Size(device->settings); ++i)
+		OScDev_Setting_Destroy(OScDev_PtrArray_At(device->settings, i));
+	OScDev_PtrArray_Destroy(device->settings);
+	device->impl->ReleaseInstance(device);
+	free(device);
+}
+
+
+static OScDev_Setting *FindSetting(OScDev_Device *device, const char *name)
+{
+	for (size_t i = 0; i < OScDev_PtrArray_Size(device->settings); ++i)
+	{
+		OScDev_Setting *setting = OScDev_PtrArray_At(device->settings, i);
+		if (strcmp(setting->name, name) == 0)
+			return setting;
+	}
+	return NULL;
+}
+
+
+bool Standalone_SetSetting(OScDev_Device *device, const char *name, const char *value)
+{
+	char msg[OScDev_MAX_STR_LEN + 1];
+	OScDev_Setting *setting = FindSetting(device, name);
+	if (!setting)
+	{
+		snprintf(msg, sizeof(msg), "No setting named \"%s\"", name);
+		Log("error", msg);
+		return false;
+	}
+
+	OScDev_Error errCode;
+	switch (setting->valueType)
+	{
+	case OScDev_ValueType_String:
+		errCode = setting->impl->SetString(setting, value);
+		break;
+	case OScDev_ValueType_Bool:
+		errCode = setting->impl->SetBool(setting, atoi(value) != 0);
+		break;
+	case OScDev_ValueType_Int32:
+		errCode = setting->impl->SetInt32(setting, (int32_t)strtol(value, NULL, 10));
+		break;
+	case OScDev_ValueType_Float64:
+		errCode = setting->impl->SetFloat64(setting, strtod(value, NULL));
+		break;
+	case OScDev_ValueType_Enum:
+	{
+		uint32_t enumValue;
+		errCode = setting->impl->GetEnumValueForName(setting, &enumValue, value);
+		if (errCode == OScDev_OK)
+			errCode = setting->impl->SetEnum(setting, enumValue);
+		break;
+	}
+	default:
+		errCode = RICH_ERROR_CODE;
+		break;
+	}
+
+	if (errCode != OScDev_OK)
+	{
+		snprintf(msg, sizeof(msg), "Failed to set \"%s\" to \"%s\"", name, value);
+		Log("error", msg);
+		return false;
+	}
+	return true;
+}
+
+
+bool Standalone_ApplySetting(OScDev_Device *device, const char *assignment)
+{
+	const char *equals = strchr(assignment, '=');
+	if (!equals || equals == assignment || equals - assignment > OScDev_MAX_STR_LEN)
+	{
+		char msg[OScDev_MAX_STR_LEN + 1];
+		snprintf(msg, sizeof(msg), "Expected Name=Value, got \"%s\"", assignment);
+		Log("error", msg);
+		return false;
+	}
+
+	char name[OScDev_MAX_STR_LEN + 1];
+	size_t len = equals - assignment;
+	memcpy(name, assignment, len);
+	name[len] = '\0';
+	return Standalone_SetSetting(device, name, equals + 1);
+}
+
+
+void Standalone_WriteCountersJSON(OScDev_Device *device, FILE *file)
+{
+	for (size_t i = 0; i < OScDev_PtrArray_Size(device->settings); ++i)
+	{
+		OScDev_Setting *setting = OScDev_PtrArray_At(device->settings, i);
+		if (setting->valueType != OScDev_ValueType_Float64 || !setting->impl->IsWritable)
+			continue;
+		bool writable;
+		double value;
+		if (setting->impl->IsWritable(setting, &writable) != OScDev_OK || writable ||
+			setting->impl->GetFloat64(setting, &value) != OScDev_OK)
+			continue;
+		fprintf(file, ", \"%s\": %.6g", setting->name, value);
+	}
+}
+
+
+bool Standalone_Acquire(OScDev_Device *device, const struct StandaloneAcquisitionParams *params,
+	struct StandaloneAcquisitionResult *result)
+{
+	OScDev_Acquisition acq = { 0 };
+	acq.params = *params;
+	memset(result, 0, sizeof(*result));
+
+	int64_t armStart = Time_GetTicks();
+	if (device->impl->Arm(device, &acq) != OScDev_OK)
+		return false;
+	int64_t start = Time_GetTicks();
+	if (device->impl->Start(device) != OScDev_OK)
+	{
+		device->impl->Stop(device);
+		return false;
+	}
+	bool ok = device->impl->Wait(device) == OScDev_OK;
+	int64_t end = Time_GetTicks();
+
+	result->framesDelivered = acq.framesDelivered;
+	size_t numPixels = (size_t)params->resolution * params->resolution;
+	if (acq.framesDelivered > 0)
+		result->meanPixel = (double)acq.pixelSum / acq.framesDelivered / numPixels;
+	result->armMs = Time_TicksToMs(start - armStart);
+	result->runMs = Time_TicksToMs(end - start);
+	return ok;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <OpenScanDeviceLib.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+// In-process stand-in for OpenScanLib, so that the console programs built
+// by CMakeLists.txt can drive a device without an OpenScan host. It
+// implements the OpenScanDeviceLib functions used by this module, and is
+// linked in place of OpenScanDeviceLib.
+//
+// The devices are simulated (see SimulatedDAQ.c) unless built with NI-DAQmx
+// and run without OSCNIDAQ_SIMULATE set. Log messages go to stderr.
+
+
+struct StandaloneAcquisitionParams
+{
+	uint32_t frames;
+	double pixelRateHz;
+	uint32_t resolution; // Of the full field of view, which is scanned
+	uint32_t stopAfterFrames; // Frame callback asks to stop after this many; 0 for never
+};
+
+
+struct StandaloneAcquisitionResult
+{
+	uint32_t framesDelivered;
+	double meanPixel; // Of the first channel, over all frames delivered
+	double armMs;
+	double runMs; // From start to the end of the acquisition
+};
+
+
+// Log Debug messages as well as the others
+void Standalone_SetVerbose(bool verbose);
+
+// Enumerate the devices and open the first; returns NULL on error
+OScDev_Device *Standalone_OpenDevice(void);
+void Standalone_CloseDevice(OScDev_Device *device);
+
+// Set the named setting from its value written as text (Bool as 0 or 1,
+// Enum as the value name); returns false on error
+bool Standalone_SetSetting(OScDev_Device *device, const char *name, const char *value);
+
+// Set a setting given as "Name=Value"; returns false on error
+bool Standalone_ApplySetting(OScDev_Device *device, const char *assignment);
+
+// Write the read-only Float64 settings (the performance counters) as JSON
+// object members, each preceded by ", "
+void Standalone_WriteCountersJSON(OScDev_Device *device, FILE *file);
+
+// Arm, start, and wait for the end of an acquisition; returns false on
+// error (which is logged)
+bool Standalone_Acquire(OScDev_Device *device, const struct StandaloneAcquisitionParams *params,
+	struct StandaloneAcquisitionResult *result);
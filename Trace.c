@@ -0,0 +1,191 @@
+#include "Trace.h"
+#include "Platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#ifndef OSCNIDAQ_NO_TRACE
+
+// Threads given their own ID in the trace; any further threads share the
+// last ID
+#define MAX_TRACE_THREADS 64
+
+
+struct TraceEvent
+{
+	int64_t ticks; // Time_GetTicks()
+	int64_t value; // TRACE_NO_VALUE if none
+	const char *name;
+	uint32_t thread; // ID in the trace, from 1
+	char phase; // As in Chrome trace JSON: 'B'egin, 'E'nd, or 'i'nstant
+};
+
+
+volatile int32_t traceEnabled;
+
+// Allocated on first start and kept, so that a thread still recording as
+// tracing is stopped always has somewhere to write
+static struct TraceEvent *traceEvents;
+
+// Events recorded since the start, modulo 2^32; the last TRACE_CAPACITY
+// are in traceEvents
+static volatile int32_t traceEventCount;
+
+// Thread IDs and names are kept across starts, as the threads persist
+static volatile int32_t traceThreadCount;
+static const char *volatile traceThreadNames[MAX_TRACE_THREADS + 1];
+static THREAD_LOCAL uint32_t traceThreadId; // 0 until assigned
+
+
+static uint32_t GetTraceThreadId(void)
+{
+	if (traceThreadId == 0)
+	{
+		int32_t id = Atomic_Increment(&traceThreadCount);
+		traceThreadId = id <= MAX_TRACE_THREADS ? id : MAX_TRACE_THREADS;
+	}
+	return traceThreadId;
+}
+
+
+void Trace_Record(const char *name, char phase, int64_t value)
+{
+	uint32_t index = (uint32_t)Atomic_Increment(&traceEventCount) - 1;
+	struct TraceEvent *event = &traceEvents[index & (TRACE_CAPACITY - 1)];
+	event->ticks = Time_GetTicks();
+	event->value = value;
+	event->name = name;
+	event->thread = GetTraceThreadId();
+	event->phase = phase;
+}
+
+
+void Trace_SetThreadName(const char *name)
+{
+	traceThreadNames[GetTraceThreadId()] = name;
+}
+
+
+bool Trace_Start(void)
+{
+	Atomic_Store(&traceEnabled, 0);
+	if (!traceEvents)
+	{
+		traceEvents = calloc(TRACE_CAPACITY, sizeof(struct TraceEvent));
+		if (!traceEvents)
+			return false;
+	}
+	Atomic_Store(&traceEventCount, 0);
+	Atomic_Store(&traceEnabled, 1);
+	return true;
+}
+
+
+void Trace_Stop(void)
+{
+	Atomic_Store(&traceEnabled, 0);
+}
+
+
+bool Trace_IsStarted(void)
+{
+	return Atomic_Load(&traceEnabled) != 0;
+}
+
+
+static void WriteTraceRecordSeparator(FILE *file, bool *first)
+{
+	fputs(*first ? "\n" : ",\n", file);
+	*first = false;
+}
+
+
+bool Trace_WriteChromeJSON(const char *path)
+{
+	FILE *file = fopen(path, "w");
+	if (!file)
+		return false;
+
+	uint32_t recorded = traceEvents ? (uint32_t)Atomic_Load(&traceEventCount) : 0;
+	uint32_t count = recorded < TRACE_CAPACITY ? recorded : TRACE_CAPACITY;
+	uint32_t firstIndex = recorded - count;
+
+	// Times are in microseconds from the earliest event
+	int64_t origin = INT64_MAX;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		int64_t ticks = traceEvents[(firstIndex + i) & (TRACE_CAPACITY - 1)].ticks;
+		if (ticks < origin)
+			origin = ticks;
+	}
+	double usPerTick = 1e6 / Time_GetTicksPerSecond();
+
+	bool first = true;
+	fputs("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [", file);
+	WriteTraceRecordSeparator(file, &first);
+	fputs("{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+		"\"args\": {\"name\": \"OpenScan NI-DAQ\"}}", file);
+
+	int32_t numThreads = Atomic_Load(&traceThreadCount);
+	if (numThreads > MAX_TRACE_THREADS)
+		numThreads = MAX_TRACE_THREADS;
+	for (int32_t id = 1; id <= numThreads; ++id)
+	{
+		if (!traceThreadNames[id])
+			continue;
+		WriteTraceRecordSeparator(file, &first);
+		fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+			"\"tid\": %d, \"args\": {\"name\": \"%s\"}}", id, traceThreadNames[id]);
+	}
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const struct TraceEvent *event = &traceEvents[(firstIndex + i) & (TRACE_CAPACITY - 1)];
+		if (!event->name) // Not yet written
+			continue;
+		WriteTraceRecordSeparator(file, &first);
+		fprintf(file, "{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %u",
+			event->name, event->phase, (event->ticks - origin) * usPerTick, event->thread);
+		if (event->phase == 'i')
+			fputs(", \"s\": \"t\"", file);
+		if (event->value != TRACE_NO_VALUE)
+			fprintf(file, ", \"args\": {\"value\": %lld}", (long long)event->value);
+		fputs("}", file);
+	}
+	fputs("\n]}\n", file);
+
+	bool ok = !ferror(file);
+	if (fclose(file) != 0)
+		ok = false;
+	return ok;
+}
+
+
+#else // OSCNIDAQ_NO_TRACE
+
+
+bool Trace_Start(void)
+{
+	return false;
+}
+
+
+void Trace_Stop(void)
+{
+}
+
+
+bool Trace_IsStarted(void)
+{
+	return false;
+}
+
+
+bool Trace_WriteChromeJSON(const char *path)
+{
+	return false;
+}
+
+
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// In-memory trace of timestamped events (begin and end of spans, and
+// instants) on every thread, for viewing the timeline of an acquisition.
+//
+// Events go into a fixed-size ring holding the last TRACE_CAPACITY events;
+// recording one takes a clock read and an atomic increment. When tracing is
+// not started, each trace point costs a test of a global flag; when built
+// with OSCNIDAQ_NO_TRACE, nothing.
+//
+// Event names must be string literals (or otherwise outlive the trace).
+// The trace is written out as Chrome trace event JSON, which can be opened
+// in chrome://tracing or the Perfetto UI.
+
+// Events kept; power of two
+#define TRACE_CAPACITY (1 << 16)
+
+// Value of events without one
+#define TRACE_NO_VALUE INT64_MIN
+
+
+#ifdef OSCNIDAQ_NO_TRACE
+
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_END(name) ((void)0)
+#define TRACE_INSTANT(name, value) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+
+#else
+
+extern volatile int32_t traceEnabled;
+
+void Trace_Record(const char *name, char phase, int64_t value);
+void Trace_SetThreadName(const char *name);
+
+#define TRACE_BEGIN(name) \
+	do { if (traceEnabled) Trace_Record((name), 'B', TRACE_NO_VALUE); } while (0)
+#define TRACE_END(name) \
+	do { if (traceEnabled) Trace_Record((name), 'E', TRACE_NO_VALUE); } while (0)
+#define TRACE_INSTANT(name, value) \
+	do { if (traceEnabled) Trace_Record((name), 'i', (value)); } while (0)
+
+// Name the calling thread in the trace
+#define TRACE_THREAD_NAME(name) \
+	do { if (traceEnabled) Trace_SetThreadName(name); } while (0)
+
+#endif
+
+
+// Discard any recorded events and start recording; returns false if the
+// ring cannot be allocated or tracing is not built in
+bool Trace_Start(void);
+void Trace_Stop(void);
+bool Trace_IsStarted(void);
+
+// Write the recorded events as Chrome trace JSON; returns false on error.
+// Events being recorded meanwhile may be written incompletely, so this is
+// best done while no acquisition is running.
+bool Trace_WriteChromeJSON(const char *path);
@@ -0,0 +1,436 @@
+#ifndef OSCNIDAQ_NO_TRACE
+
+#include "DAQBackend.h"
+#include "Trace.h"
+
+#include <NIDAQmx.h>
+
+
+// Wrappers forwarding each call to the backend in use, recording it as a
+// span in the trace (named after the DAQmx function); see GetDAQ()
+
+
+static const struct DAQBackend *traced;
+
+
+static int32 GetSysDevNames_Traced(char *data, uInt32 bufferSize)
+{
+	TRACE_BEGIN("DAQmxGetSysDevNames");
+	int32 ret = traced->GetSysDevNames(data, bufferSize);
+	TRACE_END("DAQmxGetSysDevNames");
+	return ret;
+}
+
+
+static int32 ResetDevice_Traced(const char deviceName[])
+{
+	TRACE_BEGIN("DAQmxResetDevice");
+	int32 ret = traced->ResetDevice(deviceName);
+	TRACE_END("DAQmxResetDevice");
+	return ret;
+}
+
+
+static int32 GetDevProductCategory_Traced(const char device[], int32 *data)
+{
+	TRACE_BEGIN("DAQmxGetDevProductCategory");
+	int32 ret = traced->GetDevProductCategory(device, data);
+	TRACE_END("DAQmxGetDevProductCategory");
+	return ret;
+}
+
+
+static int32 GetDevAIPhysicalChans_Traced(const char device[], char *data, uInt32 bufferSize)
+{
+	TRACE_BEGIN("DAQmxGetDevAIPhysicalChans");
+	int32 ret = traced->GetDevAIPhysicalChans(device, data, bufferSize);
+	TRACE_END("DAQmxGetDevAIPhysicalChans");
+	return ret;
+}
+
+
+static int32 GetDevAIMaxSingleChanRate_Traced(const char device[], float64 *data)
+{
+	TRACE_BEGIN("DAQmxGetDevAIMaxSingleChanRate");
+	int32 ret = traced->GetDevAIMaxSingleChanRate(device, data);
+	TRACE_END("DAQmxGetDevAIMaxSingleChanRate");
+	return ret;
+}
+
+
+static int32 GetDevAIMaxMultiChanRate_Traced(const char device[], float64 *data)
+{
+	TRACE_BEGIN("DAQmxGetDevAIMaxMultiChanRate");
+	int32 ret = traced->GetDevAIMaxMultiChanRate(device, data);
+	TRACE_END("DAQmxGetDevAIMaxMultiChanRate");
+	return ret;
+}
+
+
+static int32 GetDevAOVoltageRngs_Traced(const char device[], float64 *data, uInt32 arraySizeInElements)
+{
+	TRACE_BEGIN("DAQmxGetDevAOVoltageRngs");
+	int32 ret = traced->GetDevAOVoltageRngs(device, data, arraySizeInElements);
+	TRACE_END("DAQmxGetDevAOVoltageRngs");
+	return ret;
+}
+
+
+static int32 CreateTask_Traced(const char taskName[], TaskHandle *taskHandle)
+{
+	TRACE_BEGIN("DAQmxCreateTask");
+	int32 ret = traced->CreateTask(taskName, taskHandle);
+	TRACE_END("DAQmxCreateTask");
+	return ret;
+}
+
+
+static int32 ClearTask_Traced(TaskHandle taskHandle)
+{
+	TRACE_BEGIN("DAQmxClearTask");
+	int32 ret = traced->ClearTask(taskHandle);
+	TRACE_END("DAQmxClearTask");
+	return ret;
+}
+
+
+static int32 StartTask_Traced(TaskHandle taskHandle)
+{
+	TRACE_BEGIN("DAQmxStartTask");
+	int32 ret = traced->StartTask(taskHandle);
+	TRACE_END("DAQmxStartTask");
+	return ret;
+}
+
+
+static int32 StopTask_Traced(TaskHandle taskHandle)
+{
+	TRACE_BEGIN("DAQmxStopTask");
+	int32 ret = traced->StopTask(taskHandle);
+	TRACE_END("DAQmxStopTask");
+	return ret;
+}
+
+
+static int32 TaskControl_Traced(TaskHandle taskHandle, int32 action)
+{
+	TRACE_BEGIN("DAQmxTaskControl");
+	int32 ret = traced->TaskControl(taskHandle, action);
+	TRACE_END("DAQmxTaskControl");
+	return ret;
+}
+
+
+static int32 WaitUntilTaskDone_Traced(TaskHandle taskHandle, float64 timeToWait)
+{
+	TRACE_BEGIN("DAQmxWaitUntilTaskDone");
+	int32 ret = traced->WaitUntilTaskDone(taskHandle, timeToWait);
+	TRACE_END("DAQmxWaitUntilTaskDone");
+	return ret;
+}
+
+
+static int32 GetTaskNumDevices_Traced(TaskHandle taskHandle, uInt32 *data)
+{
+	TRACE_BEGIN("DAQmxGetTaskNumDevices");
+	int32 ret = traced->GetTaskNumDevices(taskHandle, data);
+	TRACE_END("DAQmxGetTaskNumDevices");
+	return ret;
+}
+
+
+static int32 GetNthTaskDevice_Traced(TaskHandle taskHandle, uInt32 index, char buffer[], int32 bufferSize)
+{
+	TRACE_BEGIN("DAQmxGetNthTaskDevice");
+	int32 ret = traced->GetNthTaskDevice(taskHandle, index, buffer, bufferSize);
+	TRACE_END("DAQmxGetNthTaskDevice");
+	return ret;
+}
+
+
+static int32 CreateAIVoltageChan_Traced(TaskHandle taskHandle, const char physicalChannel[],
+	const char nameToAssignToChannel[], int32 terminalConfig,
+	float64 minVal, float64 maxVal, int32 units, const char customScaleName[])
+{
+	TRACE_BEGIN("DAQmxCreateAIVoltageChan");
+	int32 ret = traced->CreateAIVoltageChan(taskHandle, physicalChannel, nameToAssignToChannel, terminalConfig,
+		minVal, maxVal, units, customScaleName);
+	TRACE_END("DAQmxCreateAIVoltageChan");
+	return ret;
+}
+
+
+static int32 CreateAOVoltageChan_Traced(TaskHandle taskHandle, const char physicalChannel[],
+	const char nameToAssignToChannel[], float64 minVal, float64 maxVal,
+	int32 units, const char customScaleName[])
+{
+	TRACE_BEGIN("DAQmxCreateAOVoltageChan");
+	int32 ret = traced->CreateAOVoltageChan(taskHandle, physicalChannel, nameToAssignToChannel, minVal,
+		maxVal, units, customScaleName);
+	TRACE_END("DAQmxCreateAOVoltageChan");
+	return ret;
+}
+
+
+static int32 CreateDOChan_Traced(TaskHandle taskHandle, const char lines[],
+	const char nameToAssignToLines[], int32 lineGrouping)
+{
+	TRACE_BEGIN("DAQmxCreateDOChan");
+	int32 ret = traced->CreateDOChan(taskHandle, lines, nameToAssignToLines, lineGrouping);
+	TRACE_END("DAQmxCreateDOChan");
+	return ret;
+}
+
+
+static int32 CreateCOPulseChanFreq_Traced(TaskHandle taskHandle, const char counter[],
+	const char nameToAssignToChannel[], int32 units, int32 idleState,
+	float64 initialDelay, float64 freq, float64 dutyCycle)
+{
+	TRACE_BEGIN("DAQmxCreateCOPulseChanFreq");
+	int32 ret = traced->CreateCOPulseChanFreq(taskHandle, counter, nameToAssignToChannel, units,
+		idleState, initialDelay, freq, dutyCycle);
+	TRACE_END("DAQmxCreateCOPulseChanFreq");
+	return ret;
+}
+
+
+static int32 SetChanAttributeF64_Traced(TaskHandle taskHandle, const char channel[],
+	int32 attribute, float64 value)
+{
+	TRACE_BEGIN("DAQmxSetChanAttributeF64");
+	int32 ret = traced->SetChanAttributeF64(taskHandle, channel, attribute, value);
+	TRACE_END("DAQmxSetChanAttributeF64");
+	return ret;
+}
+
+
+static int32 GetAIDevScalingCoeff_Traced(TaskHandle taskHandle, const char channel[],
+	float64 *data, uInt32 arraySizeInElements)
+{
+	TRACE_BEGIN("DAQmxGetAIDevScalingCoeff");
+	int32 ret = traced->GetAIDevScalingCoeff(taskHandle, channel, data, arraySizeInElements);
+	TRACE_END("DAQmxGetAIDevScalingCoeff");
+	return ret;
+}
+
+
+static int32 CfgSampClkTiming_Traced(TaskHandle taskHandle, const char source[], float64 rate,
+	int32 activeEdge, int32 sampleMode, uInt64 sampsPerChan)
+{
+	TRACE_BEGIN("DAQmxCfgSampClkTiming");
+	int32 ret = traced->CfgSampClkTiming(taskHandle, source, rate,
+		activeEdge, sampleMode, sampsPerChan);
+	TRACE_END("DAQmxCfgSampClkTiming");
+	return ret;
+}
+
+
+static int32 CfgImplicitTiming_Traced(TaskHandle taskHandle, int32 sampleMode, uInt64 sampsPerChan)
+{
+	TRACE_BEGIN("DAQmxCfgImplicitTiming");
+	int32 ret = traced->CfgImplicitTiming(taskHandle, sampleMode, sampsPerChan);
+	TRACE_END("DAQmxCfgImplicitTiming");
+	return ret;
+}
+
+
+static int32 CfgDigEdgeStartTrig_Traced(TaskHandle taskHandle, const char triggerSource[], int32 triggerEdge)
+{
+	TRACE_BEGIN("DAQmxCfgDigEdgeStartTrig");
+	int32 ret = traced->CfgDigEdgeStartTrig(taskHandle, triggerSource, triggerEdge);
+	TRACE_END("DAQmxCfgDigEdgeStartTrig");
+	return ret;
+}
+
+
+static int32 SetStartTrigRetriggerable_Traced(TaskHandle taskHandle, bool32 data)
+{
+	TRACE_BEGIN("DAQmxSetStartTrigRetriggerable");
+	int32 ret = traced->SetStartTrigRetriggerable(taskHandle, data);
+	TRACE_END("DAQmxSetStartTrigRetriggerable");
+	return ret;
+}
+
+
+static int32 CfgInputBuffer_Traced(TaskHandle taskHandle, uInt32 numSampsPerChan)
+{
+	TRACE_BEGIN("DAQmxCfgInputBuffer");
+	int32 ret = traced->CfgInputBuffer(taskHandle, numSampsPerChan);
+	TRACE_END("DAQmxCfgInputBuffer");
+	return ret;
+}
+
+
+static int32 CfgOutputBuffer_Traced(TaskHandle taskHandle, uInt32 numSampsPerChan)
+{
+	TRACE_BEGIN("DAQmxCfgOutputBuffer");
+	int32 ret = traced->CfgOutputBuffer(taskHandle, numSampsPerChan);
+	TRACE_END("DAQmxCfgOutputBuffer");
+	return ret;
+}
+
+
+static int32 WriteAnalogF64_Traced(TaskHandle taskHandle, int32 numSampsPerChan, bool32 autoStart,
+	float64 timeout, bool32 dataLayout, const float64 writeArray[],
+	int32 *sampsPerChanWritten, bool32 *reserved)
+{
+	TRACE_BEGIN("DAQmxWriteAnalogF64");
+	int32 ret = traced->WriteAnalogF64(taskHandle, numSampsPerChan, autoStart, timeout,
+		dataLayout, writeArray, sampsPerChanWritten, reserved);
+	TRACE_END("DAQmxWriteAnalogF64");
+	return ret;
+}
+
+
+static int32 WriteDigitalLines_Traced(TaskHandle taskHandle, int32 numSampsPerChan, bool32 autoStart,
+	float64 timeout, bool32 dataLayout, const uInt8 writeArray[],
+	int32 *sampsPerChanWritten, bool32 *reserved)
+{
+	TRACE_BEGIN("DAQmxWriteDigitalLines");
+	int32 ret = traced->WriteDigitalLines(taskHandle, numSampsPerChan, autoStart, timeout,
+		dataLayout, writeArray, sampsPerChanWritten, reserved);
+	TRACE_END("DAQmxWriteDigitalLines");
+	return ret;
+}
+
+
+static int32 RegisterEveryNSamplesEvent_Traced(TaskHandle task, int32 everyNsamplesEventType,
+	uInt32 nSamples, uInt32 options, DAQmxEveryNSamplesEventCallbackPtr callbackFunction,
+	void *callbackData)
+{
+	TRACE_BEGIN("DAQmxRegisterEveryNSamplesEvent");
+	int32 ret = traced->RegisterEveryNSamplesEvent(task, everyNsamplesEventType, nSamples,
+		options, callbackFunction, callbackData);
+	TRACE_END("DAQmxRegisterEveryNSamplesEvent");
+	return ret;
+}
+
+
+static int32 SetReadReadAllAvailSamp_Traced(TaskHandle taskHandle, bool32 data)
+{
+	TRACE_BEGIN("DAQmxSetReadReadAllAvailSamp");
+	int32 ret = traced->SetReadReadAllAvailSamp(taskHandle, data);
+	TRACE_END("DAQmxSetReadReadAllAvailSamp");
+	return ret;
+}
+
+
+static int32 GetReadNumChans_Traced(TaskHandle taskHandle, uInt32 *data)
+{
+	TRACE_BEGIN("DAQmxGetReadNumChans");
+	int32 ret = traced->GetReadNumChans(taskHandle, data);
+	TRACE_END("DAQmxGetReadNumChans");
+	return ret;
+}
+
+
+static int32 GetReadAvailSampPerChan_Traced(TaskHandle taskHandle, uInt32 *data)
+{
+	TRACE_BEGIN("DAQmxGetReadAvailSampPerChan");
+	int32 ret = traced->GetReadAvailSampPerChan(taskHandle, data);
+	TRACE_END("DAQmxGetReadAvailSampPerChan");
+	return ret;
+}
+
+
+static int32 GetReadCurrReadPos_Traced(TaskHandle taskHandle, uInt64 *data)
+{
+	TRACE_BEGIN("DAQmxGetReadCurrReadPos");
+	int32 ret = traced->GetReadCurrReadPos(taskHandle, data);
+	TRACE_END("DAQmxGetReadCurrReadPos");
+	return ret;
+}
+
+
+static int32 GetReadTotalSampPerChanAcquired_Traced(TaskHandle taskHandle, uInt64 *data)
+{
+	TRACE_BEGIN("DAQmxGetReadTotalSampPerChanAcquired");
+	int32 ret = traced->GetReadTotalSampPerChanAcquired(taskHandle, data);
+	TRACE_END("DAQmxGetReadTotalSampPerChanAcquired");
+	return ret;
+}
+
+
+static int32 ReadAnalogF64_Traced(TaskHandle taskHandle, int32 numSampsPerChan, float64 timeout,
+	bool32 fillMode, float64 readArray[], uInt32 arraySizeInSamps,
+	int32 *sampsPerChanRead, bool32 *reserved)
+{
+	TRACE_BEGIN("DAQmxReadAnalogF64");
+	int32 ret = traced->ReadAnalogF64(taskHandle, numSampsPerChan, timeout, fillMode,
+		readArray, arraySizeInSamps, sampsPerChanRead, reserved);
+	TRACE_END("DAQmxReadAnalogF64");
+	return ret;
+}
+
+
+static int32 ReadBinaryI16_Traced(TaskHandle taskHandle, int32 numSampsPerChan, float64 timeout,
+	bool32 fillMode, int16 readArray[], uInt32 arraySizeInSamps,
+	int32 *sampsPerChanRead, bool32 *reserved)
+{
+	TRACE_BEGIN("DAQmxReadBinaryI16");
+	int32 ret = traced->ReadBinaryI16(taskHandle, numSampsPerChan, timeout, fillMode,
+		readArray, arraySizeInSamps, sampsPerChanRead, reserved);
+	TRACE_END("DAQmxReadBinaryI16");
+	return ret;
+}
+
+
+static int32 GetExtendedErrorInfo_Traced(char errorString[], uInt32 bufferSize)
+{
+	TRACE_BEGIN("DAQmxGetExtendedErrorInfo");
+	int32 ret = traced->GetExtendedErrorInfo(errorString, bufferSize);
+	TRACE_END("DAQmxGetExtendedErrorInfo");
+	return ret;
+}
+
+
+static const struct DAQBackend TracingDAQBackend = {
+	.name = "tracing",
+	.GetSysDevNames = GetSysDevNames_Traced,
+	.ResetDevice = ResetDevice_Traced,
+	.GetDevProductCategory = GetDevProductCategory_Traced,
+	.GetDevAIPhysicalChans = GetDevAIPhysicalChans_Traced,
+	.GetDevAIMaxSingleChanRate = GetDevAIMaxSingleChanRate_Traced,
+	.GetDevAIMaxMultiChanRate = GetDevAIMaxMultiChanRate_Traced,
+	.GetDevAOVoltageRngs = GetDevAOVoltageRngs_Traced,
+	.CreateTask = CreateTask_Traced,
+	.ClearTask = ClearTask_Traced,
+	.StartTask = StartTask_Traced,
+	.StopTask = StopTask_Traced,
+	.TaskControl = TaskControl_Traced,
+	.WaitUntilTaskDone = WaitUntilTaskDone_Traced,
+	.GetTaskNumDevices = GetTaskNumDevices_Traced,
+	.GetNthTaskDevice = GetNthTaskDevice_Traced,
+	.CreateAIVoltageChan = CreateAIVoltageChan_Traced,
+	.CreateAOVoltageChan = CreateAOVoltageChan_Traced,
+	.CreateDOChan = CreateDOChan_Traced,
+	.CreateCOPulseChanFreq = CreateCOPulseChanFreq_Traced,
+	.SetChanAttributeF64 = SetChanAttributeF64_Traced,
+	.GetAIDevScalingCoeff = GetAIDevScalingCoeff_Traced,
+	.CfgSampClkTiming = CfgSampClkTiming_Traced,
+	.CfgImplicitTiming = CfgImplicitTiming_Traced,
+	.CfgDigEdgeStartTrig = CfgDigEdgeStartTrig_Traced,
+	.SetStartTrigRetriggerable = SetStartTrigRetriggerable_Traced,
+	.CfgInputBuffer = CfgInputBuffer_Traced,
+	.CfgOutputBuffer = CfgOutputBuffer_Traced,
+	.WriteAnalogF64 = WriteAnalogF64_Traced,
+	.WriteDigitalLines = WriteDigitalLines_Traced,
+	.RegisterEveryNSamplesEvent = RegisterEveryNSamplesEvent_Traced,
+	.SetReadReadAllAvailSamp = SetReadReadAllAvailSamp_Traced,
+	.GetReadNumChans = GetReadNumChans_Traced,
+	.GetReadAvailSampPerChan = GetReadAvailSampPerChan_Traced,
+	.GetReadCurrReadPos = GetReadCurrReadPos_Traced,
+	.GetReadTotalSampPerChanAcquired = GetReadTotalSampPerChanAcquired_Traced,
+	.ReadAnalogF64 = ReadAnalogF64_Traced,
+	.ReadBinaryI16 = ReadBinaryI16_Traced,
+	.GetExtendedErrorInfo = GetExtendedErrorInfo_Traced,
+};
+
+
+const struct DAQBackend *GetTracingDAQ(const struct DAQBackend *backend)
+{
+	traced = backend;
+	return &TracingDAQBackend;
+}
+
+#endif // OSCNIDAQ_NO_TRACE
@@ -30,6 +30,37 @@ GenerateGalvoWaveform(int32_t effectiveScanLen, int32_t retraceLen,
 }
 
 
+// Generate 1D (undershoot + trace + turnaround) for both directions of a
+// bidirectional scan. The forward trace spans scanStart to scanEnd, and the
+// reverse trace scanEnd to scanStart, so that the galvo position is the same
+// at corresponding pixels. Each turnaround leads into the undershoot of the
+// other direction.
+void
+GenerateBidirectionalGalvoWaveforms(int32_t effectiveScanLen, int32_t turnaroundLen,
+	int32_t undershootLen, double scanStart, double scanEnd,
+	double *forwardWaveform, double *reverseWaveform)
+{
+	double scanAmplitude = scanEnd - scanStart;
+	double step = scanAmplitude / (effectiveScanLen - 1);
+	int32_t linearLen = undershootLen + effectiveScanLen;
+
+	for (int i = 0; i < linearLen; ++i)
+	{
+		forwardWaveform[i] = scanStart + (i - undershootLen) * step;
+		reverseWaveform[i] = scanEnd - (i - undershootLen) * step;
+	}
+
+	// Reverse the slope while overshooting past the end of the trace
+	if (turnaroundLen > 0)
+	{
+		SplineInterpolate(turnaroundLen, scanEnd, reverseWaveform[0],
+			step, -step, forwardWaveform + linearLen);
+		SplineInterpolate(turnaroundLen, scanStart, forwardWaveform[0],
+			-step, step, reverseWaveform + linearLen);
+	}
+}
+
+
 // n = number of elements
 // slope in units of per element
 void SplineInterpolate(int32_t n, double yFirst, double yLast,
@@ -50,9 +81,9 @@ void SplineInterpolate(int32_t n, double yFirst, double yLast,
 
 
 /* Line clock pattern for NI DAQ to output from one of its digital IOs */
-OScDev_RichError *GenerateLineClock(uint32_t x_resolution, uint32_t numScanLines, uint32_t lineDelay, uint8_t * lineClock)
+OScDev_RichError *GenerateLineClock(uint32_t x_resolution, uint32_t numScanLines, uint32_t lineDelay, uint32_t xRetraceLen, uint8_t * lineClock)
 {
-	uint32_t x_length = lineDelay + x_resolution + X_RETRACE_LEN;
+	uint32_t x_length = lineDelay + x_resolution + xRetraceLen;
 	for (uint32_t j = 0; j < numScanLines; j++)
 		for (uint32_t i = 0; i < x_length; i++)
 			lineClock[i + j*x_length] =
@@ -64,9 +95,9 @@ OScDev_RichError *GenerateLineClock(uint32_t x_resolution, uint32_t numScanLines
 // High voltage right after a line acquisition is done
 // like a line clock of reversed polarity
 // specially for B&H FLIM application
-OScDev_RichError *GenerateFLIMLineClock(uint32_t x_resolution, uint32_t numScanLines, uint32_t lineDelay, uint8_t * lineClockFLIM)
+OScDev_RichError *GenerateFLIMLineClock(uint32_t x_resolution, uint32_t numScanLines, uint32_t lineDelay, uint32_t xRetraceLen, uint8_t * lineClockFLIM)
 {
-	uint32_t x_length = lineDelay + x_resolution + X_RETRACE_LEN;
+	uint32_t x_length = lineDelay + x_resolution + xRetraceLen;
 	for (uint32_t j = 0; j < numScanLines; j++)
 		for (uint32_t i = 0; i < x_length; i++)
 			lineClockFLIM[i + j*x_length] = (i >= lineDelay + x_resolution) ? 1 : 0;
@@ -76,9 +107,9 @@ OScDev_RichError *GenerateFLIMLineClock(uint32_t x_resolution, uint32_t numScanL
 
 // Frame clock for B&H FLIM
 // High voltage at the end of the frame
-OScDev_RichError *GenerateFLIMFrameClock(uint32_t x_resolution, uint32_t numScanLines, uint32_t lineDelay, uint8_t * frameClockFLIM)
+OScDev_RichError *GenerateFLIMFrameClock(uint32_t x_resolution, uint32_t numScanLines, uint32_t lineDelay, uint32_t xRetraceLen, uint8_t * frameClockFLIM)
 {
-	uint32_t x_length = lineDelay + x_resolution + X_RETRACE_LEN;
+	uint32_t x_length = lineDelay + x_resolution + xRetraceLen;
 	uint32_t y_length = numScanLines;
 
 	for (uint32_t j = 0; j < y_length; ++j)
@@ -95,11 +126,15 @@ Generate X and Y waveforms in analog format (voltage) for a whole frame scan
 Format: X|Y in a 1D array for NI DAQ to simultaneously output in two channels
 Analog voltage range (-0.5V, 0.5V) at zoom 1
 Including Y retrace waveform that moves the slow galvo back to its starting position
+If bidirectional, odd lines are scanned in reverse; linesPerFrame must then be
+even, so that the X galvo ends the frame at its starting position
 */
 OScDev_RichError
 *GenerateGalvoWaveformFrame(uint32_t resolution, double zoom, uint32_t undershoot,
 	uint32_t xOffset, uint32_t yOffset, // ROI offset
 	uint32_t pixelsPerLine, uint32_t linesPerFrame, // ROI size
+	uint32_t lineRepeat, // Scans of each line, for line averaging
+	bool bidirectional,
 	double galvoOffsetX, double galvoOffsetY, // Adjustment offset
 	double *xyWaveformFrame)
 {
@@ -109,11 +144,28 @@ OScDev_RichError
 	double xEnd = xStart + pixelsPerLine / (zoom * resolution);
 	double yEnd = yStart + linesPerFrame / (zoom * resolution);
 
-	size_t xLength = undershoot + pixelsPerLine + X_RETRACE_LEN;
-	size_t yLength = linesPerFrame + Y_RETRACE_LEN;
+	// Each line is scanned lineRepeat times at the same Y position, with
+	// the X direction alternating by scan (not by line) if bidirectional
+	uint32_t scanLines = linesPerFrame * lineRepeat;
+	if (bidirectional && scanLines % 2 != 0)
+		return OScDev_Error_Create("Bidirectional scan requires an even number of lines");
+
+	uint32_t xRetraceLen = GetXRetraceLen(bidirectional);
+	size_t xLength = undershoot + pixelsPerLine + xRetraceLen;
+	size_t yLength = scanLines + Y_RETRACE_LEN;
 	double *xWaveform = (double *)malloc(sizeof(double) * xLength);
-	double *yWaveform = (double *)malloc(sizeof(double) * yLength);
-	GenerateGalvoWaveform(pixelsPerLine, X_RETRACE_LEN, undershoot, xStart, xEnd, xWaveform);
+	double *xWaveformReverse = NULL;
+	double *yWaveform = (double *)malloc(sizeof(double) * (linesPerFrame + Y_RETRACE_LEN));
+	if (bidirectional)
+	{
+		xWaveformReverse = (double *)malloc(sizeof(double) * xLength);
+		GenerateBidirectionalGalvoWaveforms(pixelsPerLine, xRetraceLen, undershoot,
+			xStart, xEnd, xWaveform, xWaveformReverse);
+	}
+	else
+	{
+		GenerateGalvoWaveform(pixelsPerLine, xRetraceLen, undershoot, xStart, xEnd, xWaveform);
+	}
 	GenerateGalvoWaveform(linesPerFrame, Y_RETRACE_LEN, 0, yStart, yEnd, yWaveform);
 
 	// convert to optical degree assuming 10V equal to 30 optical degree
@@ -125,18 +177,21 @@ OScDev_RichError
 	// effective scan waveform for a whole frame
 	for (unsigned j = 0; j < yLength; ++j)
 	{
+		const double *xLine = (bidirectional && j % 2 == 1) ? xWaveformReverse : xWaveform;
+		unsigned yIndex = (j < scanLines) ? j / lineRepeat : j - scanLines + linesPerFrame;
 		for (unsigned i = 0; i < xLength; ++i)
 		{
 			// first half is X waveform,
-			// x line scan repeated yLength times (sawteeth) 
+			// x line scan repeated yLength times (sawteeth, or triangle if
+			// bidirectional)
 			// galvo x stays at starting position after one frame is scanned
-			xyWaveformFrame[i + j*xLength] = (j < linesPerFrame) ?
-				(xWaveform[i] + offsetXinDegree) : (xWaveform[0] + offsetXinDegree);
+			xyWaveformFrame[i + j*xLength] = (j < scanLines) ?
+				(xLine[i] + offsetXinDegree) : (xWaveform[0] + offsetXinDegree);
 			//xyWaveformFrame[i + j*xLength] = xWaveform[i];
 			// second half is Y waveform
 			// at each x (fast) scan line, y value is constant
 			// effectively y retrace takes (Y_RETRACE_LENGTH * xLength) steps
-			xyWaveformFrame[i + j*xLength + yLength*xLength] = (yWaveform[j] + offsetYinDegree);
+			xyWaveformFrame[i + j*xLength + yLength*xLength] = (yWaveform[yIndex] + offsetYinDegree);
 		}
 	}
 	// TODO When we are scanning multiple frames, the Y retrace can be
@@ -145,6 +200,7 @@ OScDev_RichError
 	// TODO Simpler to use interleaved x,y format?
 
 	free(xWaveform);
+	free(xWaveformReverse);
 	free(yWaveform);
 
 	return OScDev_RichError_OK;
@@ -2,6 +2,7 @@
 
 #include "OpenScanDeviceLib.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 
 
@@ -10,15 +11,29 @@
 static const uint32_t X_RETRACE_LEN = 128;
 static const uint32_t Y_RETRACE_LEN = 12;
 
+// In bidirectional scanning, the X galvo only reverses direction between
+// lines instead of flying back, which takes fewer samples
+static const uint32_t X_TURNAROUND_LEN = 32;
+
+
+// Number of samples following the trace of each line
+static inline uint32_t GetXRetraceLen(bool bidirectional)
+{
+	return bidirectional ? X_TURNAROUND_LEN : X_RETRACE_LEN;
+}
+
 
 void GenerateGalvoWaveform(int32_t effectiveScanLen, int32_t retraceLen,
 	int32_t undershootLen, double scanStart, double scanEnd, double *waveform);
+void GenerateBidirectionalGalvoWaveforms(int32_t effectiveScanLen, int32_t turnaroundLen,
+	int32_t undershootLen, double scanStart, double scanEnd,
+	double *forwardWaveform, double *reverseWaveform);
 void SplineInterpolate(int32_t n, double yFirst, double yLast,
 	double slopeFirst, double slopeLast, double *result);
-OScDev_RichError *GenerateLineClock(uint32_t x_resolution, uint32_t numScanLines, uint32_t lineDelay, uint8_t * lineClock);
-OScDev_RichError *GenerateFLIMLineClock(uint32_t x_resolution, uint32_t numScanLines, uint32_t lineDelay, uint8_t * lineClockFLIM);
-OScDev_RichError *GenerateFLIMFrameClock(uint32_t x_resolution, uint32_t numScanLines, uint32_t lineDelay, uint8_t * frameClockFLIM);
+OScDev_RichError *GenerateLineClock(uint32_t x_resolution, uint32_t numScanLines, uint32_t lineDelay, uint32_t xRetraceLen, uint8_t * lineClock);
+OScDev_RichError *GenerateFLIMLineClock(uint32_t x_resolution, uint32_t numScanLines, uint32_t lineDelay, uint32_t xRetraceLen, uint8_t * lineClockFLIM);
+OScDev_RichError *GenerateFLIMFrameClock(uint32_t x_resolution, uint32_t numScanLines, uint32_t lineDelay, uint32_t xRetraceLen, uint8_t * frameClockFLIM);
 OScDev_RichError *GenerateGalvoWaveformFrame(uint32_t resolution, double zoom, uint32_t undershoot,
 	uint32_t xStart, uint32_t yStart,
-	uint32_t pixelsPerLine, uint32_t linesPerFrame,
+	uint32_t pixelsPerLine, uint32_t linesPerFrame, uint32_t lineRepeat, bool bidirectional,
 	double galvoOffsetX, double galvoOffsetY, double *xyWaveformFrame);
\ No newline at end of file
@@ -0,0 +1,227 @@
+#include "OScNIDAQDevicePrivate.h"
+#include "Waveform.h"
+
+#include <OpenScanDeviceLib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+// Benchmark of the waveform and clock pattern generation done when the
+// scanner and clock outputs are rewritten on arming. For each resolution,
+// centered ROI, and line delay, the generators and the whole preparation of
+// the scanner and clock output buffers (as by WriteScannerOutput() and
+// WriteClockOutput(), without writing to the DAQ) are timed. The remaining
+// settings (bidirectional scan, line averaging, galvo offsets, and whether
+// the last sequence was streamed) are used as currently set.
+//
+// Each case is written as one line of JSON (see RunWaveformBenchmark()),
+// giving the
+// shortest wall time of BENCHMARK_REPEATS runs of each step, in
+// milliseconds, and the peak size of the buffers allocated at once by each
+// output preparation.
+
+
+#define BENCHMARK_REPEATS 3
+
+static const uint32_t benchmarkResolutions[] = { 256, 512, 1024, 2048 };
+
+// ROI side as a fraction (1 / n) of the resolution
+static const uint32_t benchmarkROIDivisors[] = { 1, 2, 4 };
+
+static const uint32_t benchmarkLineDelays[] = { 1, 50, 200 };
+
+
+typedef OScDev_RichError *(*ClockGeneratorFunc)(uint32_t x_resolution,
+	uint32_t numScanLines, uint32_t lineDelay, uint32_t xRetraceLen, uint8_t *clock);
+
+static const struct
+{
+	const char *name;
+	ClockGeneratorFunc generate;
+} clockGenerators[] = {
+	{ "lineClockMs", GenerateLineClock },
+	{ "flimLineClockMs", GenerateFLIMLineClock },
+	{ "flimFrameClockMs", GenerateFLIMFrameClock },
+};
+
+#define NUM_CLOCK_GENERATORS (sizeof(clockGenerators) / sizeof(clockGenerators[0]))
+
+
+struct WaveformBenchmarkResult
+{
+	double galvoMs;
+	double clockMs[NUM_CLOCK_GENERATORS];
+	double scannerOutputMs;
+	double clockOutputMs;
+	size_t scannerPeakBytes;
+	size_t clockPeakBytes;
+};
+
+
+static void RecordMinimumMs(double *minMs, int64_t start)
+{
+	double ms = Time_TicksToMs(Time_GetTicks() - start);
+	if (*minMs < 0.0 || ms < *minMs)
+		*minMs = ms;
+}
+
+
+static OScDev_RichError *RunWaveformBenchmarkCase(OScDev_Device *device,
+	uint32_t resolution, uint32_t xOffset, uint32_t yOffset,
+	uint32_t width, uint32_t height, struct WaveformBenchmarkResult *result)
+{
+	OScDev_RichError *err = OScDev_RichError_OK;
+
+	uint32_t elementsPerLine = GetElementsPerLine(device, width);
+	uint32_t scanLines = GetScanLinesPerFrame(device, height);
+	size_t galvoElements = (size_t)elementsPerLine * (scanLines + Y_RETRACE_LEN);
+	double *galvo = malloc(sizeof(double) * galvoElements * 2);
+	uint8_t *clock = malloc((size_t)elementsPerLine * scanLines);
+	if (!galvo || !clock)
+	{
+		err = OScDev_Error_Create("Failed to allocate benchmark waveforms");
+		goto cleanup;
+	}
+
+	result->galvoMs = -1.0;
+	for (size_t g = 0; g < NUM_CLOCK_GENERATORS; ++g)
+		result->clockMs[g] = -1.0;
+	result->scannerOutputMs = -1.0;
+	result->clockOutputMs = -1.0;
+
+	uint32_t lineDelay = GetData(device)->lineDelay;
+	uint32_t xRetraceLen = GetXRetraceLen(GetData(device)->bidirectionalScan);
+	for (int rep = 0; rep < BENCHMARK_REPEATS; ++rep)
+	{
+		int64_t start = Time_GetTicks();
+		err = GenerateGalvoWaveformFrame(resolution, 1.0, lineDelay,
+			xOffset, yOffset, width, height,
+			GetData(device)->linesToAverage,
+			GetData(device)->bidirectionalScan,
+			GetData(device)->offsetXY[0], GetData(device)->offsetXY[1],
+			galvo);
+		if (err)
+			goto cleanup;
+		RecordMinimumMs(&result->galvoMs, start);
+
+		for (size_t g = 0; g < NUM_CLOCK_GENERATORS; ++g)
+		{
+			start = Time_GetTicks();
+			err = clockGenerators[g].generate(width, scanLines, lineDelay,
+				xRetraceLen, clock);
+			if (err)
+				goto cleanup;
+			RecordMinimumMs(&result->clockMs[g], start);
+		}
+
+		double *xyWaveformFrame;
+		int32 elementsPerChan;
+		start = Time_GetTicks();
+		err = GenerateScannerOutput(device, resolution, 1.0,
+			xOffset, yOffset, width, height,
+			&xyWaveformFrame, &elementsPerChan, &result->scannerPeakBytes);
+		if (err)
+			goto cleanup;
+		free(xyWaveformFrame);
+		RecordMinimumMs(&result->scannerOutputMs, start);
+
+		uInt8 *lineClockPatterns;
+		start = Time_GetTicks();
+		err = GenerateClockOutput(device, width, height,
+			&lineClockPatterns, &elementsPerChan, &result->clockPeakBytes);
+		if (err)
+			goto cleanup;
+		free(lineClockPatterns);
+		RecordMinimumMs(&result->clockOutputMs, start);
+	}
+
+cleanup:
+	free(galvo);
+	free(clock);
+	return err;
+}
+
+
+static void WriteWaveformBenchmarkResult(OScDev_Device *device, FILE *output,
+	uint32_t resolution, uint32_t width, uint32_t height, const struct WaveformBenchmarkResult *result)
+{
+	char clockTimes[128] = "";
+	size_t len = 0;
+	for (size_t g = 0; g < NUM_CLOCK_GENERATORS; ++g)
+	{
+		len += snprintf(clockTimes + len, sizeof(clockTimes) - len,
+			"\"%s\": %.3f, ", clockGenerators[g].name, result->clockMs[g]);
+	}
+
+	char msg[OScDev_MAX_STR_LEN + 1];
+	snprintf(msg, OScDev_MAX_STR_LEN,
+		"{\"benchmark\": \"waveform\", \"resolution\": %u, "
+		"\"width\": %u, \"height\": %u, \"lineDelay\": %u, "
+		"\"bidirectional\": %s, \"lineRepeat\": %u, "
+		"\"galvoMs\": %.3f, %s"
+		"\"scannerOutputMs\": %.3f, \"clockOutputMs\": %.3f, "
+		"\"scannerPeakBytes\": %zu, \"clockPeakBytes\": %zu}",
+		resolution, width, height, GetData(device)->lineDelay,
+		GetData(device)->bidirectionalScan ? "true" : "false",
+		GetData(device)->linesToAverage,
+		result->galvoMs, clockTimes,
+		result->scannerOutputMs, result->clockOutputMs,
+		result->scannerPeakBytes, result->clockPeakBytes);
+	if (output)
+	{
+		fprintf(output, "%s\n", msg);
+		fflush(output);
+	}
+	else
+		OScDev_Log_Info(device, msg);
+}
+
+
+// Run every case of the benchmark, writing the results to output, or
+// logging them (at Info level) if output is NULL. The device cannot be
+// armed meanwhile.
+OScDev_RichError *RunWaveformBenchmark(OScDev_Device *device, FILE *output)
+{
+	OScDev_RichError *err = OScDev_RichError_OK;
+
+	struct Mutex *mutex = &GetData(device)->acquisition.mutex;
+	Mutex_Lock(mutex);
+	if (GetData(device)->acquisition.running)
+	{
+		Mutex_Unlock(mutex);
+		return OScDev_Error_Create("Cannot run the waveform benchmark while acquiring");
+	}
+
+	uint32_t lineDelay = GetData(device)->lineDelay;
+
+	OScDev_Log_Info(device, "Running waveform benchmark");
+	for (size_t r = 0; r < sizeof(benchmarkResolutions) / sizeof(benchmarkResolutions[0]); ++r)
+	{
+		for (size_t d = 0; d < sizeof(benchmarkROIDivisors) / sizeof(benchmarkROIDivisors[0]); ++d)
+		{
+			for (size_t l = 0; l < sizeof(benchmarkLineDelays) / sizeof(benchmarkLineDelays[0]); ++l)
+			{
+				uint32_t resolution = benchmarkResolutions[r];
+				uint32_t size = resolution / benchmarkROIDivisors[d];
+				uint32_t offset = (resolution - size) / 2;
+				GetData(device)->lineDelay = benchmarkLineDelays[l];
+
+				struct WaveformBenchmarkResult result;
+				err = RunWaveformBenchmarkCase(device, resolution,
+					offset, offset, size, size, &result);
+				if (err)
+					goto cleanup;
+				WriteWaveformBenchmarkResult(device, output, resolution, size, size, &result);
+			}
+		}
+	}
+	OScDev_Log_Info(device, "Waveform benchmark finished");
+
+cleanup:
+	GetData(device)->lineDelay = lineDelay;
+	Mutex_Unlock(mutex);
+	if (err)
+		err = OScDev_Error_Wrap(err, "Waveform benchmark failed");
+	return err;
+}